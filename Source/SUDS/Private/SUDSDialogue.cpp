@@ -2,92 +2,165 @@
 // Released under the MIT license https://opensource.org/license/MIT/
 #include "SUDSDialogue.h"
 
-#include "SUDSInternal.h"
 #include "SUDSLibrary.h"
 #include "SUDSParticipant.h"
 #include "SUDSScript.h"
-#include "SUDSScriptNode.h"
 #include "SUDSScriptNodeEvent.h"
-#include "SUDSScriptNodeGosub.h"
-#include "SUDSScriptNodeSet.h"
 #include "SUDSScriptNodeText.h"
 #include "SUDSSubsystem.h"
 #include "Kismet/GameplayStatics.h"
+#include "Serialization/ArchiveFromStructuredArchive.h"
 #include "Sound/DialogueSoundWaveProxy.h"
 #include "Sound/DialogueWave.h"
 
-DEFINE_LOG_CATEGORY(LogSUDSDialogue);
-
-const FText USUDSDialogue::DummyText = FText::FromString("INVALID");
-const FString USUDSDialogue::DummyString = "INVALID";
-
 
+// State written before it had a version started directly with the TextNodeID string, so versioned state starts with
+// a value that can never begin a string (FString treats a length of MIN_int32 as corrupt), then the version. That way
+// the data identifies itself, whether or not the archive carries custom versions
+constexpr int32 DialogueStateVersionMarker = MIN_int32;
 
 FArchive& operator<<(FArchive& Ar, FSUDSDialogueState& Value)
 {
+	int32 Version = FSUDSCustomVersion::LatestVersion;
+	if (Ar.IsLoading())
+	{
+		const int64 StartPos = Ar.Tell();
+		int32 Marker = 0;
+		Ar << Marker;
+		if (Marker == DialogueStateVersionMarker)
+		{
+			Ar << Version;
+			if (Version < 0 || Version > FSUDSCustomVersion::LatestVersion)
+			{
+				UE_LOG(LogSUDSDialogue, Error, TEXT("Cannot load dialogue state, unknown version %d"), Version);
+				Ar.SetError();
+				return Ar;
+			}
+		}
+		else
+		{
+			Ar.Seek(StartPos);
+			Version = FSUDSCustomVersion::BeforeCustomVersionWasAdded;
+		}
+	}
+	else
+	{
+		int32 Marker = DialogueStateVersionMarker;
+		Ar << Marker;
+		Ar << Version;
+	}
+	
 	Ar << Value.TextNodeID;
 	Ar << Value.Variables;
 	Ar << Value.ChoicesTaken;
 	Ar << Value.ReturnStack;
+	if (Version >= FSUDSCustomVersion::AddedRandomStream)
+	{
+		Ar << Value.bHasRandomStream;
+		Ar << Value.RandomSeed;
+		Ar << Value.RandomStreamState;
+	}
+	if (Version >= FSUDSCustomVersion::AddedVariableDeltas)
+	{
+		Ar << Value.bVariablesAreDelta;
+		Ar << Value.UnsetVariables;
+	}
 	
 	return Ar;
 }
 
 void operator<<(FStructuredArchive::FSlot Slot, FSUDSDialogueState& Value)
 {
+	if (!Slot.GetUnderlyingArchive().IsTextFormat())
+	{
+		// Binary structured archives are just the underlying archive, so use the same versioned layout
+		FArchiveFromStructuredArchive Adapter(Slot);
+		Adapter.GetArchive() << Value;
+		Adapter.Close();
+		return;
+	}
+
+	// Text formats name their fields, so fields added later are just optional
 	FStructuredArchive::FRecord Record = Slot.EnterRecord();
 	Record
 		<< SA_VALUE(TEXT("TextNodeID"), Value.TextNodeID)
 		<< SA_VALUE(TEXT("Variables"), Value.Variables)
 		<< SA_VALUE(TEXT("ChoicesTaken"), Value.ChoicesTaken)
 		<< SA_VALUE(TEXT("ReturnStack"), Value.ReturnStack);
+	auto OptionalField = [&Record](const TCHAR* Name, auto& FieldValue)
+	{
+		if (TOptional<FStructuredArchive::FSlot> Field = Record.TryEnterField(SA_FIELD_NAME(Name), true))
+		{
+			Field.GetValue() << FieldValue;
+		}
+	};
+	OptionalField(TEXT("bHasRandomStream"), Value.bHasRandomStream);
+	OptionalField(TEXT("RandomSeed"), Value.RandomSeed);
+	OptionalField(TEXT("RandomStreamState"), Value.RandomStreamState);
+	OptionalField(TEXT("bVariablesAreDelta"), Value.bVariablesAreDelta);
+	OptionalField(TEXT("UnsetVariables"), Value.UnsetVariables);
 
 }
 
-USUDSDialogue::USUDSDialogue(): BaseScript(nullptr),
-                                CurrentSpeakerNode(nullptr),
-                                CurrentRootChoiceNode(nullptr),
-                                bParamNamesExtracted(false),
-                                CurrentSourceLineNo(0)
+USUDSDialogue::USUDSDialogue(): BaseScript(nullptr)
 {
 }
 
 void USUDSDialogue::Initialise(const USUDSScript* Script)
 {
 	BaseScript = Script;
-	CurrentSpeakerNode = nullptr;
-
-	InitVariables();
-
-	CurrentSpeakerNode = nullptr;
+	RebuildParticipantRoutes();
+	Runner.Initialise(Script, this);
 
+	// Track changes for incremental saves if we're in a game; otherwise it's up to the caller to register us
+	if (USUDSSubsystem* Sys = GetSUDSSubsystem(GetWorld()))
+	{
+		Sys->RegisterDialogue(this);
+	}
 }
 
-void USUDSDialogue::InitVariables()
+void USUDSDialogue::ResetForPool()
 {
-	VariableState.Empty();
-	// Run header nodes immediately (only set nodes)
-	RunUntilNextSpeakerNodeOrEnd(BaseScript->GetHeaderNode(), false);
+	Runner.End(true);
+	Runner.SetBatchVariableRequests(false);
+	Runner.ClearVariableProviders();
+	Runner.SetCacheProvidedVariables(false);
+	Participants.Reset();
+	ParticipantInfos.Reset();
+	EventRoutes.Reset();
+	VariableChangedRoutes.Reset();
+	VariableRequestedRoutes.Reset();
+
+	OnSpeakerLine.Clear();
+	OnChoice.Clear();
+	OnProceeding.Clear();
+	OnEvent.Clear();
+	OnVariableChanged.Clear();
+	OnVariableRequested.Clear();
+	OnVariablesRequested.Clear();
+	OnStarting.Clear();
+	OnFinished.Clear();
+#if WITH_EDITOR
+	InternalOnSpeakerLine.Unbind();
+	InternalOnChoice.Unbind();
+	InternalOnProceeding.Unbind();
+	InternalOnEvent.Unbind();
+	InternalOnSetVar.Unbind();
+	InternalOnSetVarByCode.Unbind();
+	InternalOnSelectEval.Unbind();
+	InternalOnStarting.Unbind();
+	InternalOnFinished.Unbind();
+#endif
 }
 
 void USUDSDialogue::Start(FName Label)
 {
-	// Only start if not already on a speaker node
-	// This makes the restore sequence easier, you don't have to test IsEnded
-	if (!IsValid(CurrentSpeakerNode))
-	{
-		// Note that we don't reset state by default here. This is to allow long-term memory on dialogue, such as
-		// knowing whether you've met a character before etc.
-		// We also don't re-run headers here since they will have been run on Initialise()
-		// This is to allow callers to set variables before Start() that override headers
-		Restart(false, Label, false);
-	}
+	Runner.Start(Label);
 }
 
 void USUDSDialogue::SetParticipants(const TArray<UObject*>& InParticipants)
 {
 	// Protect against null participants
-	// Since our stable sort dereferences
 	Participants.Empty();
 	for (auto P : InParticipants)
 	{
@@ -108,372 +181,114 @@ void USUDSDialogue::AddParticipant(UObject* Participant)
 	}
 }
 
-void USUDSDialogue::SortParticipants()
+USUDSDialogue::FParticipantInfo USUDSDialogue::GetParticipantInfo(UObject* Participant)
 {
-	if (!Participants.IsEmpty())
-	{
-		// We order by ascending priority so that higher priority values are later in the list
-		// Which means they're called last and get to override values set by earlier ones
-		// We'll do a stable sort so that otherwise order is maintained
-		Participants.StableSort([](const UObject& A, const UObject& B)
-		{
-			if (A.Implements<USUDSParticipant>() && B.Implements<USUDSParticipant>())
-			{
-				return ISUDSParticipant::Execute_GetDialogueParticipantPriority(&A) <
-					ISUDSParticipant::Execute_GetDialogueParticipantPriority(&B);
-			}
-			// Be deterministic
-			return &A < &B;
-		});
-	}
-}
-
-void USUDSDialogue::RunUntilNextSpeakerNodeOrEnd(USUDSScriptNode* NextNode, bool bRaiseAtEnd)
-{
-	// We run through nodes which don't require a speaker line prompt
-	// E.g. set nodes, select nodes which are all automatically resolved
-	// Starting with this node
-	while (NextNode && !IsChoiceOrTextNode(NextNode->GetNodeType()))
-	{
-		NextNode = RunNode(NextNode);
-	}
-
-	if (NextNode)
-	{
-		if (NextNode->GetNodeType() == ESUDSScriptNodeType::Text)
-		{
-			SetCurrentSpeakerNode(Cast<USUDSScriptNodeText>(NextNode), false);
-		}
-		else
-		{
-			// This can happen if for example user creates a choice node as the first thing
-			UE_LOG(LogSUDSDialogue,
-			       Error,
-			       TEXT("Error in %s line %d: Tried to run to next speaker node but encountered unexpected node of type %s"),
-			       *BaseScript->GetName(),
-			       NextNode->GetSourceLineNo(),
-			       *(StaticEnum<ESUDSScriptNodeType>()->GetValueAsString(NextNode->GetNodeType()))
-			);
-		}
-	}
-	else
+	FParticipantInfo Info;
+	if (ISUDSNativeParticipant* Native = Cast<ISUDSNativeParticipant>(Participant))
 	{
-		End(!bRaiseAtEnd);
+		Info.Native = Native;
+		Info.Priority = Native->GetDialogueParticipantPriority();
+		Info.Subscription = Native->GetDialogueParticipantSubscription();
 	}
-
-}
-
-USUDSScriptNode* USUDSDialogue::RunNode(USUDSScriptNode* Node)
-{
-	CurrentSourceLineNo = Node->GetSourceLineNo();
-	switch (Node->GetNodeType())
+	else if (Participant->GetClass()->ImplementsInterface(USUDSParticipant::StaticClass()))
 	{
-	case ESUDSScriptNodeType::Select:
-		return RunSelectNode(Node);
-	case ESUDSScriptNodeType::SetVariable:
-		return RunSetVariableNode(Node);
-	case ESUDSScriptNodeType::Event:
-		return RunEventNode(Node);
-	case ESUDSScriptNodeType::Gosub:
-		return RunGosubNode(Node);
-	case ESUDSScriptNodeType::Return:
-		return RunReturnNode(Node);
-	default: ;
+		Info.bImplementsParticipant = true;
+		Info.Priority = ISUDSParticipant::Execute_GetDialogueParticipantPriority(Participant);
+		Info.Subscription = ISUDSParticipant::Execute_GetDialogueParticipantSubscription(Participant);
 	}
-
-	UE_LOG(LogSUDSDialogue,
-	       Error,
-	       TEXT("Error in %s line %d: Attempted to run non-runnable node type %s"),
-	       *BaseScript->GetName(),
-	       Node->GetSourceLineNo(),
-	       *(StaticEnum<ESUDSScriptNodeType>()->GetValueAsString(Node->GetNodeType()))
-	)
-	return nullptr;
+	return Info;
 }
 
-USUDSScriptNode* USUDSDialogue::RunSelectNode(USUDSScriptNode* Node)
+void USUDSDialogue::SortParticipants()
 {
-	// Define internal random selection variable (used in random selects)
-	if (Node->IsRandomSelect())
-	{
-		// Random picker
-		// Could try to NOT pick the same ones we already picked, but this would require some additional state, similar
-		// to "ChoicesTaken" state but for random text nodes already chosen. For now, keep it simple
-
-		const int OptCount = Node->GetEdgeCount();
-		// Use SRand() so can be seeded if required
-		const int RandChoice = FMath::Min(OptCount-1, FMath::TruncToInt(FMath::SRand() * (float)OptCount));
-
-		SetVariableInt(FSUDSConstants::RandomItemSelectIndexVarName, RandChoice);
-	}
-	
-	for (auto& Edge : Node->GetEdges())
+	// Work out how to call each participant, and its priority, once here rather than on every call
+	TArray<TPair<TObjectPtr<UObject>, FParticipantInfo>> Sorted;
+	Sorted.Reserve(Participants.Num());
+	for (const auto& P : Participants)
 	{
-		if (Edge.GetCondition().IsValid())
+		if (IsValid(P))
 		{
-			// use the first satisfied edge
-			RaiseExpressionVariablesRequested(Edge.GetCondition(), Edge.GetSourceLineNo());
-			const bool bSuccess = Edge.GetCondition().EvaluateBoolean(VariableState, GetGlobalVariables(), BaseScript->GetName());
-#if WITH_EDITOR
-			{
-				FString ExprStr = Edge.GetCondition().GetSourceString();
-				if (ExprStr.IsEmpty())
-				{
-					// Lack of condition is an else / final random option
-					ExprStr = "else";
-				}
-				InternalOnSelectEval.ExecuteIfBound(this, ExprStr, bSuccess, Edge.GetSourceLineNo());
-			}
-#endif
-			
-			if (bSuccess)
-			{
-				return Edge.GetTargetNode().Get();
-			}
+			Sorted.Add(MakeTuple(P, GetParticipantInfo(P)));
 		}
 	}
-	// NOTE: if no valid path, go to end
-	// We've already created fall-through else nodes if possible
-	return nullptr;
-}
 
-USUDSScriptNode* USUDSDialogue::RunEventNode(USUDSScriptNode* Node)
-{
-	if (USUDSScriptNodeEvent* EvtNode = Cast<USUDSScriptNodeEvent>(Node))
+	// We order by ascending priority so that higher priority values are later in the list
+	// Which means they're called last and get to override values set by earlier ones
+	// We'll do a stable sort so that otherwise order is maintained
+	Sorted.StableSort([](const TPair<TObjectPtr<UObject>, FParticipantInfo>& A,
+	                     const TPair<TObjectPtr<UObject>, FParticipantInfo>& B)
 	{
-		// Build a resolved args list, because we need to evaluate  expressions
-		TArray<FSUDSValue> ArgsResolved;
-		
-		for (auto& Expr : EvtNode->GetArgs())
-		{
-			RaiseExpressionVariablesRequested(Expr, EvtNode->GetSourceLineNo());
-			ArgsResolved.Add(Expr.Evaluate(VariableState, GetGlobalVariables()));
-		}
-		
-		for (const auto& P : Participants)
-		{
-			if (P->GetClass()->ImplementsInterface(USUDSParticipant::StaticClass()))
-			{
-				ISUDSParticipant::Execute_OnDialogueEvent(P, this, EvtNode->GetEventName(), ArgsResolved);
-			}
-		}
-		OnEvent.Broadcast(this, EvtNode->GetEventName(), ArgsResolved);
-#if WITH_EDITOR
-		InternalOnEvent.ExecuteIfBound(this, EvtNode->GetEventName(), ArgsResolved, EvtNode->GetSourceLineNo());
-#endif
-	}
-	return GetNextNode(Node);
-}
+		return A.Value.Priority < B.Value.Priority;
+	});
 
-USUDSScriptNode* USUDSDialogue::RunGosubNode(USUDSScriptNode* Node)
-{
-	if (USUDSScriptNodeGosub* GosubNode = Cast<USUDSScriptNodeGosub>(Node))
+	Participants.Reset();
+	ParticipantInfos.Reset();
+	for (const auto& Pair : Sorted)
 	{
-		if (auto TargetNode = BaseScript->GetNodeByLabel(GosubNode->GetLabelName()))
-		{
-			// Push this gosub node to the return stack, then jump
-			GosubReturnStack.Push(GosubNode);
-			return TargetNode;
-		}
-		else
-		{
-			UE_LOG(LogSUDSDialogue,
-				   Error,
-				   TEXT("Error in %s: Cannot gosub to label '%s', was not found"),
-				   *BaseScript->GetName(),
-				   *GosubNode->GetLabelName().ToString());
-			
-		}
+		Participants.Add(Pair.Key);
+		ParticipantInfos.Add(Pair.Value);
 	}
-	return GetNextNode(Node);
+	RebuildParticipantRoutes();
 }
 
-USUDSScriptNode* USUDSDialogue::RunReturnNode(USUDSScriptNode* Node)
+void USUDSDialogue::RebuildParticipantRoutes()
 {
-	if (GosubReturnStack.Num() > 0)
-	{
-		// We return to the next node after the gosub, which temporarily redirected
-		const auto GoSubNode = GosubReturnStack.Pop();
-		return GetNextNode(GoSubNode);
-	}
-	else
-	{
-		UE_LOG(LogSUDSDialogue,
-			   Error,
-			   TEXT("Attempted to return at %s:%d but there was no previous gosub to return to"),
-			   *BaseScript->GetName(),
-			   Node->GetSourceLineNo());
-		return nullptr;
-		
-	}
-}
+	EventRoutes.Reset();
+	VariableChangedRoutes.Reset();
+	VariableRequestedRoutes.Reset();
 
-USUDSScriptNode* USUDSDialogue::RunSetVariableNode(USUDSScriptNode* Node)
-{
-	if (USUDSScriptNodeSet* SetNode = Cast<USUDSScriptNodeSet>(Node))
+	// Nothing to route with no participants, and the script may not be set yet (it'll call this again)
+	if (Participants.IsEmpty() || !BaseScript)
 	{
-		if (SetNode->GetExpression().IsValid())
-		{
-			RaiseExpressionVariablesRequested(SetNode->GetExpression(), SetNode->GetSourceLineNo());
-			FSUDSValue Value = SetNode->GetExpression().Evaluate(VariableState, GetGlobalVariables());
-			FName Identifier;
-			if (USUDSLibrary::IsDialogueVariableGlobal(SetNode->GetIdentifier(), Identifier))
-			{
-				InternalSetGlobalVariable(this->GetWorld(), Identifier, Value, true, SetNode->GetSourceLineNo());
-			}
-			else
-			{
-				SetVariableImpl(SetNode->GetIdentifier(), Value, true, SetNode->GetSourceLineNo());
-			}
-#if WITH_EDITOR
-			// We do this here so that we have access to the expression
-			InternalOnSetVar.ExecuteIfBound(this,
-			                                SetNode->GetIdentifier(),
-			                                Value,
-			                                SetNode->GetExpression().IsLiteral()
-				                                ? ""
-				                                : SetNode->GetExpression().GetSourceString(),
-			                                SetNode->GetSourceLineNo());
-#endif
-		}
+		return;
 	}
 
-	// Always one edge
-	return GetNextNode(Node);
-	
-}
-
-void USUDSDialogue::RaiseVariableChange(const FName& VarName, const FSUDSValue& Value, bool bFromScript, int LineNo)
-{
-	for (const auto& P : Participants)
-	{
-		if (P->GetClass()->ImplementsInterface(USUDSParticipant::StaticClass()))
-		{
-			ISUDSParticipant::Execute_OnDialogueVariableChanged(P, this, VarName, Value, bFromScript);
-		}
-	}
-	OnVariableChanged.Broadcast(this, VarName, Value, bFromScript);
-#if WITH_EDITOR
-	if (!bFromScript)
+	// Precompute routes for everything the script uses, anything else (e.g. variables set by code) is done on demand
+	for (const auto& Name : BaseScript->GetVariableNames())
 	{
-		// Script setting is raised in SetNode so we have access to expressions
-		InternalOnSetVarByCode.ExecuteIfBound(this, VarName, Value);
+		GetParticipantRoute(VariableChangedRoutes, ESUDSParticipantCallbacks::VariableChanged, Name);
+		GetParticipantRoute(VariableRequestedRoutes, ESUDSParticipantCallbacks::VariableRequested, Name);
 	}
-#endif
-
-}
-
-void USUDSDialogue::RaiseVariableRequested(const FName& VarName, int LineNo)
-{
-	// Because variables set by participants should "win", raise event first
-	OnVariableRequested.Broadcast(this, VarName);
-	for (const auto& P : Participants)
+	for (const auto& Node : BaseScript->GetNodes())
 	{
-		if (P->GetClass()->ImplementsInterface(USUDSParticipant::StaticClass()))
+		if (Node->GetNodeType() == ESUDSScriptNodeType::Event)
 		{
-			ISUDSParticipant::Execute_OnDialogueVariableRequested(P, this, VarName);
+			if (auto EvtNode = Cast<USUDSScriptNodeEvent>(Node))
+			{
+				GetParticipantRoute(EventRoutes, ESUDSParticipantCallbacks::Event, EvtNode->GetEventName());
+			}
 		}
 	}
 }
 
-void USUDSDialogue::RaiseExpressionVariablesRequested(const FSUDSExpression& Expression, int LineNo)
+const USUDSDialogue::FParticipantRoute& USUDSDialogue::GetParticipantRoute(TMap<FName, FParticipantRoute>& Routes,
+                                                                           ESUDSParticipantCallbacks Callback,
+                                                                           const FName& Name)
 {
-	for (auto& Var : Expression.GetVariableNames())
+	if (const FParticipantRoute* pRoute = Routes.Find(Name))
 	{
-		RaiseVariableRequested(Var, LineNo);
+		return *pRoute;
 	}
-}
-
-const TMap<FName, FSUDSValue>& USUDSDialogue::GetGlobalVariables() const
-{
-	return InternalGetGlobalVariables(this->GetWorld());
-}
 
-void USUDSDialogue::SetCurrentSpeakerNode(USUDSScriptNodeText* Node, bool bQuietly)
-{
-	CurrentSpeakerNode = Node;
-
-	CurrentSpeakerDisplayName = FText::GetEmpty();
-	bParamNamesExtracted = false;
-	if (Node)
-	{
-		CurrentSourceLineNo = Node->GetSourceLineNo();
-	}
-	else
-	{
-		CurrentSourceLineNo = 0;
-	}
-	UpdateChoices();
-
-	if (!bQuietly)
+	FParticipantRoute& Route = Routes.Add(Name);
+	for (int i = 0; i < ParticipantInfos.Num(); ++i)
 	{
-		if (CurrentSpeakerNode)
-			RaiseNewSpeakerLine();
-		else
-			RaiseFinished();
-	}
-
-}
-
-FText USUDSDialogue::ResolveParameterisedText(const TArray<FName> Params, const FTextFormat& TextFormat, int LineNo)
-{
-	for (const auto& P : Params)
-	{
-		RaiseVariableRequested(P, LineNo);
-	}
-	// Need to make a temp arg list for compatibility
-	// Also lets us just set the ones we need to
-	FFormatNamedArguments Args;
-	GetTextFormatArgs(Params, Args);
-	return FText::Format(TextFormat, Args);
-	
-}
-
-void USUDSDialogue::GetTextFormatArgs(const TArray<FName>& ArgNames, FFormatNamedArguments& OutArgs) const
-{
-	for (auto& Name : ArgNames)
-	{
-		FName GlobalName;
-		if (USUDSLibrary::IsDialogueVariableGlobal(Name, GlobalName))
+		const FSUDSParticipantSubscription& Sub = ParticipantInfos[i].Subscription;
+		if (Sub.WantsCallback(Callback) &&
+			(Callback == ESUDSParticipantCallbacks::Event ? Sub.WantsEvent(Name) : Sub.WantsVariable(Name)))
 		{
-			auto& Globals = InternalGetGlobalVariables(this->GetWorld());
-			if (const FSUDSValue* Value = Globals.Find(GlobalName))
-			{
-				// Add to format args using name with prefix
-				OutArgs.Add(Name.ToString(), Value->ToFormatArg());
-			}
-		}
-		else if (const FSUDSValue* Value = VariableState.Find(Name))
-		{
-			// Use the operator conversion
-			OutArgs.Add(Name.ToString(), Value->ToFormatArg());
+			Route.Add(i);
 		}
 	}
+	return Route;
 }
 
-FText USUDSDialogue::GetText()
-{
-	if (CurrentSpeakerNode)
-	{
-		if (CurrentSpeakerNode->HasParameters())
-		{
-			return ResolveParameterisedText(CurrentSpeakerNode->GetParameterNames(),
-			                                CurrentSpeakerNode->GetTextFormat(),
-			                                CurrentSpeakerNode->GetSourceLineNo());
-		}
-		else
-		{
-			return CurrentSpeakerNode->GetText();
-		}
-	}
-	return DummyText;
-}
 
 UDialogueWave* USUDSDialogue::GetWave() const
 {
-	if (CurrentSpeakerNode)
+	if (const USUDSScriptNodeText* SpeakerNode = Runner.GetCurrentSpeakerNode())
 	{
-		return CurrentSpeakerNode->GetWave();
+		return SpeakerNode->GetWave();
 	}
 
 	return nullptr;
@@ -481,60 +296,19 @@ UDialogueWave* USUDSDialogue::GetWave() const
 
 bool USUDSDialogue::IsCurrentLineVoiced() const
 {
-	if (CurrentSpeakerNode)
+	if (const USUDSScriptNodeText* SpeakerNode = Runner.GetCurrentSpeakerNode())
 	{
-		return IsValid(CurrentSpeakerNode->GetWave());
+		return IsValid(SpeakerNode->GetWave());
 	}
 
 	return false;
 }
 
-const FString& USUDSDialogue::GetSpeakerID() const
-{
-	if (CurrentSpeakerNode)
-		return CurrentSpeakerNode->GetSpeakerID();
-	
-	return DummyString;
-}
-
-FText USUDSDialogue::GetSpeakerDisplayName() const
-{
-	if (CurrentSpeakerDisplayName.IsEmpty())
-	{
-		// Derive speaker display name
-		// Is just a special variable "SpeakerName.SpeakerID"
-		// or just the SpeakerID if none specified
-		static const FString SpeakerIDPrefix = "SpeakerName.";
-		FName Key(SpeakerIDPrefix + GetSpeakerID());
-		if (auto Arg = VariableState.Find(Key))
-		{
-			if (Arg->GetType() == ESUDSValueType::Text)
-			{
-				CurrentSpeakerDisplayName = Arg->GetTextValue();
-			}
-			else
-			{
-				UE_LOG(LogSUDSDialogue,
-				       Error,
-				       TEXT("Error in %s: %s was set to a value that was not text, cannot use"),
-				       *BaseScript->GetName(),
-				       *Key.ToString());
-			}
-		}
-		if (CurrentSpeakerDisplayName.IsEmpty())
-		{
-			// If no display name was specified, use the (non-localised) speaker ID
-			CurrentSpeakerDisplayName = FText::FromString(GetSpeakerID());
-		}
-	}
-	return CurrentSpeakerDisplayName;
-}
-
 UDialogueVoice* USUDSDialogue::GetSpeakerVoice() const
 {
-	if (CurrentSpeakerNode)
+	if (const USUDSScriptNodeText* SpeakerNode = Runner.GetCurrentSpeakerNode())
 	{
-		return GetVoice(CurrentSpeakerNode->GetSpeakerID());
+		return GetVoice(SpeakerNode->GetSpeakerID());
 	}
 	return nullptr;
 }
@@ -546,12 +320,12 @@ UDialogueVoice* USUDSDialogue::GetVoice(FString Name) const
 
 UDialogueVoice* USUDSDialogue::GetTargetVoice() const
 {
-	if (CurrentSpeakerNode)
+	if (const USUDSScriptNodeText* SpeakerNode = Runner.GetCurrentSpeakerNode())
 	{
 		// Assume that target is the first party that's NOT speaking
 		for (auto& Name : BaseScript->GetSpeakers())
 		{
-			if (Name != CurrentSpeakerNode->GetSpeakerID())
+			if (Name != SpeakerNode->GetSpeakerID())
 			{
 				return BaseScript->GetSpeakerVoice(Name);
 			}
@@ -676,517 +450,351 @@ USoundBase* USUDSDialogue::GetVoicedLineSound(bool bLooselyMatchTarget)
 	return GetSoundForCurrentLine(bLooselyMatchTarget);
 }
 
-USUDSScriptNode* USUDSDialogue::GetNextNode(USUDSScriptNode* Node)
+UWorld* USUDSDialogue::GetDialogueWorld(const FSUDSDialogueRunner& InRunner) const
 {
-	// In the case of select or random, we need to evaluate to get the next node
-	if (Node->GetNodeType() == ESUDSScriptNodeType::Select)
-	{
-		return RunSelectNode(Node);	
-	}
-	else
-	{
-		return BaseScript->GetNextNode(Node);
-	}
+	return GetWorld();
 }
 
-bool USUDSDialogue::IsChoiceOrTextNode(ESUDSScriptNodeType Type)
+void USUDSDialogue::OnDialogueStarting(FSUDSDialogueRunner& InRunner, FName StartLabel)
 {
-	return Type == ESUDSScriptNodeType::Text || Type == ESUDSScriptNodeType::Choice;
+	ForEachParticipant(ESUDSParticipantCallbacks::Starting,
+	                   [&](ISUDSNativeParticipant* P) { P->OnDialogueStarting(this, StartLabel); },
+	                   [&](UObject* P) { ISUDSParticipant::Execute_OnDialogueStarting(P, this, StartLabel); });
+	OnStarting.Broadcast(this, StartLabel);
+#if WITH_EDITOR
+	InternalOnStarting.ExecuteIfBound(this, StartLabel);
+#endif
 }
 
-const USUDSScriptNode* USUDSDialogue::WalkToNextChoiceNode(USUDSScriptNode* FromNode, bool bExecute)
+void USUDSDialogue::OnDialogueFinished(FSUDSDialogueRunner& InRunner)
 {
-	if (FromNode && FromNode->GetEdgeCount() == 1)
-	{
-		const auto NextNode = GetNextNode(FromNode);
-		TArray<TObjectPtr<USUDSScriptNodeGosub>> TempGosubStack;
-		if (!bExecute)
-		{
-			// Make a copy of the gosub stack so we can safely explore gosubs
-			TempGosubStack.Append(GosubReturnStack);
-		}
-		
-		const auto ResultNode = RecurseWalkToNextChoiceOrTextNode(NextNode, bExecute, bExecute ? GosubReturnStack : TempGosubStack);
-		if (ResultNode && ResultNode->GetNodeType() == ESUDSScriptNodeType::Choice)
-		{
-			return ResultNode;
-		}
-	}
-	return nullptr;
+	ForEachParticipant(ESUDSParticipantCallbacks::Finished,
+	                   [&](ISUDSNativeParticipant* P) { P->OnDialogueFinished(this); },
+	                   [&](UObject* P) { ISUDSParticipant::Execute_OnDialogueFinished(P, this); });
+	OnFinished.Broadcast(this);
+#if WITH_EDITOR
+	InternalOnFinished.ExecuteIfBound(this);
+#endif
+
 }
 
-USUDSScriptNode* USUDSDialogue::RecurseWalkToNextChoiceOrTextNode(USUDSScriptNode* Node, bool bExecute, TArray<TObjectPtr<USUDSScriptNodeGosub>>& LocalGosubStack)
+void USUDSDialogue::OnDialogueSpeakerLine(FSUDSDialogueRunner& InRunner)
 {
-	auto NextNode = Node;
-	while (NextNode && !IsChoiceOrTextNode(NextNode->GetNodeType()))
-	{
-		// Special case gosub/return in non-execute mode, since only RunNode will explore them
-		if (!bExecute)
-		{
-			if (NextNode->GetNodeType() == ESUDSScriptNodeType::Gosub)
-			{
-				// We need to special case Gosubs, since to find the choice we have to go into them and potentially out again
-				if (USUDSScriptNodeGosub* GosubNode = Cast<USUDSScriptNodeGosub>(NextNode))
-				{
-					if (auto SubNode = BaseScript->GetNodeByLabel(GosubNode->GetLabelName()))
-					{
-						LocalGosubStack.Add(GosubNode);
-						NextNode = RecurseWalkToNextChoiceOrTextNode(SubNode, bExecute, LocalGosubStack);
-						continue;
-					}
-				}
-						
-			}
-			else if (NextNode->GetNodeType() == ESUDSScriptNodeType::Return)
-			{
-				if (LocalGosubStack.Num() > 0)
-				{
-					// We try to find the next choice node after the gosub, which temporarily redirected
-					const auto GoSubNode = LocalGosubStack.Pop();
-					NextNode = RecurseWalkToNextChoiceOrTextNode(GetNextNode(GoSubNode), bExecute, LocalGosubStack);
-					continue;
-				}
-				else
-				{
-					return nullptr;
-				}
-			}
-		}
-		
-		if (bExecute)
-		{
-			NextNode = RunNode(NextNode);
-		}
-		else
-		{
-			NextNode = GetNextNode(NextNode);
-		}
-	}
+	ForEachParticipant(ESUDSParticipantCallbacks::SpeakerLine,
+	                   [&](ISUDSNativeParticipant* P) { P->OnDialogueSpeakerLine(this); },
+	                   [&](UObject* P) { ISUDSParticipant::Execute_OnDialogueSpeakerLine(P, this); });
+	
+	// Event listeners get it after
+	OnSpeakerLine.Broadcast(this);
+#if WITH_EDITOR
+	InternalOnSpeakerLine.ExecuteIfBound(this, GetCurrentSourceLine());
+#endif
+}
 
-	return NextNode;
+void USUDSDialogue::OnDialogueChoice(FSUDSDialogueRunner& InRunner, int ChoiceIndex, int LineNo)
+{
+	ForEachParticipant(ESUDSParticipantCallbacks::ChoiceMade,
+	                   [&](ISUDSNativeParticipant* P) { P->OnDialogueChoiceMade(this, ChoiceIndex); },
+	                   [&](UObject* P) { ISUDSParticipant::Execute_OnDialogueChoiceMade(P, this, ChoiceIndex); });
+	// Event listeners get it after
+	OnChoice.Broadcast(this, ChoiceIndex);
+#if WITH_EDITOR
+	InternalOnChoice.ExecuteIfBound(this, ChoiceIndex, LineNo);
+#endif
 }
 
-const USUDSScriptNode* USUDSDialogue::RunUntilNextChoiceNode(USUDSScriptNode* FromNode)
+void USUDSDialogue::OnDialogueProceeding(FSUDSDialogueRunner& InRunner)
 {
-	return WalkToNextChoiceNode(FromNode, true);
+	ForEachParticipant(ESUDSParticipantCallbacks::Proceeding,
+	                   [&](ISUDSNativeParticipant* P) { P->OnDialogueProceeding(this); },
+	                   [&](UObject* P) { ISUDSParticipant::Execute_OnDialogueProceeding(P, this); });
+	// Event listeners get it after
+	OnProceeding.Broadcast(this);
+#if WITH_EDITOR
+	InternalOnProceeding.ExecuteIfBound(this);
+#endif
 }
-const USUDSScriptNode* USUDSDialogue::FindNextChoiceNode(USUDSScriptNode* FromNode)
+
+void USUDSDialogue::OnDialogueEvent(FSUDSDialogueRunner& InRunner,
+                                    FName EventName,
+                                    const TArray<FSUDSValue>& Arguments,
+                                    int LineNo)
 {
-	return WalkToNextChoiceNode(FromNode, false);
+	ForEachParticipant(GetParticipantRoute(EventRoutes, ESUDSParticipantCallbacks::Event, EventName),
+	                   [&](ISUDSNativeParticipant* P) { P->OnDialogueEvent(this, EventName, Arguments); },
+	                   [&](UObject* P) { ISUDSParticipant::Execute_OnDialogueEvent(P, this, EventName, Arguments); });
+	OnEvent.Broadcast(this, EventName, Arguments);
+#if WITH_EDITOR
+	InternalOnEvent.ExecuteIfBound(this, EventName, Arguments, LineNo);
+#endif
 }
 
-const TArray<FSUDSScriptEdge>& USUDSDialogue::GetChoices() const
+void USUDSDialogue::OnDialogueVariableChanged(FSUDSDialogueRunner& InRunner,
+                                              FName VariableName,
+                                              const FSUDSValue& Value,
+                                              bool bFromScript,
+                                              int LineNo)
 {
-	return CurrentChoices;
+	ForEachParticipant(GetParticipantRoute(VariableChangedRoutes, ESUDSParticipantCallbacks::VariableChanged, VariableName),
+	                   [&](ISUDSNativeParticipant* P) { P->OnDialogueVariableChanged(this, VariableName, Value, bFromScript); },
+	                   [&](UObject* P) { ISUDSParticipant::Execute_OnDialogueVariableChanged(P, this, VariableName, Value, bFromScript); });
+	OnVariableChanged.Broadcast(this, VariableName, Value, bFromScript);
+#if WITH_EDITOR
+	if (!bFromScript)
+	{
+		// Script setting is raised in OnDialogueScriptSetVariable so we have access to expressions
+		InternalOnSetVarByCode.ExecuteIfBound(this, VariableName, Value);
+	}
+#endif
+
 }
 
-void USUDSDialogue::RecurseAppendChoices(const USUDSScriptNode* Node, TArray<FSUDSScriptEdge>& OutChoices)
+void USUDSDialogue::OnDialogueVariableRequested(FSUDSDialogueRunner& InRunner, FName VariableName, int LineNo)
 {
-	if (!Node)
-		return;
+	// Because variables set by participants should "win", raise event first
+	OnVariableRequested.Broadcast(this, VariableName);
+	ForEachParticipant(GetParticipantRoute(VariableRequestedRoutes, ESUDSParticipantCallbacks::VariableRequested, VariableName),
+	                   [&](ISUDSNativeParticipant* P) { P->OnDialogueVariableRequested(this, VariableName); },
+	                   [&](UObject* P) { ISUDSParticipant::Execute_OnDialogueVariableRequested(P, this, VariableName); });
+}
 
-	// We only cascade into choices or selects
-	if(Node->GetNodeType() != ESUDSScriptNodeType::Choice &&
-		Node->GetNodeType() != ESUDSScriptNodeType::Select)
+void USUDSDialogue::OnDialogueVariablesRequested(FSUDSDialogueRunner& InRunner,
+                                                 const TArray<FName>& VariableNames,
+                                                 int LineNo)
+{
+	// Because variables set by participants should "win", raise event first
+	OnVariablesRequested.Broadcast(this, VariableNames);
+	if (Participants.IsEmpty())
 	{
 		return;
 	}
-	
-	for (auto& Edge : Node->GetEdges())
+
+	// Only pass on the variables each participant is interested in, which the routes already know
+	TArray<TArray<FName>, TInlineAllocator<4>> NamesByParticipant;
+	NamesByParticipant.SetNum(Participants.Num());
+	for (const auto& Name : VariableNames)
 	{
-		switch (Edge.GetType())
+		for (const int32 i : GetParticipantRoute(VariableRequestedRoutes, ESUDSParticipantCallbacks::VariableRequested, Name))
 		{
-		case ESUDSEdgeType::Decision:
-			OutChoices.Add(Edge);
-			break;
-		case ESUDSEdgeType::Condition:
-			// Conditional edges are under selects
-			if (Edge.GetCondition().IsValid())
-			{
-				RaiseExpressionVariablesRequested(Edge.GetCondition(), Edge.GetSourceLineNo());
-				if (Edge.GetCondition().EvaluateBoolean(VariableState, GetGlobalVariables(), BaseScript->GetName()))
-				{
-					RecurseAppendChoices(Edge.GetTargetNode().Get(), OutChoices);
-					// When we choose a path on a select, we don't check the other paths, we can only go down one
-					return;
-				}
-			}
-			break;
-		case ESUDSEdgeType::Chained:
-			RecurseAppendChoices(Edge.GetTargetNode().Get(), OutChoices);
-			break;
-		default:
-		case ESUDSEdgeType::Continue:
-			UE_LOG(LogSUDSDialogue, Fatal, TEXT("Should not have encountered invalid edge in RecurseAppendChoices"))			
-			break;
-		};
-		
+			NamesByParticipant[i].Add(Name);
+		}
+	}
+	for (int i = 0; i < NamesByParticipant.Num(); ++i)
+	{
+		const TArray<FName>& Names = NamesByParticipant[i];
+		if (Names.IsEmpty() || !Participants.IsValidIndex(i))
+		{
+			continue;
+		}
+		auto NativeFunc = [&](ISUDSNativeParticipant* P) { P->OnDialogueVariablesRequested(this, Names); };
+		auto BlueprintFunc = [&](UObject* P) { ISUDSParticipant::Execute_OnDialogueVariablesRequested(P, this, Names); };
+		CallParticipant(i, NativeFunc, BlueprintFunc);
 	}
 }
 
-void USUDSDialogue::UpdateChoices()
+void USUDSDialogue::OnDialogueStateDirty(FSUDSDialogueRunner& InRunner)
 {
-	CurrentChoices.Reset();
-	CurrentRootChoiceNode = nullptr;
-	if (CurrentSpeakerNode)
+	if (USUDSSubsystem* Registry = StateRegistry.Get())
 	{
-		// If we've either found choices through static checking (on one or other select paths), we look for them now
-		// We also check if we're inside a gosub, since the call site changes whether there may be choices or not
-		if (CurrentSpeakerNode->MayHaveChoices() ||
-			GosubReturnStack.Num() > 0)
-		{
-			// We MIGHT have a choice; conditionals can result in HasChoices() being true but the current state not actually
-			// taking us to a choice path
-			CurrentRootChoiceNode = FindNextChoiceNode(CurrentSpeakerNode);
-			if (CurrentRootChoiceNode)
-			{
-				// Run any e.g. set nodes between text and choice
-				// These can be set nodes directly under the text and before the first choice, which get run for all choices
-				RunUntilNextChoiceNode(CurrentSpeakerNode);
+		Registry->InternalNotifyDialogueStateChanged(this);
+	}
+}
 
-				// Once we've found & run up to the root choice, there can be potentially a tree of mixed choice/select nodes
-				// for supporting conditional choices
-				RecurseAppendChoices(CurrentRootChoiceNode, CurrentChoices);
-			}
-		}
+#if WITH_EDITOR
+void USUDSDialogue::OnDialogueScriptSetVariable(FSUDSDialogueRunner& InRunner,
+                                                FName VariableName,
+                                                const FSUDSValue& Value,
+                                                const FString& ExprString,
+                                                int LineNo)
+{
+	InternalOnSetVar.ExecuteIfBound(this, VariableName, Value, ExprString, LineNo);
+}
 
-		if (CurrentChoices.Num() == 0)
-		{
-			if (auto Edge = CurrentSpeakerNode->GetEdge(0))
-			{
-				// Simple no-choice progression
-				// May occur if HasChoices was true but in current state no choice was found
-				CurrentChoices.Add(*Edge);
-			}			
-		}
-	}
+void USUDSDialogue::OnDialogueSelectEval(FSUDSDialogueRunner& InRunner,
+                                         const FString& ConditionString,
+                                         bool bResult,
+                                         int LineNo)
+{
+	InternalOnSelectEval.ExecuteIfBound(this, ConditionString, bResult, LineNo);
+}
+#endif
+
+FText USUDSDialogue::GetText()
+{
+	return Runner.GetText();
+}
+
+const FString& USUDSDialogue::GetSpeakerID() const
+{
+	return Runner.GetSpeakerID();
 }
 
+FText USUDSDialogue::GetSpeakerDisplayName() const
+{
+	return Runner.GetSpeakerDisplayName();
+}
 
 int USUDSDialogue::GetNumberOfChoices() const
 {
-	return CurrentChoices.Num();
+	return Runner.GetNumberOfChoices();
 }
 
 bool USUDSDialogue::IsSimpleContinue() const
 {
-	return CurrentChoices.Num() == 1 && CurrentChoices[0].GetText().IsEmpty();
+	return Runner.IsSimpleContinue();
 }
 
 FText USUDSDialogue::GetChoiceText(int Index)
 {
+	return Runner.GetChoiceText(Index);
+}
 
-	if (CurrentChoices.IsValidIndex(Index))
-	{
-		auto& Choice = CurrentChoices[Index];
-		if (Choice.HasParameters())
-		{
-			return ResolveParameterisedText(Choice.GetParameterNames(), Choice.GetTextFormat(), Choice.GetSourceLineNo());
-		}
-		else
-		{
-			return Choice.GetText();
-		}
-	}
-	else
+TArray<FSUDSScriptEdge> USUDSDialogue::GetChoices() const
+{
+	TArray<FSUDSScriptEdge> Ret;
+	Ret.Reserve(Runner.GetNumberOfChoices());
+	for (const auto Choice : Runner.GetChoices())
 	{
-		UE_LOG(LogSUDSDialogue, Error, TEXT("Invalid choice index %d on node %s"), Index, *GetText().ToString());
+		Ret.Add(*Choice);
 	}
-
-	return DummyText;
+	return Ret;
 }
 
 bool USUDSDialogue::HasChoiceIndexBeenTakenPreviously(int Index)
 {
-	if (CurrentChoices.IsValidIndex(Index))
-	{
-		return HasChoiceBeenTakenPreviously(CurrentChoices[Index]);
-	}
-	return false;
+	return Runner.HasChoiceIndexBeenTakenPreviously(Index);
 }
 
 bool USUDSDialogue::HasChoiceBeenTakenPreviously(const FSUDSScriptEdge& Choice)
 {
-	return ChoicesTaken.Contains(Choice.GetTextID());
+	return Runner.HasChoiceBeenTakenPreviously(Choice);
 }
 
 bool USUDSDialogue::Continue()
 {
-	if (GetNumberOfChoices() == 1)
-	{
-		return Choose(0);		
-	}
-	return !IsEnded();
+	return Runner.Continue();
 }
 
 bool USUDSDialogue::Choose(int Index)
 {
-	if (CurrentChoices.IsValidIndex(Index))
-	{
-		// ONLY run to choice node if there is one!
-		// This method is called for Continue() too, which has no choice node
-		if (CurrentNodeHasChoices())
-		{
-			const auto& Choice = CurrentChoices[Index]; 
-			ChoicesTaken.Add(Choice.GetTextID());
-			
-			RaiseChoiceMade(Index, Choice.GetSourceLineNo());
-			RaiseProceeding();
-		}
-		else
-		{
-			RaiseProceeding();
-		}
-		// Then choose path
-		RunUntilNextSpeakerNodeOrEnd(CurrentChoices[Index].GetTargetNode().Get(), true);
-		return !IsEnded();
-	}
-	else
-	{
-		UE_LOG(LogSUDSDialogue, Error, TEXT("Invalid choice index %d on node %s"), Index, *GetText().ToString());
-	}
-	return false;
-}
-
-bool USUDSDialogue::CurrentNodeHasChoices() const
-{
-	return CurrentRootChoiceNode != nullptr;
+	return Runner.Choose(Index);
 }
 
 bool USUDSDialogue::IsEnded() const
 {
-	return CurrentSpeakerNode == nullptr;
+	return Runner.IsEnded();
 }
 
 bool USUDSDialogue::IsFinalLine() const
 {
-	return CurrentSpeakerNode && CurrentChoices.Num() == 1 && CurrentChoices[0].GetTargetNode() == nullptr;
+	return Runner.IsFinalLine();
 }
 
 void USUDSDialogue::End(bool bQuietly)
 {
-	SetCurrentSpeakerNode(nullptr, bQuietly);
+	Runner.End(bQuietly);
 }
 
 int USUDSDialogue::GetCurrentSourceLine() const
 {
-	return CurrentSourceLineNo;
+	return Runner.GetCurrentSourceLine();
 }
 
-void USUDSDialogue::ResetState(bool bResetVariables, bool bResetPosition, bool bResetVisited)
+void USUDSDialogue::Restart(bool bResetState, FName StartLabel, bool bReRunHeader)
 {
-	if (bResetVariables)
-		InitVariables();
-	if (bResetPosition)
-		SetCurrentSpeakerNode(nullptr, true);
-	if (bResetVisited)
-		ChoicesTaken.Reset();
+	Runner.Restart(bResetState, StartLabel, bReRunHeader);
 }
 
-FSUDSDialogueState USUDSDialogue::GetSavedState() const
+void USUDSDialogue::ResetState(bool bResetVariables, bool bResetPosition, bool bResetVisited)
 {
-	const FString CurrentNodeId = CurrentSpeakerNode
-		                              ? SUDS_GET_TEXT_KEY(CurrentSpeakerNode->GetText())
-		                              : FString();
+	Runner.ResetState(bResetVariables, bResetPosition, bResetVisited);
+}
 
-	TArray<FString> ExportReturnStack;
-	for (auto Node : GosubReturnStack)
-	{
-		if (auto GN = Cast<USUDSScriptNodeGosub>(Node))
-		{
-			ExportReturnStack.Add(GN->GetGosubID());
-		}
-		
-	}
-	return FSUDSDialogueState(CurrentNodeId, VariableState, ChoicesTaken, ExportReturnStack);
-		  
+FSUDSDialogueState USUDSDialogue::GetSavedState(bool bOnlyChangedVariables) const
+{
+	return Runner.GetSavedState(bOnlyChangedVariables);
 }
 
 void USUDSDialogue::RestoreSavedState(const FSUDSDialogueState& State)
 {
-	// Don't just empty variables
-	// Re-run init to ensure header state is initialised then merge; important for it script is altered since state saved
-	InitVariables();
-	VariableState.Append(State.GetVariables());
-	ChoicesTaken.Empty();
-	ChoicesTaken.Append(State.GetChoicesTaken());
-	GosubReturnStack.Empty();
-	for (auto ID : State.GetReturnStack())
-	{
-		USUDSScriptNodeGosub* Node = BaseScript->GetNodeByGosubID(ID);
-		if (!Node)
-		{
-			UE_LOG(LogSUDSDialogue, Error, TEXT("Restore: Can't find Gosub with ID %s, returns referencing it will go to end"), *ID);
-		}
-		// Add anyway, will just go to end
-		GosubReturnStack.Add(Node);
-	}
-	
-	// If not found this will be null
-	if (!State.GetTextNodeID().IsEmpty())
-	{
-		USUDSScriptNodeText* Node = BaseScript->GetNodeByTextID(State.GetTextNodeID());
-		SetCurrentSpeakerNode(Node, true);
-	}
-	else
-	{
-		SetCurrentSpeakerNode(nullptr, true);
-	}
+	Runner.RestoreSavedState(State);
 }
 
-void USUDSDialogue::Restart(bool bResetState, FName StartLabel, bool bReRunHeader)
+void USUDSDialogue::GetCompactSavedState(TArray<uint8>& OutData, bool bOnlyChangedVariables) const
 {
-	if (bResetState)
-	{
-		ResetState();
-	}
-	// Always reset return stack
-	GosubReturnStack.Empty();
-	CurrentSourceLineNo = 0;
-	RaiseStarting(StartLabel);
+	OutData.Reset();
+	Runner.GetSavedState(bOnlyChangedVariables).SaveCompact(BaseScript, OutData);
+}
 
-	if (!bResetState && bReRunHeader)
+bool USUDSDialogue::RestoreCompactSavedState(const TArray<uint8>& Data)
+{
+	FSUDSDialogueState State;
+	if (State.LoadCompact(BaseScript, Data))
 	{
-		// Run header nodes but don't re-init
-		RunUntilNextSpeakerNodeOrEnd(BaseScript->GetHeaderNode(), false);
+		Runner.RestoreSavedState(State);
+		return true;
 	}
+	return false;
+}
 
-	if (StartLabel != NAME_None)
-	{
-		// Check that StartLabel leads to a text node
-		// Labels can lead to choices or select nodes for looping, but there has to be a text node to start with.
-		auto StartNode = BaseScript->GetNodeByLabel(StartLabel);
-		if (!StartNode)
-		{
-			UE_LOG(LogSUDSDialogue, Error, TEXT("No start label called %s in dialogue %s"), *StartLabel.ToString(), *BaseScript->GetName());
-			StartNode = BaseScript->GetFirstNode();
-		}
-		else if (StartNode->GetNodeType() == ESUDSScriptNodeType::Choice)
-		{
-			UE_LOG(LogSUDSDialogue,
-			       Error,
-			       TEXT("Label %s in dialogue %s cannot be used as a start point, points to a choice."),
-			       *StartLabel.ToString(),
-			       *BaseScript->GetName());
-			StartNode = BaseScript->GetFirstNode();
-		}
-		RunUntilNextSpeakerNodeOrEnd(StartNode, true);
-	}
-	else
-	{
-		RunUntilNextSpeakerNodeOrEnd(BaseScript->GetFirstNode(), true);
-	}
-	
+void USUDSDialogue::SetRandomSeed(int32 Seed)
+{
+	Runner.SetRandomSeed(Seed);
 }
 
+int32 USUDSDialogue::GetRandomSeed()
+{
+	return Runner.GetRandomSeed();
+}
 
-TSet<FName> USUDSDialogue::GetParametersInUse()
+void USUDSDialogue::SetBatchVariableRequests(bool bBatch)
 {
-	// Build on demand, may not be needed
-	if (!bParamNamesExtracted)
-	{
-		CurrentRequestedParamNames.Reset();
-		if (CurrentSpeakerNode && CurrentSpeakerNode->HasParameters())
-		{
-			CurrentRequestedParamNames.Append(CurrentSpeakerNode->GetParameterNames());
-		}
-		for (auto& Choice : CurrentChoices)
-		{
-			if (Choice.HasParameters())
-			{
-				CurrentRequestedParamNames.Append(Choice.GetParameterNames());
-			}
-		}
-		bParamNamesExtracted = true;
-	}
+	Runner.SetBatchVariableRequests(bBatch);
+}
 
-	return CurrentRequestedParamNames;
-	
+bool USUDSDialogue::IsBatchingVariableRequests() const
+{
+	return Runner.IsBatchingVariableRequests();
 }
 
-void USUDSDialogue::RaiseStarting(FName StartLabel)
+void USUDSDialogue::SetCacheProvidedVariables(bool bCache)
 {
-	for (const auto& P : Participants)
-	{
-		if (P->GetClass()->ImplementsInterface(USUDSParticipant::StaticClass()))
-		{
-			ISUDSParticipant::Execute_OnDialogueStarting(P, this, StartLabel);
-		}
-	}
-	OnStarting.Broadcast(this, StartLabel);
-#if WITH_EDITOR
-	InternalOnStarting.ExecuteIfBound(this, StartLabel);
-#endif
+	Runner.SetCacheProvidedVariables(bCache);
 }
 
-void USUDSDialogue::RaiseFinished()
+void USUDSDialogue::InvalidateProvidedVariables()
 {
-	for (const auto& P : Participants)
-	{
-		if (P->GetClass()->ImplementsInterface(USUDSParticipant::StaticClass()))
-		{
-			ISUDSParticipant::Execute_OnDialogueFinished(P, this);
-		}
-	}
-	OnFinished.Broadcast(this);
-#if WITH_EDITOR
-	InternalOnFinished.ExecuteIfBound(this);
-#endif
+	Runner.InvalidateProvidedVariables();
+}
 
+TSet<FName> USUDSDialogue::GetParametersInUse()
+{
+	return Runner.GetParametersInUse();
 }
 
-void USUDSDialogue::RaiseNewSpeakerLine()
+FSUDSValue USUDSDialogue::GetVariable(FName Name) const
 {
-	for (const auto& P : Participants)
-	{
-		if (P->GetClass()->ImplementsInterface(USUDSParticipant::StaticClass()))
-		{
-			ISUDSParticipant::Execute_OnDialogueSpeakerLine(P, this);
-		}
-	}
-	
-	// Event listeners get it after
-	OnSpeakerLine.Broadcast(this);
-#if WITH_EDITOR
-	InternalOnSpeakerLine.ExecuteIfBound(this, GetCurrentSourceLine());
-#endif
+	return Runner.GetVariable(Name);
 }
 
-void USUDSDialogue::RaiseChoiceMade(int Index, int LineNo)
+bool USUDSDialogue::IsVariableSet(FName Name) const
 {
-	for (const auto& P : Participants)
-	{
-		if (P->GetClass()->ImplementsInterface(USUDSParticipant::StaticClass()))
-		{
-			ISUDSParticipant::Execute_OnDialogueChoiceMade(P, this, Index);
-		}
-	}
-	// Event listeners get it after
-	OnChoice.Broadcast(this, Index);
-#if WITH_EDITOR
-	InternalOnChoice.ExecuteIfBound(this, Index, LineNo);
-#endif
+	return Runner.IsVariableSet(Name);
 }
 
-void USUDSDialogue::RaiseProceeding()
+TMap<FName, FSUDSValue> USUDSDialogue::GetVariables() const
 {
-	for (const auto& P : Participants)
-	{
-		if (P->GetClass()->ImplementsInterface(USUDSParticipant::StaticClass()))
-		{
-			ISUDSParticipant::Execute_OnDialogueProceeding(P, this);
-		}
-	}
-	// Event listeners get it after
-	OnProceeding.Broadcast(this);
-#if WITH_EDITOR
-	InternalOnProceeding.ExecuteIfBound(this);
-#endif
+	return Runner.GetVariables();
+}
+
+void USUDSDialogue::UnSetVariable(FName Name)
+{
+	Runner.UnSetVariable(Name);
 }
 
 FText USUDSDialogue::GetVariableText(FName Name) const
 {
-	if (const auto Arg = VariableState.Find(Name))
+	if (const auto Arg = FindVariable(Name))
 	{
 		if (Arg->GetType() == ESUDSValueType::Text)
 		{
@@ -1207,7 +815,7 @@ void USUDSDialogue::SetVariableInt(FName Name, int32 Value)
 
 int USUDSDialogue::GetVariableInt(FName Name) const
 {
-	if (const auto Arg = VariableState.Find(Name))
+	if (const auto Arg = FindVariable(Name))
 	{
 		switch (Arg->GetType())
 		{
@@ -1232,7 +840,7 @@ void USUDSDialogue::SetVariableFloat(FName Name, float Value)
 
 float USUDSDialogue::GetVariableFloat(FName Name) const
 {
-	if (const auto Arg = VariableState.Find(Name))
+	if (const auto Arg = FindVariable(Name))
 	{
 		switch (Arg->GetType())
 		{
@@ -1256,7 +864,7 @@ void USUDSDialogue::SetVariableGender(FName Name, ETextGender Value)
 
 ETextGender USUDSDialogue::GetVariableGender(FName Name) const
 {
-	if (const auto Arg = VariableState.Find(Name))
+	if (const auto Arg = FindVariable(Name))
 	{
 		switch (Arg->GetType())
 		{
@@ -1280,7 +888,7 @@ void USUDSDialogue::SetVariableBoolean(FName Name, bool Value)
 
 bool USUDSDialogue::GetVariableBoolean(FName Name) const
 {
-	if (const auto Arg = VariableState.Find(Name))
+	if (const auto Arg = FindVariable(Name))
 	{
 		switch (Arg->GetType())
 		{
@@ -1305,7 +913,7 @@ void USUDSDialogue::SetVariableName(FName Name, FName Value)
 
 FName USUDSDialogue::GetVariableName(FName Name) const
 {
-	if (const auto Arg = VariableState.Find(Name))
+	if (const auto Arg = FindVariable(Name))
 	{
 		if (Arg->GetType() == ESUDSValueType::Name)
 		{
@@ -1318,8 +926,3 @@ FName USUDSDialogue::GetVariableName(FName Name) const
 	}
 	return NAME_None;
 }
-
-void USUDSDialogue::UnSetVariable(FName Name)
-{
-	VariableState.Remove(Name);
-}
@@ -0,0 +1,1387 @@
+﻿// Copyright Steve Streeting 2022
+// Released under the MIT license https://opensource.org/license/MIT/
+#include "SUDSDialogueRunner.h"
+
+#include "SUDSInternal.h"
+#include "SUDSScript.h"
+#include "SUDSScriptNode.h"
+#include "SUDSScriptNodeEvent.h"
+#include "SUDSScriptNodeGosub.h"
+#include "SUDSScriptNodeSet.h"
+#include "SUDSScriptNodeText.h"
+
+DEFINE_LOG_CATEGORY(LogSUDSDialogue);
+
+const FText FSUDSDialogueRunner::DummyText = FText::FromString("INVALID");
+const FString FSUDSDialogueRunner::DummyString = "INVALID";
+
+FSUDSDialogueRunner::FSUDSDialogueRunner(): BaseScript(nullptr),
+                                            Listener(nullptr),
+                                            CurrentSpeakerNode(nullptr),
+                                            CurrentRootChoiceNode(nullptr),
+                                            NumScriptVariableSlots(0),
+                                            bParamNamesExtracted(false),
+                                            RandomSeed(0),
+                                            bRandomStreamSeeded(false),
+                                            DefaultRandomSeed(0),
+                                            bCacheProvidedVariables(false),
+                                            bBatchVariableRequests(false),
+                                            bStateDirty(true),
+                                            CurrentSourceLineNo(0)
+{
+}
+
+void FSUDSDialogueRunner::Initialise(const USUDSScript* Script, ISUDSDialogueRunnerListener* InListener)
+{
+	BaseScript = Script;
+	Listener = InListener;
+	CurrentSpeakerNode = nullptr;
+	// Runners can be initialised again to reuse them, so clear anything left over from before
+	CurrentRootChoiceNode = nullptr;
+	CurrentChoices.Reset();
+	CurrentChoiceTargets.Reset();
+	CurrentSpeakerDisplayName = FText::GetEmpty();
+	bParamNamesExtracted = false;
+	CurrentSourceLineNo = 0;
+	GosubReturnStack.Reset();
+	ChoicesTaken.Reset();
+	RandomSeed = 0;
+	bRandomStreamSeeded = false;
+	TakeDefaultRandomSeed();
+	bStateDirty = true;
+
+	InitVariables();
+
+	CurrentSpeakerNode = nullptr;
+
+}
+
+void FSUDSDialogueRunner::AddReferencedObjects(FReferenceCollector& Collector)
+{
+	Collector.AddReferencedObject(BaseScript);
+}
+
+void FSUDSDialogueRunner::InitVariables()
+{
+	NumScriptVariableSlots = BaseScript->GetNumVariableSlots();
+	VariableValues.Reset();
+	VariableValues.SetNum(NumScriptVariableSlots);
+	VariableSetFlags.Init(false, NumScriptVariableSlots);
+	ExtraVariableNames.Reset();
+	ExtraVariableSlots.Reset();
+	// Run header nodes immediately (only set nodes)
+	RunHeader();
+}
+
+void FSUDSDialogueRunner::RunHeader()
+{
+	// The script has already evaluated the leading header sets which don't depend on state, so just apply those.
+	// This still raises the same variable change notifications as running the set nodes would
+	for (const auto& Default : BaseScript->GetHeaderDefaults())
+	{
+		const USUDSScriptNodeSet* SetNode = Default.Node;
+		CurrentSourceLineNo = SetNode->GetSourceLineNo();
+		SetVariableImpl(SetNode->GetIdentifier(), Default.Value, true, SetNode->GetSourceLineNo(), SetNode->GetVariableSlot());
+#if WITH_EDITOR
+		if (Listener)
+		{
+			Listener->OnDialogueScriptSetVariable(*this,
+			                                      SetNode->GetIdentifier(),
+			                                      Default.Value,
+			                                      SetNode->GetExpression().IsLiteral()
+				                                      ? ""
+				                                      : SetNode->GetExpression().GetSourceString(),
+			                                      SetNode->GetSourceLineNo());
+		}
+#endif
+	}
+	// Anything else in the header has to be run
+	BeginStep(BaseScript->GetHeaderResumeNode());
+	RunUntilNextSpeakerNodeOrEnd(BaseScript->GetHeaderResumeNode(), false);
+}
+
+void FSUDSDialogueRunner::Start(FName Label)
+{
+	// Only start if not already on a speaker node
+	// This makes the restore sequence easier, you don't have to test IsEnded
+	if (!CurrentSpeakerNode)
+	{
+		// Note that we don't reset state by default here. This is to allow long-term memory on dialogue, such as
+		// knowing whether you've met a character before etc.
+		// We also don't re-run headers here since they will have been run on Initialise()
+		// This is to allow callers to set variables before Start() that override headers
+		Restart(false, Label, false);
+	}
+}
+
+void FSUDSDialogueRunner::RunUntilNextSpeakerNodeOrEnd(USUDSScriptNode* NextNode, bool bRaiseAtEnd)
+{
+	// We run through nodes which don't require a speaker line prompt
+	// E.g. set nodes, select nodes which are all automatically resolved
+	// Starting with this node
+	while (NextNode && !IsChoiceOrTextNode(NextNode->GetNodeType()))
+	{
+		NextNode = RunNode(NextNode);
+	}
+
+	if (NextNode)
+	{
+		if (NextNode->GetNodeType() == ESUDSScriptNodeType::Text)
+		{
+			// Type already checked
+			SetCurrentSpeakerNode(static_cast<USUDSScriptNodeText*>(NextNode), false);
+		}
+		else
+		{
+			// This can happen if for example user creates a choice node as the first thing
+			UE_LOG(LogSUDSDialogue,
+			       Error,
+			       TEXT("Error in %s line %d: Tried to run to next speaker node but encountered unexpected node of type %s"),
+			       *BaseScript->GetName(),
+			       NextNode->GetSourceLineNo(),
+			       *(StaticEnum<ESUDSScriptNodeType>()->GetValueAsString(NextNode->GetNodeType()))
+			);
+		}
+	}
+	else
+	{
+		End(!bRaiseAtEnd);
+	}
+
+}
+
+USUDSScriptNode* FSUDSDialogueRunner::RunNode(USUDSScriptNode* Node)
+{
+	CurrentSourceLineNo = Node->GetSourceLineNo();
+	switch (Node->GetNodeType())
+	{
+	case ESUDSScriptNodeType::Select:
+		return RunSelectNode(Node);
+	case ESUDSScriptNodeType::SetVariable:
+		return RunSetVariableNode(Node);
+	case ESUDSScriptNodeType::Event:
+		return RunEventNode(Node);
+	case ESUDSScriptNodeType::Gosub:
+		return RunGosubNode(Node);
+	case ESUDSScriptNodeType::Return:
+		return RunReturnNode(Node);
+	default: ;
+	}
+
+	UE_LOG(LogSUDSDialogue,
+	       Error,
+	       TEXT("Error in %s line %d: Attempted to run non-runnable node type %s"),
+	       *BaseScript->GetName(),
+	       Node->GetSourceLineNo(),
+	       *(StaticEnum<ESUDSScriptNodeType>()->GetValueAsString(Node->GetNodeType()))
+	)
+	return nullptr;
+}
+
+USUDSScriptNode* FSUDSDialogueRunner::RunSelectNode(USUDSScriptNode* Node)
+{
+	// Define internal random selection variable (used in random selects)
+	if (Node->IsRandomSelect())
+	{
+		// Random picker
+		// Could try to NOT pick the same ones we already picked, but this would require some additional state, similar
+		// to "ChoicesTaken" state but for random text nodes already chosen. For now, keep it simple
+
+		const int OptCount = Node->GetEdgeCount();
+		// Use our own stream so results don't depend on anything else using random numbers, see SetRandomSeed()
+		EnsureRandomStreamSeeded();
+		const int RandChoice = FMath::Min(OptCount-1, FMath::TruncToInt(RandomStream.GetFraction() * (float)OptCount));
+		// The stream position is part of the saved state
+		MarkStateDirty();
+
+		SetVariable(FSUDSConstants::RandomItemSelectIndexVarName, RandChoice);
+	}
+	
+	const auto& Edges = Node->GetEdges();
+	for (int i = 0; i < Edges.Num(); ++i)
+	{
+		const auto& Edge = Edges[i];
+		if (Edge.GetCondition().IsValid())
+		{
+			// use the first satisfied edge
+			const bool bSuccess = EvaluateCondition(Edge.GetCondition(), Edge.GetSourceLineNo());
+#if WITH_EDITOR
+			{
+				FString ExprStr = Edge.GetCondition().GetSourceString();
+				if (ExprStr.IsEmpty())
+				{
+					// Lack of condition is an else / final random option
+					ExprStr = "else";
+				}
+				if (Listener)
+				{
+					Listener->OnDialogueSelectEval(*this, ExprStr, bSuccess, Edge.GetSourceLineNo());
+				}
+			}
+#endif
+			
+			if (bSuccess)
+			{
+				return BaseScript->GetEdgeTarget(Node, i);
+			}
+		}
+	}
+	// NOTE: if no valid path, go to end
+	// We've already created fall-through else nodes if possible
+	return nullptr;
+}
+
+USUDSScriptNode* FSUDSDialogueRunner::RunEventNode(USUDSScriptNode* Node)
+{
+	if (USUDSScriptNodeEvent* EvtNode = Cast<USUDSScriptNodeEvent>(Node))
+	{
+		// Build a resolved args list, because we need to evaluate  expressions
+		TArray<FSUDSValue> ArgsResolved;
+		
+		for (auto& Expr : EvtNode->GetArgs())
+		{
+			ArgsResolved.Add(EvaluateExpression(Expr, EvtNode->GetSourceLineNo()));
+		}
+		
+		if (Listener)
+		{
+			Listener->OnDialogueEvent(*this, EvtNode->GetEventName(), ArgsResolved, EvtNode->GetSourceLineNo());
+		}
+	}
+	return GetNextNode(Node);
+}
+
+USUDSScriptNode* FSUDSDialogueRunner::RunGosubNode(USUDSScriptNode* Node)
+{
+	if (USUDSScriptNodeGosub* GosubNode = Cast<USUDSScriptNodeGosub>(Node))
+	{
+		if (auto TargetNode = BaseScript->GetGosubTarget(GosubNode))
+		{
+			// Push this gosub node to the return stack, then jump
+			GosubReturnStack.Push(GosubNode);
+			return TargetNode;
+		}
+		else
+		{
+			UE_LOG(LogSUDSDialogue,
+				   Error,
+				   TEXT("Error in %s: Cannot gosub to label '%s', was not found"),
+				   *BaseScript->GetName(),
+				   *GosubNode->GetLabelName().ToString());
+			
+		}
+	}
+	return GetNextNode(Node);
+}
+
+USUDSScriptNode* FSUDSDialogueRunner::RunReturnNode(USUDSScriptNode* Node)
+{
+	if (GosubReturnStack.Num() > 0)
+	{
+		// We return to the next node after the gosub, which temporarily redirected
+		const auto GoSubNode = GosubReturnStack.Pop();
+		return GetNextNode(GoSubNode);
+	}
+	else
+	{
+		UE_LOG(LogSUDSDialogue,
+			   Error,
+			   TEXT("Attempted to return at %s:%d but there was no previous gosub to return to"),
+			   *BaseScript->GetName(),
+			   Node->GetSourceLineNo());
+		return nullptr;
+		
+	}
+}
+
+USUDSScriptNode* FSUDSDialogueRunner::RunSetVariableNode(USUDSScriptNode* Node)
+{
+	if (USUDSScriptNodeSet* SetNode = Cast<USUDSScriptNodeSet>(Node))
+	{
+		if (SetNode->GetExpression().IsValid())
+		{
+			FSUDSValue Value = EvaluateExpression(SetNode->GetExpression(), SetNode->GetSourceLineNo());
+			if (SetNode->IsGlobal())
+			{
+				InternalSetGlobalVariable(GetWorld(), SetNode->GetGlobalIdentifier(), Value, true, SetNode->GetSourceLineNo());
+			}
+			else
+			{
+				SetVariableImpl(SetNode->GetIdentifier(), Value, true, SetNode->GetSourceLineNo(), SetNode->GetVariableSlot());
+			}
+#if WITH_EDITOR
+			// We do this here so that we have access to the expression
+			if (Listener)
+			{
+				Listener->OnDialogueScriptSetVariable(*this,
+				                                      SetNode->GetIdentifier(),
+				                                      Value,
+				                                      SetNode->GetExpression().IsLiteral()
+					                                      ? ""
+					                                      : SetNode->GetExpression().GetSourceString(),
+				                                      SetNode->GetSourceLineNo());
+			}
+#endif
+		}
+	}
+
+	// Always one edge
+	return GetNextNode(Node);
+	
+}
+
+void FSUDSDialogueRunner::RaiseVariableChange(const FName& VarName, const FSUDSValue& Value, bool bFromScript, int LineNo)
+{
+	if (Listener)
+	{
+		Listener->OnDialogueVariableChanged(*this, VarName, Value, bFromScript, LineNo);
+	}
+}
+
+void FSUDSDialogueRunner::RaiseVariableRequested(const FName& VarName, int LineNo)
+{
+	if (bBatchVariableRequests)
+	{
+		// Already requested in this step's batch, or individually earlier in the step
+		bool bAlreadyRequested = false;
+		StepRequestedVariables.Add(VarName, &bAlreadyRequested);
+		if (bAlreadyRequested)
+		{
+			return;
+		}
+	}
+	if (Listener)
+	{
+		Listener->OnDialogueVariableRequested(*this, VarName, LineNo);
+	}
+}
+
+void FSUDSDialogueRunner::AddVariableProvider(ISUDSVariableProvider* Provider)
+{
+	if (Provider)
+	{
+		VariableProviders.AddUnique(Provider);
+		ProvidedVariableCache.Reset();
+	}
+}
+
+void FSUDSDialogueRunner::RemoveVariableProvider(ISUDSVariableProvider* Provider)
+{
+	VariableProviders.Remove(Provider);
+	ProvidedVariableCache.Reset();
+}
+
+void FSUDSDialogueRunner::ClearVariableProviders()
+{
+	VariableProviders.Reset();
+	ProvidedVariableCache.Reset();
+}
+
+void FSUDSDialogueRunner::SetCacheProvidedVariables(bool bCache)
+{
+	bCacheProvidedVariables = bCache;
+	ProvidedVariableCache.Reset();
+}
+
+bool FSUDSDialogueRunner::FindProvidedVariable(const FName& Name, FSUDSValue& OutValue) const
+{
+	if (VariableProviders.IsEmpty())
+	{
+		return false;
+	}
+	if (bCacheProvidedVariables)
+	{
+		if (const FSUDSValue* pCached = ProvidedVariableCache.Find(Name))
+		{
+			OutValue = *pCached;
+			return true;
+		}
+	}
+
+	for (const auto Provider : VariableProviders)
+	{
+		if (Provider->ProvideVariable(*this, Name, OutValue))
+		{
+			if (bCacheProvidedVariables)
+			{
+				ProvidedVariableCache.Add(Name, OutValue);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+void FSUDSDialogueRunner::SetBatchVariableRequests(bool bBatch)
+{
+	bBatchVariableRequests = bBatch;
+	StepRequestedVariables.Reset();
+}
+
+void FSUDSDialogueRunner::BeginStep(const USUDSScriptNode* FromNode)
+{
+	// Provided values are only cached within a step
+	ProvidedVariableCache.Reset();
+
+	if (!bBatchVariableRequests)
+	{
+		return;
+	}
+
+	StepRequestedVariables.Reset();
+	if (FromNode)
+	{
+		// Our own copy, since listeners may step other dialogues which add to the script's cache
+		TArray<FName> Names;
+		BaseScript->GetStepVariableNames(FromNode, Names);
+		if (!Names.IsEmpty())
+		{
+			StepRequestedVariables.Append(Names);
+			if (Listener)
+			{
+				Listener->OnDialogueVariablesRequested(*this, Names, FromNode->GetSourceLineNo());
+			}
+		}
+	}
+}
+
+namespace
+{
+	/// Lets expressions read variables directly from a dialogue's slots
+	class FSUDSDialogueVariableSource : public ISUDSVariableSource
+	{
+	protected:
+		const FSUDSDialogueRunner& Runner;
+		const TMap<FName, FSUDSValue>& GlobalVariables;
+		/// Values from providers, which the expression may point at until it's finished. Each is allocated
+		/// separately so that adding more doesn't move the earlier ones
+		mutable TIndirectArray<FSUDSValue> ProvidedValues;
+	public:
+		FSUDSDialogueVariableSource(const FSUDSDialogueRunner& InRunner,
+		                            const TMap<FName, FSUDSValue>& InGlobalVariables)
+			: Runner(InRunner),
+			  GlobalVariables(InGlobalVariables)
+		{
+		}
+
+		virtual const FSUDSValue* FindVariable(const FName& Name, int32 Slot) const override
+		{
+			if (const FSUDSValue* Value = Runner.FindVariable(Name, Slot))
+			{
+				return Value;
+			}
+			FSUDSValue ProvidedValue;
+			if (Runner.FindProvidedVariable(Name, ProvidedValue))
+			{
+				const int32 Index = ProvidedValues.Add(new FSUDSValue(MoveTemp(ProvidedValue)));
+				return &ProvidedValues[Index];
+			}
+			return nullptr;
+		}
+
+		virtual const FSUDSValue* FindGlobalVariable(const FName& Name) const override
+		{
+			return GlobalVariables.Find(Name);
+		}
+	};
+}
+
+FSUDSValue FSUDSDialogueRunner::EvaluateExpression(const FSUDSExpression& Expression, int LineNo)
+{
+	// Variables are requested lazily, only when the expression actually reads them
+	return Expression.Evaluate(FSUDSDialogueVariableSource(*this, GetGlobalVariables()),
+	                           [this, LineNo](const FName& VarName)
+	                           {
+		                           RaiseVariableRequested(VarName, LineNo);
+	                           });
+}
+
+bool FSUDSDialogueRunner::EvaluateCondition(const FSUDSExpression& Expression, int LineNo)
+{
+	// Conditions which were constant at import time are known without evaluating, which means select edges which are
+	// always false are skipped entirely
+	if (Expression.IsBooleanLiteral())
+	{
+		return Expression.GetBooleanLiteralValue();
+	}
+	
+	return Expression.EvaluateBoolean(FSUDSDialogueVariableSource(*this, GetGlobalVariables()),
+	                                  BaseScript->GetName(),
+	                                  [this, LineNo](const FName& VarName)
+	                                  {
+		                                  RaiseVariableRequested(VarName, LineNo);
+	                                  });
+}
+
+UWorld* FSUDSDialogueRunner::GetWorld() const
+{
+	return Listener ? Listener->GetDialogueWorld(*this) : nullptr;
+}
+
+const TMap<FName, FSUDSValue>& FSUDSDialogueRunner::GetGlobalVariables() const
+{
+	return InternalGetGlobalVariables(GetWorld());
+}
+
+void FSUDSDialogueRunner::SetCurrentSpeakerNode(USUDSScriptNodeText* Node, bool bQuietly)
+{
+	CurrentSpeakerNode = Node;
+	MarkStateDirty();
+
+	CurrentSpeakerDisplayName = FText::GetEmpty();
+	bParamNamesExtracted = false;
+	if (Node)
+	{
+		CurrentSourceLineNo = Node->GetSourceLineNo();
+	}
+	else
+	{
+		CurrentSourceLineNo = 0;
+	}
+	UpdateChoices();
+
+	if (!bQuietly)
+	{
+		if (Listener)
+		{
+			if (CurrentSpeakerNode)
+				Listener->OnDialogueSpeakerLine(*this);
+			else
+				Listener->OnDialogueFinished(*this);
+		}
+	}
+
+}
+
+FText FSUDSDialogueRunner::ResolveParameterisedText(const TArray<FSUDSVariableRef>& Params,
+                                              const FTextFormat& TextFormat,
+                                              int LineNo)
+{
+	for (const auto& P : Params)
+	{
+		RaiseVariableRequested(P.Name, LineNo);
+	}
+	// Need to make a temp arg list for compatibility
+	// Also lets us just set the ones we need to
+	FFormatNamedArguments Args;
+	GetTextFormatArgs(Params, Args);
+	return FText::Format(TextFormat, Args);
+	
+}
+
+void FSUDSDialogueRunner::GetTextFormatArgs(const TArray<FSUDSVariableRef>& Args, FFormatNamedArguments& OutArgs) const
+{
+	for (const auto& Arg : Args)
+	{
+		if (Arg.IsGlobal())
+		{
+			auto& Globals = InternalGetGlobalVariables(GetWorld());
+			if (const FSUDSValue* Value = Globals.Find(Arg.GlobalName))
+			{
+				// Add to format args using name with prefix
+				OutArgs.Add(Arg.ArgumentName, Value->ToFormatArg());
+			}
+		}
+		else if (const FSUDSValue* Value = FindVariable(Arg.Name, Arg.Slot))
+		{
+			// Use the operator conversion
+			OutArgs.Add(Arg.ArgumentName, Value->ToFormatArg());
+		}
+		else
+		{
+			FSUDSValue ProvidedValue;
+			if (FindProvidedVariable(Arg.Name, ProvidedValue))
+			{
+				OutArgs.Add(Arg.ArgumentName, ProvidedValue.ToFormatArg());
+			}
+		}
+	}
+}
+
+FText FSUDSDialogueRunner::GetText()
+{
+	if (CurrentSpeakerNode)
+	{
+		if (CurrentSpeakerNode->HasParameters())
+		{
+			return ResolveParameterisedText(CurrentSpeakerNode->GetParameterRefs(BaseScript),
+			                                CurrentSpeakerNode->GetTextFormat(),
+			                                CurrentSpeakerNode->GetSourceLineNo());
+		}
+		else
+		{
+			return CurrentSpeakerNode->GetText();
+		}
+	}
+	return DummyText;
+}
+
+const FString& FSUDSDialogueRunner::GetSpeakerID() const
+{
+	if (CurrentSpeakerNode)
+		return CurrentSpeakerNode->GetSpeakerID();
+	
+	return DummyString;
+}
+
+FText FSUDSDialogueRunner::GetSpeakerDisplayName() const
+{
+	if (CurrentSpeakerDisplayName.IsEmpty())
+	{
+		// Derive speaker display name
+		// Is just a special variable "SpeakerName.SpeakerID"
+		// or just the SpeakerID if none specified
+		static const FString SpeakerIDPrefix = "SpeakerName.";
+		FName Key(SpeakerIDPrefix + GetSpeakerID());
+		const FSUDSValue* Arg = FindVariable(Key);
+		FSUDSValue ProvidedValue;
+		if (!Arg && FindProvidedVariable(Key, ProvidedValue))
+		{
+			Arg = &ProvidedValue;
+		}
+		if (Arg)
+		{
+			if (Arg->GetType() == ESUDSValueType::Text)
+			{
+				CurrentSpeakerDisplayName = Arg->GetTextValue();
+			}
+			else
+			{
+				UE_LOG(LogSUDSDialogue,
+				       Error,
+				       TEXT("Error in %s: %s was set to a value that was not text, cannot use"),
+				       *BaseScript->GetName(),
+				       *Key.ToString());
+			}
+		}
+		if (CurrentSpeakerDisplayName.IsEmpty())
+		{
+			// If no display name was specified, use the (non-localised) speaker ID
+			CurrentSpeakerDisplayName = FText::FromString(GetSpeakerID());
+		}
+	}
+	return CurrentSpeakerDisplayName;
+}
+
+USUDSScriptNode* FSUDSDialogueRunner::GetNextNode(USUDSScriptNode* Node)
+{
+	// In the case of select or random, we need to evaluate to get the next node
+	if (Node->GetNodeType() == ESUDSScriptNodeType::Select)
+	{
+		return RunSelectNode(Node);	
+	}
+	else
+	{
+		return BaseScript->GetNextNode(Node);
+	}
+}
+
+bool FSUDSDialogueRunner::IsChoiceOrTextNode(ESUDSScriptNodeType Type)
+{
+	return Type == ESUDSScriptNodeType::Text || Type == ESUDSScriptNodeType::Choice;
+}
+
+const USUDSScriptNode* FSUDSDialogueRunner::WalkToNextChoiceNode(USUDSScriptNode* FromNode, bool bExecute)
+{
+	if (FromNode && FromNode->GetEdgeCount() == 1)
+	{
+		const auto NextNode = GetNextNode(FromNode);
+		TArray<USUDSScriptNodeGosub*> TempGosubStack;
+		if (!bExecute)
+		{
+			// Make a copy of the gosub stack so we can safely explore gosubs
+			TempGosubStack.Append(GosubReturnStack);
+		}
+		
+		const auto ResultNode = RecurseWalkToNextChoiceOrTextNode(NextNode, bExecute, bExecute ? GosubReturnStack : TempGosubStack);
+		if (ResultNode && ResultNode->GetNodeType() == ESUDSScriptNodeType::Choice)
+		{
+			return ResultNode;
+		}
+	}
+	return nullptr;
+}
+
+USUDSScriptNode* FSUDSDialogueRunner::RecurseWalkToNextChoiceOrTextNode(USUDSScriptNode* Node, bool bExecute, TArray<USUDSScriptNodeGosub*>& LocalGosubStack)
+{
+	auto NextNode = Node;
+	while (NextNode && !IsChoiceOrTextNode(NextNode->GetNodeType()))
+	{
+		// Special case gosub/return in non-execute mode, since only RunNode will explore them
+		if (!bExecute)
+		{
+			if (NextNode->GetNodeType() == ESUDSScriptNodeType::Gosub)
+			{
+				// We need to special case Gosubs, since to find the choice we have to go into them and potentially out again
+				if (USUDSScriptNodeGosub* GosubNode = Cast<USUDSScriptNodeGosub>(NextNode))
+				{
+					if (auto SubNode = BaseScript->GetGosubTarget(GosubNode))
+					{
+						LocalGosubStack.Add(GosubNode);
+						NextNode = RecurseWalkToNextChoiceOrTextNode(SubNode, bExecute, LocalGosubStack);
+						continue;
+					}
+				}
+						
+			}
+			else if (NextNode->GetNodeType() == ESUDSScriptNodeType::Return)
+			{
+				if (LocalGosubStack.Num() > 0)
+				{
+					// We try to find the next choice node after the gosub, which temporarily redirected
+					const auto GoSubNode = LocalGosubStack.Pop();
+					NextNode = RecurseWalkToNextChoiceOrTextNode(GetNextNode(GoSubNode), bExecute, LocalGosubStack);
+					continue;
+				}
+				else
+				{
+					return nullptr;
+				}
+			}
+		}
+		
+		if (bExecute)
+		{
+			NextNode = RunNode(NextNode);
+		}
+		else
+		{
+			NextNode = GetNextNode(NextNode);
+		}
+	}
+
+	return NextNode;
+}
+
+const USUDSScriptNode* FSUDSDialogueRunner::RunUntilNextChoiceNode(USUDSScriptNode* FromNode)
+{
+	return WalkToNextChoiceNode(FromNode, true);
+}
+
+const USUDSScriptNode* FSUDSDialogueRunner::FindNextChoiceNode(USUDSScriptNode* FromNode)
+{
+	return WalkToNextChoiceNode(FromNode, false);
+}
+
+void FSUDSDialogueRunner::RecurseAppendChoices(const USUDSScriptNode* Node,
+                                               TArray<const FSUDSScriptEdge*>& OutChoices,
+                                               TArray<USUDSScriptNode*>& OutTargets)
+{
+	if (!Node)
+		return;
+
+	// We only cascade into choices or selects
+	if(Node->GetNodeType() != ESUDSScriptNodeType::Choice &&
+		Node->GetNodeType() != ESUDSScriptNodeType::Select)
+	{
+		return;
+	}
+	
+	const auto& Edges = Node->GetEdges();
+	for (int i = 0; i < Edges.Num(); ++i)
+	{
+		const auto& Edge = Edges[i];
+		switch (Edge.GetType())
+		{
+		case ESUDSEdgeType::Decision:
+			OutChoices.Add(&Edge);
+			OutTargets.Add(BaseScript->GetEdgeTarget(Node, i));
+			break;
+		case ESUDSEdgeType::Condition:
+			// Conditional edges are under selects
+			if (Edge.GetCondition().IsValid())
+			{
+				if (EvaluateCondition(Edge.GetCondition(), Edge.GetSourceLineNo()))
+				{
+					RecurseAppendChoices(BaseScript->GetEdgeTarget(Node, i), OutChoices, OutTargets);
+					// When we choose a path on a select, we don't check the other paths, we can only go down one
+					return;
+				}
+			}
+			break;
+		case ESUDSEdgeType::Chained:
+			RecurseAppendChoices(BaseScript->GetEdgeTarget(Node, i), OutChoices, OutTargets);
+			break;
+		default:
+		case ESUDSEdgeType::Continue:
+			UE_LOG(LogSUDSDialogue, Fatal, TEXT("Should not have encountered invalid edge in RecurseAppendChoices"))			
+			break;
+		};
+		
+	}
+}
+
+bool FSUDSDialogueRunner::RunChoicePlan(const USUDSScriptNode* FromNode)
+{
+	// Follow the precomputed plans, going back out through the gosub stack on returns without copying it
+	TArray<const FSUDSChoicePlan*, TInlineAllocator<4>> Plans;
+	int StackIndex = GosubReturnStack.Num() - 1;
+	const FSUDSChoicePlan* Plan = BaseScript->FindChoicePlan(FromNode);
+	while (Plan && Plan->Result == ESUDSChoicePlanResult::Return)
+	{
+		Plans.Add(Plan);
+		if (StackIndex < 0)
+		{
+			// Returning with nothing to return to means no choice
+			return true;
+		}
+		Plan = BaseScript->FindChoicePlan(GosubReturnStack[StackIndex--]);
+	}
+	if (!Plan || Plan->Result == ESUDSChoicePlanResult::Dynamic)
+	{
+		return false;
+	}
+	Plans.Add(Plan);
+
+	if (Plan->Result == ESUDSChoicePlanResult::Choice)
+	{
+		// Run any e.g. set nodes between text and choice, including returns which pop the gosub stack as we go
+		for (const auto P : Plans)
+		{
+			for (const auto Node : P->IntermediateNodes)
+			{
+				RunNode(Node);
+			}
+		}
+		CurrentRootChoiceNode = Plan->RootChoiceNode;
+	}
+	return true;
+}
+
+void FSUDSDialogueRunner::UpdateChoices()
+{
+	CurrentChoices.Reset();
+	CurrentChoiceTargets.Reset();
+	CurrentRootChoiceNode = nullptr;
+	if (CurrentSpeakerNode)
+	{
+		// If we've either found choices through static checking (on one or other select paths), we look for them now
+		// We also check if we're inside a gosub, since the call site changes whether there may be choices or not
+		if (CurrentSpeakerNode->MayHaveChoices() ||
+			GosubReturnStack.Num() > 0)
+		{
+			// We MIGHT have a choice; conditionals can result in HasChoices() being true but the current state not actually
+			// taking us to a choice path
+			if (!RunChoicePlan(CurrentSpeakerNode))
+			{
+				// The path depends on state, so look ahead first, then run
+				CurrentRootChoiceNode = FindNextChoiceNode(CurrentSpeakerNode);
+				if (CurrentRootChoiceNode)
+				{
+					// Run any e.g. set nodes between text and choice
+					// These can be set nodes directly under the text and before the first choice, which get run for all choices
+					RunUntilNextChoiceNode(CurrentSpeakerNode);
+				}
+			}
+			if (CurrentRootChoiceNode)
+			{
+				// Once we've found & run up to the root choice, there can be potentially a tree of mixed choice/select nodes
+				// for supporting conditional choices
+				RecurseAppendChoices(CurrentRootChoiceNode, CurrentChoices, CurrentChoiceTargets);
+			}
+		}
+
+		if (CurrentChoices.Num() == 0)
+		{
+			if (auto Edge = CurrentSpeakerNode->GetEdge(0))
+			{
+				// Simple no-choice progression
+				// May occur if HasChoices was true but in current state no choice was found
+				CurrentChoices.Add(Edge);
+				CurrentChoiceTargets.Add(BaseScript->GetEdgeTarget(CurrentSpeakerNode, 0));
+			}			
+		}
+	}
+}
+
+int FSUDSDialogueRunner::GetNumberOfChoices() const
+{
+	return CurrentChoices.Num();
+}
+
+bool FSUDSDialogueRunner::IsSimpleContinue() const
+{
+	return CurrentChoices.Num() == 1 && CurrentChoices[0]->GetText().IsEmpty();
+}
+
+FText FSUDSDialogueRunner::GetChoiceText(int Index)
+{
+
+	if (CurrentChoices.IsValidIndex(Index))
+	{
+		const auto& Choice = *CurrentChoices[Index];
+		if (Choice.HasParameters())
+		{
+			return ResolveParameterisedText(Choice.GetParameterRefs(BaseScript),
+			                                Choice.GetTextFormat(),
+			                                Choice.GetSourceLineNo());
+		}
+		else
+		{
+			return Choice.GetText();
+		}
+	}
+	else
+	{
+		UE_LOG(LogSUDSDialogue, Error, TEXT("Invalid choice index %d on node %s"), Index, *GetText().ToString());
+	}
+
+	return DummyText;
+}
+
+bool FSUDSDialogueRunner::HasChoiceIndexBeenTakenPreviously(int Index) const
+{
+	if (CurrentChoices.IsValidIndex(Index))
+	{
+		return HasChoiceBeenTakenPreviously(*CurrentChoices[Index]);
+	}
+	return false;
+}
+
+bool FSUDSDialogueRunner::HasChoiceBeenTakenPreviously(const FSUDSScriptEdge& Choice) const
+{
+	return ChoicesTaken.Contains(Choice.GetTextID());
+}
+
+bool FSUDSDialogueRunner::Continue()
+{
+	if (GetNumberOfChoices() == 1)
+	{
+		return Choose(0);		
+	}
+	return !IsEnded();
+}
+
+bool FSUDSDialogueRunner::Choose(int Index)
+{
+	if (CurrentChoices.IsValidIndex(Index))
+	{
+		// ONLY run to choice node if there is one!
+		// This method is called for Continue() too, which has no choice node
+		if (CurrentNodeHasChoices())
+		{
+			const auto& Choice = *CurrentChoices[Index];
+			bool bAlreadyTaken = false;
+			ChoicesTaken.Add(Choice.GetTextID(), &bAlreadyTaken);
+			if (!bAlreadyTaken)
+			{
+				MarkStateDirty();
+			}
+			
+			if (Listener)
+			{
+				Listener->OnDialogueChoice(*this, Index, Choice.GetSourceLineNo());
+			}
+		}
+		if (Listener)
+		{
+			Listener->OnDialogueProceeding(*this);
+		}
+		// Then choose path
+		USUDSScriptNode* TargetNode = CurrentChoiceTargets[Index];
+		BeginStep(TargetNode);
+		RunUntilNextSpeakerNodeOrEnd(TargetNode, true);
+		return !IsEnded();
+	}
+	else
+	{
+		UE_LOG(LogSUDSDialogue, Error, TEXT("Invalid choice index %d on node %s"), Index, *GetText().ToString());
+	}
+	return false;
+}
+
+bool FSUDSDialogueRunner::CurrentNodeHasChoices() const
+{
+	return CurrentRootChoiceNode != nullptr;
+}
+
+bool FSUDSDialogueRunner::IsEnded() const
+{
+	return CurrentSpeakerNode == nullptr;
+}
+
+bool FSUDSDialogueRunner::IsFinalLine() const
+{
+	return CurrentSpeakerNode && CurrentChoices.Num() == 1 && CurrentChoiceTargets[0] == nullptr;
+}
+
+void FSUDSDialogueRunner::End(bool bQuietly)
+{
+	SetCurrentSpeakerNode(nullptr, bQuietly);
+}
+
+int FSUDSDialogueRunner::GetCurrentSourceLine() const
+{
+	return CurrentSourceLineNo;
+}
+
+void FSUDSDialogueRunner::ResetState(bool bResetVariables, bool bResetPosition, bool bResetVisited)
+{
+	if (bResetVariables)
+		InitVariables();
+	if (bResetPosition)
+		SetCurrentSpeakerNode(nullptr, true);
+	if (bResetVisited)
+		ChoicesTaken.Reset();
+	MarkStateDirty();
+}
+
+namespace
+{
+	/// Exact comparison for saving deltas; unlike operator== there's no conversion or tolerance, since the restored
+	/// value has to be identical
+	bool IsIdenticalValue(const FSUDSValue& A, const FSUDSValue& B)
+	{
+		if (A.GetType() != B.GetType())
+		{
+			return false;
+		}
+		switch (A.GetType())
+		{
+		case ESUDSValueType::Text:
+			return A.GetTextValue().IdenticalTo(B.GetTextValue()) ||
+				A.GetTextValue().ToString().Equals(B.GetTextValue().ToString(), ESearchCase::CaseSensitive);
+		case ESUDSValueType::Name:
+		case ESUDSValueType::Variable:
+			return A.GetNameValue().IsEqual(B.GetNameValue(), ENameCase::CaseSensitive);
+		case ESUDSValueType::Float:
+			return A.GetFloatValue() == B.GetFloatValue();
+		case ESUDSValueType::Empty:
+			return true;
+		default:
+			return A.GetIntValueUnchecked() == B.GetIntValueUnchecked();
+		}
+	}
+}
+
+FSUDSDialogueState FSUDSDialogueRunner::GetSavedState(bool bOnlyChangedVariables) const
+{
+	const FString CurrentNodeId = CurrentSpeakerNode
+		                              ? SUDS_GET_TEXT_KEY(CurrentSpeakerNode->GetText())
+		                              : FString();
+
+	TArray<FString> ExportReturnStack;
+	for (auto Node : GosubReturnStack)
+	{
+		if (auto GN = Cast<USUDSScriptNodeGosub>(Node))
+		{
+			ExportReturnStack.Add(GN->GetGosubID());
+		}
+		
+	}
+	TMap<FName, FSUDSValue> Variables = GetVariables();
+	TArray<FName> UnsetVariables;
+	if (bOnlyChangedVariables)
+	{
+		// Leave out anything the header would set to the same value on restore, and note anything it would set
+		// which is now unset
+		for (auto& Pair : BaseScript->GetHeaderDefaultValues())
+		{
+			if (const FSUDSValue* Value = Variables.Find(Pair.Key))
+			{
+				if (IsIdenticalValue(*Value, Pair.Value))
+				{
+					Variables.Remove(Pair.Key);
+				}
+			}
+			else
+			{
+				UnsetVariables.Add(Pair.Key);
+			}
+		}
+	}
+	FSUDSDialogueState State(CurrentNodeId, Variables, ChoicesTaken, ExportReturnStack);
+	if (bOnlyChangedVariables)
+	{
+		State.SetVariablesDelta(UnsetVariables);
+	}
+	if (bRandomStreamSeeded)
+	{
+		State.SetRandomStream(RandomSeed, RandomStream.GetCurrentSeed());
+	}
+	return State;
+		  
+}
+
+void FSUDSDialogueRunner::RestoreSavedState(const FSUDSDialogueState& State)
+{
+	// Don't just empty variables
+	// Re-run init to ensure header state is initialised then merge; important for it script is altered since state saved
+	InitVariables();
+	for (auto& Pair : State.GetVariables())
+	{
+		// Restoring doesn't raise change events, same as before
+		const int32 Slot = FindOrAddVariableSlot(Pair.Key);
+		VariableValues[Slot] = Pair.Value;
+		VariableSetFlags[Slot] = true;
+	}
+	// Delta states don't include variables which the header set to the same value, since InitVariables has
+	// restored those already, but they do record the ones which had been unset since
+	for (auto& Name : State.GetUnsetVariables())
+	{
+		UnSetVariable(Name);
+	}
+	ChoicesTaken.Empty();
+	ChoicesTaken.Append(State.GetChoicesTaken());
+	if (State.HasRandomStream())
+	{
+		// Continue from where the stream was, rather than from the seed
+		RandomSeed = State.GetRandomSeed();
+		RandomStream.Initialize(State.GetRandomStreamState());
+		bRandomStreamSeeded = true;
+	}
+	GosubReturnStack.Empty();
+	for (auto ID : State.GetReturnStack())
+	{
+		USUDSScriptNodeGosub* Node = BaseScript->GetNodeByGosubID(ID);
+		if (!Node)
+		{
+			UE_LOG(LogSUDSDialogue, Error, TEXT("Restore: Can't find Gosub with ID %s, returns referencing it will go to end"), *ID);
+		}
+		// Add anyway, will just go to end
+		GosubReturnStack.Add(Node);
+	}
+	
+	// If not found this will be null
+	if (!State.GetTextNodeID().IsEmpty())
+	{
+		USUDSScriptNodeText* Node = BaseScript->GetNodeByTextID(State.GetTextNodeID());
+		SetCurrentSpeakerNode(Node, true);
+	}
+	else
+	{
+		SetCurrentSpeakerNode(nullptr, true);
+	}
+	// Restored state isn't dirty until it changes again, otherwise every restored dialogue would be saved again
+	ClearStateDirty();
+}
+
+void FSUDSDialogueRunner::SetRandomSeed(int32 Seed)
+{
+	RandomSeed = Seed;
+	RandomStream.Initialize(Seed);
+	bRandomStreamSeeded = true;
+	MarkStateDirty();
+}
+
+int32 FSUDSDialogueRunner::GetRandomSeed()
+{
+	EnsureRandomStreamSeeded();
+	return RandomSeed;
+}
+
+void FSUDSDialogueRunner::TakeDefaultRandomSeed()
+{
+	// Take the seed from SRand so that games which seed that for repeatability still get it, then move SRand on so
+	// that each dialogue gets a different seed. This is the only place the global stream is used, and it's only
+	// called when initialising or starting, never while stepping.
+	// SRand and FRandomStream share the same generator, so just stepping SRand would give the next dialogue a seed
+	// one step along this one's stream, and it would play the same sequence one pick behind. Hash the seed instead
+	// so the next one starts somewhere unrelated (but still repeatable).
+	DefaultRandomSeed = FMath::GetRandSeed();
+	FMath::SRandInit(static_cast<int32>(HashCombine(GetTypeHash(DefaultRandomSeed), 0x9E3779B9)));
+}
+
+void FSUDSDialogueRunner::EnsureRandomStreamSeeded()
+{
+	if (!bRandomStreamSeeded)
+	{
+		SetRandomSeed(DefaultRandomSeed);
+	}
+}
+
+void FSUDSDialogueRunner::Restart(bool bResetState, FName StartLabel, bool bReRunHeader)
+{
+	if (bResetState)
+	{
+		ResetState();
+	}
+	if (!bRandomStreamSeeded)
+	{
+		// Take it again in case SRand has been seeded since we were initialised
+		TakeDefaultRandomSeed();
+	}
+	// Always reset return stack
+	GosubReturnStack.Empty();
+	CurrentSourceLineNo = 0;
+	if (Listener)
+	{
+		Listener->OnDialogueStarting(*this, StartLabel);
+	}
+
+	if (!bResetState && bReRunHeader)
+	{
+		// Run header nodes but don't re-init
+		RunHeader();
+	}
+
+	if (StartLabel != NAME_None)
+	{
+		// Check that StartLabel leads to a text node
+		// Labels can lead to choices or select nodes for looping, but there has to be a text node to start with.
+		auto StartNode = BaseScript->GetNodeByLabel(StartLabel);
+		if (!StartNode)
+		{
+			UE_LOG(LogSUDSDialogue, Error, TEXT("No start label called %s in dialogue %s"), *StartLabel.ToString(), *BaseScript->GetName());
+			StartNode = BaseScript->GetFirstNode();
+		}
+		else if (StartNode->GetNodeType() == ESUDSScriptNodeType::Choice)
+		{
+			UE_LOG(LogSUDSDialogue,
+			       Error,
+			       TEXT("Label %s in dialogue %s cannot be used as a start point, points to a choice."),
+			       *StartLabel.ToString(),
+			       *BaseScript->GetName());
+			StartNode = BaseScript->GetFirstNode();
+		}
+		BeginStep(StartNode);
+		RunUntilNextSpeakerNodeOrEnd(StartNode, true);
+	}
+	else
+	{
+		BeginStep(BaseScript->GetFirstNode());
+		RunUntilNextSpeakerNodeOrEnd(BaseScript->GetFirstNode(), true);
+	}
+	
+}
+
+TSet<FName> FSUDSDialogueRunner::GetParametersInUse()
+{
+	// Build on demand, may not be needed
+	if (!bParamNamesExtracted)
+	{
+		CurrentRequestedParamNames.Reset();
+		if (CurrentSpeakerNode && CurrentSpeakerNode->HasParameters())
+		{
+			CurrentRequestedParamNames.Append(CurrentSpeakerNode->GetParameterNames());
+		}
+		for (const auto Choice : CurrentChoices)
+		{
+			if (Choice->HasParameters())
+			{
+				CurrentRequestedParamNames.Append(Choice->GetParameterNames());
+			}
+		}
+		bParamNamesExtracted = true;
+	}
+
+	return CurrentRequestedParamNames;
+	
+}
+
+void FSUDSDialogueRunner::UnSetVariable(FName Name)
+{
+	const int32 Slot = FindVariableSlot(Name);
+	if (Slot != INDEX_NONE)
+	{
+		if (VariableSetFlags[Slot])
+		{
+			MarkStateDirty();
+		}
+		VariableValues[Slot] = FSUDSValue();
+		VariableSetFlags[Slot] = false;
+	}
+}
+
+int32 FSUDSDialogueRunner::FindVariableSlot(const FName& Name, int32 ScriptSlot) const
+{
+	if (ScriptSlot != INDEX_NONE && ScriptSlot < NumScriptVariableSlots)
+	{
+		return ScriptSlot;
+	}
+	if (BaseScript)
+	{
+		const int32 Slot = BaseScript->GetVariableSlot(Name);
+		if (Slot != INDEX_NONE && Slot < NumScriptVariableSlots)
+		{
+			return Slot;
+		}
+	}
+	if (const int32* pSlot = ExtraVariableSlots.Find(Name))
+	{
+		return *pSlot;
+	}
+	return INDEX_NONE;
+}
+
+int32 FSUDSDialogueRunner::FindOrAddVariableSlot(const FName& Name, int32 ScriptSlot)
+{
+	int32 Slot = FindVariableSlot(Name, ScriptSlot);
+	if (Slot == INDEX_NONE)
+	{
+		// Not referenced by the script, e.g. only used from code
+		Slot = VariableValues.AddDefaulted();
+		VariableSetFlags.Add(false);
+		ExtraVariableNames.Add(Name);
+		ExtraVariableSlots.Add(Name, Slot);
+	}
+	return Slot;
+}
+
+const FName& FSUDSDialogueRunner::GetVariableSlotName(int32 Slot) const
+{
+	if (Slot < NumScriptVariableSlots)
+	{
+		return BaseScript->GetVariableNames()[Slot];
+	}
+	return ExtraVariableNames[Slot - NumScriptVariableSlots];
+}
+
+const FSUDSValue* FSUDSDialogueRunner::FindVariable(const FName& Name, int32 ScriptSlot) const
+{
+	const int32 Slot = FindVariableSlot(Name, ScriptSlot);
+	if (Slot != INDEX_NONE && VariableSetFlags[Slot])
+	{
+		return &VariableValues[Slot];
+	}
+	return nullptr;
+}
+
+void FSUDSDialogueRunner::SetVariableImpl(FName Name, const FSUDSValue& Value, bool bFromScript, int LineNo, int32 ScriptSlot)
+{
+	const int32 Slot = FindOrAddVariableSlot(Name, ScriptSlot);
+	if (!VariableSetFlags[Slot] ||
+		(VariableValues[Slot] != Value).GetBooleanValue())
+	{
+		VariableValues[Slot] = Value;
+		VariableSetFlags[Slot] = true;
+		MarkStateDirty();
+		RaiseVariableChange(Name, Value, bFromScript, LineNo);
+	}
+}
+
+void FSUDSDialogueRunner::MarkStateDirty()
+{
+	if (!bStateDirty)
+	{
+		bStateDirty = true;
+		if (Listener)
+		{
+			Listener->OnDialogueStateDirty(*this);
+		}
+	}
+}
+
+FSUDSValue FSUDSDialogueRunner::GetVariable(FName Name) const
+{
+	if (const auto Arg = FindVariable(Name))
+	{
+		return *Arg;
+	}
+	return FSUDSValue();
+}
+
+bool FSUDSDialogueRunner::IsVariableSet(FName Name) const
+{
+	return FindVariable(Name) != nullptr;
+}
+
+TMap<FName, FSUDSValue> FSUDSDialogueRunner::GetVariables() const
+{
+	TMap<FName, FSUDSValue> Variables;
+	for (TConstSetBitIterator<> It(VariableSetFlags); It; ++It)
+	{
+		Variables.Add(GetVariableSlotName(It.GetIndex()), VariableValues[It.GetIndex()]);
+	}
+	return Variables;
+}
@@ -0,0 +1,435 @@
+﻿// Copyright Steve Streeting 2022
+// Released under the MIT license https://opensource.org/license/MIT/
+#include "SUDSDialogueState.h"
+
+#include "SUDSScript.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace SUDSCompactState
+{
+	/// Version of the compact format, written as the first byte
+	enum EVersion : uint8
+	{
+		Initial = 1,
+		/// Variables can be a delta from header defaults, with a list of unset variables
+		AddedVariableDeltas = 2,
+
+		VersionPlusOne,
+		Latest = VersionPlusOne - 1
+	};
+
+	/// Value tags; booleans are folded into the tag so they take a single byte
+	enum ETag : uint8
+	{
+		Empty = 0,
+		False,
+		True,
+		Int,
+		Float,
+		Gender,
+		Name,
+		Variable,
+		Text
+	};
+
+	void WriteString(FArchive& Ar, const FString& Str)
+	{
+		FTCHARToUTF8 Conv(*Str);
+		uint32 Len = Conv.Length();
+		Ar.SerializeIntPacked(Len);
+		Ar.Serialize(const_cast<ANSICHAR*>(Conv.Get()), Len);
+	}
+
+	FString ReadString(FArchive& Ar)
+	{
+		uint32 Len = 0;
+		Ar.SerializeIntPacked(Len);
+		if (Ar.IsError() || Len > (uint32)(Ar.TotalSize() - Ar.Tell()))
+		{
+			Ar.SetError();
+			return FString();
+		}
+		TArray<ANSICHAR> Buf;
+		Buf.SetNumUninitialized(Len);
+		Ar.Serialize(Buf.GetData(), Len);
+		FUTF8ToTCHAR Conv(Buf.GetData(), Len);
+		return FString(Conv.Length(), Conv.Get());
+	}
+
+	void WriteInt(FArchive& Ar, int32 Value)
+	{
+		// Zigzag so that small negative numbers stay small
+		uint32 Packed = (static_cast<uint32>(Value) << 1) ^ static_cast<uint32>(Value >> 31);
+		Ar.SerializeIntPacked(Packed);
+	}
+
+	int32 ReadInt(FArchive& Ar)
+	{
+		uint32 Packed = 0;
+		Ar.SerializeIntPacked(Packed);
+		return static_cast<int32>(Packed >> 1) ^ -static_cast<int32>(Packed & 1);
+	}
+
+	void WriteIndex(FArchive& Ar, int32 Index)
+	{
+		uint32 Packed = Index;
+		Ar.SerializeIntPacked(Packed);
+	}
+
+	int32 ReadIndex(FArchive& Ar)
+	{
+		uint32 Packed = 0;
+		Ar.SerializeIntPacked(Packed);
+		return static_cast<int32>(Packed);
+	}
+
+	/// Read the number of items which follow, each of which takes at least one byte. Flags an error on the archive if
+	/// the count is negative or there isn't enough data left, so corrupt data can't make us allocate huge arrays
+	int32 ReadCount(FArchive& Ar)
+	{
+		const int32 Count = ReadIndex(Ar);
+		if (Count < 0 || Count > Ar.TotalSize() - Ar.Tell())
+		{
+			Ar.SetError();
+			return 0;
+		}
+		return Count;
+	}
+
+	/// Strings used by one saved state, each written once
+	struct FStringTable
+	{
+		TArray<FString> Strings;
+		TMap<FString, int32> Index;
+
+		int32 Intern(const FString& Str)
+		{
+			if (const int32* pIdx = Index.Find(Str))
+			{
+				return *pIdx;
+			}
+			const int32 Idx = Strings.Add(Str);
+			Index.Add(Str, Idx);
+			return Idx;
+		}
+	};
+}
+
+void FSUDSDialogueState::SaveCompact(const USUDSScript* Script, TArray<uint8>& OutData) const
+{
+	using namespace SUDSCompactState;
+
+	// Write the body first so we know which strings it needs, then the string table ahead of it
+	FStringTable Strings;
+	TArray<uint8> Body;
+	FMemoryWriter BodyAr(Body);
+
+	WriteIndex(BodyAr, Strings.Intern(TextNodeID));
+
+	WriteIndex(BodyAr, Variables.Num());
+	for (auto& Pair : Variables)
+	{
+		WriteIndex(BodyAr, Strings.Intern(Pair.Key.ToString()));
+		const FSUDSValue& Value = Pair.Value;
+		uint8 Tag;
+		switch (Value.GetType())
+		{
+		case ESUDSValueType::Int:
+			Tag = Int;
+			BodyAr << Tag;
+			WriteInt(BodyAr, Value.GetIntValue());
+			break;
+		case ESUDSValueType::Float:
+			{
+				Tag = Float;
+				float F = Value.GetFloatValue();
+				BodyAr << Tag << F;
+				break;
+			}
+		case ESUDSValueType::Boolean:
+			Tag = Value.GetBooleanValue() ? True : False;
+			BodyAr << Tag;
+			break;
+		case ESUDSValueType::Gender:
+			{
+				Tag = Gender;
+				uint8 G = static_cast<uint8>(Value.GetGenderValue());
+				BodyAr << Tag << G;
+				break;
+			}
+		case ESUDSValueType::Name:
+		case ESUDSValueType::Variable:
+			Tag = Value.GetType() == ESUDSValueType::Name ? Name : Variable;
+			BodyAr << Tag;
+			WriteIndex(BodyAr, Strings.Intern(Value.GetNameValue().ToString()));
+			break;
+		case ESUDSValueType::Text:
+			{
+				Tag = Text;
+				FText T = Value.GetTextValue();
+				BodyAr << Tag << T;
+				break;
+			}
+		default:
+		case ESUDSValueType::Empty:
+			Tag = Empty;
+			BodyAr << Tag;
+			break;
+		}
+	}
+
+	uint8 bDelta = bVariablesAreDelta ? 1 : 0;
+	BodyAr << bDelta;
+	if (bVariablesAreDelta)
+	{
+		WriteIndex(BodyAr, UnsetVariables.Num());
+		for (auto& VarName : UnsetVariables)
+		{
+			WriteIndex(BodyAr, Strings.Intern(VarName.ToString()));
+		}
+	}
+
+	// Choices as a bitset over the script's ordinals; any we can't find an ordinal for are kept as IDs
+	const int32 NumOrdinals = Script ? Script->GetNumChoiceOrdinals() : 0;
+	TArray<uint8> ChoiceBits;
+	ChoiceBits.SetNumZeroed((NumOrdinals + 7) / 8);
+	TArray<int32> UnknownChoices;
+	for (auto& ID : ChoicesTaken)
+	{
+		const int32 Ordinal = Script ? Script->GetChoiceOrdinal(ID) : INDEX_NONE;
+		if (Ordinal != INDEX_NONE)
+		{
+			ChoiceBits[Ordinal / 8] |= 1 << (Ordinal % 8);
+		}
+		else
+		{
+			UnknownChoices.Add(Strings.Intern(ID));
+		}
+	}
+	WriteIndex(BodyAr, NumOrdinals);
+	BodyAr.Serialize(ChoiceBits.GetData(), ChoiceBits.Num());
+	WriteIndex(BodyAr, UnknownChoices.Num());
+	for (int32 Idx : UnknownChoices)
+	{
+		WriteIndex(BodyAr, Idx);
+	}
+
+	WriteIndex(BodyAr, ReturnStack.Num());
+	for (auto& ID : ReturnStack)
+	{
+		WriteIndex(BodyAr, Strings.Intern(ID));
+	}
+
+	uint8 bRandom = bHasRandomStream ? 1 : 0;
+	BodyAr << bRandom;
+	if (bHasRandomStream)
+	{
+		int32 Seed = RandomSeed;
+		int32 StreamState = RandomStreamState;
+		BodyAr << Seed << StreamState;
+	}
+
+	// Payload is the string table followed by the body
+	TArray<uint8> Payload;
+	FMemoryWriter PayloadAr(Payload);
+	WriteIndex(PayloadAr, Strings.Strings.Num());
+	for (auto& Str : Strings.Strings)
+	{
+		WriteString(PayloadAr, Str);
+	}
+	PayloadAr.Serialize(Body.GetData(), Body.Num());
+
+	// Header is version, payload size & checksum, so bad data is rejected before we try to read it
+	FMemoryWriter Ar(OutData);
+	Ar.Seek(OutData.Num());
+	uint8 Version = Latest;
+	Ar << Version;
+	uint32 PayloadSize = Payload.Num();
+	Ar << PayloadSize;
+	uint32 Crc = FCrc::MemCrc32(Payload.GetData(), Payload.Num());
+	Ar << Crc;
+	Ar.Serialize(Payload.GetData(), Payload.Num());
+}
+
+bool FSUDSDialogueState::LoadCompact(const USUDSScript* Script, const TArray<uint8>& Data)
+{
+	using namespace SUDSCompactState;
+
+	if (Data.Num() < 1 || Data[0] == 0 || Data[0] > Latest)
+	{
+		UE_LOG(LogSUDS, Error, TEXT("Cannot load compact dialogue state, unknown version"));
+		return false;
+	}
+	// Check the header by hand, since the data may be truncated
+	constexpr int32 HeaderSize = 1 + 4 + 4;
+	uint32 PayloadSize = 0;
+	if (Data.Num() >= HeaderSize)
+	{
+		FMemory::Memcpy(&PayloadSize, &Data[1], 4);
+	}
+	if (Data.Num() < HeaderSize || PayloadSize != (uint32)(Data.Num() - HeaderSize))
+	{
+		UE_LOG(LogSUDS, Error, TEXT("Compact dialogue state is corrupt"));
+		return false;
+	}
+	uint32 Crc;
+	FMemory::Memcpy(&Crc, &Data[5], 4);
+	if (Crc != FCrc::MemCrc32(Data.GetData() + HeaderSize, PayloadSize))
+	{
+		UE_LOG(LogSUDS, Error, TEXT("Compact dialogue state is corrupt"));
+		return false;
+	}
+
+	FMemoryReader Ar(Data);
+	Ar.Seek(HeaderSize);
+
+	TArray<FString> Strings;
+	const int32 NumStrings = ReadCount(Ar);
+	if (Ar.IsError())
+	{
+		UE_LOG(LogSUDS, Error, TEXT("Compact dialogue state is corrupt"));
+		return false;
+	}
+	Strings.Reserve(NumStrings);
+	for (int32 i = 0; i < NumStrings && !Ar.IsError(); ++i)
+	{
+		Strings.Add(ReadString(Ar));
+	}
+	auto ReadStringRef = [&Ar, &Strings]() -> const FString&
+	{
+		const int32 Idx = ReadIndex(Ar);
+		if (!Strings.IsValidIndex(Idx))
+		{
+			Ar.SetError();
+			static const FString Dummy;
+			return Dummy;
+		}
+		return Strings[Idx];
+	};
+
+	*this = FSUDSDialogueState();
+	TextNodeID = ReadStringRef();
+
+	const int32 NumVars = ReadCount(Ar);
+	for (int32 i = 0; i < NumVars && !Ar.IsError(); ++i)
+	{
+		const FName VarName(ReadStringRef());
+		uint8 Tag = Empty;
+		Ar << Tag;
+		FSUDSValue Value;
+		switch (Tag)
+		{
+		case Empty:
+			break;
+		case False:
+		case True:
+			Value = FSUDSValue(Tag == True);
+			break;
+		case Int:
+			Value = FSUDSValue(ReadInt(Ar));
+			break;
+		case Float:
+			{
+				float F = 0;
+				Ar << F;
+				Value = FSUDSValue(F);
+				break;
+			}
+		case Gender:
+			{
+				uint8 G = 0;
+				Ar << G;
+				Value = FSUDSValue(static_cast<ETextGender>(G));
+				break;
+			}
+		case Name:
+		case Variable:
+			Value = FSUDSValue(FName(ReadStringRef()), Tag == Variable);
+			break;
+		case Text:
+			{
+				FText T;
+				Ar << T;
+				Value = FSUDSValue(MoveTemp(T));
+				break;
+			}
+		default:
+			Ar.SetError();
+			break;
+		}
+		Variables.Add(VarName, Value);
+	}
+
+	if (Data[0] >= AddedVariableDeltas)
+	{
+		uint8 bDelta = 0;
+		Ar << bDelta;
+		if (bDelta)
+		{
+			TArray<FName> Unset;
+			const int32 NumUnset = ReadCount(Ar);
+			for (int32 i = 0; i < NumUnset && !Ar.IsError(); ++i)
+			{
+				Unset.Add(FName(ReadStringRef()));
+			}
+			SetVariablesDelta(Unset);
+		}
+	}
+
+	// One bit per ordinal, so the usual count check doesn't apply
+	const int32 NumOrdinals = ReadIndex(Ar);
+	const int64 NumBitBytes = ((int64)NumOrdinals + 7) / 8;
+	if (Ar.IsError() || NumOrdinals < 0 || NumBitBytes > Ar.TotalSize() - Ar.Tell())
+	{
+		UE_LOG(LogSUDS, Error, TEXT("Compact dialogue state is corrupt"));
+		*this = FSUDSDialogueState();
+		return false;
+	}
+	if (Script && NumOrdinals > Script->GetNumChoiceOrdinals())
+	{
+		UE_LOG(LogSUDS, Warning, TEXT("Compact dialogue state has more choices than script %s, later choices will be ignored"), *Script->GetName());
+	}
+	TArray<uint8> ChoiceBits;
+	ChoiceBits.SetNumUninitialized(static_cast<int32>(NumBitBytes));
+	Ar.Serialize(ChoiceBits.GetData(), NumBitBytes);
+	for (int32 Ordinal = 0; Ordinal < NumOrdinals; ++Ordinal)
+	{
+		if (ChoiceBits[Ordinal / 8] & (1 << (Ordinal % 8)))
+		{
+			if (const FString* ID = Script ? Script->GetChoiceIDByOrdinal(Ordinal) : nullptr)
+			{
+				ChoicesTaken.Add(*ID);
+			}
+		}
+	}
+	const int32 NumUnknownChoices = ReadCount(Ar);
+	for (int32 i = 0; i < NumUnknownChoices && !Ar.IsError(); ++i)
+	{
+		ChoicesTaken.Add(ReadStringRef());
+	}
+
+	const int32 NumReturns = ReadCount(Ar);
+	for (int32 i = 0; i < NumReturns && !Ar.IsError(); ++i)
+	{
+		ReturnStack.Add(ReadStringRef());
+	}
+
+	uint8 bRandom = 0;
+	Ar << bRandom;
+	if (bRandom)
+	{
+		int32 Seed = 0;
+		int32 StreamState = 0;
+		Ar << Seed << StreamState;
+		SetRandomStream(Seed, StreamState);
+	}
+
+	if (Ar.IsError())
+	{
+		UE_LOG(LogSUDS, Error, TEXT("Compact dialogue state is corrupt"));
+		*this = FSUDSDialogueState();
+		return false;
+	}
+	return true;
+}
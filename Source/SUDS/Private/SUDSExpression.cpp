@@ -4,7 +4,42 @@
 
 #include "SUDSLibrary.h"
 #include "Misc/DefaultValueHelper.h"
-#include "Internationalization/Regex.h"
+
+FSUDSVariableRef::FSUDSVariableRef(const FString& InName)
+	: Name(InName),
+	  ArgumentName(InName)
+{
+	if (!USUDSLibrary::IsDialogueVariableGlobal(Name, GlobalName))
+	{
+		GlobalName = NAME_None;
+	}
+}
+
+namespace
+{
+	/// Find the column of the item which makes a queue invalid, the same way Validate() checks it
+	int32 FindBadExpressionColumn(const TArray<FSUDSExpressionItem>& Queue, const TArray<int32>& Columns)
+	{
+		int32 Depth = 0;
+		for (int i = 0; i < Queue.Num(); ++i)
+		{
+			const auto& Item = Queue[i];
+			if (Item.IsOperator())
+			{
+				const int32 NumArgs = Item.IsBinaryOperator() ? 2 : 1;
+				if (Depth < NumArgs)
+					return Columns[i];
+				Depth -= NumArgs - 1;
+			}
+			else
+			{
+				++Depth;
+			}
+		}
+		// Too many operands, report the last one
+		return Depth > 1 && Columns.Num() > 0 ? Columns.Last() : 0;
+	}
+}
 
 bool FSUDSExpression::ParseFromString(const FString& Expression, FString* OutParseError)
 {
@@ -12,6 +47,8 @@ bool FSUDSExpression::ParseFromString(const FString& Expression, FString* OutPar
 	bIsValid = false;
 	Queue.Empty();
 	VariableNames.Empty();
+	VariableSlots.Empty();
+	VariableTypes.Empty();
 	SourceString = Expression;
 	
 	// Shunting-yard algorithm
@@ -20,24 +57,19 @@ bool FSUDSExpression::ParseFromString(const FString& Expression, FString* OutPar
 	// expressed in Reverse Polish Notation, which can be easily executed later
 	// Variables are not resolved at this point, only at execution time.
 	
-	// Split into individual tokens; sections of the regex are:
-	// - {Variable}
-	// - Literal numbers (with or without decimal point, with or without preceding negation)
-	// - Arithmetic operators & parentheses
-	// - Boolean operators & comparisons
-	// - Predefined constants (Masculine, feminine, true, false etc)
-	// - Quoted strings "string"
-	//   - Including ignoring escaped double quotes
-	// - Quoted names `name`
-	const FRegexPattern Pattern(TEXT("(\\{[\\w\\.]+\\}|-?\\d+(?:\\.\\d*)?|[-+*\\/%\\(\\)]|and|&&|\\|\\||or|not|\\<\\>|!=|!|\\<=?|\\>=?|==?|[mM]asculine|[fF]eminine|[nN]euter|[tT]rue|[fF]alse|\"(?:[^\"\\\\]|\\\\.)*\"|`([^`]*)`)"));
-	FRegexMatcher Regex(Pattern, Expression);
-	// Stacks that we use to construct
-	TArray<ESUDSExpressionItemType> OperatorStack;
+	// Split into individual tokens with NextToken; see there for the kinds of token
+	const FStringView ExpressionView(Expression);
+	// Stacks that we use to construct, with the 1-based column of each item for errors
+	TArray<TPair<ESUDSExpressionItemType, int32>> OperatorStack;
+	TArray<int32> QueueColumns;
 	bool bParsedSomething = false;
 	bool bErrors = false;
-	while (Regex.FindNext())
+	int32 Pos = 0;
+	FSUDSExpressionToken Token;
+	while (NextToken(ExpressionView, Pos, Token))
 	{
-		FString Str = Regex.GetCaptureGroup(1);
+		const FStringView Str = ExpressionView.Mid(Token.Start, Token.Len);
+		const int32 Column = Token.Start + 1;
 		ESUDSExpressionItemType OpType = ParseOperator(Str);
 		if (OpType != ESUDSExpressionItemType::Null)
 		{
@@ -45,26 +77,28 @@ bool FSUDSExpression::ParseFromString(const FString& Expression, FString* OutPar
 
 			if (OpType == ESUDSExpressionItemType::LParens)
 			{
-				OperatorStack.Push(OpType);
+				OperatorStack.Push(MakeTuple(OpType, Column));
 			}
 			else if (OpType == ESUDSExpressionItemType::RParens)
 			{
 				if (OperatorStack.IsEmpty())
 				{
 					if (OutParseError)
-						*OutParseError = TEXT("Mismatched parentheses");
+						*OutParseError = FString::Printf(TEXT("Mismatched parentheses at column %d"), Column);
 					bErrors = true;
 					break;
 				}
 					
-				while (OperatorStack.Num() > 0 && OperatorStack.Top() != ESUDSExpressionItemType::LParens)
+				while (OperatorStack.Num() > 0 && OperatorStack.Top().Key != ESUDSExpressionItemType::LParens)
 				{
-					Queue.Add(FSUDSExpressionItem(OperatorStack.Pop()));
+					const auto Op = OperatorStack.Pop();
+					Queue.Add(FSUDSExpressionItem(Op.Key));
+					QueueColumns.Add(Op.Value);
 				}
 				if (OperatorStack.IsEmpty())
 				{
 					if (OutParseError)
-						*OutParseError = TEXT("Mismatched parentheses");
+						*OutParseError = FString::Printf(TEXT("Mismatched parentheses at column %d"), Column);
 					bErrors = true;
 					break;
 				}
@@ -83,13 +117,15 @@ bool FSUDSExpression::ParseFromString(const FString& Expression, FString* OutPar
 				// Apply anything on the operator stack which is higher / equal precedence
 				while (OperatorStack.Num() > 0 &&
 					// higher precedence applied now, and equal precedence if left-associative
-					(static_cast<int>(OperatorStack.Top()) < static_cast<int>(OpType) ||
-					(static_cast<int>(OperatorStack.Top()) <= static_cast<int>(OpType)	&& bLeftAssociative)))
+					(static_cast<int>(OperatorStack.Top().Key) < static_cast<int>(OpType) ||
+					(static_cast<int>(OperatorStack.Top().Key) <= static_cast<int>(OpType)	&& bLeftAssociative)))
 				{
-					Queue.Add(FSUDSExpressionItem(OperatorStack.Pop()));
+					const auto Op = OperatorStack.Pop();
+					Queue.Add(FSUDSExpressionItem(Op.Key));
+					QueueColumns.Add(Op.Value);
 				}
 
-				OperatorStack.Push(OpType);
+				OperatorStack.Push(MakeTuple(OpType, Column));
 			}
 		}
 		else
@@ -100,11 +136,12 @@ bool FSUDSExpression::ParseFromString(const FString& Expression, FString* OutPar
 			{
 				bParsedSomething = true;
 				Queue.Add(FSUDSExpressionItem(Operand));
+				QueueColumns.Add(Column);
 			}
 			else
 			{
 				if (OutParseError)
-					*OutParseError = FString::Printf(TEXT("Unrecognised token %s"), *Str);
+					*OutParseError = FString::Printf(TEXT("Unrecognised token %s at column %d"), *FString(Str), Column);
 				bErrors = true;
 			}
 		}
@@ -112,16 +149,18 @@ bool FSUDSExpression::ParseFromString(const FString& Expression, FString* OutPar
 	// finish up
 	while (OperatorStack.Num() > 0)
 	{
-		if (OperatorStack.Top() == ESUDSExpressionItemType::LParens ||
-			OperatorStack.Top() == ESUDSExpressionItemType::RParens)
+		if (OperatorStack.Top().Key == ESUDSExpressionItemType::LParens ||
+			OperatorStack.Top().Key == ESUDSExpressionItemType::RParens)
 		{
 			bErrors = true;
 			if (OutParseError)
-				*OutParseError = TEXT("Mismatched parentheses");
+				*OutParseError = FString::Printf(TEXT("Mismatched parentheses at column %d"), OperatorStack.Top().Value);
 			break;
 		}
 
-		Queue.Add(FSUDSExpressionItem(OperatorStack.Pop()));
+		const auto Op = OperatorStack.Pop();
+		Queue.Add(FSUDSExpressionItem(Op.Key));
+		QueueColumns.Add(Op.Value);
 	}
 
 	if (!Validate() ||
@@ -129,11 +168,21 @@ bool FSUDSExpression::ParseFromString(const FString& Expression, FString* OutPar
 	{
 		bErrors = true;
 		if (OutParseError)
-			*OutParseError = FString::Printf(TEXT("Bad expression '%s'"), *Expression);
+		{
+			const int32 BadColumn = FindBadExpressionColumn(Queue, QueueColumns);
+			*OutParseError = BadColumn > 0
+				                 ? FString::Printf(TEXT("Bad expression '%s' at column %d"), *Expression, BadColumn)
+				                 : FString::Printf(TEXT("Bad expression '%s'"), *Expression);
+		}
 	}
 
 	bIsValid = bParsedSomething && !bErrors;
 
+	if (bIsValid)
+	{
+		Optimise();
+	}
+
 	// Build list of variables
 	if (bIsValid)
 	{
@@ -147,6 +196,8 @@ bool FSUDSExpression::ParseFromString(const FString& Expression, FString* OutPar
 
 	}
 
+	Compile();
+
 	return bIsValid;
 }
 
@@ -155,7 +206,610 @@ void FSUDSExpression::Reset()
 	bIsValid = true;
 	Queue.Empty();
 	VariableNames.Empty();
+	VariableSlots.Empty();
+	VariableTypes.Empty();
 	SourceString = "";
+	Ops.Empty();
+	TypedOps.Empty();
+	VariableGlobalNames.Empty();
+	MaxStackDepth = 0;
+}
+
+namespace
+{
+	/// What we know about the result of a sub-expression at import time
+	enum class ESUDSExpressionResultKind : uint8
+	{
+		/// Single literal operand
+		Literal,
+		/// Single variable operand, could be any type or unset
+		Variable,
+		/// Result of a comparison / boolean operator, always a boolean
+		Boolean,
+		/// Result of an arithmetic operator, always an int or float
+		Numeric
+	};
+
+	/// A sub-expression in RPN order, used when optimising
+	struct FSUDSExpressionFragment
+	{
+		TArray<FSUDSExpressionItem> Items;
+		ESUDSExpressionResultKind Kind;
+
+		const FSUDSValue& GetLiteral() const { return Items[0].GetOperandValue(); }
+		bool IsLiteral() const { return Kind == ESUDSExpressionResultKind::Literal; }
+		bool IsBooleanLiteral() const { return IsLiteral() && GetLiteral().GetType() == ESUDSValueType::Boolean; }
+		bool IsIntLiteral(int32 Val) const
+		{
+			return IsLiteral() && GetLiteral().GetType() == ESUDSValueType::Int && GetLiteral().GetIntValue() == Val;
+		}
+	};
+
+	ESUDSExpressionResultKind GetOperatorResultKind(ESUDSExpressionItemType Op)
+	{
+		switch (Op)
+		{
+		case ESUDSExpressionItemType::Multiply:
+		case ESUDSExpressionItemType::Divide:
+		case ESUDSExpressionItemType::Modulo:
+		case ESUDSExpressionItemType::Add:
+		case ESUDSExpressionItemType::Subtract:
+			return ESUDSExpressionResultKind::Numeric;
+		default:
+			return ESUDSExpressionResultKind::Boolean;
+		}
+	}
+
+	/// Whether an operator can be applied to 2 literals at import time with the same result as at runtime
+	bool CanFoldLiterals(ESUDSExpressionItemType Op, const FSUDSValue& Arg1, const FSUDSValue& Arg2)
+	{
+		switch (Op)
+		{
+		case ESUDSExpressionItemType::Not:
+			return Arg1.GetType() == ESUDSValueType::Boolean;
+		case ESUDSExpressionItemType::Divide:
+		case ESUDSExpressionItemType::Modulo:
+			// Leave divide by zero to runtime
+			return Arg1.IsNumeric() && Arg2.IsNumeric() && Arg2.GetFloatValue() != 0.0f;
+		case ESUDSExpressionItemType::Multiply:
+		case ESUDSExpressionItemType::Add:
+		case ESUDSExpressionItemType::Subtract:
+		case ESUDSExpressionItemType::Less:
+		case ESUDSExpressionItemType::LessEqual:
+		case ESUDSExpressionItemType::Greater:
+		case ESUDSExpressionItemType::GreaterEqual:
+			return Arg1.IsNumeric() && Arg2.IsNumeric();
+		case ESUDSExpressionItemType::Equal:
+		case ESUDSExpressionItemType::NotEqual:
+			// Text comparisons depend on culture & localisation so always do those at runtime
+			return (Arg1.IsNumeric() && Arg2.IsNumeric()) ||
+				(Arg1.GetType() == Arg2.GetType() &&
+					(Arg1.GetType() == ESUDSValueType::Boolean ||
+						Arg1.GetType() == ESUDSValueType::Gender ||
+						Arg1.GetType() == ESUDSValueType::Name));
+		case ESUDSExpressionItemType::And:
+		case ESUDSExpressionItemType::Or:
+			return Arg1.GetType() == ESUDSValueType::Boolean && Arg2.GetType() == ESUDSValueType::Boolean;
+		default:
+			return false;
+		}
+	}
+	
+}
+
+void FSUDSExpression::Optimise()
+{
+	// Rebuild the queue one sub-expression at a time, folding operators on literals into a single literal, and
+	// dropping operations which can't change the result. Identities are only applied when we know the type of the
+	// other side isn't changed by them (e.g. x + 0 is not x if x is an unset variable, since that produces 0.0)
+	TArray<FSUDSExpressionFragment> Fragments;
+	for (const auto& Item : Queue)
+	{
+		if (Item.IsOperand())
+		{
+			auto& Frag = Fragments.AddDefaulted_GetRef();
+			Frag.Items.Add(Item);
+			Frag.Kind = Item.GetOperandValue().IsVariable()
+				            ? ESUDSExpressionResultKind::Variable
+				            : ESUDSExpressionResultKind::Literal;
+			continue;
+		}
+
+		const ESUDSExpressionItemType Op = Item.GetType();
+		if (!Item.IsBinaryOperator())
+		{
+			auto& Arg = Fragments.Last();
+			if (Arg.IsLiteral() && CanFoldLiterals(Op, Arg.GetLiteral(), FSUDSValue()))
+			{
+				Arg.Items[0].SetOperandValue(EvaluateOperator(ESUDSExpressionOpCode::Not, Arg.GetLiteral(), FSUDSValue()));
+			}
+			else
+			{
+				Arg.Items.Add(Item);
+				Arg.Kind = ESUDSExpressionResultKind::Boolean;
+			}
+			continue;
+		}
+
+		FSUDSExpressionFragment Rhs = Fragments.Pop();
+		auto& Lhs = Fragments.Last();
+
+		if (Lhs.IsLiteral() && Rhs.IsLiteral())
+		{
+			if (CanFoldLiterals(Op, Lhs.GetLiteral(), Rhs.GetLiteral()))
+			{
+				const FSUDSValue& A = Lhs.GetLiteral();
+				const FSUDSValue& B = Rhs.GetLiteral();
+				Lhs.Items[0].SetOperandValue(Op == ESUDSExpressionItemType::And
+					                             ? A && B
+					                             : Op == ESUDSExpressionItemType::Or
+					                             ? A || B
+					                             : EvaluateOperator(GetBinaryOpCode(Op), A, B));
+				continue;
+			}
+		}
+		else if (Op == ESUDSExpressionItemType::And || Op == ESUDSExpressionItemType::Or)
+		{
+			// The value which decides the result on its own
+			const bool bDecider = Op == ESUDSExpressionItemType::Or;
+			if (Lhs.IsBooleanLiteral())
+			{
+				if (Lhs.GetLiteral().GetBooleanValue() == bDecider)
+				{
+					// false and x, true or x: rhs never evaluated anyway
+					continue;
+				}
+				if (Rhs.Kind == ESUDSExpressionResultKind::Boolean)
+				{
+					// true and x, false or x
+					Lhs = MoveTemp(Rhs);
+					continue;
+				}
+			}
+			else if (Rhs.IsBooleanLiteral())
+			{
+				if (Rhs.GetLiteral().GetBooleanValue() == bDecider)
+				{
+					// x and false, x or true
+					Lhs = MoveTemp(Rhs);
+					continue;
+				}
+				if (Lhs.Kind == ESUDSExpressionResultKind::Boolean)
+				{
+					// x and true, x or false
+					continue;
+				}
+			}
+		}
+		else if (Lhs.Kind == ESUDSExpressionResultKind::Numeric || Rhs.Kind == ESUDSExpressionResultKind::Numeric)
+		{
+			// Arithmetic identities, only with int literals so that the type of the other side is kept
+			if ((Lhs.Kind == ESUDSExpressionResultKind::Numeric &&
+					((Rhs.IsIntLiteral(0) && (Op == ESUDSExpressionItemType::Add || Op == ESUDSExpressionItemType::Subtract)) ||
+					(Rhs.IsIntLiteral(1) && (Op == ESUDSExpressionItemType::Multiply || Op == ESUDSExpressionItemType::Divide)))))
+			{
+				// x + 0, x - 0, x * 1, x / 1
+				continue;
+			}
+			if (Rhs.Kind == ESUDSExpressionResultKind::Numeric &&
+				((Lhs.IsIntLiteral(0) && Op == ESUDSExpressionItemType::Add) ||
+				(Lhs.IsIntLiteral(1) && Op == ESUDSExpressionItemType::Multiply)))
+			{
+				// 0 + x, 1 * x
+				Lhs = MoveTemp(Rhs);
+				continue;
+			}
+		}
+
+		// Nothing to optimise
+		Lhs.Items.Append(MoveTemp(Rhs.Items));
+		Lhs.Items.Add(Item);
+		Lhs.Kind = GetOperatorResultKind(Op);
+	}
+
+	check(Fragments.Num() == 1);
+	Queue = MoveTemp(Fragments[0].Items);
+}
+
+void FSUDSExpression::Compile()
+{
+	Ops.Empty();
+	TypedOps.Empty();
+	VariableGlobalNames.Empty();
+	if (!bIsValid || !Validate())
+		return;
+
+	// Resolve scopes now rather than every time a variable is read
+	VariableGlobalNames.SetNum(VariableNames.Num());
+	for (int i = 0; i < VariableNames.Num(); ++i)
+	{
+		FName GlobalName;
+		if (USUDSLibrary::IsDialogueVariableGlobal(VariableNames[i], GlobalName))
+		{
+			VariableGlobalNames[i] = GlobalName;
+		}
+	}
+
+	checkf(Queue.Num() <= MAX_uint16, TEXT("Expression '%s' is too long to compile"), *SourceString);
+
+	// Build instruction fragments for each sub-expression so that "and" / "or" can be turned into conditional jumps
+	// over their right-hand side, instead of always evaluating both sides
+	TArray<TArray<FSUDSExpressionOp>> Fragments;
+	for (int i = 0; i < Queue.Num(); ++i)
+	{
+		const auto& Item = Queue[i];
+		if (Item.IsOperand())
+		{
+			const auto& Operand = Item.GetOperandValue();
+			auto& Frag = Fragments.AddDefaulted_GetRef();
+			if (Operand.IsVariable())
+			{
+				const int32 VarIndex = VariableNames.IndexOfByKey(Operand.GetVariableNameValue());
+				Frag.Add(FSUDSExpressionOp(ESUDSExpressionOpCode::PushVariable,
+				                           static_cast<uint16>(i),
+				                           VarIndex != INDEX_NONE && VarIndex < FSUDSExpressionOp::NoVariableIndex
+					                           ? static_cast<uint8>(VarIndex)
+					                           : FSUDSExpressionOp::NoVariableIndex));
+			}
+			else
+			{
+				Frag.Add(FSUDSExpressionOp(ESUDSExpressionOpCode::PushLiteral, static_cast<uint16>(i)));
+			}
+			continue;
+		}
+
+		if (!Item.IsBinaryOperator())
+		{
+			// Not, just applies to the last fragment
+			Fragments.Last().Add(FSUDSExpressionOp(ESUDSExpressionOpCode::Not));
+			continue;
+		}
+
+		TArray<FSUDSExpressionOp> Rhs = Fragments.Pop();
+		auto& Lhs = Fragments.Last();
+		switch (Item.GetType())
+		{
+		case ESUDSExpressionItemType::And:
+		case ESUDSExpressionItemType::Or:
+			// Lhs, jump past Rhs if that decides it, Rhs, convert Rhs to boolean 
+			Lhs.Add(FSUDSExpressionOp(Item.GetType() == ESUDSExpressionItemType::And
+				                          ? ESUDSExpressionOpCode::JumpIfFalse
+				                          : ESUDSExpressionOpCode::JumpIfTrue,
+			                          static_cast<uint16>(Rhs.Num() + 1)));
+			Lhs.Append(Rhs);
+			Lhs.Add(FSUDSExpressionOp(ESUDSExpressionOpCode::ToBoolean));
+			break;
+		default:
+			Lhs.Append(Rhs);
+			Lhs.Add(FSUDSExpressionOp(GetBinaryOpCode(Item.GetType())));
+			break;
+		}
+	}
+
+	check(Fragments.Num() == 1);
+	Ops = MoveTemp(Fragments[0]);
+
+	CompileTyped();
+}
+
+void FSUDSExpression::CompileTyped()
+{
+	// Only worth it if every variable's type is known
+	if (VariableTypes.Num() != VariableNames.Num() || VariableTypes.Contains(ESUDSValueType::Empty))
+		return;
+
+	// Jumps are ignored here; "and" / "or" pop their boolean left hand side and the right hand side pushes another,
+	// so following the instructions in order gives the right types on the stack either way
+	TArray<ESUDSValueType, TInlineAllocator<InlineStackSize>> TypeStack;
+	TArray<FSUDSExpressionOp> Typed;
+	Typed.Reserve(Ops.Num());
+	bool bAnySpecialised = false;
+	for (const auto& Op : Ops)
+	{
+		FSUDSExpressionOp& NewOp = Typed.Add_GetRef(Op);
+		switch (Op.OpCode)
+		{
+		case ESUDSExpressionOpCode::PushLiteral:
+			TypeStack.Push(Queue[Op.Operand].GetOperandValue().GetType());
+			break;
+		case ESUDSExpressionOpCode::PushVariable:
+			if (Op.VariableIndex == FSUDSExpressionOp::NoVariableIndex)
+			{
+				// Can't check the type of this variable at runtime
+				return;
+			}
+			TypeStack.Push(VariableTypes[Op.VariableIndex]);
+			break;
+		case ESUDSExpressionOpCode::Not:
+			if (TypeStack.Top() == ESUDSValueType::Boolean)
+			{
+				NewOp.OpCode = ESUDSExpressionOpCode::BoolNot;
+				bAnySpecialised = true;
+			}
+			TypeStack.Top() = ESUDSValueType::Boolean;
+			break;
+		case ESUDSExpressionOpCode::JumpIfFalse:
+		case ESUDSExpressionOpCode::JumpIfTrue:
+			TypeStack.Pop();
+			break;
+		case ESUDSExpressionOpCode::ToBoolean:
+			TypeStack.Top() = ESUDSValueType::Boolean;
+			break;
+		default:
+			{
+				const ESUDSValueType Arg2Type = TypeStack.Pop();
+				const ESUDSValueType Arg1Type = TypeStack.Top();
+				NewOp.OpCode = GetTypedOpCode(Op.OpCode, Arg1Type, Arg2Type);
+				if (NewOp.OpCode != Op.OpCode)
+				{
+					bAnySpecialised = true;
+					NewOp.OperandFlags = (Arg1Type == ESUDSValueType::Int ? FSUDSExpressionOp::Arg1IsInt : 0) |
+						(Arg2Type == ESUDSValueType::Int ? FSUDSExpressionOp::Arg2IsInt : 0);
+				}
+				switch (Op.OpCode)
+				{
+				case ESUDSExpressionOpCode::Multiply:
+				case ESUDSExpressionOpCode::Divide:
+				case ESUDSExpressionOpCode::Modulo:
+				case ESUDSExpressionOpCode::Add:
+				case ESUDSExpressionOpCode::Subtract:
+					TypeStack.Top() = Arg1Type == ESUDSValueType::Int && Arg2Type == ESUDSValueType::Int
+						                  ? ESUDSValueType::Int
+						                  : ESUDSValueType::Float;
+					break;
+				default:
+					TypeStack.Top() = ESUDSValueType::Boolean;
+					break;
+				}
+			}
+			break;
+		}
+	}
+
+	if (bAnySpecialised)
+	{
+		TypedOps = MoveTemp(Typed);
+	}
+}
+
+ESUDSExpressionOpCode FSUDSExpression::GetTypedOpCode(ESUDSExpressionOpCode Op,
+                                                      ESUDSValueType Arg1Type,
+                                                      ESUDSValueType Arg2Type)
+{
+	const bool bBothNumeric = (Arg1Type == ESUDSValueType::Int || Arg1Type == ESUDSValueType::Float) &&
+		(Arg2Type == ESUDSValueType::Int || Arg2Type == ESUDSValueType::Float);
+	if (bBothNumeric)
+	{
+		// Same widening rules as FSUDSValue: only stays int if both are ints
+		const bool bInt = Arg1Type == ESUDSValueType::Int && Arg2Type == ESUDSValueType::Int;
+		switch (Op)
+		{
+		case ESUDSExpressionOpCode::Multiply:
+			return bInt ? ESUDSExpressionOpCode::IntMultiply : ESUDSExpressionOpCode::FloatMultiply;
+		case ESUDSExpressionOpCode::Divide:
+			return bInt ? ESUDSExpressionOpCode::IntDivide : ESUDSExpressionOpCode::FloatDivide;
+		case ESUDSExpressionOpCode::Modulo:
+			return bInt ? ESUDSExpressionOpCode::IntModulo : ESUDSExpressionOpCode::FloatModulo;
+		case ESUDSExpressionOpCode::Add:
+			return bInt ? ESUDSExpressionOpCode::IntAdd : ESUDSExpressionOpCode::FloatAdd;
+		case ESUDSExpressionOpCode::Subtract:
+			return bInt ? ESUDSExpressionOpCode::IntSubtract : ESUDSExpressionOpCode::FloatSubtract;
+		case ESUDSExpressionOpCode::Less:
+			return bInt ? ESUDSExpressionOpCode::IntLess : ESUDSExpressionOpCode::FloatLess;
+		case ESUDSExpressionOpCode::LessEqual:
+			return bInt ? ESUDSExpressionOpCode::IntLessEqual : ESUDSExpressionOpCode::FloatLessEqual;
+		case ESUDSExpressionOpCode::Greater:
+			return bInt ? ESUDSExpressionOpCode::IntGreater : ESUDSExpressionOpCode::FloatGreater;
+		case ESUDSExpressionOpCode::GreaterEqual:
+			return bInt ? ESUDSExpressionOpCode::IntGreaterEqual : ESUDSExpressionOpCode::FloatGreaterEqual;
+		case ESUDSExpressionOpCode::Equal:
+			return bInt ? ESUDSExpressionOpCode::IntEqual : ESUDSExpressionOpCode::FloatEqual;
+		case ESUDSExpressionOpCode::NotEqual:
+			return bInt ? ESUDSExpressionOpCode::IntNotEqual : ESUDSExpressionOpCode::FloatNotEqual;
+		default:
+			break;
+		}
+	}
+	else if (Arg1Type == ESUDSValueType::Boolean && Arg2Type == ESUDSValueType::Boolean)
+	{
+		switch (Op)
+		{
+		case ESUDSExpressionOpCode::Equal:
+			return ESUDSExpressionOpCode::BoolEqual;
+		case ESUDSExpressionOpCode::NotEqual:
+			return ESUDSExpressionOpCode::BoolNotEqual;
+		default:
+			break;
+		}
+	}
+	// Text, names etc just use the general operators
+	return Op;
+}
+
+ESUDSValueType FSUDSExpression::InferOperatorType(ESUDSExpressionItemType Op,
+                                                  ESUDSValueType Arg1Type,
+                                                  ESUDSValueType Arg2Type,
+                                                  FString& OutProblem)
+{
+	// Empty means the type isn't known, which is never a problem
+	auto IsNumericOrUnknown = [](ESUDSValueType T)
+	{
+		return T == ESUDSValueType::Int || T == ESUDSValueType::Float || T == ESUDSValueType::Empty;
+	};
+	auto IsBooleanOrUnknown = [](ESUDSValueType T)
+	{
+		return T == ESUDSValueType::Boolean || T == ESUDSValueType::Empty;
+	};
+	auto TypeName = [](ESUDSValueType T)
+	{
+		return StaticEnum<ESUDSValueType>()->GetNameStringByValue((int64)T);
+	};
+	const FString OpName = StaticEnum<ESUDSExpressionItemType>()->GetNameStringByValue((int64)Op);
+
+	switch (Op)
+	{
+	case ESUDSExpressionItemType::Not:
+		if (!IsBooleanOrUnknown(Arg1Type))
+		{
+			OutProblem = FString::Printf(TEXT("'Not' used on %s, expected Boolean"), *TypeName(Arg1Type));
+		}
+		return ESUDSValueType::Boolean;
+	case ESUDSExpressionItemType::Multiply:
+	case ESUDSExpressionItemType::Divide:
+	case ESUDSExpressionItemType::Modulo:
+	case ESUDSExpressionItemType::Add:
+	case ESUDSExpressionItemType::Subtract:
+		if (!IsNumericOrUnknown(Arg1Type) || !IsNumericOrUnknown(Arg2Type))
+		{
+			OutProblem = FString::Printf(TEXT("'%s' used on %s and %s, expected numbers"), *OpName, *TypeName(Arg1Type), *TypeName(Arg2Type));
+			return ESUDSValueType::Empty;
+		}
+		if (Arg1Type == ESUDSValueType::Empty || Arg2Type == ESUDSValueType::Empty)
+		{
+			return ESUDSValueType::Empty;
+		}
+		return Arg1Type == ESUDSValueType::Int && Arg2Type == ESUDSValueType::Int
+			       ? ESUDSValueType::Int
+			       : ESUDSValueType::Float;
+	case ESUDSExpressionItemType::Less:
+	case ESUDSExpressionItemType::LessEqual:
+	case ESUDSExpressionItemType::Greater:
+	case ESUDSExpressionItemType::GreaterEqual:
+		if (!IsNumericOrUnknown(Arg1Type) || !IsNumericOrUnknown(Arg2Type))
+		{
+			OutProblem = FString::Printf(TEXT("'%s' used on %s and %s, expected numbers"), *OpName, *TypeName(Arg1Type), *TypeName(Arg2Type));
+		}
+		return ESUDSValueType::Boolean;
+	case ESUDSExpressionItemType::Equal:
+	case ESUDSExpressionItemType::NotEqual:
+		if (Arg1Type != ESUDSValueType::Empty &&
+			Arg2Type != ESUDSValueType::Empty &&
+			Arg1Type != Arg2Type &&
+			!(IsNumericOrUnknown(Arg1Type) && IsNumericOrUnknown(Arg2Type)))
+		{
+			OutProblem = FString::Printf(TEXT("'%s' compares %s with %s, the result will always be the same"), *OpName, *TypeName(Arg1Type), *TypeName(Arg2Type));
+		}
+		return ESUDSValueType::Boolean;
+	case ESUDSExpressionItemType::And:
+	case ESUDSExpressionItemType::Or:
+		if (!IsBooleanOrUnknown(Arg1Type) || !IsBooleanOrUnknown(Arg2Type))
+		{
+			OutProblem = FString::Printf(TEXT("'%s' used on %s and %s, expected Boolean"), *OpName, *TypeName(Arg1Type), *TypeName(Arg2Type));
+		}
+		return ESUDSValueType::Boolean;
+	default:
+		return ESUDSValueType::Empty;
+	}
+}
+
+ESUDSValueType FSUDSExpression::InferTypes(const TMap<FName, ESUDSValueType>& KnownTypes, TArray<FString>& OutProblems)
+{
+	VariableTypes.SetNumUninitialized(VariableNames.Num());
+	for (int i = 0; i < VariableNames.Num(); ++i)
+	{
+		const ESUDSValueType* pType = KnownTypes.Find(VariableNames[i]);
+		VariableTypes[i] = pType ? *pType : ESUDSValueType::Empty;
+	}
+
+	ESUDSValueType Result = ESUDSValueType::Empty;
+	if (bIsValid && !Queue.IsEmpty())
+	{
+		TArray<ESUDSValueType, TInlineAllocator<InlineStackSize>> TypeStack;
+		for (const auto& Item : Queue)
+		{
+			if (Item.IsOperand())
+			{
+				const FSUDSValue& Operand = Item.GetOperandValue();
+				if (Operand.IsVariable())
+				{
+					const ESUDSValueType* pType = KnownTypes.Find(Operand.GetVariableNameValue());
+					TypeStack.Push(pType ? *pType : ESUDSValueType::Empty);
+				}
+				else
+				{
+					TypeStack.Push(Operand.GetType());
+				}
+				continue;
+			}
+
+			FString Problem;
+			ESUDSValueType OpType;
+			if (Item.IsBinaryOperator())
+			{
+				const ESUDSValueType Arg2Type = TypeStack.Pop();
+				OpType = InferOperatorType(Item.GetType(), TypeStack.Top(), Arg2Type, Problem);
+			}
+			else
+			{
+				OpType = InferOperatorType(Item.GetType(), TypeStack.Top(), ESUDSValueType::Empty, Problem);
+			}
+			TypeStack.Top() = OpType;
+			if (!Problem.IsEmpty())
+			{
+				OutProblems.Add(FString::Printf(TEXT("Expression '%s': %s"), *SourceString, *Problem));
+			}
+		}
+		if (TypeStack.Num() == 1)
+		{
+			Result = TypeStack[0];
+		}
+	}
+
+	Compile();
+	
+	return Result;
+}
+
+ESUDSExpressionOpCode FSUDSExpression::GetBinaryOpCode(ESUDSExpressionItemType ItemType)
+{
+	switch (ItemType)
+	{
+	case ESUDSExpressionItemType::Multiply:
+		return ESUDSExpressionOpCode::Multiply;
+	case ESUDSExpressionItemType::Divide:
+		return ESUDSExpressionOpCode::Divide;
+	case ESUDSExpressionItemType::Modulo:
+		return ESUDSExpressionOpCode::Modulo;
+	case ESUDSExpressionItemType::Add:
+		return ESUDSExpressionOpCode::Add;
+	case ESUDSExpressionItemType::Subtract:
+		return ESUDSExpressionOpCode::Subtract;
+	case ESUDSExpressionItemType::Less:
+		return ESUDSExpressionOpCode::Less;
+	case ESUDSExpressionItemType::LessEqual:
+		return ESUDSExpressionOpCode::LessEqual;
+	case ESUDSExpressionItemType::Greater:
+		return ESUDSExpressionOpCode::Greater;
+	case ESUDSExpressionItemType::GreaterEqual:
+		return ESUDSExpressionOpCode::GreaterEqual;
+	case ESUDSExpressionItemType::Equal:
+		return ESUDSExpressionOpCode::Equal;
+	case ESUDSExpressionItemType::NotEqual:
+		return ESUDSExpressionOpCode::NotEqual;
+	default:
+		// Validate() will have rejected anything else
+		checkNoEntry();
+		return ESUDSExpressionOpCode::Equal;
+	}
+}
+
+void FSUDSExpression::ResolveVariableSlots(const TMap<FName, int32>& SlotMap)
+{
+	VariableSlots.SetNumUninitialized(VariableNames.Num());
+	for (int i = 0; i < VariableNames.Num(); ++i)
+	{
+		// Globals aren't in the table so will resolve to INDEX_NONE
+		const int32* pSlot = SlotMap.Find(VariableNames[i]);
+		VariableSlots[i] = pSlot ? *pSlot : INDEX_NONE;
+	}
+}
+
+void FSUDSExpression::PostSerialize(const FArchive& Ar)
+{
+	if (Ar.IsLoading())
+	{
+		Compile();
+	}
 }
 
 bool FSUDSExpression::IsRandomCondition() const
@@ -168,54 +822,226 @@ bool FSUDSExpression::IsRandomCondition() const
 	return false;
 }
 
-ESUDSExpressionItemType FSUDSExpression::ParseOperator(const FString& OpStr)
+ESUDSExpressionItemType FSUDSExpression::ParseOperator(FStringView OpStr)
 {
-	if (OpStr == "+")
+	if (OpStr == TEXT("+"))
 		return ESUDSExpressionItemType::Add;
-	if (OpStr == "-")
+	if (OpStr == TEXT("-"))
 		return ESUDSExpressionItemType::Subtract;
-	if (OpStr == "*")
+	if (OpStr == TEXT("*"))
 		return ESUDSExpressionItemType::Multiply;
-	if (OpStr == "/")
+	if (OpStr == TEXT("/"))
 		return ESUDSExpressionItemType::Divide;
-	if (OpStr == "%")
+	if (OpStr == TEXT("%"))
 		return ESUDSExpressionItemType::Modulo;
-	if (OpStr == "and" || OpStr == "&&")
+	if (OpStr == TEXT("and") || OpStr == TEXT("&&"))
 		return ESUDSExpressionItemType::And;
-	if (OpStr == "or" || OpStr == "||")
+	if (OpStr == TEXT("or") || OpStr == TEXT("||"))
 		return ESUDSExpressionItemType::Or;
-	if (OpStr == "not" || OpStr == "!")
+	if (OpStr == TEXT("not") || OpStr == TEXT("!"))
 		return ESUDSExpressionItemType::Not;
-	if (OpStr == "==" || OpStr == "=")
+	if (OpStr == TEXT("==") || OpStr == TEXT("="))
 		return ESUDSExpressionItemType::Equal;
-	if (OpStr == ">=")
+	if (OpStr == TEXT(">="))
 		return ESUDSExpressionItemType::GreaterEqual;
-	if (OpStr == ">")
+	if (OpStr == TEXT(">"))
 		return ESUDSExpressionItemType::Greater;
-	if (OpStr == "<=")
+	if (OpStr == TEXT("<="))
 		return ESUDSExpressionItemType::LessEqual;
-	if (OpStr == "<")
+	if (OpStr == TEXT("<"))
 		return ESUDSExpressionItemType::Less;
-	if (OpStr == "<>" || OpStr == "!=")
+	if (OpStr == TEXT("<>") || OpStr == TEXT("!="))
 		return ESUDSExpressionItemType::NotEqual;
-	if (OpStr == "(")
+	if (OpStr == TEXT("("))
 		return ESUDSExpressionItemType::LParens;
-	if (OpStr == ")")
+	if (OpStr == TEXT(")"))
 		return ESUDSExpressionItemType::RParens;
 
 	return ESUDSExpressionItemType::Null;
 }
 
-bool FSUDSExpression::ParseOperand(const FString& ValueStr, FSUDSValue& OutVal)
+namespace
+{
+	// Character classes as used by the regular expression this lexer replaced; \w and \d are approximated with the
+	// platform's alphanumeric / digit tests
+	FORCEINLINE bool IsWordChar(TCHAR C)
+	{
+		return FChar::IsAlnum(C) || C == TCHAR('_');
+	}
+
+	FORCEINLINE bool IsLineTerminator(TCHAR C)
+	{
+		return C == TCHAR('\n') || C == TCHAR('\r') || C == TCHAR(0x85) || C == TCHAR(0x2028) || C == TCHAR(0x2029);
+	}
+
+	FORCEINLINE bool HasLiteralAt(FStringView Str, int32 Pos, FStringView Literal)
+	{
+		return Str.Len() - Pos >= Literal.Len() &&
+			FCString::Strncmp(Str.GetData() + Pos, Literal.GetData(), Literal.Len()) == 0;
+	}
+
+	/// Case-insensitive first letter, case-sensitive rest, e.g. [tT]rue
+	FORCEINLINE bool HasKeywordAt(FStringView Str, int32 Pos, FStringView Keyword)
+	{
+		return Str.Len() - Pos >= Keyword.Len() &&
+			FChar::ToLower(Str[Pos]) == Keyword[0] &&
+			FCString::Strncmp(Str.GetData() + Pos + 1, Keyword.GetData() + 1, Keyword.Len() - 1) == 0;
+	}
+
+	/// Whether a string is the body of a quoted string; no unescaped double quotes, and backslashes escape the
+	/// next character as long as it's not a line terminator
+	bool IsQuotedStringBody(FStringView Body)
+	{
+		for (int32 i = 0; i < Body.Len(); ++i)
+		{
+			if (Body[i] == TCHAR('"'))
+				return false;
+			if (Body[i] == TCHAR('\\'))
+			{
+				if (i + 1 >= Body.Len() || IsLineTerminator(Body[i + 1]))
+					return false;
+				++i;
+			}
+		}
+		return true;
+	}
+
+	/// Get the length of the token which starts at Pos, or 0 if no token starts there
+	int32 MatchTokenAt(FStringView Str, int32 Pos)
+	{
+		const int32 Len = Str.Len();
+		const TCHAR C = Str[Pos];
+		auto CharAt = [&Str, Len](int32 Idx) { return Idx < Len ? Str[Idx] : TCHAR(0); };
+
+		// {Variable}
+		if (C == TCHAR('{'))
+		{
+			int32 End = Pos + 1;
+			while (End < Len && (IsWordChar(Str[End]) || Str[End] == TCHAR('.')))
+				++End;
+			if (End > Pos + 1 && CharAt(End) == TCHAR('}'))
+				return End + 1 - Pos;
+		}
+
+		// Literal numbers, with or without decimal point, with or without preceding negation
+		{
+			int32 End = C == TCHAR('-') ? Pos + 1 : Pos;
+			const int32 DigitsStart = End;
+			while (FChar::IsDigit(CharAt(End)))
+				++End;
+			if (End > DigitsStart)
+			{
+				if (CharAt(End) == TCHAR('.'))
+				{
+					++End;
+					while (FChar::IsDigit(CharAt(End)))
+						++End;
+				}
+				return End - Pos;
+			}
+		}
+
+		switch (C)
+		{
+		// Arithmetic operators & parentheses
+		case TCHAR('-'):
+		case TCHAR('+'):
+		case TCHAR('*'):
+		case TCHAR('/'):
+		case TCHAR('%'):
+		case TCHAR('('):
+		case TCHAR(')'):
+			return 1;
+		// Boolean operators & comparisons
+		case TCHAR('a'):
+			return HasLiteralAt(Str, Pos, TEXTVIEW("and")) ? 3 : 0;
+		case TCHAR('&'):
+			return CharAt(Pos + 1) == TCHAR('&') ? 2 : 0;
+		case TCHAR('|'):
+			return CharAt(Pos + 1) == TCHAR('|') ? 2 : 0;
+		case TCHAR('o'):
+			return CharAt(Pos + 1) == TCHAR('r') ? 2 : 0;
+		case TCHAR('!'):
+			return CharAt(Pos + 1) == TCHAR('=') ? 2 : 1;
+		case TCHAR('<'):
+			return CharAt(Pos + 1) == TCHAR('>') || CharAt(Pos + 1) == TCHAR('=') ? 2 : 1;
+		case TCHAR('>'):
+		case TCHAR('='):
+			return CharAt(Pos + 1) == TCHAR('=') ? 2 : 1;
+		// Predefined constants
+		case TCHAR('n'):
+			if (HasLiteralAt(Str, Pos, TEXTVIEW("not")))
+				return 3;
+			// Could still be neuter
+			[[fallthrough]];
+		case TCHAR('N'):
+			return HasKeywordAt(Str, Pos, TEXTVIEW("neuter")) ? 6 : 0;
+		case TCHAR('m'):
+		case TCHAR('M'):
+			return HasKeywordAt(Str, Pos, TEXTVIEW("masculine")) ? 9 : 0;
+		case TCHAR('f'):
+		case TCHAR('F'):
+			if (HasKeywordAt(Str, Pos, TEXTVIEW("feminine")))
+				return 8;
+			return HasKeywordAt(Str, Pos, TEXTVIEW("false")) ? 5 : 0;
+		case TCHAR('t'):
+		case TCHAR('T'):
+			return HasKeywordAt(Str, Pos, TEXTVIEW("true")) ? 4 : 0;
+		// Quoted strings "string", ignoring escaped double quotes
+		case TCHAR('"'):
+			for (int32 End = Pos + 1; End < Len; ++End)
+			{
+				if (Str[End] == TCHAR('"'))
+					return End + 1 - Pos;
+				if (Str[End] == TCHAR('\\'))
+				{
+					if (End + 1 >= Len || IsLineTerminator(Str[End + 1]))
+						return 0;
+					++End;
+				}
+			}
+			return 0;
+		// Quoted names `name`
+		case TCHAR('`'):
+			for (int32 End = Pos + 1; End < Len; ++End)
+			{
+				if (Str[End] == TCHAR('`'))
+					return End + 1 - Pos;
+			}
+			return 0;
+		default:
+			return 0;
+		}
+	}
+}
+
+bool FSUDSExpression::NextToken(FStringView Expression, int32& InOutPos, FSUDSExpressionToken& OutToken)
+{
+	// Anything that doesn't start a token is skipped
+	for (; InOutPos < Expression.Len(); ++InOutPos)
+	{
+		const int32 TokenLen = MatchTokenAt(Expression, InOutPos);
+		if (TokenLen > 0)
+		{
+			OutToken.Start = InOutPos;
+			OutToken.Len = TokenLen;
+			InOutPos += TokenLen;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FSUDSExpression::ParseOperand(FStringView ValueStr, FSUDSValue& OutVal)
 {
 	// Try Boolean first since only 2 options
 	{
-		if (ValueStr.Compare("true", ESearchCase::IgnoreCase) == 0)
+		if (ValueStr.Equals(TEXT("true"), ESearchCase::IgnoreCase))
 		{
 			OutVal = FSUDSValue(true);
 			return true;
 		}
-		if (ValueStr.Compare("false", ESearchCase::IgnoreCase) == 0)
+		if (ValueStr.Equals(TEXT("false"), ESearchCase::IgnoreCase))
 		{
 			OutVal = FSUDSValue(false);
 			return true;
@@ -223,68 +1049,73 @@ bool FSUDSExpression::ParseOperand(const FString& ValueStr, FSUDSValue& OutVal)
 	}
 	// Try gender
 	{
-		if (ValueStr.Compare("masculine", ESearchCase::IgnoreCase) == 0)
+		if (ValueStr.Equals(TEXT("masculine"), ESearchCase::IgnoreCase))
 		{
 			OutVal = FSUDSValue(ETextGender::Masculine);
 			return true;
 		}
-		if (ValueStr.Compare("feminine", ESearchCase::IgnoreCase) == 0)
+		if (ValueStr.Equals(TEXT("feminine"), ESearchCase::IgnoreCase))
 		{
 			OutVal = FSUDSValue(ETextGender::Feminine);
 			return true;
 		}
-		if (ValueStr.Compare("neuter", ESearchCase::IgnoreCase) == 0)
+		if (ValueStr.Equals(TEXT("neuter"), ESearchCase::IgnoreCase))
 		{
 			OutVal = FSUDSValue(ETextGender::Neuter);
 			return true;
 		}
 	}
+
+	// The delimited forms below must match the whole string, although a single line terminator is allowed at the end 
+	FStringView Delimited = ValueStr;
+	if (Delimited.EndsWith(TEXT("\r\n"), ESearchCase::CaseSensitive))
+	{
+		Delimited.LeftChopInline(2);
+	}
+	else if (Delimited.Len() > 0 && IsLineTerminator(Delimited[Delimited.Len() - 1]))
+	{
+		Delimited.LeftChopInline(1);
+	}
+	const int32 DelimLen = Delimited.Len();
+	const FStringView Inner = DelimLen >= 2 ? Delimited.Mid(1, DelimLen - 2) : FStringView();
+	
 	// Try quoted text (will be localised later in asset conversion)
+	if (DelimLen >= 2 && Delimited[0] == TCHAR('"') && Delimited[DelimLen - 1] == TCHAR('"') &&
+		IsQuotedStringBody(Inner))
 	{
-		const FRegexPattern Pattern(TEXT("^\"((?:[^\"\\\\]|\\\\.)*)\"$"));
-		FRegexMatcher Regex(Pattern, ValueStr);
-		if (Regex.FindNext())
-		{
-			FString Val = Regex.GetCaptureGroup(1);
-			// Consolidate any escaped double quotes into just quotes
-			Val.ReplaceInline(TEXT("\\\""), TEXT("\""));
-			OutVal = FSUDSValue(FText::FromString(Val));
-			return true;
-		}
+		FString Val(Inner);
+		// Consolidate any escaped double quotes into just quotes
+		Val.ReplaceInline(TEXT("\\\""), TEXT("\""));
+		OutVal = FSUDSValue(FText::FromString(Val));
+		return true;
 	}
+	int32 Unused;
 	// Try FName
+	if (DelimLen >= 2 && Delimited[0] == TCHAR('`') && Delimited[DelimLen - 1] == TCHAR('`') &&
+		!Inner.FindChar(TCHAR('`'), Unused))
 	{
-		const FRegexPattern Pattern(TEXT("^`([^`]*)`$"));
-		FRegexMatcher Regex(Pattern, ValueStr);
-		if (Regex.FindNext())
-		{
-			const FString Name = Regex.GetCaptureGroup(1);
-			OutVal = FSUDSValue(FName(Name), false);
-			return true;
-		}
+		OutVal = FSUDSValue(FName(Inner), false);
+		return true;
 	}
 	// Try variable name
+	if (DelimLen >= 2 && Delimited[0] == TCHAR('{') && Delimited[DelimLen - 1] == TCHAR('}') &&
+		!Inner.FindChar(TCHAR('}'), Unused))
 	{
-		const FRegexPattern Pattern(TEXT("^\\{([^\\}]*)\\}$"));
-		FRegexMatcher Regex(Pattern, ValueStr);
-		if (Regex.FindNext())
-		{
-			const FName VariableName(Regex.GetCaptureGroup(1));
-			OutVal = FSUDSValue(VariableName, true);
-			return true;
-		}
+		OutVal = FSUDSValue(FName(Inner), true);
+		return true;
 	}
 	// Try Numbers
 	{
+		const FString NumStr(ValueStr);
 		float FloatVal;
 		int IntVal;
 		// look for int first; anything with a decimal point will fail
-		if (FDefaultValueHelper::ParseInt(ValueStr, IntVal))
+		if (FDefaultValueHelper::ParseInt(NumStr, IntVal))
 		{
 			OutVal = FSUDSValue(IntVal);	
 			return true;
 		}
-		if (FDefaultValueHelper::ParseFloat(ValueStr, FloatVal))
+		if (FDefaultValueHelper::ParseFloat(NumStr, FloatVal))
 		{
 			OutVal = FSUDSValue(FloatVal);	
 			return true;
@@ -297,81 +1128,272 @@ bool FSUDSExpression::ParseOperand(const FString& ValueStr, FSUDSValue& OutVal)
 
 bool FSUDSExpression::Validate()
 {
+	MaxStackDepth = 0;
+	
 	// Empty expressions are always valid, mean "true"
 	if (Queue.IsEmpty())
 		return true;
 
-	// Same algorithm as Execute, we just don't execute
-	TArray<FSUDSExpressionItem> EvalStack;
-	const TMap<FName, FSUDSValue> TempVariables;
+	// Same algorithm as Evaluate, we just track the stack depth instead of executing
+	int32 Depth = 0;
 	for (auto& Item : Queue)
 	{
 		if (Item.IsOperator())
 		{
-			FSUDSExpressionItem Arg1, Arg2;
-			if (Item.IsBinaryOperator())
-			{
-				if (EvalStack.IsEmpty())
-					return false;
-				Arg2 = EvalStack.Pop();
-			}
-			if (EvalStack.IsEmpty())
+			const int32 NumArgs = Item.IsBinaryOperator() ? 2 : 1;
+			if (Depth < NumArgs)
 				return false;
-			Arg1 = EvalStack.Pop();
-
-			EvalStack.Push(EvaluateOperator(Item.GetType(), Arg1, Arg2, TempVariables, TempVariables));
+			// Args are replaced by the result
+			Depth -= NumArgs - 1;
 		}
 		else
 		{
-			EvalStack.Push(Item);
+			++Depth;
+			MaxStackDepth = FMath::Max(MaxStackDepth, Depth);
 		}
 	}
 
-	// Must be one item left and must be an operand
-	return EvalStack.Num() == 1 && EvalStack[0].IsOperand();
+	// Must be one item left
+	return Depth == 1;
 	
 }
 
+namespace
+{
+	/// Variable source for plain maps of local & global variables
+	class FSUDSMapVariableSource : public ISUDSVariableSource
+	{
+	protected:
+		const TMap<FName, FSUDSValue>& Variables;
+		const TMap<FName, FSUDSValue>& GlobalVariables;
+	public:
+		FSUDSMapVariableSource(const TMap<FName, FSUDSValue>& InVariables,
+		                       const TMap<FName, FSUDSValue>& InGlobalVariables)
+			: Variables(InVariables),
+			  GlobalVariables(InGlobalVariables)
+		{
+		}
+
+		virtual const FSUDSValue* FindVariable(const FName& Name, int32 Slot) const override
+		{
+			return Variables.Find(Name);
+		}
+
+		virtual const FSUDSValue* FindGlobalVariable(const FName& Name) const override
+		{
+			return GlobalVariables.Find(Name);
+		}
+	};
+}
+
 FSUDSValue FSUDSExpression::Evaluate(const TMap<FName, FSUDSValue>& Variables, const TMap<FName, FSUDSValue>& GlobalVariables) const
+{
+	return EvaluateImpl(FSUDSMapVariableSource(Variables, GlobalVariables), nullptr);
+}
+
+FSUDSValue FSUDSExpression::Evaluate(const TMap<FName, FSUDSValue>& Variables,
+                                     const TMap<FName, FSUDSValue>& GlobalVariables,
+                                     FSUDSVariableRequestFunc OnVariableRequested) const
+{
+	return EvaluateImpl(FSUDSMapVariableSource(Variables, GlobalVariables), &OnVariableRequested);
+}
+
+FSUDSValue FSUDSExpression::Evaluate(const ISUDSVariableSource& Variables,
+                                     FSUDSVariableRequestFunc OnVariableRequested) const
+{
+	return EvaluateImpl(Variables, &OnVariableRequested);
+}
+
+FSUDSValue FSUDSExpression::EvaluateImpl(const ISUDSVariableSource& Variables,
+                                         const FSUDSVariableRequestFunc* OnVariableRequested) const
 {
 	checkf(bIsValid, TEXT("Cannot execute an invalid expression tree"));
 
 	// Blanks are mostly used for conditionals, for simplicity always return true
-	if (Queue.IsEmpty())
+	if (Ops.IsEmpty())
 		return FSUDSValue(true);
 
-	TArray<FSUDSExpressionItem> EvalStack;
-	// We could pre-optimise all literal expressions, but let's not for now
-	for (auto& Item : Queue)
+	// Variables we've already requested in this evaluation, kept if we have to fall back to the untyped version
+	FRequestedVariables Requested;
+	FSUDSValue Result;
+	if (!TypedOps.IsEmpty() && Execute(TypedOps, true, Variables, OnVariableRequested, Requested, Result))
 	{
-		if (Item.IsOperator())
+		return Result;
+	}
+	Execute(Ops, false, Variables, OnVariableRequested, Requested, Result);
+	return Result;
+}
+
+bool FSUDSExpression::FRequestedVariables::MarkRequested(uint8 VariableIndex, const FName& Name)
+{
+	if (VariableIndex == FSUDSExpressionOp::NoVariableIndex)
+	{
+		if (Names.Contains(Name))
 		{
-			FSUDSExpressionItem Arg1, Arg2;
-			// Arg2 (RHS) has to be popped first
-			if (Item.IsBinaryOperator())
-			{
-				checkf(!EvalStack.IsEmpty(), TEXT("Args missing before operator, bad expression"));
-				Arg2 = EvalStack.Pop();
-			}
-			checkf(!EvalStack.IsEmpty(), TEXT("Args missing before operator, bad expression"));
-			Arg1 = EvalStack.Pop();
-			EvalStack.Push(EvaluateOperator(Item.GetType(), Arg1, Arg2, Variables, GlobalVariables));
+			return false;
 		}
-		else
+		Names.Add(Name);
+		return true;
+	}
+	if (VariableIndex >= Indexes.Num())
+	{
+		Indexes.Add(false, VariableIndex + 1 - Indexes.Num());
+	}
+	if (Indexes[VariableIndex])
+	{
+		return false;
+	}
+	Indexes[VariableIndex] = true;
+	return true;
+}
+
+bool FSUDSExpression::Execute(const TArray<FSUDSExpressionOp>& Program,
+                              bool bTyped,
+                              const ISUDSVariableSource& Variables,
+                              const FSUDSVariableRequestFunc* OnVariableRequested,
+                              FRequestedVariables& InOutRequested,
+                              FSUDSValue& OutResult) const
+{
+	static const FSUDSValue TrueValue(true);
+	static const FSUDSValue FalseValue(false);
+
+	// The stack only holds pointers; literals and variables are used in place, and operator results are held in
+	// Results, which is reserved up-front so that it never reallocates and invalidates the pointers.
+	// Both stay on the C++ stack unless the expression is unusually large
+	TArray<const FSUDSValue*, TInlineAllocator<InlineStackSize>> Stack;
+	Stack.SetNumUninitialized(MaxStackDepth);
+	int32 StackTop = 0;
+	TArray<FSUDSValue, TInlineAllocator<InlineStackSize>> Results;
+	Results.Reserve(Program.Num());
+
+	for (int32 PC = 0; PC < Program.Num(); ++PC)
+	{
+		const auto& Op = Program[PC];
+		switch (Op.OpCode)
 		{
-			EvalStack.Push(Item);
+		case ESUDSExpressionOpCode::PushLiteral:
+			Stack[StackTop++] = &Queue[Op.Operand].GetOperandValue();
+			break;
+		case ESUDSExpressionOpCode::PushVariable:
+			{
+				const FSUDSValue& Operand = Queue[Op.Operand].GetOperandValue();
+				int32 Slot = INDEX_NONE;
+				FName GlobalName;
+				if (Op.VariableIndex != FSUDSExpressionOp::NoVariableIndex)
+				{
+					Slot = VariableSlots.IsValidIndex(Op.VariableIndex) ? VariableSlots[Op.VariableIndex] : INDEX_NONE;
+					GlobalName = VariableGlobalNames[Op.VariableIndex];
+				}
+				else
+				{
+					// Only happens for huge expressions
+					if (!USUDSLibrary::IsDialogueVariableGlobal(Operand.GetVariableNameValue(), GlobalName))
+					{
+						GlobalName = NAME_None;
+					}
+				}
+				if (OnVariableRequested)
+				{
+					// Variables are only requested when they're actually read, so anything skipped by a short-circuited
+					// "and" / "or" isn't requested at all
+					if (InOutRequested.MarkRequested(Op.VariableIndex, Operand.GetVariableNameValue()))
+					{
+						(*OnVariableRequested)(Operand.GetVariableNameValue());
+					}
+					// The request may have changed the variable state, so we can't keep pointers into it
+					Stack[StackTop++] = &Results.Add_GetRef(FindOperandValue(Operand, Slot, GlobalName, Variables));
+				}
+				else
+				{
+					Stack[StackTop++] = &FindOperandValue(Operand, Slot, GlobalName, Variables);
+				}
+				if (bTyped && Stack[StackTop - 1]->GetType() != VariableTypes[Op.VariableIndex])
+				{
+					// Typed operators rely on variables having the type seen at import. This one is unset or was
+					// changed at runtime, so use the general operators which deal with that
+					return false;
+				}
+			}
+			break;
+		case ESUDSExpressionOpCode::Not:
+			checkf(StackTop >= 1, TEXT("Args missing before operator, bad expression"));
+			Stack[StackTop - 1] = &Results.Add_GetRef(!*Stack[StackTop - 1]);
+			break;
+		case ESUDSExpressionOpCode::JumpIfFalse:
+		case ESUDSExpressionOpCode::JumpIfTrue:
+			{
+				checkf(StackTop >= 1, TEXT("Args missing before operator, bad expression"));
+				const FSUDSValue& Arg1 = *Stack[StackTop - 1];
+				// We always let unset variables degrade to false
+				check(Arg1.GetType() == ESUDSValueType::Boolean || Arg1.GetType() == ESUDSValueType::Variable);
+				const bool bJumpValue = Op.OpCode == ESUDSExpressionOpCode::JumpIfTrue;
+				if (Arg1.GetBooleanValue() == bJumpValue)
+				{
+					// This decides the result, skip the right hand side
+					Stack[StackTop - 1] = bJumpValue ? &TrueValue : &FalseValue;
+					PC += Op.Operand;
+				}
+				else
+				{
+					// Right hand side decides the result
+					--StackTop;
+				}
+			}
+			break;
+		case ESUDSExpressionOpCode::ToBoolean:
+			{
+				checkf(StackTop >= 1, TEXT("Args missing before operator, bad expression"));
+				const FSUDSValue& Arg1 = *Stack[StackTop - 1];
+				check(Arg1.GetType() == ESUDSValueType::Boolean || Arg1.GetType() == ESUDSValueType::Variable);
+				Stack[StackTop - 1] = Arg1.GetBooleanValue() ? &TrueValue : &FalseValue;
+			}
+			break;
+		case ESUDSExpressionOpCode::BoolNot:
+			checkf(StackTop >= 1, TEXT("Args missing before operator, bad expression"));
+			Stack[StackTop - 1] = Stack[StackTop - 1]->GetIntValueUnchecked() != 0 ? &FalseValue : &TrueValue;
+			break;
+		default:
+			{
+				checkf(StackTop >= 2, TEXT("Args missing before operator, bad expression"));
+				// Arg2 (RHS) is on top
+				const FSUDSValue& Arg2 = *Stack[--StackTop];
+				const FSUDSValue& Arg1 = *Stack[StackTop - 1];
+				Stack[StackTop - 1] = &Results.Add_GetRef(Op.OpCode >= ESUDSExpressionOpCode::IntMultiply
+					                                          ? EvaluateTypedOperator(Op, Arg1, Arg2)
+					                                          : EvaluateOperator(Op.OpCode, Arg1, Arg2));
+			}
+			break;
 		}
 	}
 	
-	checkf(EvalStack.Num() == 1, TEXT("We should end with a single item in the eval stack and it should be an operand"));
+	checkf(StackTop == 1, TEXT("We should end with a single item in the eval stack"));
 
-	return EvaluateOperand(EvalStack.Top().GetOperandValue(), Variables, GlobalVariables);
+	OutResult = *Stack[0];
+	return true;
 }
 
 bool FSUDSExpression::EvaluateBoolean(const TMap<FName, FSUDSValue>& Variables, const TMap<FName, FSUDSValue>& GlobalVariables, const FString& ErrorContext) const
 {
-	const auto Result = Evaluate(Variables, GlobalVariables);
+	return CheckBooleanResult(Evaluate(Variables, GlobalVariables), ErrorContext);
+}
 
+bool FSUDSExpression::EvaluateBoolean(const TMap<FName, FSUDSValue>& Variables,
+                                      const TMap<FName, FSUDSValue>& GlobalVariables,
+                                      const FString& ErrorContext,
+                                      FSUDSVariableRequestFunc OnVariableRequested) const
+{
+	return CheckBooleanResult(Evaluate(Variables, GlobalVariables, OnVariableRequested), ErrorContext);
+}
+
+bool FSUDSExpression::EvaluateBoolean(const ISUDSVariableSource& Variables,
+                                      const FString& ErrorContext,
+                                      FSUDSVariableRequestFunc OnVariableRequested) const
+{
+	return CheckBooleanResult(Evaluate(Variables, OnVariableRequested), ErrorContext);
+}
+
+bool FSUDSExpression::CheckBooleanResult(const FSUDSValue& Result, const FString& ErrorContext) const
+{
 	if (Result.GetType() != ESUDSValueType::Boolean &&
 		Result.GetType() != ESUDSValueType::Variable) // Allow unresolved variable, will assume false
 	{
@@ -381,79 +1403,123 @@ bool FSUDSExpression::EvaluateBoolean(const TMap<FName, FSUDSValue>& Variables,
 	return Result.GetBooleanValue();
 }
 
-FSUDSExpressionItem FSUDSExpression::EvaluateOperator(ESUDSExpressionItemType Op,
-                                                      const FSUDSExpressionItem& Arg1,
-                                                      const FSUDSExpressionItem& Arg2,
-                                                      const TMap<FName, FSUDSValue>& Variables,
-                                                      const TMap<FName, FSUDSValue>& GlobalVariables) const
+FSUDSValue FSUDSExpression::EvaluateOperator(ESUDSExpressionOpCode Op,
+                                             const FSUDSValue& Arg1,
+                                             const FSUDSValue& Arg2)
 {
-	const FSUDSValue Val1 = EvaluateOperand(Arg1.GetOperandValue(), Variables, GlobalVariables);
-	FSUDSValue Val2;
-	if (Arg1.IsBinaryOperator())
-	{
-		Val2 = EvaluateOperand(Arg2.GetOperandValue(), Variables, GlobalVariables);
-	}
-
 	switch (Op)
 	{
-	case ESUDSExpressionItemType::Not:
-		return FSUDSExpressionItem(!Val1);
-	case ESUDSExpressionItemType::Multiply:
-		return FSUDSExpressionItem(Val1 * Val2);
-	case ESUDSExpressionItemType::Divide:
-		return FSUDSExpressionItem(Val1 / Val2);
-	case ESUDSExpressionItemType::Modulo:
-		return FSUDSExpressionItem(Val1 % Val2);
-	case ESUDSExpressionItemType::Add:
-		return FSUDSExpressionItem(Val1 + Val2);
-	case ESUDSExpressionItemType::Subtract:
-		return FSUDSExpressionItem(Val1 - Val2);
-	case ESUDSExpressionItemType::Less:
-		return FSUDSExpressionItem(Val1 < Val2);
-	case ESUDSExpressionItemType::LessEqual:
-		return FSUDSExpressionItem(Val1 <= Val2);
-	case ESUDSExpressionItemType::Greater:
-		return FSUDSExpressionItem(Val1 > Val2);
-	case ESUDSExpressionItemType::GreaterEqual:
-		return FSUDSExpressionItem(Val1 >= Val2);
-	case ESUDSExpressionItemType::Equal:
-		return FSUDSExpressionItem(Val1 == Val2);
-	case ESUDSExpressionItemType::NotEqual:
-		return FSUDSExpressionItem(Val1 != Val2);
-	case ESUDSExpressionItemType::And:
-		return FSUDSExpressionItem(Val1 && Val2);
-	case ESUDSExpressionItemType::Or:
-		return FSUDSExpressionItem(Val1 || Val2);
-
+	case ESUDSExpressionOpCode::Not:
+		return !Arg1;
+	case ESUDSExpressionOpCode::Multiply:
+		return Arg1 * Arg2;
+	case ESUDSExpressionOpCode::Divide:
+		return Arg1 / Arg2;
+	case ESUDSExpressionOpCode::Modulo:
+		return Arg1 % Arg2;
+	case ESUDSExpressionOpCode::Add:
+		return Arg1 + Arg2;
+	case ESUDSExpressionOpCode::Subtract:
+		return Arg1 - Arg2;
+	case ESUDSExpressionOpCode::Less:
+		return Arg1 < Arg2;
+	case ESUDSExpressionOpCode::LessEqual:
+		return Arg1 <= Arg2;
+	case ESUDSExpressionOpCode::Greater:
+		return Arg1 > Arg2;
+	case ESUDSExpressionOpCode::GreaterEqual:
+		return Arg1 >= Arg2;
+	case ESUDSExpressionOpCode::Equal:
+		return Arg1 == Arg2;
+	case ESUDSExpressionOpCode::NotEqual:
+		return Arg1 != Arg2;
 		
 	default: // these won't occur
-	case ESUDSExpressionItemType::Null:
-	case ESUDSExpressionItemType::Operand:
-	case ESUDSExpressionItemType::LParens:
-	case ESUDSExpressionItemType::RParens:
-		return FSUDSExpressionItem();
+		return FSUDSValue();
 	};
 	
 }
 
-FSUDSValue FSUDSExpression::EvaluateOperand(const FSUDSValue& Operand,
-                                            const TMap<FName, FSUDSValue>& Variables,
-                                            const TMap<FName, FSUDSValue>& GlobalVariables) const
+FSUDSValue FSUDSExpression::EvaluateTypedOperator(const FSUDSExpressionOp& Op,
+                                                  const FSUDSValue& Arg1,
+                                                  const FSUDSValue& Arg2)
+{
+	// Types were checked when these were compiled and when variables were read, so no need to check them again here.
+	// Results match the general FSUDSValue operators
+	const int32 I1 = Arg1.GetIntValueUnchecked();
+	const int32 I2 = Arg2.GetIntValueUnchecked();
+	const float F1 = (Op.OperandFlags & FSUDSExpressionOp::Arg1IsInt) ? (float)I1 : Arg1.GetFloatValueUnchecked();
+	const float F2 = (Op.OperandFlags & FSUDSExpressionOp::Arg2IsInt) ? (float)I2 : Arg2.GetFloatValueUnchecked();
+	switch (Op.OpCode)
+	{
+	case ESUDSExpressionOpCode::IntMultiply:
+		return FSUDSValue(I1 * I2);
+	case ESUDSExpressionOpCode::IntDivide:
+		return FSUDSValue(I1 / I2);
+	case ESUDSExpressionOpCode::IntModulo:
+		return FSUDSValue(I1 % I2);
+	case ESUDSExpressionOpCode::IntAdd:
+		return FSUDSValue(I1 + I2);
+	case ESUDSExpressionOpCode::IntSubtract:
+		return FSUDSValue(I1 - I2);
+	case ESUDSExpressionOpCode::IntLess:
+		return FSUDSValue(I1 < I2);
+	case ESUDSExpressionOpCode::IntLessEqual:
+		return FSUDSValue(I1 <= I2);
+	case ESUDSExpressionOpCode::IntGreater:
+		return FSUDSValue(I1 > I2);
+	case ESUDSExpressionOpCode::IntGreaterEqual:
+		return FSUDSValue(I1 >= I2);
+	case ESUDSExpressionOpCode::IntEqual:
+	case ESUDSExpressionOpCode::BoolEqual:
+		return FSUDSValue(I1 == I2);
+	case ESUDSExpressionOpCode::IntNotEqual:
+	case ESUDSExpressionOpCode::BoolNotEqual:
+		return FSUDSValue(I1 != I2);
+	case ESUDSExpressionOpCode::FloatMultiply:
+		return FSUDSValue(F1 * F2);
+	case ESUDSExpressionOpCode::FloatDivide:
+		return FSUDSValue(F1 / F2);
+	case ESUDSExpressionOpCode::FloatModulo:
+		return FSUDSValue(F2 != 0 ? FMath::Fmod(F1, F2) : 0.0f);
+	case ESUDSExpressionOpCode::FloatAdd:
+		return FSUDSValue(F1 + F2);
+	case ESUDSExpressionOpCode::FloatSubtract:
+		return FSUDSValue(F1 - F2);
+	case ESUDSExpressionOpCode::FloatLess:
+		return FSUDSValue(F1 < F2);
+	case ESUDSExpressionOpCode::FloatLessEqual:
+		return FSUDSValue(F1 < F2 || FMath::IsNearlyEqual(F1, F2));
+	case ESUDSExpressionOpCode::FloatGreater:
+		return FSUDSValue(F2 < F1);
+	case ESUDSExpressionOpCode::FloatGreaterEqual:
+		return FSUDSValue(F2 < F1 || FMath::IsNearlyEqual(F1, F2));
+	case ESUDSExpressionOpCode::FloatEqual:
+		return FSUDSValue(FMath::IsNearlyEqual(F1, F2));
+	case ESUDSExpressionOpCode::FloatNotEqual:
+		return FSUDSValue(!FMath::IsNearlyEqual(F1, F2));
+	default: // these won't occur
+		return FSUDSValue();
+	}
+}
+
+const FSUDSValue& FSUDSExpression::FindOperandValue(const FSUDSValue& Operand,
+                                                    int32 Slot,
+                                                    const FName& GlobalName,
+                                                    const ISUDSVariableSource& Variables)
 {
 	// Simplify conversion to variable values
 	if (Operand.IsVariable())
 	{
-		FName Name = Operand.GetVariableNameValue();
-		FName GlobalName;
-		if (USUDSLibrary::IsDialogueVariableGlobal(Name, GlobalName))
+		if (!GlobalName.IsNone())
 		{
-			// This will have stripped the prefix so direct find is OK
-			if (const auto Var = GlobalVariables.Find(GlobalName))
+			// Prefix is already stripped so direct find is OK
+			if (const auto Var = Variables.FindGlobalVariable(GlobalName))
 			{
 				return *Var;
 			}
 		}
-		if (const auto Var = Variables.Find(Operand.GetVariableNameValue()))
+		if (const auto Var = Variables.FindVariable(Operand.GetVariableNameValue(), Slot))
 		{
 			return *Var;
 		}
@@ -2,4 +2,26 @@
 // Released under the MIT license https://opensource.org/license/MIT/
 #include "SUDSParticipant.h"
 
-
+bool FSUDSParticipantSubscription::WantsVariable(const FName& VariableName) const
+{
+	if (VariableNames.IsEmpty() && VariablePrefixes.IsEmpty())
+	{
+		return true;
+	}
+	if (VariableNames.Contains(VariableName))
+	{
+		return true;
+	}
+	if (!VariablePrefixes.IsEmpty())
+	{
+		const FString NameStr = VariableName.ToString();
+		for (const auto& Prefix : VariablePrefixes)
+		{
+			if (NameStr.StartsWith(Prefix))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
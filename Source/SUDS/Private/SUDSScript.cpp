@@ -2,8 +2,11 @@
 // Released under the MIT license https://opensource.org/license/MIT/
 #include "SUDSScript.h"
 
+#include "SUDSLibrary.h"
 #include "SUDSScriptNode.h"
+#include "SUDSScriptNodeEvent.h"
 #include "SUDSScriptNodeGosub.h"
+#include "SUDSScriptNodeSet.h"
 #include "SUDSScriptNodeText.h"
 #include "EditorFramework/AssetImportData.h"
 
@@ -27,7 +30,7 @@ USUDSScriptNode* USUDSScript::GetNextNode(const USUDSScriptNode* Node) const
 	case 0:
 		return nullptr;
 	case 1:
-		return Node->GetEdge(0)->GetTargetNode().Get();
+		return GetEdgeTarget(Node, 0);
 	default:
 		UE_LOG(LogSUDS, Error, TEXT("Called GetNextNode on a node with more than one edge"));
 		return nullptr;
@@ -95,7 +98,7 @@ int USUDSScript::RecurseLookForChoice(USUDSScriptNode* CurrNode)
 			// When we hit a gosub here we go into it, not after it
 			if (auto GosubNode = Cast<USUDSScriptNodeGosub>(CurrNode))
 			{
-				int SubResult = RecurseLookForChoice(GetNodeByLabel(GosubNode->GetLabelName()));
+				int SubResult = RecurseLookForChoice(GetGosubTarget(GosubNode));
 				if (SubResult != 0)
 				{
 					// Found definitive result (choice or text) inside sub
@@ -115,8 +118,87 @@ int USUDSScript::RecurseLookForChoice(USUDSScriptNode* CurrNode)
 	return kChoiceNotFoundBeforeEnd;
 }
 
+USUDSScriptNode* USUDSScript::GetEdgeTarget(const USUDSScriptNode* Node, int EdgeIndex) const
+{
+	if (const FSUDSRuntimeNode* RNode = GetRuntimeNode(Node))
+	{
+		if (EdgeIndex >= 0 && EdgeIndex < RNode->NumEdges)
+		{
+			const int32 TargetIdx = RuntimeEdgeTargets[RNode->FirstEdge + EdgeIndex];
+			return TargetIdx != INDEX_NONE ? RuntimeNodes[TargetIdx].Node : nullptr;
+		}
+		return nullptr;
+	}
+
+	// Not built yet
+	const FSUDSScriptEdge* Edge = Node ? Node->GetEdge(EdgeIndex) : nullptr;
+	return Edge ? Edge->GetTargetNode().Get() : nullptr;
+}
+
+USUDSScriptNode* USUDSScript::GetGosubTarget(const USUDSScriptNode* GosubNode) const
+{
+	if (const FSUDSRuntimeNode* RNode = GetRuntimeNode(GosubNode))
+	{
+		return RNode->GosubTarget != INDEX_NONE ? RuntimeNodes[RNode->GosubTarget].Node : nullptr;
+	}
+
+	// Not built yet
+	if (auto Gosub = Cast<USUDSScriptNodeGosub>(GosubNode))
+	{
+		return GetNodeByLabel(Gosub->GetLabelName());
+	}
+	return nullptr;
+}
+
+void USUDSScript::BuildRuntimeGraph()
+{
+	RuntimeNodes.Empty(Nodes.Num() + HeaderNodes.Num());
+	RuntimeEdgeTargets.Empty();
+
+	auto AddNodes = [this](const TArray<TObjectPtr<USUDSScriptNode>>& NodeList)
+	{
+		for (auto Node : NodeList)
+		{
+			const int32 Idx = RuntimeNodes.Num();
+			Node->SetRuntimeIndex(Idx);
+			FSUDSRuntimeNode& RNode = RuntimeNodes.AddDefaulted_GetRef();
+			RNode.Node = Node;
+			RNode.Type = Node->GetNodeType();
+		}
+	};
+	AddNodes(Nodes);
+	AddNodes(HeaderNodes);
+
+	// Now that every node has an index, resolve edges & gosubs
+	for (auto& RNode : RuntimeNodes)
+	{
+		RNode.FirstEdge = RuntimeEdgeTargets.Num();
+		RNode.NumEdges = RNode.Node->GetEdgeCount();
+		for (auto& Edge : RNode.Node->GetEdges())
+		{
+			const USUDSScriptNode* Target = Edge.GetTargetNode().Get();
+			RuntimeEdgeTargets.Add(Target ? Target->GetRuntimeIndex() : INDEX_NONE);
+		}
+
+		if (RNode.Type == ESUDSScriptNodeType::Gosub)
+		{
+			if (auto Gosub = Cast<USUDSScriptNodeGosub>(RNode.Node))
+			{
+				if (const int* pIdx = LabelList.Find(Gosub->GetLabelName()))
+				{
+					RNode.GosubTarget = *pIdx;
+				}
+			}
+		}
+	}
+}
+
 void USUDSScript::FinishImport()
 {
+	BuildRuntimeGraph();
+	bNodeIDIndexesBuilt = false;
+	ClearStepVariableNames();
+
 	// As an optimisation, make all text/gosub nodes pre-scan their follow-on nodes for choice nodes
 	// We can actually have intermediate nodes, for example set nodes which run for all choices that are placed
 	// between the text and the first choice. Resolve whether they exist now
@@ -150,9 +232,293 @@ void USUDSScript::FinishImport()
 			}
 		}
 	}
+
+	BuildVariableTable(true);
+	BuildHeaderDefaults();
+	BuildChoicePlans();
+	UpdateChoiceOrdinals();
 	
 }
 
+void USUDSScript::BuildVariableTable(bool bIncludeTextParameters)
+{
+	// Header first, so that the variables initialised at the start get the lowest slots
+	TArray<FName> Names;
+	for (auto Node : HeaderNodes)
+	{
+		Node->GetReferencedVariableNames(Names, bIncludeTextParameters);
+	}
+	for (auto Node : Nodes)
+	{
+		Node->GetReferencedVariableNames(Names, bIncludeTextParameters);
+	}
+
+	// Globals live in the subsystem, not in the dialogue
+	VariableNames.Empty();
+	for (auto& Name : Names)
+	{
+		FName GlobalName;
+		if (!USUDSLibrary::IsDialogueVariableGlobal(Name, GlobalName))
+		{
+			VariableNames.Add(Name);
+		}
+	}
+
+	ResolveVariableSlots();
+}
+
+void USUDSScript::ResolveVariableSlots()
+{
+	VariableSlotMap.Empty(VariableNames.Num());
+	for (int i = 0; i < VariableNames.Num(); ++i)
+	{
+		VariableSlotMap.Add(VariableNames[i], i);
+	}
+
+	for (auto Node : HeaderNodes)
+	{
+		Node->ResolveVariableSlots(VariableSlotMap);
+	}
+	for (auto Node : Nodes)
+	{
+		Node->ResolveVariableSlots(VariableSlotMap);
+	}
+}
+
+void USUDSScript::PostLoad()
+{
+	Super::PostLoad();
+
+	BuildRuntimeGraph();
+	bNodeIDIndexesBuilt = false;
+	ClearStepVariableNames();
+	if (VariableNames.IsEmpty())
+	{
+		// Imported before we had variable tables; build it now, but leave text parameters out since string tables
+		// may not be loaded yet. Dialogues cope with variables that aren't in the table, they're just slower
+		BuildVariableTable(false);
+	}
+	else
+	{
+		ResolveVariableSlots();
+	}
+	BuildHeaderDefaults();
+	BuildChoicePlans();
+}
+
+void USUDSScript::BuildChoicePlans()
+{
+	// Work out the path from each text node to its choices now, so that dialogues don't have to walk it twice (once
+	// to find out whether there's a choice, then again to run it). Only paths through selects or gosubs depend
+	// on state; those are left to be walked at runtime
+	ChoicePlans.Empty();
+	for (auto Node : Nodes)
+	{
+		// Text nodes inside a gosub can have choices after returning even if they're not flagged as such, so
+		// every text node gets a plan
+		if (Node->GetNodeType() != ESUDSScriptNodeType::Text &&
+			Node->GetNodeType() != ESUDSScriptNodeType::Gosub)
+		{
+			continue;
+		}
+
+		FSUDSChoicePlan& Plan = ChoicePlans.Add(Node);
+		USUDSScriptNode* CurrNode = Node->GetEdgeCount() == 1 ? GetNextNode(Node) : nullptr;
+		while (CurrNode)
+		{
+			const ESUDSScriptNodeType Type = CurrNode->GetNodeType();
+			if (Type == ESUDSScriptNodeType::Choice)
+			{
+				Plan.RootChoiceNode = CurrNode;
+				Plan.Result = ESUDSChoicePlanResult::Choice;
+				break;
+			}
+			if (Type == ESUDSScriptNodeType::Text)
+			{
+				break;
+			}
+			if (Type == ESUDSScriptNodeType::Select || Type == ESUDSScriptNodeType::Gosub)
+			{
+				Plan.Result = ESUDSChoicePlanResult::Dynamic;
+				break;
+			}
+
+			Plan.IntermediateNodes.Add(CurrNode);
+			if (Type == ESUDSScriptNodeType::Return)
+			{
+				Plan.Result = ESUDSChoicePlanResult::Return;
+				break;
+			}
+			// Set and event nodes only have one way out
+			CurrNode = GetNextNode(CurrNode);
+		}
+		if (Plan.Result != ESUDSChoicePlanResult::Choice && Plan.Result != ESUDSChoicePlanResult::Return)
+		{
+			// Nothing to run if there's no choice
+			Plan.IntermediateNodes.Empty();
+		}
+	}
+}
+
+void USUDSScript::BuildHeaderDefaults()
+{
+	// Most headers are just [set]s of literals, which give the same result for every dialogue. Evaluate those once
+	// here, stopping at the first node which could depend on state (variables, globals, participants) or control flow
+	// so that everything from there on is still run by each dialogue, in the same order as before
+	HeaderDefaults.Reset();
+	USUDSScriptNode* Node = GetHeaderNode();
+	while (Node && Node->GetNodeType() == ESUDSScriptNodeType::SetVariable)
+	{
+		auto SetNode = Cast<USUDSScriptNodeSet>(Node);
+		if (!SetNode ||
+			SetNode->IsGlobal() ||
+			!SetNode->GetExpression().IsValid() ||
+			SetNode->GetExpression().GetVariableNames().Num() > 0)
+		{
+			break;
+		}
+
+		const TMap<FName, FSUDSValue> NoVariables;
+		HeaderDefaults.Add(FSUDSHeaderDefault { SetNode, SetNode->GetExpression().Evaluate(NoVariables, NoVariables) });
+		Node = GetNextNode(Node);
+	}
+	HeaderResumeNode = Node;
+
+	// The values each dialogue starts with, for saving only what's changed. Leave out anything that the rest of the
+	// header might set again, since then the value after the header isn't known until it's run
+	HeaderDefaultValues.Reset();
+	for (const auto& Default : HeaderDefaults)
+	{
+		HeaderDefaultValues.Add(Default.Node->GetIdentifier(), Default.Value);
+	}
+	for (auto HeaderNode : HeaderNodes)
+	{
+		if (auto SetNode = Cast<USUDSScriptNodeSet>(HeaderNode))
+		{
+			if (!HeaderDefaults.ContainsByPredicate([SetNode](const FSUDSHeaderDefault& D) { return D.Node == SetNode; }))
+			{
+				HeaderDefaultValues.Remove(SetNode->GetIdentifier());
+			}
+		}
+	}
+}
+
+void USUDSScript::ClearStepVariableNames()
+{
+	// These are derived from the nodes, so have to be forgotten when the nodes change; they're rebuilt on demand
+	FWriteScopeLock WriteLock(StepVariableNamesLock);
+	StepVariableNames.Empty();
+}
+
+void USUDSScript::GetStepVariableNames(const USUDSScriptNode* FromNode, TArray<FName>& OutNames) const
+{
+	{
+		FReadScopeLock ReadLock(StepVariableNamesLock);
+		if (const TArray<FName>* pNames = StepVariableNames.Find(FromNode))
+		{
+			OutNames = *pNames;
+			return;
+		}
+	}
+
+	// Built on demand, rather than at import or load, because text parameters need the string tables.
+	// Collecting fills caches on the text nodes as well, so it has to be done under the lock too. Check again since
+	// another dialogue may have collected them while we were waiting
+	FWriteScopeLock WriteLock(StepVariableNamesLock);
+	if (const TArray<FName>* pNames = StepVariableNames.Find(FromNode))
+	{
+		OutNames = *pNames;
+		return;
+	}
+	OutNames.Reset();
+	TSet<const USUDSScriptNode*> Visited;
+	CollectStepVariableNames(FromNode, false, OutNames, Visited);
+	StepVariableNames.Add(FromNode, OutNames);
+}
+
+void USUDSScript::CollectStepVariableNames(const USUDSScriptNode* Node,
+                                           bool bAfterText,
+                                           TArray<FName>& OutNames,
+                                           TSet<const USUDSScriptNode*>& Visited) const
+{
+	// Follows every path from a node that a step could run: up to the next text node, then after that only to
+	// the choices which would be presented with it. Returns from gosubs aren't followed since the destination isn't
+	// known statically; any variables on the other side are just requested individually when they're used
+	while (Node)
+	{
+		bool bAlreadyVisited = false;
+		Visited.Add(Node, &bAlreadyVisited);
+		if (bAlreadyVisited)
+		{
+			return;
+		}
+
+		switch (Node->GetNodeType())
+		{
+		case ESUDSScriptNodeType::Text:
+			if (bAfterText)
+			{
+				// Next step
+				return;
+			}
+			Node->GetReferencedVariableNames(OutNames, true);
+			if (auto TextNode = Cast<USUDSScriptNodeText>(Node))
+			{
+				if (!TextNode->MayHaveChoices())
+				{
+					return;
+				}
+			}
+			bAfterText = true;
+			Node = GetNextNode(Node);
+			break;
+		case ESUDSScriptNodeType::Choice:
+		case ESUDSScriptNodeType::Select:
+			if (Node->GetNodeType() == ESUDSScriptNodeType::Choice && !bAfterText)
+			{
+				// Choices are always attached to text, can't start a step
+				return;
+			}
+			// Conditions and choice text
+			Node->GetReferencedVariableNames(OutNames, true);
+			for (const auto& Edge : Node->GetEdges())
+			{
+				// Choices lead to the next step
+				if (Edge.GetType() != ESUDSEdgeType::Decision)
+				{
+					CollectStepVariableNames(Edge.GetTargetNode().Get(), bAfterText, OutNames, Visited);
+				}
+			}
+			return;
+		case ESUDSScriptNodeType::SetVariable:
+			// Not the set variable itself, that's not requested
+			if (auto SetNode = Cast<USUDSScriptNodeSet>(Node))
+			{
+				for (const auto& Name : SetNode->GetExpression().GetVariableNames())
+				{
+					OutNames.AddUnique(Name);
+				}
+			}
+			Node = GetNextNode(Node);
+			break;
+		case ESUDSScriptNodeType::Event:
+			Node->GetReferencedVariableNames(OutNames, true);
+			Node = GetNextNode(Node);
+			break;
+		case ESUDSScriptNodeType::Gosub:
+			if (auto GosubNode = Cast<USUDSScriptNodeGosub>(Node))
+			{
+				CollectStepVariableNames(GetGosubTarget(GosubNode), bAfterText, OutNames, Visited);
+			}
+			Node = GetNextNode(Node);
+			break;
+		default:
+		case ESUDSScriptNodeType::Return:
+			return;
+		}
+	}
+}
+
 USUDSScriptNode* USUDSScript::GetHeaderNode() const
 {
 	if (HeaderNodes.Num() > 0)
@@ -180,39 +546,124 @@ USUDSScriptNode* USUDSScript::GetNodeByLabel(const FName& Label) const
 	
 }
 
-USUDSScriptNodeText* USUDSScript::GetNodeByTextID(const FString& TextID) const
+void USUDSScript::EnsureNodeIDIndexesBuilt() const
+{
+	// Checked again under the lock in case another thread built them while we were waiting. Once built they're only
+	// read until the next import or load
+	if (!bNodeIDIndexesBuilt.load(std::memory_order_acquire))
+	{
+		FWriteScopeLock WriteLock(NodeIDIndexesLock);
+		if (!bNodeIDIndexesBuilt.load(std::memory_order_relaxed))
+		{
+			BuildNodeIDIndexes();
+			bNodeIDIndexesBuilt.store(true, std::memory_order_release);
+		}
+	}
+}
+
+void USUDSScript::BuildNodeIDIndexes() const
 {
-	for (auto N : Nodes)
+	// Built on first use rather than on load, since text IDs come from string tables which may not be loaded then
+	TextIDIndex.Empty();
+	GosubIDIndex.Empty();
+	for (int i = 0; i < Nodes.Num(); ++i)
 	{
-		if (N->GetNodeType() == ESUDSScriptNodeType::Text)
+		switch (Nodes[i]->GetNodeType())
 		{
-			if (auto TN = Cast<USUDSScriptNodeText>(N))
+		case ESUDSScriptNodeType::Text:
+			if (auto TN = Cast<USUDSScriptNodeText>(Nodes[i]))
 			{
-				if (TextID.Equals(TN->GetTextID()))
-				{
-					return TN;
-				}
+				TextIDIndex.FindOrAdd(TN->GetTextID(), i);
 			}
+			break;
+		case ESUDSScriptNodeType::Gosub:
+			if (auto GN = Cast<USUDSScriptNodeGosub>(Nodes[i]))
+			{
+				GosubIDIndex.FindOrAdd(GN->GetGosubID(), i);
+			}
+			break;
+		default: break;
 		}
 	}
-	return nullptr;
+
+	RuntimeChoiceOrdinals = ChoiceOrdinals;
+	if (RuntimeChoiceOrdinals.IsEmpty())
+	{
+		// Imported before choices had ordinals, derive them from the node order (stable until re-imported)
+		CollectChoiceIDs(RuntimeChoiceOrdinals);
+	}
+	ChoiceOrdinalIndex.Empty(RuntimeChoiceOrdinals.Num());
+	for (int i = 0; i < RuntimeChoiceOrdinals.Num(); ++i)
+	{
+		ChoiceOrdinalIndex.FindOrAdd(RuntimeChoiceOrdinals[i], i);
+	}
 }
 
-USUDSScriptNodeGosub* USUDSScript::GetNodeByGosubID(const FString& ID) const
+void USUDSScript::CollectChoiceIDs(TArray<FString>& OutIDs) const
 {
-	for (auto N : Nodes)
+	// Decision edges only exist on choice nodes
+	for (auto Node : Nodes)
 	{
-		if (N->GetNodeType() == ESUDSScriptNodeType::Text)
+		if (Node->GetNodeType() == ESUDSScriptNodeType::Choice)
 		{
-			if (auto GN = Cast<USUDSScriptNodeGosub>(N))
+			for (auto& Edge : Node->GetEdges())
 			{
-				if (ID.Equals(GN->GetGosubID()))
+				if (Edge.GetType() == ESUDSEdgeType::Decision)
 				{
-					return GN;
+					OutIDs.AddUnique(Edge.GetTextID());
 				}
 			}
 		}
 	}
+}
+
+void USUDSScript::UpdateChoiceOrdinals()
+{
+	// Keep existing ordinals from a previous import, so that compact saves from older versions still line up
+	TArray<FString> IDs;
+	CollectChoiceIDs(IDs);
+	for (auto& ID : IDs)
+	{
+		ChoiceOrdinals.AddUnique(ID);
+	}
+}
+
+int32 USUDSScript::GetNumChoiceOrdinals() const
+{
+	EnsureNodeIDIndexesBuilt();
+	return RuntimeChoiceOrdinals.Num();
+}
+
+int32 USUDSScript::GetChoiceOrdinal(const FString& ChoiceID) const
+{
+	EnsureNodeIDIndexesBuilt();
+	const int32* pOrdinal = ChoiceOrdinalIndex.Find(ChoiceID);
+	return pOrdinal ? *pOrdinal : INDEX_NONE;
+}
+
+const FString* USUDSScript::GetChoiceIDByOrdinal(int32 Ordinal) const
+{
+	EnsureNodeIDIndexesBuilt();
+	return RuntimeChoiceOrdinals.IsValidIndex(Ordinal) ? &RuntimeChoiceOrdinals[Ordinal] : nullptr;
+}
+
+USUDSScriptNodeText* USUDSScript::GetNodeByTextID(const FString& TextID) const
+{
+	EnsureNodeIDIndexesBuilt();
+	if (const int32* pIdx = TextIDIndex.Find(TextID))
+	{
+		return Cast<USUDSScriptNodeText>(Nodes[*pIdx]);
+	}
+	return nullptr;
+}
+
+USUDSScriptNodeGosub* USUDSScript::GetNodeByGosubID(const FString& ID) const
+{
+	EnsureNodeIDIndexesBuilt();
+	if (const int32* pIdx = GosubIDIndex.Find(ID))
+	{
+		return Cast<USUDSScriptNodeGosub>(Nodes[*pIdx]);
+	}
 	return nullptr;
 }
 
@@ -2,6 +2,7 @@
 // Released under the MIT license https://opensource.org/license/MIT/
 #include "SUDSScriptEdge.h"
 
+#include "SUDSScript.h"
 #include "SUDSScriptNode.h"
 
 
@@ -23,13 +24,17 @@ void FSUDSScriptEdge::ExtractFormat() const
 	// Only do this on demand, and only once
 	TextFormat = Text;
 	ParameterNames.Empty();
+	ParameterRefs.Empty();
 	TArray<FString> TextParams;
 	TextFormat.GetFormatArgumentNames(TextParams);
 	for (auto Param : TextParams)
 	{
-		ParameterNames.Add(FName(Param));
+		// Scope is resolved here, once, so that it doesn't need parsing every time the text is shown
+		const FSUDSVariableRef& Ref = ParameterRefs.Add_GetRef(FSUDSVariableRef(Param));
+		ParameterNames.Add(Ref.Name);
 	}
 	bFormatExtracted = true;
+	bParameterSlotsResolved = false;
 }
 
 FString FSUDSScriptEdge::GetTextID() const
@@ -77,3 +82,20 @@ bool FSUDSScriptEdge::HasParameters() const
 	return !ParameterNames.IsEmpty();
 	
 }
+
+const TArray<FSUDSVariableRef>& FSUDSScriptEdge::GetParameterRefs(const USUDSScript* Script) const
+{
+	if (!bFormatExtracted)
+	{
+		ExtractFormat();
+	}
+	if (!bParameterSlotsResolved)
+	{
+		for (auto& Ref : ParameterRefs)
+		{
+			Ref.Slot = Script && !Ref.IsGlobal() ? Script->GetVariableSlot(Ref.Name) : INDEX_NONE;
+		}
+		bParameterSlotsResolved = true;
+	}
+	return ParameterRefs;
+}
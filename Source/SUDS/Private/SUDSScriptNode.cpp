@@ -36,3 +36,29 @@ void USUDSScriptNode::AddEdge(const FSUDSScriptEdge& NewEdge)
 	Edges.Add(NewEdge);
 }
 
+void USUDSScriptNode::GetReferencedVariableNames(TArray<FName>& OutNames, bool bIncludeTextParameters) const
+{
+	for (auto& Edge : Edges)
+	{
+		for (auto& Name : Edge.GetCondition().GetVariableNames())
+		{
+			OutNames.AddUnique(Name);
+		}
+		if (bIncludeTextParameters && !Edge.GetText().IsEmpty())
+		{
+			for (auto& Name : Edge.GetParameterNames())
+			{
+				OutNames.AddUnique(Name);
+			}
+		}
+	}
+}
+
+void USUDSScriptNode::ResolveVariableSlots(const TMap<FName, int32>& SlotMap)
+{
+	for (auto& Edge : Edges)
+	{
+		Edge.ResolveVariableSlots(SlotMap);
+	}
+}
+
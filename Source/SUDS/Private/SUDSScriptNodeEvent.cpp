@@ -10,3 +10,26 @@ void USUDSScriptNodeEvent::Init(const FString& EvtName, const TArray<FSUDSExpres
 	SourceLineNo = LineNo;
 	
 }
+
+void USUDSScriptNodeEvent::GetReferencedVariableNames(TArray<FName>& OutNames, bool bIncludeTextParameters) const
+{
+	Super::GetReferencedVariableNames(OutNames, bIncludeTextParameters);
+
+	for (auto& Arg : Args)
+	{
+		for (auto& Name : Arg.GetVariableNames())
+		{
+			OutNames.AddUnique(Name);
+		}
+	}
+}
+
+void USUDSScriptNodeEvent::ResolveVariableSlots(const TMap<FName, int32>& SlotMap)
+{
+	Super::ResolveVariableSlots(SlotMap);
+
+	for (auto& Arg : Args)
+	{
+		Arg.ResolveVariableSlots(SlotMap);
+	}
+}
@@ -2,10 +2,43 @@
 // Released under the MIT license https://opensource.org/license/MIT/
 #include "SUDSScriptNodeSet.h"
 
+#include "SUDSLibrary.h"
+
 void USUDSScriptNodeSet::Init(const FString& VarName, const FSUDSExpression& InExpression, int LineNo)
 {
 	NodeType = ESUDSScriptNodeType::SetVariable;
 	Identifier = FName(VarName);
 	Expression = InExpression;
 	SourceLineNo = LineNo;
+	ResolveScope();
+}
+
+void USUDSScriptNodeSet::ResolveScope()
+{
+	if (!USUDSLibrary::IsDialogueVariableGlobal(Identifier, GlobalIdentifier))
+	{
+		GlobalIdentifier = NAME_None;
+	}
+}
+
+void USUDSScriptNodeSet::GetReferencedVariableNames(TArray<FName>& OutNames, bool bIncludeTextParameters) const
+{
+	Super::GetReferencedVariableNames(OutNames, bIncludeTextParameters);
+
+	OutNames.AddUnique(Identifier);
+	for (auto& Name : Expression.GetVariableNames())
+	{
+		OutNames.AddUnique(Name);
+	}
+}
+
+void USUDSScriptNodeSet::ResolveVariableSlots(const TMap<FName, int32>& SlotMap)
+{
+	Super::ResolveVariableSlots(SlotMap);
+
+	// Also covers assets imported before the scope was stored
+	ResolveScope();
+	const int32* pSlot = SlotMap.Find(Identifier);
+	VariableSlot = pSlot ? *pSlot : INDEX_NONE;
+	Expression.ResolveVariableSlots(SlotMap);
 }
@@ -2,6 +2,8 @@
 // Released under the MIT license https://opensource.org/license/MIT/
 #include "SUDSScriptNodeText.h"
 
+#include "SUDSScript.h"
+
 void USUDSScriptNodeText::Init(const FString& InSpeakerID, const FText& InText, int LineNo)
 {
 	NodeType = ESUDSScriptNodeType::Text;
@@ -10,6 +12,7 @@ void USUDSScriptNodeText::Init(const FString& InSpeakerID, const FText& InText,
 	TextFormat = Text;
 	SourceLineNo = LineNo;
 	bFormatExtracted = false;
+	bParameterSlotsResolved = false;
 	
 }
 
@@ -46,17 +49,50 @@ bool USUDSScriptNodeText::HasParameters() const
 	
 }
 
+const TArray<FSUDSVariableRef>& USUDSScriptNodeText::GetParameterRefs(const USUDSScript* Script) const
+{
+	if (!bFormatExtracted)
+	{
+		ExtractFormat();
+	}
+	if (!bParameterSlotsResolved)
+	{
+		for (auto& Ref : ParameterRefs)
+		{
+			Ref.Slot = Script && !Ref.IsGlobal() ? Script->GetVariableSlot(Ref.Name) : INDEX_NONE;
+		}
+		bParameterSlotsResolved = true;
+	}
+	return ParameterRefs;
+}
+
+void USUDSScriptNodeText::GetReferencedVariableNames(TArray<FName>& OutNames, bool bIncludeTextParameters) const
+{
+	Super::GetReferencedVariableNames(OutNames, bIncludeTextParameters);
+
+	if (bIncludeTextParameters)
+	{
+		for (auto& Name : GetParameterNames())
+		{
+			OutNames.AddUnique(Name);
+		}
+	}
+}
+
 void USUDSScriptNodeText::ExtractFormat() const
 {
 	// Only do this on demand, and only once
 	TextFormat = Text;
 	ParameterNames.Empty();
+	ParameterRefs.Empty();
 
 	TArray<FString> TextParams;
 	TextFormat.GetFormatArgumentNames(TextParams);
 	for (auto Param : TextParams)
 	{
-		ParameterNames.Add(FName(Param));
+		const FSUDSVariableRef& Ref = ParameterRefs.Add_GetRef(FSUDSVariableRef(Param));
+		ParameterNames.Add(Ref.Name);
 	}
 	bFormatExtracted = true;
+	bParameterSlotsResolved = false;
 }
@@ -1,6 +1,13 @@
 ﻿// Copyright Steve Streeting 2022
 // Released under the MIT license https://opensource.org/license/MIT/
 #include "SUDSSubsystem.h"
+
+#include "SUDSDialogue.h"
+#include "SUDSScript.h"
+#include "SUDSSettings.h"
+#include "Async/Async.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
 #include "Sound/SoundConcurrency.h"
 
 DEFINE_LOG_CATEGORY(LogSUDSSubsystem)
@@ -9,6 +16,85 @@ DEFINE_LOG_CATEGORY(LogSUDSSubsystem)
 	TMap<FName, FSUDSValue> USUDSSubsystem::Test_DummyGlobalVariables;
 #endif
 
+FArchive& operator<<(FArchive& Ar, FSUDSGlobalState& Value)
+{
+	Ar << Value.GlobalVariables;
+	return Ar;
+}
+
+void operator<<(FStructuredArchive::FSlot Slot, FSUDSGlobalState& Value)
+{
+	FStructuredArchive::FRecord Record = Slot.EnterRecord();
+	Record << SA_VALUE(TEXT("GlobalVariables"), Value.GlobalVariables);
+}
+
+void FSUDSStateSnapshot::SaveToBytes(TArray<uint8>& OutData) const
+{
+	TArray<uint8> Payload;
+	FMemoryWriter PayloadAr(Payload, true);
+	// Serialising is non-const in general but doesn't change anything when saving
+	FSUDSStateSnapshot& Self = const_cast<FSUDSStateSnapshot&>(*this);
+	PayloadAr << Self.bHasGlobalState;
+	if (bHasGlobalState)
+	{
+		PayloadAr << Self.GlobalState;
+	}
+	PayloadAr << Self.DialogueStates;
+
+	// Header is version, payload size & checksum, so bad data is rejected before we try to read it
+	OutData.Reset();
+	FMemoryWriter Ar(OutData, true);
+	int32 Version = FSUDSCustomVersion::LatestVersion;
+	Ar << Version;
+	uint32 PayloadSize = Payload.Num();
+	Ar << PayloadSize;
+	uint32 Crc = FCrc::MemCrc32(Payload.GetData(), Payload.Num());
+	Ar << Crc;
+	Ar.Serialize(Payload.GetData(), Payload.Num());
+}
+
+bool FSUDSStateSnapshot::LoadFromBytes(const TArray<uint8>& Data)
+{
+	// Check the header by hand, since the data may be truncated
+	constexpr int32 HeaderSize = 4 + 4 + 4;
+	if (Data.Num() < HeaderSize)
+	{
+		UE_LOG(LogSUDSSubsystem, Error, TEXT("State snapshot is corrupt"));
+		return false;
+	}
+	int32 Version;
+	uint32 PayloadSize, Crc;
+	FMemory::Memcpy(&Version, Data.GetData(), 4);
+	FMemory::Memcpy(&PayloadSize, Data.GetData() + 4, 4);
+	FMemory::Memcpy(&Crc, Data.GetData() + 8, 4);
+	if (Version < 0 || Version > FSUDSCustomVersion::LatestVersion)
+	{
+		UE_LOG(LogSUDSSubsystem, Error, TEXT("Cannot load state snapshot, unknown version"));
+		return false;
+	}
+	if (PayloadSize != (uint32)(Data.Num() - HeaderSize) ||
+		Crc != FCrc::MemCrc32(Data.GetData() + HeaderSize, PayloadSize))
+	{
+		UE_LOG(LogSUDSSubsystem, Error, TEXT("State snapshot is corrupt"));
+		return false;
+	}
+
+	FMemoryReader Ar(Data, true);
+	Ar.Seek(HeaderSize);
+	Ar << bHasGlobalState;
+	if (bHasGlobalState)
+	{
+		Ar << GlobalState;
+	}
+	Ar << DialogueStates;
+	if (Ar.IsError())
+	{
+		UE_LOG(LogSUDSSubsystem, Error, TEXT("State snapshot is corrupt"));
+		return false;
+	}
+	return true;
+}
+
 void USUDSSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 {
 	Super::Initialize(Collection);
@@ -16,10 +102,13 @@ void USUDSSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 	// Default to a single voice line being played at once
 	VoiceConcurrency = NewObject<USoundConcurrency>(this);
 	VoiceConcurrency->Concurrency.MaxCount = 1;
+
+	MaxPooledDialoguesPerScript = GetDefault<USUDSSettings>()->MaxPooledDialoguesPerScript;
 }
 
 void USUDSSubsystem::Deinitialize()
 {
+	EmptyDialoguePool();
 	Super::Deinitialize();
 }
 
@@ -40,10 +129,319 @@ int USUDSSubsystem::GetMaxConcurrentVoicedLines() const
 	return 1;
 }
 
+USUDSDialogue* USUDSSubsystem::AcquireDialogue(USUDSScript* Script,
+                                               const TArray<UObject*>& Participants,
+                                               bool bStartImmediately,
+                                               FName StartLabel)
+{
+	if (!IsValid(Script))
+	{
+		UE_LOG(LogSUDSSubsystem, Error, TEXT("Called AcquireDialogue with an invalid script"))
+		return nullptr;
+	}
+
+	USUDSDialogue* Dlg = nullptr;
+	if (FSUDSDialoguePoolEntry* Entry = DialoguePool.Find(Script))
+	{
+		while (!Dlg && Entry->FreeDialogues.Num() > 0)
+		{
+			Dlg = Entry->FreeDialogues.Pop();
+			--DialoguePoolStats.NumPooled;
+			if (!IsValid(Dlg))
+			{
+				// Shouldn't happen since we reference them, but someone could have marked it as garbage
+				Dlg = nullptr;
+			}
+		}
+	}
+
+	if (Dlg)
+	{
+		++DialoguePoolStats.NumReused;
+	}
+	else
+	{
+		// Pooled dialogues are owned by us rather than the caller, since they outlive each use
+		const FName Name = MakeUniqueObjectName(this, USUDSDialogue::StaticClass(), Script->GetFName());
+		Dlg = NewObject<USUDSDialogue>(this, Name);
+		++DialoguePoolStats.NumCreated;
+	}
+
+	// Same sequence as USUDSLibrary::CreateDialogueWithParticipants, Initialise resets any previous state
+	Dlg->SetParticipants(Participants);
+	Dlg->Initialise(Script);
+	RegisterDialogue(Dlg);
+	if (bStartImmediately)
+	{
+		Dlg->Start(StartLabel);
+	}
+	return Dlg;
+}
+
+void USUDSSubsystem::ReleaseDialogue(USUDSDialogue* Dialogue)
+{
+	if (!IsValid(Dialogue))
+	{
+		return;
+	}
+	if (Dialogue->GetOuter() != this)
+	{
+		// Pooling someone else's dialogue would keep its owner alive
+		UE_LOG(LogSUDSSubsystem, Warning, TEXT("ReleaseDialogue: %s was not acquired from the pool, ignoring"), *Dialogue->GetName());
+		return;
+	}
+
+	USUDSScript* Script = const_cast<USUDSScript*>(Dialogue->GetScript());
+	if (!IsValid(Script))
+	{
+		return;
+	}
+
+	FSUDSDialoguePoolEntry& Entry = DialoguePool.FindOrAdd(Script);
+	if (Entry.FreeDialogues.Contains(Dialogue))
+	{
+		UE_LOG(LogSUDSSubsystem, Warning, TEXT("ReleaseDialogue: %s was released more than once"), *Dialogue->GetName());
+		return;
+	}
+
+	// Resetting isn't a change anyone needs to save
+	UnregisterDialogue(Dialogue);
+	Dialogue->ResetForPool();
+	++DialoguePoolStats.NumReleased;
+	if (Entry.FreeDialogues.Num() < MaxPooledDialoguesPerScript)
+	{
+		Entry.FreeDialogues.Add(Dialogue);
+		++DialoguePoolStats.NumPooled;
+	}
+	else
+	{
+		++DialoguePoolStats.NumDiscarded;
+	}
+}
+
+void USUDSSubsystem::SetMaxPooledDialoguesPerScript(int32 MaxDialogues)
+{
+	MaxPooledDialoguesPerScript = FMath::Max(0, MaxDialogues);
+	// Trim existing pools to the new size
+	for (auto& Pair : DialoguePool)
+	{
+		const int32 Excess = Pair.Value.FreeDialogues.Num() - MaxPooledDialoguesPerScript;
+		if (Excess > 0)
+		{
+			Pair.Value.FreeDialogues.RemoveAt(MaxPooledDialoguesPerScript, Excess);
+			DialoguePoolStats.NumPooled -= Excess;
+			DialoguePoolStats.NumDiscarded += Excess;
+		}
+	}
+}
+
+void USUDSSubsystem::EmptyDialoguePool()
+{
+	DialoguePool.Empty();
+	DialoguePoolStats.NumPooled = 0;
+}
+
+void USUDSSubsystem::RegisterDialogue(USUDSDialogue* Dialogue)
+{
+	if (!IsValid(Dialogue))
+	{
+		return;
+	}
+	if (Dialogue->InternalGetStateRegistry() == this)
+	{
+		// Registering again, e.g. after re-initialising, still counts as a change
+		InternalNotifyDialogueStateChanged(Dialogue);
+		return;
+	}
+	if (USUDSSubsystem* Previous = Dialogue->InternalGetStateRegistry())
+	{
+		Previous->UnregisterDialogue(Dialogue);
+	}
+	Dialogue->InternalSetStateRegistry(this);
+	// It hasn't been saved by us yet
+	InternalNotifyDialogueStateChanged(Dialogue);
+}
+
+void USUDSSubsystem::UnregisterDialogue(USUDSDialogue* Dialogue)
+{
+	if (IsValid(Dialogue) && Dialogue->InternalGetStateRegistry() == this)
+	{
+		// Any entries in the change log are skipped from now on, and pruned later
+		Dialogue->InternalSetStateRegistry(nullptr);
+		Dialogue->InternalSetChangedGeneration(0);
+	}
+}
+
+void USUDSSubsystem::InternalNotifyDialogueStateChanged(USUDSDialogue* Dialogue)
+{
+	if (Dialogue->InternalGetChangedGeneration() == StateGeneration)
+	{
+		// Already in the log for this generation
+		return;
+	}
+	Dialogue->InternalSetChangedGeneration(StateGeneration);
+	ChangeLog.Add(FSUDSDialogueChange { Dialogue, StateGeneration });
+
+	// Dialogues which change over and over leave older entries behind, don't let them build up forever
+	if (ChangeLog.Num() > ChangeLogPrunedSize * 2 + 64)
+	{
+		PruneChangeLog();
+	}
+}
+
+void USUDSSubsystem::PruneChangeLog()
+{
+	ChangeLog.RemoveAll([this](const FSUDSDialogueChange& Change)
+	{
+		const USUDSDialogue* Dlg = Change.Dialogue.Get();
+		return !IsValid(Dlg) ||
+			Dlg->InternalGetStateRegistry() != this ||
+			Dlg->InternalGetChangedGeneration() != Change.Generation;
+	});
+	ChangeLogPrunedSize = ChangeLog.Num();
+}
+
+int64 USUDSSubsystem::GetChangedDialogueStates(int64 SinceGeneration,
+                                               TArray<FSUDSDialogueSaveEntry>& OutStates,
+                                               bool bOnlyChangedVariables)
+{
+	OutStates.Reset();
+	const int64 SavedGeneration = StateGeneration;
+	++StateGeneration;
+
+	auto IsCurrent = [this](const FSUDSDialogueChange& Change, USUDSDialogue* Dlg)
+	{
+		return IsValid(Dlg) &&
+			Dlg->InternalGetStateRegistry() == this &&
+			Dlg->InternalGetChangedGeneration() == Change.Generation;
+	};
+
+	// Newest entries are at the end, so we only have to look back as far as the requested generation. Each
+	// registered dialogue's newest entry is the only one matching its changed generation, so none are returned twice
+	for (int i = ChangeLog.Num() - 1; i >= 0 && ChangeLog[i].Generation > SinceGeneration; --i)
+	{
+		USUDSDialogue* Dlg = ChangeLog[i].Dialogue.Get();
+		if (IsCurrent(ChangeLog[i], Dlg))
+		{
+			OutStates.Add(FSUDSDialogueSaveEntry { Dlg, Dlg->GetSavedState(bOnlyChangedVariables) });
+		}
+	}
+
+	// Dialogues which changed in the generation we just ended must notify us again when they next change, so that
+	// it's recorded in the new generation. Done separately since the caller may not have asked for them
+	for (int i = ChangeLog.Num() - 1; i >= 0 && ChangeLog[i].Generation == SavedGeneration; --i)
+	{
+		USUDSDialogue* Dlg = ChangeLog[i].Dialogue.Get();
+		if (IsCurrent(ChangeLog[i], Dlg))
+		{
+			Dlg->InternalClearStateDirty();
+		}
+	}
+
+	return SavedGeneration;
+}
+
+FSUDSStateSnapshotRef USUDSSubsystem::TakeStateSnapshot(const TArray<USUDSDialogue*>& Dialogues,
+                                                        bool bIncludeGlobalState,
+                                                        bool bOnlyChangedVariables) const
+{
+	TSharedRef<FSUDSStateSnapshot, ESPMode::ThreadSafe> Snapshot = MakeShared<FSUDSStateSnapshot, ESPMode::ThreadSafe>();
+	Snapshot->DialogueStates.Reserve(Dialogues.Num());
+	for (const USUDSDialogue* Dlg : Dialogues)
+	{
+		// Keep positions the same as Dialogues even if one is invalid, so restoring lines up
+		Snapshot->DialogueStates.Add(IsValid(Dlg) ? Dlg->GetSavedState(bOnlyChangedVariables) : FSUDSDialogueState());
+	}
+	if (bIncludeGlobalState)
+	{
+		Snapshot->bHasGlobalState = true;
+		Snapshot->GlobalState = GetSavedGlobalState();
+	}
+	return Snapshot;
+}
+
+FSUDSStateSnapshotRef USUDSSubsystem::TakeStateSnapshot(const TArray<FSUDSDialogueSaveEntry>& States,
+                                                        bool bIncludeGlobalState) const
+{
+	TSharedRef<FSUDSStateSnapshot, ESPMode::ThreadSafe> Snapshot = MakeShared<FSUDSStateSnapshot, ESPMode::ThreadSafe>();
+	Snapshot->DialogueStates.Reserve(States.Num());
+	for (const auto& Entry : States)
+	{
+		Snapshot->DialogueStates.Add(Entry.State);
+	}
+	if (bIncludeGlobalState)
+	{
+		Snapshot->bHasGlobalState = true;
+		Snapshot->GlobalState = GetSavedGlobalState();
+	}
+	return Snapshot;
+}
+
+TFuture<TArray<uint8>> USUDSSubsystem::SerializeStateSnapshotAsync(const FSUDSStateSnapshotRef& Snapshot)
+{
+	return Async(EAsyncExecution::TaskGraph, [Snapshot]()
+	{
+		TArray<uint8> Data;
+		Snapshot->SaveToBytes(Data);
+		return Data;
+	});
+}
+
+void USUDSSubsystem::SaveStateAsync(const TArray<USUDSDialogue*>& Dialogues,
+                                    bool bIncludeGlobalState,
+                                    const FOnSUDSStateSerialized& OnComplete,
+                                    bool bOnlyChangedVariables)
+{
+	const FSUDSStateSnapshotRef Snapshot = TakeStateSnapshot(Dialogues, bIncludeGlobalState, bOnlyChangedVariables);
+	AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [Snapshot, OnComplete]()
+	{
+		TArray<uint8> Data;
+		Snapshot->SaveToBytes(Data);
+		// Blueprint delegates must be called on the game thread
+		AsyncTask(ENamedThreads::GameThread, [Data = MoveTemp(Data), OnComplete]()
+		{
+			OnComplete.ExecuteIfBound(Data);
+		});
+	});
+}
+
+bool USUDSSubsystem::RestoreSerializedState(const TArray<uint8>& Data,
+                                            const TArray<USUDSDialogue*>& Dialogues,
+                                            bool bRestoreGlobalState)
+{
+	FSUDSStateSnapshot Snapshot;
+	if (!Snapshot.LoadFromBytes(Data))
+	{
+		return false;
+	}
+	if (Snapshot.DialogueStates.Num() != Dialogues.Num())
+	{
+		UE_LOG(LogSUDSSubsystem, Error, TEXT("Cannot restore serialized state, it holds %d dialogues but %d were given"),
+		       Snapshot.DialogueStates.Num(), Dialogues.Num());
+		return false;
+	}
+
+	for (int i = 0; i < Dialogues.Num(); ++i)
+	{
+		if (IsValid(Dialogues[i]))
+		{
+			Dialogues[i]->RestoreSavedState(Snapshot.DialogueStates[i]);
+		}
+	}
+	if (bRestoreGlobalState && Snapshot.bHasGlobalState)
+	{
+		RestoreSavedGlobalState(Snapshot.GlobalState);
+	}
+	return true;
+}
+
 void USUDSSubsystem::ResetGlobalState(bool bResetVariables)
 {
-	if (bResetVariables)
+	if (bResetVariables && GlobalVariableState.Num() > 0)
+	{
 		GlobalVariableState.Empty();
+		GlobalChangedGeneration = StateGeneration;
+	}
 }
 
 FSUDSGlobalState USUDSSubsystem::GetSavedGlobalState() const
@@ -55,6 +453,7 @@ void USUDSSubsystem::RestoreSavedGlobalState(const FSUDSGlobalState& State)
 {
 	ResetGlobalState();
 	GlobalVariableState.Append(State.GetGlobalVariables());
+	GlobalChangedGeneration = StateGeneration;
 }
 
 
@@ -195,5 +594,8 @@ FName USUDSSubsystem::GetGlobalVariableName(FName Name) const
 
 void USUDSSubsystem::UnSetGlobalVariable(FName Name)
 {
-	GlobalVariableState.Remove(Name);
+	if (GlobalVariableState.Remove(Name) > 0)
+	{
+		GlobalChangedGeneration = StateGeneration;
+	}
 }
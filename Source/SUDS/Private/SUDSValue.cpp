@@ -2,30 +2,38 @@
 // Released under the MIT license https://opensource.org/license/MIT/
 #include "SUDSValue.h"
 
+#include "SUDSSettings.h"
+
 FArchive& operator<<(FArchive& Ar, FSUDSValue& Value)
 {
-	// Custom serialisation since we can't auto-serialise union, TOptional
+	// Custom serialisation since we can't auto-serialise the union
+	// Format is unchanged from when text & name were stored separately: type, int/float bits, then text or name
 	uint8 TypeAsInt = (uint8)Value.Type; 
 	Ar << TypeAsInt;
-	if (Ar.IsLoading())
-		Value.Type = static_cast<ESUDSValueType>(TypeAsInt);
 
-	// This gets/sets float value too
-	Ar << Value.IntValue;
+	// This gets/sets float value too; text / name types always wrote 0 here
+	int32 IntBits = Value.GetRawIntValue();
+	Ar << IntBits;
 
-	if (Value.Type == ESUDSValueType::Text)
+	const ESUDSValueType Type = static_cast<ESUDSValueType>(TypeAsInt);
+	if (Type == ESUDSValueType::Text)
 	{
-		FText Text = Value.TextValue.Get(FText::GetEmpty());
+		FText Text = Value.GetRawTextValue();
 		Ar << Text;
 		if (Ar.IsLoading())
-			Value.TextValue = Text;
+			Value = FSUDSValue(MoveTemp(Text));
 	}
-	else if (Value.Type == ESUDSValueType::Variable || Value.Type == ESUDSValueType::Name)
+	else if (Type == ESUDSValueType::Variable || Type == ESUDSValueType::Name)
 	{
-		FString VarNameStr = Value.Name.Get(NAME_None).ToString();
+		FString VarNameStr = Value.GetRawNameValue().ToString();
 		Ar << VarNameStr;
 		if (Ar.IsLoading())
-			Value.Name = FName(VarNameStr);
+			Value = FSUDSValue(FName(VarNameStr), Type == ESUDSValueType::Variable);
+	}
+	else if (Ar.IsLoading())
+	{
+		Value = FSUDSValue(Type);
+		Value.IntValue = IntBits;
 	}
 		
 	return Ar;
@@ -34,19 +42,70 @@ FArchive& operator<<(FArchive& Ar, FSUDSValue& Value)
 void operator<<(FStructuredArchive::FSlot Slot, FSUDSValue& Value)
 {
 	FStructuredArchive::FRecord Record = Slot.EnterRecord();
+	ESUDSValueType Type = Value.Type;
+	int32 IntBits = Value.GetRawIntValue();
 	Record
-		<< SA_VALUE(TEXT("Type"), Value.Type)
-		<< SA_VALUE(TEXT("IntValue"), Value.IntValue); // gets/sets float/boolean/gender too
+		<< SA_VALUE(TEXT("Type"), Type)
+		<< SA_VALUE(TEXT("IntValue"), IntBits); // gets/sets float/boolean/gender too
 
-	if (Value.Type == ESUDSValueType::Text)
+	const bool bLoading = Record.GetUnderlyingArchive().IsLoading();
+	if (Type == ESUDSValueType::Text)
+	{
+		// Kept as an optional for compatibility with the original layout
+		TOptional<FText> TextValue;
+		if (!bLoading)
+			TextValue = Value.GetRawTextValue();
+		Record << SA_VALUE(TEXT("TextValue"), TextValue);
+		if (bLoading)
+			Value = FSUDSValue(TextValue.Get(FText::GetEmpty()));
+	}
+	else if (Type == ESUDSValueType::Variable || Type == ESUDSValueType::Name)
 	{
-		Record << SA_VALUE(TEXT("TextValue"), Value.TextValue);
+		TOptional<FName> Name;
+		if (!bLoading)
+			Name = Value.GetRawNameValue();
+		Record << SA_VALUE(TEXT("Name"), Name);
+		if (bLoading)
+			Value = FSUDSValue(Name.Get(NAME_None), Type == ESUDSValueType::Variable);
 	}
-	else if (Value.Type == ESUDSValueType::Variable || Value.Type == ESUDSValueType::Name)
+	else if (bLoading)
 	{
-		Record << SA_VALUE(TEXT("Name"), Value.Name);
+		Value = FSUDSValue(Type);
+		Value.IntValue = IntBits;
+	}
+
+}
+
+bool FSUDSValue::TextEquals(const FText& A, const FText& B)
+{
+	const ESUDSTextComparison Mode = GetDefault<USUDSSettings>()->TextComparison;
+	if (Mode == ESUDSTextComparison::CultureAware)
+	{
+		return A.EqualTo(B);
+	}
+
+	// Copies of the same text share data
+	if (A.IdenticalTo(B))
+	{
+		return true;
+	}
+
+	// Conditions often compare against string table literals; the same entry in the same table is always equal
+	// Different entries can still have the same string, so those fall through to the string comparison
+	FName TableA, TableB;
+	FString KeyA, KeyB;
+	if (FTextInspector::GetTableIdAndKey(A, TableA, KeyA) &&
+		FTextInspector::GetTableIdAndKey(B, TableB, KeyB) &&
+		TableA == TableB &&
+		KeyA == KeyB)
+	{
+		return true;
 	}
 
+	return A.ToString().Equals(B.ToString(),
+	                           Mode == ESUDSTextComparison::OrdinalIgnoreCase
+		                           ? ESearchCase::IgnoreCase
+		                           : ESearchCase::CaseSensitive);
 }
 
 FString FSUDSValue::ToString() const
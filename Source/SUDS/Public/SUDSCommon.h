@@ -9,6 +9,23 @@ DECLARE_LOG_CATEGORY_CLASS(LogSUDS, Warning, All)
 
 #define SUDS_RANDOMITEM_VAR "SUDS.RandomItem"
 
+/// Version of SUDS data written with custom FArchive serialisation, e.g. FSUDSDialogueState. This is written inline
+/// with the data rather than relying on the archive's custom versions, so plain memory archives can read older data
+struct SUDS_API FSUDSCustomVersion
+{
+	enum Type
+	{
+		BeforeCustomVersionWasAdded = 0,
+		/// Dialogue state includes the dialogue's random stream
+		AddedRandomStream = 1,
+		/// Dialogue state can hold only the variables which differ from header defaults
+		AddedVariableDeltas = 2,
+
+		VersionPlusOne,
+		LatestVersion = VersionPlusOne - 1
+	};
+};
+
 struct FSUDSConstants
 {
 	/// Reserved variable named use to create random results from select nodes
@@ -3,8 +3,11 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "SUDSDialogueRunner.h"
+#include "SUDSDialogueState.h"
 #include "SUDSScriptNode.h"
 #include "SUDSExpression.h"
+#include "SUDSParticipant.h"
 #include "UObject/Object.h"
 #include "SUDSDialogue.generated.h"
 
@@ -16,6 +19,7 @@ class USUDSScript;
 class UDialogueWave;
 class UDialogueVoice;
 class USoundBase;
+class USUDSSubsystem;
 
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnDialogueSpeakerLine, class USUDSDialogue*, Dialogue);
@@ -26,6 +30,7 @@ DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnDialogueFinished, class USUDSDial
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FOnDialogueEvent, class USUDSDialogue*, Dialogue, FName, EventName, const TArray<FSUDSValue>&, Arguments);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_FourParams(FOnVariableChangedEvent, class USUDSDialogue*, Dialogue, FName, VariableName, const FSUDSValue&, Value, bool, bFromScript);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnVariableRequestedEvent, class USUDSDialogue*, Dialogue, FName, VariableName);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnVariablesRequestedEvent, class USUDSDialogue*, Dialogue, const TArray<FName>&, VariableNames);
 
 #if WITH_EDITOR
 	// Non-dynamic events for editor use
@@ -40,58 +45,6 @@ DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnVariableRequestedEvent, class US
 	DECLARE_DELEGATE_FourParams(FOnDialogueSelectEval, class USUDSDialogue* /*Dialogue*/, const FString& /*ConditionString*/, bool /*bResult*/, int /*SourceLineNo*/);
 #endif
 
-DECLARE_LOG_CATEGORY_EXTERN(LogSUDSDialogue, Verbose, All);
-
-/// Copy of the internal state of a dialogue
-USTRUCT(BlueprintType)
-struct FSUDSDialogueState
-{
-	GENERATED_BODY()
-protected:
-	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
-	FString TextNodeID;
-
-	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
-	TMap<FName, FSUDSValue> Variables;
-
-	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
-	TArray<FString> ChoicesTaken;
-
-	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
-	TArray<FString> ReturnStack;
-	
-public:
-	FSUDSDialogueState() {}
-
-	FSUDSDialogueState(const FString& TxtID,
-	                   const TMap<FName, FSUDSValue>& InVars,
-	                   const TSet<FString>& InChoices,
-	                   const TArray<FString>& InReturnStack) : TextNodeID(TxtID),
-	                                                           Variables(InVars),
-	                                                           ChoicesTaken(InChoices.Array()),
-	                                                           ReturnStack(InReturnStack)
-	{
-	}
-
-	const FString& GetTextNodeID() const { return TextNodeID; }
-	const TMap<FName, FSUDSValue>& GetVariables() const { return Variables; }
-	const TArray<FString>& GetChoicesTaken() const { return ChoicesTaken; }
-	const TArray<FString>& GetReturnStack() const { return ReturnStack; }
-
-	SUDS_API friend FArchive& operator<<(FArchive& Ar, FSUDSDialogueState& Value);
-	SUDS_API friend void operator<<(FStructuredArchive::FSlot Slot, FSUDSDialogueState& Value);
-	bool Serialize(FStructuredArchive::FSlot Slot)
-	{
-		Slot << *this;
-		return true;
-	}
-	bool Serialize(FArchive& Ar)
-	{
-		Ar << *this;
-		return true;
-	}
-	
-};
 /**
  * A Dialogue is a runtime instance of a Script (the asset on which the dialogue is based)
  * An Dialogue always stops on a speaker line, which may have player choices. It progresses when you call Continue()
@@ -107,9 +60,11 @@ public:
  * Dialogues need to be owned by an object, mainly for garbage collection. It's recommended that you set the owner to
  * one of the NPCs in the dialogue.
  * You can save/restore the state of a dialogue via GetSavedState/RestoreSavedState. 
+ * All of the state and stepping logic lives in FSUDSDialogueRunner, which you can use directly instead if you need
+ * lots of lightweight dialogues and don't need participants, Blueprint events or voices.
  */
 UCLASS(BlueprintType)
-class SUDS_API USUDSDialogue : public UObject
+class SUDS_API USUDSDialogue : public UObject, public ISUDSDialogueRunnerListener
 {
 	GENERATED_BODY()
 public:
@@ -134,6 +89,10 @@ public:
 	/// dialogue on-demand rather than up-front; anything set during this hook will be immediately used by the dialogue 
 	UPROPERTY(BlueprintAssignable)
 	FOnVariableRequestedEvent OnVariableRequested;
+	/// Event raised at the start of each step when variable requests are batched (see SetBatchVariableRequests), with
+	/// every variable the step might use. Like OnVariableRequested, anything set during this hook is used immediately
+	UPROPERTY(BlueprintAssignable)
+	FOnVariablesRequestedEvent OnVariablesRequested;
 	/// Event raised when the dialogue is starting, before the first speaker line
 	UPROPERTY(BlueprintAssignable)
 	FOnDialogueStarting OnStarting;
@@ -143,87 +102,118 @@ public:
 protected:
 	UPROPERTY()
 	TObjectPtr<const USUDSScript> BaseScript;
-	UPROPERTY()
-	TObjectPtr<USUDSScriptNodeText> CurrentSpeakerNode;
-	UPROPERTY()
-	TObjectPtr<const USUDSScriptNode> CurrentRootChoiceNode;
 
 	/// External objects which want to closely participate in the dialogue (not just listen to events)
 	UPROPERTY()
 	TArray<TObjectPtr<UObject>> Participants;
-	
 
-	/// All of the dialogue variables
-	/// Dialogue variable state is all held locally. Dialogue participants can retrieve or set values in state.
-	/// All state is saved with the dialogue. Variables can be used as text substitution parameters, conditionals,
-	/// or communication with external state.
-	typedef TMap<FName, FSUDSValue> FSUDSValueMap;
-	FSUDSValueMap VariableState;
+	/// What we need to know to call a participant, looked up once when it's added rather than on every call
+	struct FParticipantInfo
+	{
+		/// The native interface, if implemented; called directly in preference to ISUDSParticipant
+		ISUDSNativeParticipant* Native = nullptr;
+		/// Whether the participant implements ISUDSParticipant
+		bool bImplementsParticipant = false;
+		/// Cached participant priority
+		int Priority = 0;
+		/// Cached description of which callbacks the participant wants
+		FSUDSParticipantSubscription Subscription;
+	};
+	/// Info for each entry in Participants, in the same order
+	TArray<FParticipantInfo> ParticipantInfos;
+
+	/// Indexes into Participants of the participants interested in a particular event or variable
+	typedef TArray<int32, TInlineAllocator<4>> FParticipantRoute;
+	/// Routing of events and variables to participants. Built for the names used in the script whenever the
+	/// participants change, and on demand for any other names
+	TMap<FName, FParticipantRoute> EventRoutes;
+	TMap<FName, FParticipantRoute> VariableChangedRoutes;
+	TMap<FName, FParticipantRoute> VariableRequestedRoutes;
+
+	/// The core of the dialogue, which holds its state and steps through the script. This object adds participants,
+	/// Blueprint events and voice support on top, and BaseScript is what keeps the runner's script alive
+	FSUDSDialogueRunner Runner;
+
+	/// The subsystem tracking changes to our state, if registered, see USUDSSubsystem::RegisterDialogue
+	TWeakObjectPtr<USUDSSubsystem> StateRegistry;
+	/// The save generation our state last changed in, as far as StateRegistry knows
+	int64 ChangedGeneration = 0;
 
-	/// Stack of Gosub nodes to return to
-	UPROPERTY()
-	TArray<TObjectPtr<USUDSScriptNodeGosub>> GosubReturnStack;
+	void SortParticipants();
+	static FParticipantInfo GetParticipantInfo(UObject* Participant);
 
-	/// Set of all the TextIDs of choices taken already in this dialogue
-	TSet<FString> ChoicesTaken;
+	void RebuildParticipantRoutes();
+	const FParticipantRoute& GetParticipantRoute(TMap<FName, FParticipantRoute>& Routes,
+	                                             ESUDSParticipantCallbacks Callback,
+	                                             const FName& Name);
 
-	TSet<FName> CurrentRequestedParamNames;
-	bool bParamNamesExtracted;
-	
-	/// Cached derived info
-	mutable FText CurrentSpeakerDisplayName;
-	/// All valid choices
-	TArray<FSUDSScriptEdge> CurrentChoices;
-	int CurrentSourceLineNo;
-	static const FText DummyText;
-	static const FString DummyString;
-
-	void InitVariables();
-	void RunUntilNextSpeakerNodeOrEnd(USUDSScriptNode* FromNode, bool bRaiseAtEnd);
-	const USUDSScriptNode* WalkToNextChoiceNode(USUDSScriptNode* FromNode, bool bExecute);
-	USUDSScriptNode* RecurseWalkToNextChoiceOrTextNode(USUDSScriptNode* Node, bool bExecute, TArray<TObjectPtr<USUDSScriptNodeGosub>>& LocalGosubStack);
-	const USUDSScriptNode* RunUntilNextChoiceNode(USUDSScriptNode* FromTextNode);
-	const USUDSScriptNode* FindNextChoiceNode(USUDSScriptNode* FromNode);
-	void SetCurrentSpeakerNode(USUDSScriptNodeText* Node, bool bQuietly);
-	void SortParticipants();
-	void RaiseStarting(FName StartLabel);
-	void RaiseFinished();
-	void RaiseNewSpeakerLine();
-	void RaiseChoiceMade(int Index, int LineNo);
-	void RaiseProceeding();
-	void RaiseVariableChange(const FName& VarName, const FSUDSValue& Value, bool bFromScript, int LineNo);
-	void RaiseVariableRequested(const FName& VarName, int LineNo);
-	void RaiseExpressionVariablesRequested(const FSUDSExpression& Expression, int LineNo);
-	const TMap<FName, FSUDSValue>& GetGlobalVariables() const;
-
-	USUDSScriptNode* GetNextNode(USUDSScriptNode* Node);
-	bool IsChoiceOrTextNode(ESUDSScriptNodeType Type);
-	USUDSScriptNode* RunNode(USUDSScriptNode* Node);
-	USUDSScriptNode* RunSelectNode(USUDSScriptNode* Node);
-	USUDSScriptNode* RunSetVariableNode(USUDSScriptNode* Node);
-	USUDSScriptNode* RunEventNode(USUDSScriptNode* Node);
-	USUDSScriptNode* RunGosubNode(USUDSScriptNode* Node);
-	USUDSScriptNode* RunReturnNode(USUDSScriptNode* Node);
-	void UpdateChoices();
-	void RecurseAppendChoices(const USUDSScriptNode* Node, TArray<FSUDSScriptEdge>& OutChoices);
-	USoundBase* GetSoundForCurrentLine(bool bAllowAnyTarget) const;
-	UDialogueVoice* GetTargetVoice() const;
-	class USoundConcurrency* GetVoiceSoundConcurrency() const;
+	/// Call a participant, directly if native and through Blueprint events otherwise
+	template <typename TNativeFunc, typename TBlueprintFunc>
+	void CallParticipant(int Index, TNativeFunc& NativeFunc, TBlueprintFunc& BlueprintFunc)
+	{
+		// Could have been destroyed since it was added
+		if (UObject* P = Participants[Index])
+		{
+			const FParticipantInfo& Info = ParticipantInfos[Index];
+			if (Info.Native)
+			{
+				NativeFunc(Info.Native);
+			}
+			else if (Info.bImplementsParticipant)
+			{
+				BlueprintFunc(P);
+			}
+		}
+	}
+
+	/// Call every participant which wants a type of callback
+	template <typename TNativeFunc, typename TBlueprintFunc>
+	void ForEachParticipant(ESUDSParticipantCallbacks Callback, TNativeFunc&& NativeFunc, TBlueprintFunc&& BlueprintFunc)
+	{
+		// Index-based because participants may be added during callbacks
+		for (int i = 0; i < Participants.Num(); ++i)
+		{
+			if (ParticipantInfos[i].Subscription.WantsCallback(Callback))
+			{
+				CallParticipant(i, NativeFunc, BlueprintFunc);
+			}
+		}
+	}
 
-	FText ResolveParameterisedText(const TArray<FName> Params, const FTextFormat& TextFormat, int LineNo);
-	void GetTextFormatArgs(const TArray<FName>& ArgNames, FFormatNamedArguments& OutArgs) const;
-	bool CurrentNodeHasChoices() const;
-	void SetVariableImpl(FName Name, const FSUDSValue& Value, bool bFromScript, int LineNo)
+	/// Call every participant in a route
+	template <typename TNativeFunc, typename TBlueprintFunc>
+	void ForEachParticipant(const FParticipantRoute& Route, TNativeFunc&& NativeFunc, TBlueprintFunc&& BlueprintFunc)
 	{
-		const FSUDSValue OldValue = GetVariable(Name);
-		if (!IsVariableSet(Name) ||
-			(OldValue != Value).GetBooleanValue())
+		// Copy, since participants may be added during callbacks which rebuilds the routes
+		const FParticipantRoute RouteCopy = Route;
+		for (const int32 i : RouteCopy)
 		{
-			VariableState.Add(Name, Value);
-			RaiseVariableChange(Name, Value, bFromScript, LineNo);
+			if (Participants.IsValidIndex(i))
+			{
+				CallParticipant(i, NativeFunc, BlueprintFunc);
+			}
 		}
-		
 	}
+	USoundBase* GetSoundForCurrentLine(bool bAllowAnyTarget) const;
+	UDialogueVoice* GetTargetVoice() const;
+	class USoundConcurrency* GetVoiceSoundConcurrency() const;
+
+	// ISUDSDialogueRunnerListener
+	virtual UWorld* GetDialogueWorld(const FSUDSDialogueRunner& InRunner) const override;
+	virtual void OnDialogueStarting(FSUDSDialogueRunner& InRunner, FName StartLabel) override;
+	virtual void OnDialogueSpeakerLine(FSUDSDialogueRunner& InRunner) override;
+	virtual void OnDialogueChoice(FSUDSDialogueRunner& InRunner, int ChoiceIndex, int LineNo) override;
+	virtual void OnDialogueProceeding(FSUDSDialogueRunner& InRunner) override;
+	virtual void OnDialogueFinished(FSUDSDialogueRunner& InRunner) override;
+	virtual void OnDialogueEvent(FSUDSDialogueRunner& InRunner, FName EventName, const TArray<FSUDSValue>& Arguments, int LineNo) override;
+	virtual void OnDialogueVariableChanged(FSUDSDialogueRunner& InRunner, FName VariableName, const FSUDSValue& Value, bool bFromScript, int LineNo) override;
+	virtual void OnDialogueVariableRequested(FSUDSDialogueRunner& InRunner, FName VariableName, int LineNo) override;
+	virtual void OnDialogueVariablesRequested(FSUDSDialogueRunner& InRunner, const TArray<FName>& VariableNames, int LineNo) override;
+	virtual void OnDialogueStateDirty(FSUDSDialogueRunner& InRunner) override;
+#if WITH_EDITOR
+	virtual void OnDialogueScriptSetVariable(FSUDSDialogueRunner& InRunner, FName VariableName, const FSUDSValue& Value, const FString& ExprString, int LineNo) override;
+	virtual void OnDialogueSelectEval(FSUDSDialogueRunner& InRunner, const FString& ConditionString, bool bResult, int LineNo) override;
+#endif
 
 public:
 	USUDSDialogue();
@@ -232,6 +222,24 @@ public:
 	//		UE_LOG(LogTemp, Warning, TEXT("*********** Destroyed Dialogue!"));
 	// }
 	void Initialise(const USUDSScript* Script);
+
+	/// Get the runner which holds the state of this dialogue and steps through it
+	const FSUDSDialogueRunner& GetRunner() const { return Runner; }
+
+	/// Prepare this dialogue to be kept for reuse, see USUDSSubsystem::ReleaseDialogue. Quietly ends the dialogue and
+	/// removes all participants and event bindings; call Initialise again before using it
+	void ResetForPool();
+
+	/// Internal use only, see USUDSSubsystem::RegisterDialogue
+	USUDSSubsystem* InternalGetStateRegistry() const { return StateRegistry.Get(); }
+	/// Internal use only
+	void InternalSetStateRegistry(USUDSSubsystem* Registry) { StateRegistry = Registry; }
+	/// Internal use only
+	int64 InternalGetChangedGeneration() const { return ChangedGeneration; }
+	/// Internal use only
+	void InternalSetChangedGeneration(int64 Generation) { ChangedGeneration = Generation; }
+	/// Internal use only
+	void InternalClearStateDirty() { Runner.ClearStateDirty(); }
 	
 	/// Get the script asset this dialogue is based on
 	UFUNCTION(BlueprintCallable, BlueprintPure, Category="SUDS|Dialogue")
@@ -389,9 +397,13 @@ public:
 	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
 	FText GetChoiceText(int Index);
 
-	/// Get all the current choices available, if you prefer this format
+	/// Get a copy of all the current choices available, if you prefer this format. From C++, GetChoiceRefs avoids the copy
 	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
-	const TArray<FSUDSScriptEdge>& GetChoices() const;
+	TArray<FSUDSScriptEdge> GetChoices() const;
+
+	/// Get all the current choices available without copying them. These point into the script and are only valid
+	/// until the dialogue moves on
+	const TArray<const FSUDSScriptEdge*>& GetChoiceRefs() const { return Runner.GetChoices(); }
 
 	/** Returns whether the choice at the given index has been taken previously.
 	*	This is saved in dialogue state so will be remembered across save/restore.
@@ -470,9 +482,12 @@ public:
 	 *  @note If you save/load mid-dialogue then you're need to have written Text ID's into the source text to ensure they
 	 *  stay the same between edits, as you do for localisation. If you only save/load after dialogue has ended then
 	 *  you don't need to worry about this since the dialogue will always start from the beginning
+	 *  @param bOnlyChangedVariables If true, only variables which differ from the values set by the script header are
+	 *  included, which makes the state much smaller for dialogues which haven't been run much. RestoreSavedState
+	 *  fills the rest back in from the header
 	 */
 	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
-	FSUDSDialogueState GetSavedState() const;
+	FSUDSDialogueState GetSavedState(bool bOnlyChangedVariables = false) const;
 
 	/** Restore the saved state of this dialogue.
 	 *  This is useful for restoring the state of this dialogue. It will attempt to restore both the value of variables,
@@ -486,6 +501,75 @@ public:
 	 */
 	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
 	void RestoreSavedState(const FSUDSDialogueState& State);
+
+	/** Retrieve the state of this dialogue in a compact binary form.
+	 *  This holds the same information as GetSavedState(), but is much smaller, which helps when you're saving lots
+	 *  of dialogues. Restore it with RestoreCompactSavedState() on a dialogue for the same script.
+	 *  @param OutData Array to receive the data
+	 *  @param bOnlyChangedVariables If true, only variables which differ from the header defaults are included, see
+	 *  GetSavedState()
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
+	void GetCompactSavedState(TArray<uint8>& OutData, bool bOnlyChangedVariables = false) const;
+
+	/** Restore the state of this dialogue from data retrieved by GetCompactSavedState().
+	 *  @param Data The compact state data
+	 *  @return Whether the state could be read. If not, the dialogue is unchanged
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
+	bool RestoreCompactSavedState(const TArray<uint8>& Data);
+
+	/** Seed the random stream this dialogue uses for random selects.
+	 *  Each dialogue has its own stream, so with the same seed the same random choices will be made regardless of
+	 *  anything else using random numbers. If you don't set a seed, one is taken from FMath::SRand's seed on first use.
+	 *  The stream is included in saved state, so restoring a save continues the same sequence.
+	 *  @param Seed The seed to use
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
+	void SetRandomSeed(int32 Seed);
+
+	/// Get the seed of the random stream this dialogue uses for random selects. If no seed has been set yet, one is
+	/// picked now, as it would be on first use
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
+	int32 GetRandomSeed();
+
+	/**
+	 * Set whether variable requests are batched. Normally OnVariableRequested and participants' OnDialogueVariableRequested
+	 * are called for each variable just before it's used, which can be many calls per step. When batched,
+	 * OnVariablesRequested and participants' OnDialogueVariablesRequested are instead called once at the start of
+	 * each step with every variable the step might use; a step runs from starting or making a choice up to and
+	 * including the next speaker line and its choices. Variables which can't be known in advance (e.g. after returning
+	 * from a gosub) are still requested individually, at most once per step.
+	 * @param bBatch Whether to batch variable requests
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
+	void SetBatchVariableRequests(bool bBatch);
+
+	/// Get whether variable requests are batched, see SetBatchVariableRequests
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category="SUDS|Dialogue")
+	bool IsBatchingVariableRequests() const;
+
+	/**
+	 * Add a native provider which the dialogue will ask for the values of variables that aren't set in the dialogue,
+	 * whenever the script reads them. This avoids copying externally owned state into the dialogue. The dialogue
+	 * doesn't own providers; they must outlive it, or be removed. See ISUDSVariableProvider.
+	 * @param Provider The provider to add
+	 */
+	void AddVariableProvider(ISUDSVariableProvider* Provider) { Runner.AddVariableProvider(Provider); }
+	/// Remove a previously added variable provider
+	void RemoveVariableProvider(ISUDSVariableProvider* Provider) { Runner.RemoveVariableProvider(Provider); }
+
+	/**
+	 * Set whether values from variable providers are cached until the next step (starting, or making a choice),
+	 * so each provider is asked at most once per variable per step. Off by default.
+	 * @param bCache Whether to cache provided values
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
+	void SetCacheProvidedVariables(bool bCache);
+
+	/// Discard any values from variable providers cached for this step, e.g. because the external state has changed
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
+	void InvalidateProvidedVariables();
 	
 	/// Get the set of text parameters that are actually being asked for in the current state of the dialogue.
 	/// This will include parameters in the text, and parameters in any current choices being displayed.
@@ -501,31 +585,32 @@ public:
 	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
 	void SetVariable(FName Name, FSUDSValue Value)
 	{
-		SetVariableImpl(Name, Value, false, 0);
+		Runner.SetVariable(Name, Value);
 	}
 
 	/// Get a variable in dialogue state as a general value type
 	/// See GetDialogueText, GetDialogueInt etc for more type friendly versions, but if you want to access the state
 	/// as a type-flexible value then you can do so with this function.
 	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
-	FSUDSValue GetVariable(FName Name) const
-	{
-		if (const auto Arg = VariableState.Find(Name))
-		{
-			return *Arg;
-		}
-		return FSUDSValue();
-	}
+	FSUDSValue GetVariable(FName Name) const;
 
 	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
-	bool IsVariableSet(FName Name) const
-	{
-		return VariableState.Contains(Name);
-	}
+	bool IsVariableSet(FName Name) const;
 
-	/// Get all variables
+	/// Get all variables. Variables are stored in slots internally, so this builds a new map each time it's called
 	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue")
-	const TMap<FName, FSUDSValue>& GetVariables() const { return VariableState; }
+	TMap<FName, FSUDSValue> GetVariables() const;
+
+	/**
+	 * Find the value of a variable in dialogue state, without copying it.
+	 * @param Name The name of the variable
+	 * @param ScriptSlot The slot of the variable in the script's variable table if known, to avoid looking up the name
+	 * @return Pointer to the value, or null if the variable isn't set
+	 */
+	const FSUDSValue* FindVariable(const FName& Name, int32 ScriptSlot = INDEX_NONE) const
+	{
+		return Runner.FindVariable(Name, ScriptSlot);
+	}
 	
 	/**
 	 * Set a text dialogue variable
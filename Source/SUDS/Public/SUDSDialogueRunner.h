@@ -0,0 +1,343 @@
+﻿// Copyright Steve Streeting 2022
+// Released under the MIT license https://opensource.org/license/MIT/
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SUDSDialogueState.h"
+#include "SUDSExpression.h"
+#include "SUDSScriptEdge.h"
+#include "SUDSValue.h"
+
+class FSUDSDialogueRunner;
+class USUDSScript;
+class USUDSScriptNode;
+class USUDSScriptNodeGosub;
+class USUDSScriptNodeText;
+enum class ESUDSScriptNodeType : uint8;
+
+DECLARE_LOG_CATEGORY_EXTERN(LogSUDSDialogue, Verbose, All);
+
+/**
+ * Native callbacks from a FSUDSDialogueRunner. All of them do nothing by default, so just override the ones you need.
+ * Each callback is passed the runner which raised it, so one listener can be shared between many runners.
+ */
+class SUDS_API ISUDSDialogueRunnerListener
+{
+public:
+	virtual ~ISUDSDialogueRunnerListener() = default;
+
+	/// Get the world used to access global variables. If null, global variables are only available in the editor
+	virtual UWorld* GetDialogueWorld(const FSUDSDialogueRunner& Runner) const { return nullptr; }
+	/// Called when the dialogue is starting, before the first speaker line
+	virtual void OnDialogueStarting(FSUDSDialogueRunner& Runner, FName StartLabel) {}
+	/// Called when a new speaker line, potentially with new choices, is ready to be displayed
+	virtual void OnDialogueSpeakerLine(FSUDSDialogueRunner& Runner) {}
+	/// Called when a choice is made, before the dialogue progresses as a result. Not called for simple continues
+	virtual void OnDialogueChoice(FSUDSDialogueRunner& Runner, int ChoiceIndex, int LineNo) {}
+	/// Called when the dialogue is about to proceed away from the current speaker line
+	virtual void OnDialogueProceeding(FSUDSDialogueRunner& Runner) {}
+	/// Called when the dialogue finishes
+	virtual void OnDialogueFinished(FSUDSDialogueRunner& Runner) {}
+	/// Called when an event is sent from the dialogue script
+	virtual void OnDialogueEvent(FSUDSDialogueRunner& Runner, FName EventName, const TArray<FSUDSValue>& Arguments, int LineNo) {}
+	/// Called when a variable is changed, either by the script or from code
+	virtual void OnDialogueVariableChanged(FSUDSDialogueRunner& Runner, FName VariableName, const FSUDSValue& Value, bool bFromScript, int LineNo) {}
+	/// Called the first time the savable state changes after being clean, see FSUDSDialogueRunner::IsStateDirty
+	virtual void OnDialogueStateDirty(FSUDSDialogueRunner& Runner) {}
+	/// Called when the script is about to use a variable; anything set during this call is used immediately
+	virtual void OnDialogueVariableRequested(FSUDSDialogueRunner& Runner, FName VariableName, int LineNo) {}
+	/**
+	 * Called at the start of each step when variable requests are batched (see FSUDSDialogueRunner::SetBatchVariableRequests),
+	 * with every variable the step might use. By default this calls OnDialogueVariableRequested for each one.
+	 */
+	virtual void OnDialogueVariablesRequested(FSUDSDialogueRunner& Runner, const TArray<FName>& VariableNames, int LineNo)
+	{
+		for (const auto& Name : VariableNames)
+		{
+			OnDialogueVariableRequested(Runner, Name, LineNo);
+		}
+	}
+#if WITH_EDITOR
+	/// Called after the script has run a set node, with the source of the expression if it wasn't a literal
+	virtual void OnDialogueScriptSetVariable(FSUDSDialogueRunner& Runner, FName VariableName, const FSUDSValue& Value, const FString& ExprString, int LineNo) {}
+	/// Called when a select condition has been evaluated
+	virtual void OnDialogueSelectEval(FSUDSDialogueRunner& Runner, const FString& ConditionString, bool bResult, int LineNo) {}
+#endif
+};
+
+/**
+ * Supplies variable values to a dialogue on demand, from state held outside the dialogue (e.g. inventory counts).
+ * Unlike setting variables in response to a request, the value isn't copied into the dialogue's state and no change
+ * notifications are raised; the provider is simply asked for the value whenever the script reads the variable.
+ * Providers are only asked for variables which aren't set in the dialogue itself.
+ */
+class SUDS_API ISUDSVariableProvider
+{
+public:
+	virtual ~ISUDSVariableProvider() = default;
+
+	/**
+	 * Provide the current value of a variable, if this provider supplies it
+	 * @param Runner The runner asking for the value
+	 * @param Name The name of the variable
+	 * @param OutValue The value, if this provider supplies the variable
+	 * @return Whether this provider supplies the variable
+	 */
+	virtual bool ProvideVariable(const FSUDSDialogueRunner& Runner, const FName& Name, FSUDSValue& OutValue) const = 0;
+};
+
+/**
+ * The core of a running dialogue, without any UObject overhead.
+ * This holds all the state of a running instance of a script, and steps through it. USUDSDialogue wraps one of these
+ * to add participants, Blueprint events and voice support; if you don't need those, e.g. for large numbers of
+ * ambient conversations, you can use this directly and receive callbacks through an ISUDSDialogueRunnerListener.
+ * The runner does not keep the script alive, its owner must do that, see AddReferencedObjects().
+ */
+class SUDS_API FSUDSDialogueRunner
+{
+protected:
+	const USUDSScript* BaseScript;
+	ISUDSDialogueRunnerListener* Listener;
+	USUDSScriptNodeText* CurrentSpeakerNode;
+	const USUDSScriptNode* CurrentRootChoiceNode;
+
+	/// Values are held in slots; the first slots match the script's variable table so that the script can find them
+	/// by index, and variables the script doesn't reference (e.g. only set from code) are given extra slots on demand.
+	TArray<FSUDSValue> VariableValues;
+	/// Which of the slots in VariableValues are set
+	TBitArray<> VariableSetFlags;
+	/// Number of slots at the start of VariableValues which are from the script's variable table
+	int32 NumScriptVariableSlots;
+	/// Names of the variables in extra slots, which come after the script's slots
+	TArray<FName> ExtraVariableNames;
+	/// Lookup from extra variable name to slot
+	TMap<FName, int32> ExtraVariableSlots;
+
+	/// Stack of Gosub nodes to return to
+	TArray<USUDSScriptNodeGosub*> GosubReturnStack;
+
+	/// Set of all the TextIDs of choices taken already in this dialogue
+	TSet<FString> ChoicesTaken;
+
+	TSet<FName> CurrentRequestedParamNames;
+	bool bParamNamesExtracted;
+
+	/// Random stream used for random selects, separate per dialogue so results are repeatable for a given seed
+	FRandomStream RandomStream;
+	/// The seed RandomStream was initialised with; RandomStream's own initial seed changes when restoring a save
+	int32 RandomSeed;
+	/// Whether RandomStream has been seeded yet, it's seeded on first use if not set explicitly
+	bool bRandomStreamSeeded;
+	/// The seed used if RandomStream is needed before one is set. Taken from the global stream when initialising and
+	/// starting, so that stepping the dialogue never touches global state and can happen on any thread
+	int32 DefaultRandomSeed;
+
+	/// External sources of variable values, asked in order for any variable which isn't set in the dialogue
+	TArray<ISUDSVariableProvider*> VariableProviders;
+	/// Whether values from providers are cached until the next step, see SetCacheProvidedVariables
+	bool bCacheProvidedVariables;
+	/// Values from providers cached for this step
+	mutable TMap<FName, FSUDSValue> ProvidedVariableCache;
+
+	/// Whether variable requests are raised in one batch per step, see SetBatchVariableRequests
+	bool bBatchVariableRequests;
+	/// Whether the savable state has changed since ClearStateDirty was last called
+	bool bStateDirty;
+	/// When batching, the variables which have already been requested in the current step
+	TSet<FName> StepRequestedVariables;
+
+	/// Cached derived info
+	mutable FText CurrentSpeakerDisplayName;
+	/// All valid choices, pointing at edges in the script which don't change while running
+	TArray<const FSUDSScriptEdge*> CurrentChoices;
+	/// Nodes each of the current choices leads to, from the script's runtime graph
+	TArray<USUDSScriptNode*> CurrentChoiceTargets;
+	int CurrentSourceLineNo;
+	static const FText DummyText;
+	static const FString DummyString;
+
+	void InitVariables();
+	void RunHeader();
+	void BeginStep(const USUDSScriptNode* FromNode);
+	void EnsureRandomStreamSeeded();
+	void TakeDefaultRandomSeed();
+	void RunUntilNextSpeakerNodeOrEnd(USUDSScriptNode* FromNode, bool bRaiseAtEnd);
+	const USUDSScriptNode* WalkToNextChoiceNode(USUDSScriptNode* FromNode, bool bExecute);
+	USUDSScriptNode* RecurseWalkToNextChoiceOrTextNode(USUDSScriptNode* Node, bool bExecute, TArray<USUDSScriptNodeGosub*>& LocalGosubStack);
+	const USUDSScriptNode* RunUntilNextChoiceNode(USUDSScriptNode* FromTextNode);
+	const USUDSScriptNode* FindNextChoiceNode(USUDSScriptNode* FromNode);
+	void SetCurrentSpeakerNode(USUDSScriptNodeText* Node, bool bQuietly);
+	void RaiseVariableChange(const FName& VarName, const FSUDSValue& Value, bool bFromScript, int LineNo);
+	void RaiseVariableRequested(const FName& VarName, int LineNo);
+	FSUDSValue EvaluateExpression(const FSUDSExpression& Expression, int LineNo);
+	bool EvaluateCondition(const FSUDSExpression& Expression, int LineNo);
+	UWorld* GetWorld() const;
+	const TMap<FName, FSUDSValue>& GetGlobalVariables() const;
+
+	USUDSScriptNode* GetNextNode(USUDSScriptNode* Node);
+	bool IsChoiceOrTextNode(ESUDSScriptNodeType Type);
+	USUDSScriptNode* RunNode(USUDSScriptNode* Node);
+	USUDSScriptNode* RunSelectNode(USUDSScriptNode* Node);
+	USUDSScriptNode* RunSetVariableNode(USUDSScriptNode* Node);
+	USUDSScriptNode* RunEventNode(USUDSScriptNode* Node);
+	USUDSScriptNode* RunGosubNode(USUDSScriptNode* Node);
+	USUDSScriptNode* RunReturnNode(USUDSScriptNode* Node);
+	void UpdateChoices();
+	/// Run up to the choices using the script's precomputed choice plans, returns false if the path has to be walked instead
+	bool RunChoicePlan(const USUDSScriptNode* FromNode);
+	void RecurseAppendChoices(const USUDSScriptNode* Node,
+	                          TArray<const FSUDSScriptEdge*>& OutChoices,
+	                          TArray<USUDSScriptNode*>& OutTargets);
+
+	FText ResolveParameterisedText(const TArray<FSUDSVariableRef>& Params, const FTextFormat& TextFormat, int LineNo);
+	void GetTextFormatArgs(const TArray<FSUDSVariableRef>& Args, FFormatNamedArguments& OutArgs) const;
+	bool CurrentNodeHasChoices() const;
+	int32 FindVariableSlot(const FName& Name, int32 ScriptSlot = INDEX_NONE) const;
+	int32 FindOrAddVariableSlot(const FName& Name, int32 ScriptSlot = INDEX_NONE);
+	const FName& GetVariableSlotName(int32 Slot) const;
+	void SetVariableImpl(FName Name, const FSUDSValue& Value, bool bFromScript, int LineNo, int32 ScriptSlot = INDEX_NONE);
+	void MarkStateDirty();
+
+public:
+	FSUDSDialogueRunner();
+
+	/**
+	 * Initialise this runner to run a script. Header nodes are run immediately.
+	 * Runners can be initialised again to reuse them, which clears all previous state.
+	 * @param Script The script to run. The caller must keep this alive for as long as the runner uses it
+	 * @param InListener Optional listener to receive callbacks, also see SetListener
+	 */
+	void Initialise(const USUDSScript* Script, ISUDSDialogueRunnerListener* InListener = nullptr);
+
+	/// Set the listener which receives callbacks from this runner. May be null
+	void SetListener(ISUDSDialogueRunnerListener* InListener) { Listener = InListener; }
+	ISUDSDialogueRunnerListener* GetListener() const { return Listener; }
+
+	/// Get the script this runner is running
+	const USUDSScript* GetScript() const { return BaseScript; }
+
+	/// Report the objects this runner needs to stay alive, for owners which are FGCObjects or UObjects with their own
+	/// AddReferencedObjects. Script nodes are owned by the script, so only the script itself is reported
+	void AddReferencedObjects(FReferenceCollector& Collector);
+
+	/// Get the current speaker node, or null if the dialogue has ended
+	USUDSScriptNodeText* GetCurrentSpeakerNode() const { return CurrentSpeakerNode; }
+
+	/// Begin the dialogue, unless it's already on a speaker line. See USUDSDialogue::Start
+	void Start(FName Label = NAME_None);
+	/// Restart the dialogue, either from the start or from a named label. See USUDSDialogue::Restart
+	void Restart(bool bResetState = false, FName StartLabel = NAME_None, bool bReRunHeader = true);
+	/// Continue if there's only one path out of the current speaker line. Returns false if the dialogue has ended
+	bool Continue();
+	/// Pick one of the available choices. Returns false if the dialogue has ended
+	bool Choose(int Index);
+	/// End the dialogue early
+	void End(bool bQuietly);
+	/// Returns true if the dialogue has reached the end
+	bool IsEnded() const;
+	/// Returns whether the current speaker line is the last line of dialogue
+	bool IsFinalLine() const;
+	/// Get the source line number of the current position of the dialogue (returns 0 if not applicable)
+	int GetCurrentSourceLine() const;
+
+	/// Get the speech text for the current dialogue node, resolving parameters
+	FText GetText();
+	/// Get the ID of the current speaker
+	const FString& GetSpeakerID() const;
+	/// Get the display name of the current speaker
+	FText GetSpeakerDisplayName() const;
+
+	/// Get the number of choices available from this node, which is 1 for simple continues
+	int GetNumberOfChoices() const;
+	/// Return whether to progress from here is a simple continue (no choices, no text)
+	bool IsSimpleContinue() const;
+	/// Get the text associated with a choice, resolving parameters
+	FText GetChoiceText(int Index);
+	/// Get all the current choices available. These point into the script, so only copy them if you need to keep them
+	const TArray<const FSUDSScriptEdge*>& GetChoices() const { return CurrentChoices; }
+	/// Get a current choice, or null if the index is invalid
+	const FSUDSScriptEdge* GetChoice(int Index) const { return CurrentChoices.IsValidIndex(Index) ? CurrentChoices[Index] : nullptr; }
+	/// Returns whether the choice at the given index has been taken previously
+	bool HasChoiceIndexBeenTakenPreviously(int Index) const;
+	/// Returns whether a choice has been taken previously
+	bool HasChoiceBeenTakenPreviously(const FSUDSScriptEdge& Choice) const;
+	/// Get the set of text parameters that are actually being asked for in the current state of the dialogue
+	TSet<FName> GetParametersInUse();
+
+	/// Reset the state of this dialogue. See USUDSDialogue::ResetState
+	void ResetState(bool bResetVariables = true, bool bResetPosition = true, bool bResetVisited = true);
+	/// Retrieve a copy of the state of this dialogue, for saving, optionally with only the variables which differ
+	/// from the script's header defaults
+	FSUDSDialogueState GetSavedState(bool bOnlyChangedVariables = false) const;
+	/// Restore the saved state of this dialogue
+	void RestoreSavedState(const FSUDSDialogueState& State);
+	/**
+	 * Returns whether anything which GetSavedState would return has changed since ClearStateDirty was last called.
+	 * Runners start dirty, since their state has never been saved.
+	 */
+	bool IsStateDirty() const { return bStateDirty; }
+	/// Mark the current state as saved, so that IsStateDirty returns false until it next changes
+	void ClearStateDirty() { bStateDirty = false; }
+
+	/**
+	 * Set whether variable requests are batched. Normally each variable is requested individually just before it's
+	 * used, which can mean many callbacks per step. When batched, every variable a step could use is requested in one
+	 * OnDialogueVariablesRequested callback before anything in the step is evaluated; a step is everything from
+	 * starting or making a choice, up to and including the next speaker line and its choices. Variables the script
+	 * can't be statically shown to need are still requested individually, at most once per step.
+	 */
+	void SetBatchVariableRequests(bool bBatch);
+	/// Get whether variable requests are batched, see SetBatchVariableRequests
+	bool IsBatchingVariableRequests() const { return bBatchVariableRequests; }
+
+	/**
+	 * Add a provider which will be asked for the values of variables which aren't set in the dialogue. Providers are
+	 * asked in the order they were added. The runner doesn't own providers; they must outlive it, or be removed.
+	 * @param Provider The provider to add
+	 */
+	void AddVariableProvider(ISUDSVariableProvider* Provider);
+	/// Remove a previously added variable provider
+	void RemoveVariableProvider(ISUDSVariableProvider* Provider);
+	/// Remove all variable providers
+	void ClearVariableProviders();
+	/**
+	 * Set whether values from providers are cached until the next step (starting, or making a choice), so that each
+	 * provider is asked at most once per variable per step. Off by default, so that providers are asked every time.
+	 */
+	void SetCacheProvidedVariables(bool bCache);
+	/// Discard any values from providers cached for this step, e.g. because the external state has changed
+	void InvalidateProvidedVariables() { ProvidedVariableCache.Reset(); }
+	/**
+	 * Find the value of a variable from the variable providers, ignoring the dialogue's own state.
+	 * @param Name The name of the variable
+	 * @param OutValue The value, if a provider supplies it
+	 * @return Whether a provider supplied the value
+	 */
+	bool FindProvidedVariable(const FName& Name, FSUDSValue& OutValue) const;
+
+	/// Seed the random stream this dialogue uses for random selects
+	void SetRandomSeed(int32 Seed);
+	/// Get the seed of the random stream this dialogue uses for random selects, picking one if not set yet
+	int32 GetRandomSeed();
+
+	/// Set a variable in dialogue state, from code
+	void SetVariable(FName Name, const FSUDSValue& Value)
+	{
+		SetVariableImpl(Name, Value, false, 0);
+	}
+	/// Get a copy of a variable's value, or an empty value if not set
+	FSUDSValue GetVariable(FName Name) const;
+	/// Returns whether a variable is set
+	bool IsVariableSet(FName Name) const;
+	/// Get all variables. Variables are stored in slots internally, so this builds a new map each time it's called
+	TMap<FName, FSUDSValue> GetVariables() const;
+	/**
+	 * Find the value of a variable in dialogue state, without copying it.
+	 * @param Name The name of the variable
+	 * @param ScriptSlot The slot of the variable in the script's variable table if known, to avoid looking up the name
+	 * @return Pointer to the value, or null if the variable isn't set
+	 */
+	const FSUDSValue* FindVariable(const FName& Name, int32 ScriptSlot = INDEX_NONE) const;
+	/// Remove the definition of a variable
+	void UnSetVariable(FName Name);
+};
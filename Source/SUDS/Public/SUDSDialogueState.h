@@ -0,0 +1,116 @@
+﻿// Copyright Steve Streeting 2022
+// Released under the MIT license https://opensource.org/license/MIT/
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SUDSValue.h"
+#include "SUDSDialogueState.generated.h"
+
+class USUDSScript;
+
+/// Copy of the internal state of a dialogue
+USTRUCT(BlueprintType)
+struct FSUDSDialogueState
+{
+	GENERATED_BODY()
+protected:
+	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
+	FString TextNodeID;
+
+	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
+	TMap<FName, FSUDSValue> Variables;
+
+	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
+	TArray<FString> ChoicesTaken;
+
+	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
+	TArray<FString> ReturnStack;
+
+	/// If true, Variables only holds values which differ from the script's header defaults, see UnsetVariables
+	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
+	bool bVariablesAreDelta = false;
+
+	/// When Variables are a delta, the variables with header defaults which were unset when saved
+	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
+	TArray<FName> UnsetVariables;
+
+	/// Whether the dialogue's random stream had been seeded when saved. If not, the other random values are ignored
+	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
+	bool bHasRandomStream = false;
+
+	/// The seed the dialogue's random stream was initialised with
+	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
+	int32 RandomSeed = 0;
+
+	/// The current position of the dialogue's random stream, so that restoring continues the same sequence
+	UPROPERTY(BlueprintReadOnly, SaveGame, Category="SUDS|Dialogue")
+	int32 RandomStreamState = 0;
+	
+public:
+	FSUDSDialogueState() {}
+
+	FSUDSDialogueState(const FString& TxtID,
+	                   const TMap<FName, FSUDSValue>& InVars,
+	                   const TSet<FString>& InChoices,
+	                   const TArray<FString>& InReturnStack) : TextNodeID(TxtID),
+	                                                           Variables(InVars),
+	                                                           ChoicesTaken(InChoices.Array()),
+	                                                           ReturnStack(InReturnStack)
+	{
+	}
+
+	const FString& GetTextNodeID() const { return TextNodeID; }
+	const TMap<FName, FSUDSValue>& GetVariables() const { return Variables; }
+	const TArray<FString>& GetChoicesTaken() const { return ChoicesTaken; }
+	const TArray<FString>& GetReturnStack() const { return ReturnStack; }
+	bool AreVariablesDelta() const { return bVariablesAreDelta; }
+	const TArray<FName>& GetUnsetVariables() const { return UnsetVariables; }
+	bool HasRandomStream() const { return bHasRandomStream; }
+	int32 GetRandomSeed() const { return RandomSeed; }
+	int32 GetRandomStreamState() const { return RandomStreamState; }
+
+	/// Mark the variables as only those which differ from the header defaults
+	void SetVariablesDelta(const TArray<FName>& InUnsetVariables)
+	{
+		bVariablesAreDelta = true;
+		UnsetVariables = InUnsetVariables;
+	}
+
+	void SetRandomStream(int32 InSeed, int32 InState)
+	{
+		bHasRandomStream = true;
+		RandomSeed = InSeed;
+		RandomStreamState = InState;
+	}
+
+	/**
+	 * Write this state in the compact binary format, for when you're saving many dialogues. Choices taken are written
+	 * as a bitset over the script's choice ordinals, names and IDs are written once each and referred to by index,
+	 * and numbers are packed.
+	 * @param Script The script this state was saved from, which provides the choice ordinals
+	 * @param OutData Array the data is appended to
+	 */
+	SUDS_API void SaveCompact(const USUDSScript* Script, TArray<uint8>& OutData) const;
+
+	/**
+	 * Read state which was written by SaveCompact, replacing the contents of this state
+	 * @param Script The script the state was saved from
+	 * @param Data The compact data
+	 * @return Whether the data was read successfully
+	 */
+	SUDS_API bool LoadCompact(const USUDSScript* Script, const TArray<uint8>& Data);
+
+	SUDS_API friend FArchive& operator<<(FArchive& Ar, FSUDSDialogueState& Value);
+	SUDS_API friend void operator<<(FStructuredArchive::FSlot Slot, FSUDSDialogueState& Value);
+	bool Serialize(FStructuredArchive::FSlot Slot)
+	{
+		Slot << *this;
+		return true;
+	}
+	bool Serialize(FArchive& Ar)
+	{
+		Ar << *this;
+		return true;
+	}
+	
+};
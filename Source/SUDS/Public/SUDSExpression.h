@@ -71,6 +71,143 @@ public:
 	}
 };
 
+/// Instruction codes for the compiled form of an expression
+enum class ESUDSExpressionOpCode : uint8
+{
+	/// Push a literal operand
+	PushLiteral,
+	/// Push the current value of a variable operand
+	PushVariable,
+	// Operators, all of which replace their arguments on the stack with the result
+	Not,
+	Multiply,
+	Divide,
+	Modulo,
+	Add,
+	Subtract,
+	Less,
+	LessEqual,
+	Greater,
+	GreaterEqual,
+	Equal,
+	NotEqual,
+	/// Short-circuit "and": if the top of the stack is false, replace it with false and skip Operand instructions,
+	/// otherwise pop it and carry on to evaluate the right hand side
+	JumpIfFalse,
+	/// Short-circuit "or": if the top of the stack is true, replace it with true and skip Operand instructions,
+	/// otherwise pop it and carry on to evaluate the right hand side
+	JumpIfTrue,
+	/// Convert the top of the stack to a boolean, used after the right hand side of "and" / "or"
+	ToBoolean,
+	// Specialised operators, only used when operand types are known at import time. These read the values directly
+	// without checking types; float operators use OperandFlags to know which arguments are ints
+	IntMultiply,
+	IntDivide,
+	IntModulo,
+	IntAdd,
+	IntSubtract,
+	IntLess,
+	IntLessEqual,
+	IntGreater,
+	IntGreaterEqual,
+	IntEqual,
+	IntNotEqual,
+	FloatMultiply,
+	FloatDivide,
+	FloatModulo,
+	FloatAdd,
+	FloatSubtract,
+	FloatLess,
+	FloatLessEqual,
+	FloatGreater,
+	FloatGreaterEqual,
+	FloatEqual,
+	FloatNotEqual,
+	BoolNot,
+	BoolEqual,
+	BoolNotEqual
+};
+
+/// A single instruction in a compiled expression
+struct FSUDSExpressionOp
+{
+	/// VariableIndex value used when the expression has too many variables to index them all
+	static constexpr uint8 NoVariableIndex = 255;
+
+	/// For typed float operators, set in OperandFlags if the first argument is an int
+	static constexpr uint8 Arg1IsInt = 1;
+	/// For typed float operators, set in OperandFlags if the second argument is an int
+	static constexpr uint8 Arg2IsInt = 2;
+
+	ESUDSExpressionOpCode OpCode;
+	union
+	{
+		/// For PushVariable, the index of the variable in the expression's variable names (255 if out of range)
+		uint8 VariableIndex;
+		/// For typed float operators, combination of Arg1IsInt / Arg2IsInt
+		uint8 OperandFlags;
+	};
+	/// For push instructions, the index of the operand item in the source queue. For jumps, the number of
+	/// instructions to skip
+	uint16 Operand;
+
+	FSUDSExpressionOp(ESUDSExpressionOpCode InOpCode, uint16 InOperand = 0, uint8 InVariableIndex = 0)
+		: OpCode(InOpCode), VariableIndex(InVariableIndex), Operand(InOperand) {}
+};
+
+/// A token found in an expression string, see FSUDSExpression::NextToken
+struct FSUDSExpressionToken
+{
+	/// Index of the first character of the token in the expression string
+	int32 Start = 0;
+	/// Number of characters in the token
+	int32 Len = 0;
+};
+
+/// Function called to request a variable value just before an expression reads it
+typedef TFunctionRef<void(const FName& VariableName)> FSUDSVariableRequestFunc;
+
+/// A variable referenced by a script, with its scope resolved up-front so that the name never needs parsing at runtime
+struct FSUDSVariableRef
+{
+	/// The name as used in the script, e.g. "global.Foo"
+	FName Name;
+	/// For global variables, the name without the "global." prefix; NAME_None for local variables
+	FName GlobalName;
+	/// The name as a string, for use as a text format argument
+	FString ArgumentName;
+	/// The slot in the script's variable table, INDEX_NONE for globals or if not resolved
+	int32 Slot = INDEX_NONE;
+
+	FSUDSVariableRef() {}
+	/// Initialise from a name as used in the script, resolving the scope
+	SUDS_API explicit FSUDSVariableRef(const FString& InName);
+
+	bool IsGlobal() const { return !GlobalName.IsNone(); }
+};
+
+/// Where an expression gets its variable values from when it's evaluated
+class SUDS_API ISUDSVariableSource
+{
+public:
+	virtual ~ISUDSVariableSource() = default;
+
+	/**
+	 * Find the current value of a local variable
+	 * @param Name The name of the variable
+	 * @param Slot The variable's slot in the script's variable table, or INDEX_NONE if it doesn't have one
+	 * @return Pointer to the value, or null if the variable isn't set
+	 */
+	virtual const FSUDSValue* FindVariable(const FName& Name, int32 Slot) const = 0;
+
+	/**
+	 * Find the current value of a global variable
+	 * @param Name The name of the variable, without the "global." prefix
+	 * @return Pointer to the value, or null if the variable isn't set
+	 */
+	virtual const FSUDSValue* FindGlobalVariable(const FName& Name) const = 0;
+};
+
 
 /// An expression holds an executable expression, whether it's a simple single literal
 /// or a compound expression with variables
@@ -90,20 +227,91 @@ protected:
 
 	UPROPERTY()
 	TArray<FName> VariableNames;
+
+	/// The slot in the owning script's variable table of each entry in VariableNames, INDEX_NONE for globals
+	UPROPERTY()
+	TArray<int32> VariableSlots;
 	
 
 	/// The original string version of the expression, for reference 
 	UPROPERTY(BlueprintReadOnly, Category="SUDS|Expression")
 	FString SourceString;
 
-	FSUDSExpressionItem EvaluateOperator(ESUDSExpressionItemType Op,
-	                                     const FSUDSExpressionItem& Arg1,
-	                                     const FSUDSExpressionItem& Arg2,
-	                                     const TMap<FName, FSUDSValue>& Variables,
-	                                     const TMap<FName, FSUDSValue>& GlobalVariables) const;
-	FSUDSValue EvaluateOperand(const FSUDSValue& Operand, const TMap<FName, FSUDSValue>& Variables, const TMap<FName, FSUDSValue>& GlobalVariables) const;
+	/// The statically known type of each entry in VariableNames, inferred at import time from the script header.
+	/// Empty if types haven't been inferred, and ESUDSValueType::Empty for any variable whose type isn't known
+	UPROPERTY()
+	TArray<ESUDSValueType> VariableTypes;
+
+	/// Compiled form of Queue which is what's actually executed. Not saved, always rebuilt from Queue
+	TArray<FSUDSExpressionOp> Ops;
+	/// Version of Ops using specialised operators, built only if all the types in the expression are known.
+	/// If a variable turns out to have a different type at runtime, Ops is used instead
+	TArray<FSUDSExpressionOp> TypedOps;
+	/// For each entry in VariableNames, the name without the "global." prefix if global, or NAME_None if local.
+	/// Built with Ops so that the scope doesn't have to be parsed from the name every time the variable is read
+	TArray<FName> VariableGlobalNames;
+	/// The maximum depth of the evaluation stack, calculated in Validate()
+	int32 MaxStackDepth = 0;
+
+	/// Size of evaluation stacks which can be held without any heap allocation
+	static constexpr int32 InlineStackSize = 16;
+
+	/// The variables which have already been requested during one evaluation, so each is only requested once
+	struct FRequestedVariables
+	{
+		/// By index in VariableNames; no heap allocation unless the expression uses more than 64 variables
+		TBitArray<TInlineAllocator<2>> Indexes;
+		/// Variables without an index, which only happens in huge expressions
+		TArray<FName> Names;
+
+		/// Record a variable as requested, returning true if it hadn't been already
+		bool MarkRequested(uint8 VariableIndex, const FName& Name);
+	};
+
+	FSUDSValue EvaluateImpl(const ISUDSVariableSource& Variables,
+	                        const FSUDSVariableRequestFunc* OnVariableRequested) const;
+	/**
+	 * Execute a list of compiled instructions
+	 * @param Program The instructions, either Ops or TypedOps
+	 * @param bTyped Whether Program is TypedOps, in which case variable types are checked as they're read
+	 * @param Variables Source of variable values
+	 * @param OnVariableRequested Optional callback for variables as they're read
+	 * @param InOutRequested The variables already requested in this evaluation
+	 * @param OutResult The result of the expression
+	 * @return False if a typed program read a variable which didn't have its expected type, so needs to be re-run
+	 *   untyped. Always true for untyped programs
+	 */
+	bool Execute(const TArray<FSUDSExpressionOp>& Program,
+	             bool bTyped,
+	             const ISUDSVariableSource& Variables,
+	             const FSUDSVariableRequestFunc* OnVariableRequested,
+	             FRequestedVariables& InOutRequested,
+	             FSUDSValue& OutResult) const;
+	static FSUDSValue EvaluateTypedOperator(const FSUDSExpressionOp& Op, const FSUDSValue& Arg1, const FSUDSValue& Arg2);
+	bool CheckBooleanResult(const FSUDSValue& Result, const FString& ErrorContext) const;
+	static FSUDSValue EvaluateOperator(ESUDSExpressionOpCode Op, const FSUDSValue& Arg1, const FSUDSValue& Arg2);
+	static ESUDSExpressionOpCode GetBinaryOpCode(ESUDSExpressionItemType ItemType);
+	static const FSUDSValue& FindOperandValue(const FSUDSValue& Operand,
+	                                          int32 Slot,
+	                                          const FName& GlobalName,
+	                                          const ISUDSVariableSource& Variables);
 
 	bool Validate();
+	/// Fold constant sub-expressions & remove identity operations from the queue
+	void Optimise();
+	/// Rebuild the compiled instructions from the queue
+	void Compile();
+	/// Build TypedOps from Ops, if all types are known
+	void CompileTyped();
+	/// Get the operator to use in place of a generic operator when the argument types are known, or the generic one
+	/// if there isn't a specialised version
+	static ESUDSExpressionOpCode GetTypedOpCode(ESUDSExpressionOpCode Op, ESUDSValueType Arg1Type, ESUDSValueType Arg2Type);
+	/// Statically determine the result type of an operator given its argument types, where ESUDSValueType::Empty means
+	/// unknown. Any type mismatch is described in OutProblem
+	static ESUDSValueType InferOperatorType(ESUDSExpressionItemType Op,
+	                                        ESUDSValueType Arg1Type,
+	                                        ESUDSValueType Arg2Type,
+	                                        FString& OutProblem);
 
 public:
 
@@ -116,6 +324,7 @@ public:
 		if (LiteralOrVariable.IsVariable())
 			VariableNames.Add(LiteralOrVariable.GetVariableNameValue());
 		bIsValid = true;
+		Compile();
 	}
 
 	/**
@@ -133,9 +342,42 @@ public:
 	/// Evaluate the expression and return the result, using a given variable state 
 	FSUDSValue Evaluate(const TMap<FName, FSUDSValue>& Variables, const TMap<FName, FSUDSValue>& GlobalVariables) const;
 
+	/**
+	 * Evaluate the expression and return the result, using a given variable state. Variables are requested via a
+	 * callback just before they're read, so that values can be provided on demand; variables which aren't needed,
+	 * e.g. because an "and" / "or" was decided by its left hand side, are never requested.
+	 * @param Variables The local variable state
+	 * @param GlobalVariables The global variable state
+	 * @param OnVariableRequested Called once per evaluation for each variable, before it's read
+	 * @return The result of the expression
+	 */
+	FSUDSValue Evaluate(const TMap<FName, FSUDSValue>& Variables,
+	                    const TMap<FName, FSUDSValue>& GlobalVariables,
+	                    FSUDSVariableRequestFunc OnVariableRequested) const;
+
+	/**
+	 * Evaluate the expression and return the result, reading variables from a variable source, which can look them
+	 * up by slot instead of by name.
+	 * @param Variables The source of local & global variable values
+	 * @param OnVariableRequested Called once per evaluation for each variable, before it's read
+	 * @return The result of the expression
+	 */
+	FSUDSValue Evaluate(const ISUDSVariableSource& Variables, FSUDSVariableRequestFunc OnVariableRequested) const;
+
 	/// Evaluate the expression and return the result as a boolean, using a given variable state 
 	bool EvaluateBoolean(const TMap<FName, FSUDSValue>& Variables, const TMap<FName, FSUDSValue>& GlobalVariables, const FString& ErrorContext) const;
 
+	/// Evaluate the expression and return the result as a boolean, requesting variables as they're read
+	bool EvaluateBoolean(const TMap<FName, FSUDSValue>& Variables,
+	                     const TMap<FName, FSUDSValue>& GlobalVariables,
+	                     const FString& ErrorContext,
+	                     FSUDSVariableRequestFunc OnVariableRequested) const;
+
+	/// Evaluate the expression and return the result as a boolean, reading variables from a variable source
+	bool EvaluateBoolean(const ISUDSVariableSource& Variables,
+	                     const FString& ErrorContext,
+	                     FSUDSVariableRequestFunc OnVariableRequested) const;
+
 	/// Get the original source of the expression as a string
 	const FString& GetSourceString() const { return SourceString; }
 
@@ -147,7 +389,31 @@ public:
 
 	/// Get the list of variables this expression needs
 	const TArray<FName>& GetVariableNames() const { return VariableNames; }
+
+	/// Get the script variable slots of the variables this expression needs, in the same order as GetVariableNames().
+	/// Empty if slots haven't been resolved
+	const TArray<int32>& GetVariableSlots() const { return VariableSlots; }
+
+	/**
+	 * Look up the slots of the variables this expression uses in a script's variable table
+	 * @param SlotMap Map of variable name to slot, from the script
+	 */
+	void ResolveVariableSlots(const TMap<FName, int32>& SlotMap);
 	
+	/**
+	 * Infer the types of this expression's variables and operators from known variable types, e.g. from the
+	 * initial [set] of each variable in the script header. If every type is known the expression is evaluated using
+	 * specialised operators, see IsStaticallyTyped().
+	 * @param KnownTypes Map of variable name to type, for variables whose type is known
+	 * @param OutProblems Descriptions of any type mismatches found, which would always produce a default or
+	 *   surprising result at runtime
+	 * @return The result type of the expression, or ESUDSValueType::Empty if it can't be determined
+	 */
+	ESUDSValueType InferTypes(const TMap<FName, ESUDSValueType>& KnownTypes, TArray<FString>& OutProblems);
+
+	/// Whether the types of everything in this expression are known, so specialised operators are used
+	bool IsStaticallyTyped() const { return !TypedOps.IsEmpty(); }
+
 	/// Return whether this expression is a generated random condition
 	bool IsRandomCondition() const;
 
@@ -158,10 +424,22 @@ public:
 	 * @param OutVal The operand value which will be populated if successful
 	 * @return True if successful, false if not
 	 */
-	static bool ParseOperand(const FString& ValueStr, FSUDSValue& OutVal);
+	static bool ParseOperand(FStringView ValueStr, FSUDSValue& OutVal);
 	
 	// Attempt to parse an operator from an incoming string
-	static ESUDSExpressionItemType ParseOperator(const FString& OpStr);
+	static ESUDSExpressionItemType ParseOperator(FStringView OpStr);
+
+	/**
+	 * Find the next token in an expression string. Characters which can't start a token are skipped.
+	 * Where more than one kind of token could start at the same position, the first in this order wins:
+	 * {Variable}, number, arithmetic operator or parenthesis, boolean operator or comparison, constant, "quoted text",
+	 * `quoted name`.
+	 * @param Expression The expression string
+	 * @param InOutPos The position to start looking from, updated to just after the token if one is found
+	 * @param OutToken The token, if one was found
+	 * @return Whether a token was found; false means the end of the string was reached
+	 */
+	static bool NextToken(FStringView Expression, int32& InOutPos, FSUDSExpressionToken& OutToken);
 
 	/// Access the internal RPN execution queue
 	const TArray<FSUDSExpressionItem>& GetQueue() { return Queue; }
@@ -179,6 +457,12 @@ public:
 		return Queue[0].GetOperandValue();
 	}
 
+	/// Return whether this is a boolean literal, e.g. a condition which is always true or false
+	bool IsBooleanLiteral() const
+	{
+		return bIsValid && Queue.Num() == 1 && Queue[0].IsOperand() && Queue[0].GetOperandValue().GetType() == ESUDSValueType::Boolean;
+	}
+
 	/// Return whenter this is a text literal
 	bool IsTextLiteral() const
 	{
@@ -195,14 +479,15 @@ public:
 	void SetTextLiteralValue(const FText& NewLiteral)
 	{
 		check(IsTextLiteral());
+		// Compiled instructions refer to queue items by index so this doesn't need a recompile
 		Queue[0].SetOperandValue(NewLiteral);
 	}
 
 	/// Helper method to get boolean literal value
 	bool GetBooleanLiteralValue() const
 	{
-		check(IsLiteral() && GetLiteralValue().GetType() == ESUDSValueType::Boolean);
-		return GetLiteralValue().GetBooleanValue();
+		check(IsBooleanLiteral());
+		return Queue[0].GetOperandValue().GetBooleanValue();
 	}
 	/// Helper method to get int literal value
 	int GetIntLiteralValue() const
@@ -229,6 +514,17 @@ public:
 		return GetLiteralValue().GetNameValue();
 	}
 
+	/// Rebuilds the compiled form after loading, since only the queue is saved
+	void PostSerialize(const FArchive& Ar);
 
 };
 
+template<>
+struct TStructOpsTypeTraits<FSUDSExpression> : public TStructOpsTypeTraitsBase2<FSUDSExpression>
+{
+	enum
+	{
+		WithPostSerialize = true
+	};
+};
+
@@ -8,6 +8,63 @@
 #include "SUDSParticipant.generated.h"
 
 class USUDSDialogue;
+
+/// The callbacks a participant can receive, see FSUDSParticipantSubscription
+UENUM(BlueprintType, meta=(Bitflags, UseEnumValuesAsMaskValuesInEditor="true"))
+enum class ESUDSParticipantCallbacks : uint8
+{
+	None = 0 UMETA(Hidden),
+	Starting = 1 << 0,
+	Finished = 1 << 1,
+	SpeakerLine = 1 << 2,
+	ChoiceMade = 1 << 3,
+	Proceeding = 1 << 4,
+	Event = 1 << 5,
+	VariableChanged = 1 << 6,
+	VariableRequested = 1 << 7,
+};
+ENUM_CLASS_FLAGS(ESUDSParticipantCallbacks);
+
+/**
+ * Describes which callbacks a participant wants to receive. Participants which only care about a few events or
+ * variables can use this to avoid being called for everything else. The default is to receive everything.
+ */
+USTRUCT(BlueprintType)
+struct SUDS_API FSUDSParticipantSubscription
+{
+	GENERATED_BODY()
+
+	/// Which callbacks the participant wants to receive, combination of ESUDSParticipantCallbacks
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="SUDS", meta=(Bitmask, BitmaskEnum="/Script/SUDS.ESUDSParticipantCallbacks"))
+	int32 Callbacks = 0xFF;
+
+	/// If not empty, OnDialogueEvent is only called for events with these names
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="SUDS")
+	TArray<FName> EventNames;
+
+	/// If this or VariablePrefixes is not empty, OnDialogueVariableChanged and OnDialogueVariableRequested are only
+	/// called for variables with these names, or which start with one of VariablePrefixes
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="SUDS")
+	TArray<FName> VariableNames;
+
+	/// Variable name prefixes to receive callbacks for, e.g. "SpeakerName." See VariableNames
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="SUDS")
+	TArray<FString> VariablePrefixes;
+
+	/// Whether this subscription includes a type of callback
+	bool WantsCallback(ESUDSParticipantCallbacks Callback) const
+	{
+		return (Callbacks & static_cast<int32>(Callback)) != 0;
+	}
+	/// Whether this subscription includes a named event
+	bool WantsEvent(const FName& EventName) const
+	{
+		return EventNames.IsEmpty() || EventNames.Contains(EventName);
+	}
+	/// Whether this subscription includes a named variable
+	bool WantsVariable(const FName& VariableName) const;
+};
+
 UINTERFACE(MinimalAPI)
 class USUDSParticipant : public UInterface
 {
@@ -113,17 +170,85 @@ public:
 	 */
 	UFUNCTION(BlueprintCallable, BlueprintNativeEvent, Category="SUDS")
 	void OnDialogueVariableRequested(USUDSDialogue* Dialogue, FName VariableName);
+
+	/**
+	 * Called instead of OnDialogueVariableRequested when the dialogue batches variable requests (see
+	 * USUDSDialogue::SetBatchVariableRequests). It's called once at the start of each step, with every variable the
+	 * step might use, before any of them are used. Call SetVariable on the dialogue to provide values.
+	 * Variables which can't be known in advance are still requested individually via OnDialogueVariableRequested.
+	 * @param Dialogue The dialogue instance
+	 * @param VariableNames The names of the variables which may be used
+	 */
+	UFUNCTION(BlueprintCallable, BlueprintNativeEvent, Category="SUDS")
+	void OnDialogueVariablesRequested(USUDSDialogue* Dialogue, const TArray<FName>& VariableNames);
 	
 	/**
 	 * Return the priority of this participant (default 0).
 	 * If for some reason you need to control the order multiple participants in a dialogue are called, 
 	 * override this method; higher priority participants will be called *later* so that their variables etc override
-	 * previously set values.
+	 * previously set values. This is only called when the participant is added to a dialogue, so changing the
+	 * priority after that has no effect until it's added again.
 	 * @return Relative priority, default 0, higher numbers override lower ones. 
 	 */
 	UFUNCTION(BlueprintCallable, BlueprintNativeEvent, Category="SUDS")
 	int GetDialogueParticipantPriority() const;
 
+	/**
+	 * Return which callbacks this participant wants to receive (default everything).
+	 * Override this if the participant only cares about some events or variables, so that it isn't called for the rest.
+	 * Like the priority, this is only called when the participant is added to a dialogue.
+	 * @return Description of the callbacks the participant wants
+	 */
+	UFUNCTION(BlueprintCallable, BlueprintNativeEvent, Category="SUDS")
+	FSUDSParticipantSubscription GetDialogueParticipantSubscription() const;
+
 };
 
 
+UINTERFACE(MinimalAPI, meta=(CannotImplementInterfaceInBlueprint))
+class USUDSNativeParticipant : public UInterface
+{
+	GENERATED_BODY()
+};
+
+/**
+* Native C++ alternative to ISUDSParticipant, for participants which don't need to be implemented in Blueprints.
+* The callbacks are the same as ISUDSParticipant, but they're plain virtual functions which are called directly,
+* rather than going through the Blueprint event dispatch. Prefer this for participants in C++ which are called often,
+* e.g. those supplying variables to lots of barks.
+* If an object implements both interfaces, only this one is called.
+*/
+class SUDS_API ISUDSNativeParticipant
+{
+	GENERATED_BODY()
+
+public:
+	/// See ISUDSParticipant::OnDialogueStarting
+	virtual void OnDialogueStarting(USUDSDialogue* Dialogue, FName AtLabel) = 0;
+	/// See ISUDSParticipant::OnDialogueFinished
+	virtual void OnDialogueFinished(USUDSDialogue* Dialogue) = 0;
+	/// See ISUDSParticipant::OnDialogueSpeakerLine
+	virtual void OnDialogueSpeakerLine(USUDSDialogue* Dialogue) = 0;
+	/// See ISUDSParticipant::OnDialogueChoiceMade
+	virtual void OnDialogueChoiceMade(USUDSDialogue* Dialogue, int ChoiceIndex) = 0;
+	/// See ISUDSParticipant::OnDialogueProceeding
+	virtual void OnDialogueProceeding(USUDSDialogue* Dialogue) = 0;
+	/// See ISUDSParticipant::OnDialogueEvent
+	virtual void OnDialogueEvent(USUDSDialogue* Dialogue, FName EventName, const TArray<FSUDSValue>& Arguments) = 0;
+	/// See ISUDSParticipant::OnDialogueVariableChanged
+	virtual void OnDialogueVariableChanged(USUDSDialogue* Dialogue, FName VariableName, const FSUDSValue& Value, bool bFromScript) = 0;
+	/// See ISUDSParticipant::OnDialogueVariableRequested
+	virtual void OnDialogueVariableRequested(USUDSDialogue* Dialogue, FName VariableName) = 0;
+	/// See ISUDSParticipant::OnDialogueVariablesRequested. By default calls OnDialogueVariableRequested for each variable
+	virtual void OnDialogueVariablesRequested(USUDSDialogue* Dialogue, const TArray<FName>& VariableNames)
+	{
+		for (const auto& Name : VariableNames)
+		{
+			OnDialogueVariableRequested(Dialogue, Name);
+		}
+	}
+	/// See ISUDSParticipant::GetDialogueParticipantPriority. Only read when the participant is added to a dialogue
+	virtual int GetDialogueParticipantPriority() const = 0;
+	/// See ISUDSParticipant::GetDialogueParticipantSubscription. Only read when the participant is added to a dialogue
+	virtual FSUDSParticipantSubscription GetDialogueParticipantSubscription() const { return FSUDSParticipantSubscription(); }
+};
@@ -3,6 +3,9 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "SUDSScriptNode.h"
+#include "SUDSValue.h"
+#include "Misc/ScopeRWLock.h"
 #include "Runtime/Launch/Resources/Version.h"
 #include "Sound/DialogueVoice.h"
 #include "UObject/Object.h"
@@ -11,6 +14,53 @@
 class USUDSScriptNode;
 class USUDSScriptNodeText;
 class USUDSScriptNodeGosub;
+class USUDSScriptNodeSet;
+
+/// The result of a header [set] which doesn't depend on any state, so can be evaluated once for every dialogue
+struct FSUDSHeaderDefault
+{
+	/// The set node this came from
+	const USUDSScriptNodeSet* Node;
+	/// The value the set node's expression always evaluates to
+	FSUDSValue Value;
+};
+
+/// A node in a script's flattened runtime graph, see USUDSScript::GetRuntimeNode
+struct FSUDSRuntimeNode
+{
+	/// The node object, which holds the node's data (text, expressions etc)
+	USUDSScriptNode* Node = nullptr;
+	ESUDSScriptNodeType Type = ESUDSScriptNodeType::Text;
+	/// Start of this node's edges in the script's edge target array
+	int32 FirstEdge = 0;
+	int32 NumEdges = 0;
+	/// For gosub nodes, the index of the node jumped to
+	int32 GosubTarget = INDEX_NONE;
+};
+
+/// How the path from a text or gosub node towards its choices ends, see FSUDSChoicePlan
+enum class ESUDSChoicePlanResult : uint8
+{
+	/// Reaches a choice node
+	Choice,
+	/// Reaches another text node or the end of the script, so there are no choices
+	NoChoice,
+	/// Reaches a return, so what follows depends on the call site; continue with the plan of the gosub returned to
+	Return,
+	/// Reaches a select or gosub, so the path depends on state and has to be walked at runtime
+	Dynamic
+};
+
+/// The static path from a text node to its choices, or from a gosub node to the choices after it returns
+struct FSUDSChoicePlan
+{
+	/// Nodes to run on the way, in order. If the result is Return, the last one is the return node
+	TArray<USUDSScriptNode*> IntermediateNodes;
+	/// The choice node reached, if the result is Choice
+	const USUDSScriptNode* RootChoiceNode = nullptr;
+	ESUDSChoicePlanResult Result = ESUDSChoicePlanResult::NoChoice;
+};
+
 /**
  * A single SUDS script asset.
  */
@@ -44,8 +94,66 @@ protected:
 	UPROPERTY(BlueprintReadOnly, EditDefaultsOnly, Category="SUDS")
 	TMap<FString, TObjectPtr<UDialogueVoice>> SpeakerVoices;
 
+	/// Names of all the local variables referenced in this script. A variable's index in this list is its slot,
+	/// which is what expressions, set nodes and text parameters use to find it at runtime
+	UPROPERTY(BlueprintReadOnly, VisibleDefaultsOnly, Category="SUDS")
+	TArray<FName> VariableNames;
+
+	/// Text IDs of every choice in the script, in ordinal order for compact saved state. Re-importing appends new
+	/// choices and leaves removed ones in place, so a choice's ordinal doesn't change between versions of the script
+	UPROPERTY()
+	TArray<FString> ChoiceOrdinals;
+
+	/// Lookup from variable name to slot, built from VariableNames
+	TMap<FName, int32> VariableSlotMap;
+
+	/// Pre-evaluated results of the leading header [set]s which don't depend on any state
+	TArray<FSUDSHeaderDefault> HeaderDefaults;
+	/// The first header node not covered by HeaderDefaults, which has to be run by each dialogue (null if none)
+	USUDSScriptNode* HeaderResumeNode = nullptr;
+	/// Value of each variable that every dialogue has after running the header, regardless of state
+	TMap<FName, FSUDSValue> HeaderDefaultValues;
+
+	/// Flattened graph used to step through the script at runtime, built after import and load. Body nodes come first
+	/// in the same order as Nodes, so label indexes are also runtime indexes, followed by header nodes
+	TArray<FSUDSRuntimeNode> RuntimeNodes;
+	/// Runtime index of the target of every edge (INDEX_NONE for the end), ranges referenced by FSUDSRuntimeNode
+	TArray<int32> RuntimeEdgeTargets;
+
+	/// Index in Nodes of each text node by text ID, and each gosub node by gosub ID, for restoring saved state.
+	/// These are built on first use, possibly by dialogues on different threads, so they're built under NodeIDIndexesLock
+	mutable TMap<FString, int32> TextIDIndex;
+	mutable TMap<FString, int32> GosubIDIndex;
+	/// Ordinal of each choice by text ID, and the ordinals in use (ChoiceOrdinals, or derived for older assets)
+	mutable TMap<FString, int32> ChoiceOrdinalIndex;
+	mutable TArray<FString> RuntimeChoiceOrdinals;
+	mutable std::atomic<bool> bNodeIDIndexesBuilt { false };
+	mutable FRWLock NodeIDIndexesLock;
+
+	/// Choice plans of text and gosub nodes, built after import and load
+	TMap<const USUDSScriptNode*, FSUDSChoicePlan> ChoicePlans;
+
+	/// Names of the variables which could be requested in a dialogue step starting at a node, built on first use.
+	/// Shared by every dialogue running this script, so only ever accessed under StepVariableNamesLock
+	mutable TMap<const USUDSScriptNode*, TArray<FName>> StepVariableNames;
+	mutable FRWLock StepVariableNamesLock;
+
 	bool DoesAnyPathAfterLeadToChoice(USUDSScriptNode* FromNode);
 	int RecurseLookForChoice(USUDSScriptNode* CurrNode);
+	void BuildVariableTable(bool bIncludeTextParameters);
+	void ResolveVariableSlots();
+	void BuildHeaderDefaults();
+	void BuildChoicePlans();
+	void BuildRuntimeGraph();
+	void EnsureNodeIDIndexesBuilt() const;
+	void BuildNodeIDIndexes() const;
+	void CollectChoiceIDs(TArray<FString>& OutIDs) const;
+	void UpdateChoiceOrdinals();
+	void ClearStepVariableNames();
+	void CollectStepVariableNames(const USUDSScriptNode* Node,
+	                              bool bAfterText,
+	                              TArray<FName>& OutNames,
+	                              TSet<const USUDSScriptNode*>& Visited) const;
 	
 public:
 	void StartImport(TArray<TObjectPtr<USUDSScriptNode>>** Nodes,
@@ -59,12 +167,74 @@ public:
 	const TArray<USUDSScriptNode*>& GetHeaderNodes() const { return ObjectPtrDecay(HeaderNodes); }
 	const TMap<FName, int>& GetLabelList() const { return LabelList; }
 	const TMap<FName, int>& GetHeaderLabelList() const { return HeaderLabelList; }
+
+	/// Get the names of all local variables referenced in the script, in slot order
+	const TArray<FName>& GetVariableNames() const { return VariableNames; }
+	/// Get the number of variable slots in the script's variable table
+	int32 GetNumVariableSlots() const { return VariableNames.Num(); }
+	/// Get the slot of a local variable in the script's variable table, or INDEX_NONE if the script doesn't reference it
+	int32 GetVariableSlot(const FName& Name) const
+	{
+		const int32* pSlot = VariableSlotMap.Find(Name);
+		return pSlot ? *pSlot : INDEX_NONE;
+	}
+
+	virtual void PostLoad() override;
 	
 
 	/// Get the first header node, if any (header nodes are run every time the script starts)
 	UFUNCTION(BlueprintCallable, BlueprintPure, Category="SUDS")
 	USUDSScriptNode* GetHeaderNode() const;
 
+	/**
+	 * Get the results of the header [set]s at the start of the header which only involve literals, in order. These
+	 * are the same for every dialogue, so are evaluated once when the script is loaded rather than every time the
+	 * header is run. The rest of the header, starting at GetHeaderResumeNode(), still has to be run.
+	 */
+	const TArray<FSUDSHeaderDefault>& GetHeaderDefaults() const { return HeaderDefaults; }
+	/// Get the value of each variable which every dialogue has after running the header, regardless of state.
+	/// Variables which the rest of the header may set again aren't included
+	const TMap<FName, FSUDSValue>& GetHeaderDefaultValues() const { return HeaderDefaultValues; }
+
+	/// Get the first header node which isn't covered by GetHeaderDefaults() and so still needs to be run, if any
+	USUDSScriptNode* GetHeaderResumeNode() const { return HeaderResumeNode; }
+
+	/// Get the record of a node in the flattened runtime graph, or null if it's not part of this script's graph
+	const FSUDSRuntimeNode* GetRuntimeNode(const USUDSScriptNode* Node) const
+	{
+		const int32 Idx = Node ? Node->GetRuntimeIndex() : INDEX_NONE;
+		return RuntimeNodes.IsValidIndex(Idx) && RuntimeNodes[Idx].Node == Node ? &RuntimeNodes[Idx] : nullptr;
+	}
+
+	/**
+	 * Get the node an edge leads to, using the runtime graph rather than resolving the edge's weak pointer
+	 * @param Node The node the edge comes from
+	 * @param EdgeIndex The index of the edge on the node
+	 * @return The target node, or null if the edge leads to the end (or doesn't exist)
+	 */
+	USUDSScriptNode* GetEdgeTarget(const USUDSScriptNode* Node, int EdgeIndex) const;
+
+	/// Get the node which a gosub node jumps to, or null if the label doesn't exist
+	USUDSScriptNode* GetGosubTarget(const USUDSScriptNode* GosubNode) const;
+
+	/**
+	 * Get the precomputed path from a text node to its choices, or from a gosub node to the choices which follow it
+	 * once it returns. Only text and gosub nodes have plans.
+	 * @param Node The text or gosub node
+	 * @return The plan, or null if the node doesn't have one
+	 */
+	const FSUDSChoicePlan* FindChoicePlan(const USUDSScriptNode* Node) const { return ChoicePlans.Find(Node); }
+
+	/**
+	 * Get the names of all the variables which could be requested during a dialogue step starting at a node: running
+	 * on to the next speaker line, that line's text, and the choices which follow it. All paths are included, since
+	 * which one will be taken isn't known until the step runs. Built on first use for each node, then cached.
+	 * The names are copied out, since the cache is shared by every dialogue and can grow while they're used.
+	 * @param FromNode The node the step starts at
+	 * @param OutNames The names of the variables, which may be empty
+	 */
+	void GetStepVariableNames(const USUDSScriptNode* FromNode, TArray<FName>& OutNames) const;
+
 	/// Get the first node of the script, if starting from the beginning
 	UFUNCTION(BlueprintCallable, BlueprintPure, Category="SUDS")
 	USUDSScriptNode* GetFirstNode() const;
@@ -77,6 +247,21 @@ public:
 	UFUNCTION(BlueprintCallable, Category="SUDS")
 	USUDSScriptNode* GetNodeByLabel(const FName& Label) const;
 
+	/// Get the text IDs of every choice in ordinal order, as stored by the last import
+	const TArray<FString>& GetChoiceOrdinals() const { return ChoiceOrdinals; }
+	/**
+	 * Seed the choice ordinals before importing, from a previous version of this script. Importing keeps these and
+	 * appends any new choices, so compact saved state from the previous version still restores correctly.
+	 * @param PrevOrdinals The result of GetChoiceOrdinals on the previous version
+	 */
+	void SetChoiceOrdinals(const TArray<FString>& PrevOrdinals) { ChoiceOrdinals = PrevOrdinals; }
+	/// Get the number of choice ordinals, including those of choices since removed from the script
+	int32 GetNumChoiceOrdinals() const;
+	/// Get the stable ordinal of a choice from its text ID, or INDEX_NONE if it's not a choice in this script
+	int32 GetChoiceOrdinal(const FString& ChoiceID) const;
+	/// Get the text ID of a choice from its ordinal, or null if the ordinal isn't valid
+	const FString* GetChoiceIDByOrdinal(int32 Ordinal) const;
+
 	/// Try to find a speaker node by its text ID
 	UFUNCTION(BlueprintCallable, Category="SUDS")
 	USUDSScriptNodeText* GetNodeByTextID(const FString& TextID) const;
@@ -7,6 +7,7 @@
 #include "SUDSScriptEdge.generated.h"
 
 class USUDSScriptNode;
+class USUDSScript;
 
 UENUM(BlueprintType)
 enum class ESUDSEdgeType : uint8
@@ -51,6 +52,8 @@ protected:
 	mutable bool bFormatExtracted = false; 
 	mutable TArray<FName> ParameterNames;
 	mutable FTextFormat TextFormat;
+	mutable bool bParameterSlotsResolved = false;
+	mutable TArray<FSUDSVariableRef> ParameterRefs;
 
 	void ExtractFormat() const;
 	
@@ -78,4 +81,9 @@ public:
 	const FTextFormat& GetTextFormat() const;
 	const TArray<FName>& GetParameterNames() const;
 	bool HasParameters() const;
+	/// Get the resolved variable references of the text parameters, in the same order as GetParameterNames()
+	const TArray<FSUDSVariableRef>& GetParameterRefs(const USUDSScript* Script) const;
+
+	/// Resolve variables referenced by the condition to slots in the script's variable table
+	void ResolveVariableSlots(const TMap<FName, int32>& SlotMap) { Condition.ResolveVariableSlots(SlotMap); }
 };
\ No newline at end of file
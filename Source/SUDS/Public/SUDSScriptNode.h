@@ -52,6 +52,8 @@ protected:
 	/// The line number in the script that this node came from
 	UPROPERTY(BlueprintReadOnly, Category="SUDS")
 	int SourceLineNo;
+	/// Index of this node in the owning script's runtime graph, rebuilt on import & load so not saved
+	int32 RuntimeIndex = INDEX_NONE;
 
 
 public:
@@ -60,6 +62,8 @@ public:
 	ESUDSScriptNodeType GetNodeType() const { return NodeType; }
 	const TArray<FSUDSScriptEdge>& GetEdges() const { return Edges; }
 	int GetSourceLineNo() const { return SourceLineNo; }
+	int32 GetRuntimeIndex() const { return RuntimeIndex; }
+	void SetRuntimeIndex(int32 Index) { RuntimeIndex = Index; }
 
 	void AddEdge(const FSUDSScriptEdge& NewEdge);
 	void InitChoice(int LineNo);
@@ -78,4 +82,17 @@ public:
 
 	/// Determine if this node is a Select node that's representing a [random]
 	bool IsRandomSelect() const;
+
+	/**
+	 * Add the names of all variables this node refers to, to a list
+	 * @param OutNames List of names to add to, names already in the list aren't added again
+	 * @param bIncludeTextParameters Whether to include parameters in text, which requires the text to be available
+	 */
+	virtual void GetReferencedVariableNames(TArray<FName>& OutNames, bool bIncludeTextParameters) const;
+
+	/**
+	 * Resolve all variable references in this node to slots in the script's variable table
+	 * @param SlotMap Map of variable name to slot, from the script
+	 */
+	virtual void ResolveVariableSlots(const TMap<FName, int32>& SlotMap);
 };
@@ -24,10 +24,28 @@ protected:
 	UPROPERTY(BlueprintReadOnly, Category="SUDS")
 	FSUDSExpression Expression;
 
+	/// Slot of the variable in the script's variable table, INDEX_NONE for globals
+	UPROPERTY()
+	int32 VariableSlot = INDEX_NONE;
+
+	/// If this sets a global variable, the identifier without the "global." prefix, otherwise NAME_None
+	UPROPERTY()
+	FName GlobalIdentifier;
+
+	void ResolveScope();
+
 public:
 
 	void Init(const FString& VarName, const FSUDSExpression& InExpression, int LineNo);
 	const FName& GetIdentifier() const { return Identifier; }
 	const FSUDSExpression& GetExpression() const { return Expression; }
+	int32 GetVariableSlot() const { return VariableSlot; }
+	/// Whether this node sets a global variable
+	bool IsGlobal() const { return !GlobalIdentifier.IsNone(); }
+	/// If this node sets a global variable, get the identifier without the "global." prefix
+	const FName& GetGlobalIdentifier() const { return GlobalIdentifier; }
+
+	virtual void GetReferencedVariableNames(TArray<FName>& OutNames, bool bIncludeTextParameters) const override;
+	virtual void ResolveVariableSlots(const TMap<FName, int32>& SlotMap) override;
 	
 };
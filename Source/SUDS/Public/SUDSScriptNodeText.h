@@ -7,6 +7,7 @@
 #include "SUDSScriptNodeText.generated.h"
 
 class UDialogueWave;
+class USUDSScript;
 
 /**
 * A node which contains speaker text 
@@ -41,6 +42,8 @@ protected:
 	mutable bool bFormatExtracted = false; 
 	mutable TArray<FName> ParameterNames;
 	mutable FTextFormat TextFormat;
+	mutable bool bParameterSlotsResolved = false;
+	mutable TArray<FSUDSVariableRef> ParameterRefs;
 
 	void ExtractFormat() const;
 
@@ -58,6 +61,10 @@ public:
 	const FTextFormat& GetTextFormat() const;
 	const TArray<FName>& GetParameterNames() const;	
 	bool HasParameters() const;
+	/// Get the resolved variable references of the text parameters, in the same order as GetParameterNames()
+	const TArray<FSUDSVariableRef>& GetParameterRefs(const USUDSScript* Script) const;
+
+	virtual void GetReferencedVariableNames(TArray<FName>& OutNames, bool bIncludeTextParameters) const override;
 
 	void NotifyMayHaveChoices() { bHasChoices = true; }
 
@@ -0,0 +1,36 @@
+﻿// Copyright Steve Streeting 2022
+// Released under the MIT license https://opensource.org/license/MIT/
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "SUDSSettings.generated.h"
+
+UENUM(BlueprintType)
+enum class ESUDSTextComparison : uint8
+{
+	/// Compare the displayed strings exactly, character by character
+	Ordinal,
+	/// Compare the displayed strings character by character, ignoring case
+	OrdinalIgnoreCase,
+	/// Use culture-aware comparison (FText::EqualTo). Slowest, since it goes through ICU collation
+	CultureAware
+};
+
+/**
+ * Runtime settings for SUDS
+ */
+UCLASS(config = Game, defaultconfig, meta=(DisplayName="SUDS"))
+class SUDS_API USUDSSettings : public UObject
+{
+	GENERATED_BODY()
+public:
+
+	UPROPERTY(config, EditAnywhere, Category = "Expressions", meta = (Tooltip = "How text values are compared for equality in conditions. Texts from the same string table entry are always equal without further comparison, except in CultureAware mode."))
+	ESUDSTextComparison TextComparison = ESUDSTextComparison::Ordinal;
+
+	UPROPERTY(config, EditAnywhere, Category = "Dialogue Pool", meta = (ClampMin = 0, Tooltip = "The maximum number of released dialogues kept for reuse per script by USUDSSubsystem::AcquireDialogue. Dialogues released beyond this are left for garbage collection."))
+	int32 MaxPooledDialoguesPerScript = 16;
+
+	USUDSSettings() {}
+};
@@ -3,6 +3,8 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "SUDSDialogueState.h"
 #include "SUDSValue.h"
 #include "Subsystems/GameInstanceSubsystem.h"
 #include "Engine/World.h"
@@ -16,6 +18,7 @@ struct FSoundConcurrencySettings;
 DECLARE_LOG_CATEGORY_EXTERN(LogSUDSSubsystem, Log, All);
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FOnGlobalVariableChangedEvent, FName, VariableName, const FSUDSValue&, Value, bool, bFromScript);
+DECLARE_DYNAMIC_DELEGATE_OneParam(FOnSUDSStateSerialized, const TArray<uint8>&, Data);
 
 /// Copy of the global state of the system
 USTRUCT(BlueprintType)
@@ -50,6 +53,86 @@ public:
 	
 };
 
+/// Statistics about the dialogue pool, see USUDSSubsystem::AcquireDialogue
+USTRUCT(BlueprintType)
+struct FSUDSDialoguePoolStats
+{
+	GENERATED_BODY()
+
+	/// Number of released dialogues currently waiting to be reused, across all scripts
+	UPROPERTY(BlueprintReadOnly, Category="SUDS|Dialogue Pool")
+	int32 NumPooled = 0;
+
+	/// Number of acquires which reused a pooled dialogue
+	UPROPERTY(BlueprintReadOnly, Category="SUDS|Dialogue Pool")
+	int32 NumReused = 0;
+
+	/// Number of acquires which had to create a new dialogue
+	UPROPERTY(BlueprintReadOnly, Category="SUDS|Dialogue Pool")
+	int32 NumCreated = 0;
+
+	/// Number of dialogues released back to the pool
+	UPROPERTY(BlueprintReadOnly, Category="SUDS|Dialogue Pool")
+	int32 NumReleased = 0;
+
+	/// Number of released dialogues which weren't kept because the pool for their script was full
+	UPROPERTY(BlueprintReadOnly, Category="SUDS|Dialogue Pool")
+	int32 NumDiscarded = 0;
+};
+
+/// Released dialogues for one script
+USTRUCT()
+struct FSUDSDialoguePoolEntry
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TArray<TObjectPtr<USUDSDialogue>> FreeDialogues;
+};
+
+/// The saved state of one dialogue, see USUDSSubsystem::GetChangedDialogueStates
+USTRUCT(BlueprintType)
+struct FSUDSDialogueSaveEntry
+{
+	GENERATED_BODY()
+
+	/// The dialogue the state belongs to
+	UPROPERTY(BlueprintReadOnly, Category="SUDS")
+	TObjectPtr<USUDSDialogue> Dialogue;
+
+	/// The state of the dialogue
+	UPROPERTY(BlueprintReadOnly, Category="SUDS")
+	FSUDSDialogueState State;
+};
+
+/**
+ * Immutable copy of the state of some dialogues, and optionally the global state, which can be serialised on any
+ * thread. See USUDSSubsystem::TakeStateSnapshot.
+ */
+struct SUDS_API FSUDSStateSnapshot
+{
+	/// States of the dialogues, in the order they were given
+	TArray<FSUDSDialogueState> DialogueStates;
+	/// Whether GlobalState was included
+	bool bHasGlobalState = false;
+	FSUDSGlobalState GlobalState;
+
+	/// Write the snapshot to a byte buffer. Doesn't touch any UObjects, so can be called on any thread
+	void SaveToBytes(TArray<uint8>& OutData) const;
+	/// Read a snapshot written by SaveToBytes. Returns false if the data couldn't be read
+	bool LoadFromBytes(const TArray<uint8>& Data);
+};
+
+using FSUDSStateSnapshotRef = TSharedRef<const FSUDSStateSnapshot, ESPMode::ThreadSafe>;
+
+/// An entry in USUDSSubsystem's log of dialogues whose state has changed
+struct FSUDSDialogueChange
+{
+	TWeakObjectPtr<USUDSDialogue> Dialogue;
+	/// The save generation the dialogue changed in
+	int64 Generation;
+};
+
 /**
  * 
  */
@@ -72,6 +155,27 @@ protected:
 	
 	/// Global variable state
 	TMap<FName, FSUDSValue> GlobalVariableState;
+
+	/// Released dialogues waiting to be reused, by script
+	UPROPERTY()
+	TMap<TObjectPtr<USUDSScript>, FSUDSDialoguePoolEntry> DialoguePool;
+
+	/// Maximum number of dialogues kept in DialoguePool for each script
+	int32 MaxPooledDialoguesPerScript = 16;
+
+	FSUDSDialoguePoolStats DialoguePoolStats;
+
+	/// The save generation changes are currently being recorded against, see GetChangedDialogueStates
+	int64 StateGeneration = 1;
+	/// The save generation global state last changed in
+	int64 GlobalChangedGeneration = 1;
+	/// Registered dialogues in the order their state changed. A dialogue only appears once per generation, and only
+	/// its newest entry is current; older entries are pruned as the log grows
+	TArray<FSUDSDialogueChange> ChangeLog;
+	/// Size of ChangeLog after it was last pruned
+	int32 ChangeLogPrunedSize = 0;
+
+	void PruneChangeLog();
 	
 	void SetGlobalVariableImpl(FName Name, const FSUDSValue& Value, bool bFromScript, int LineNo)
 	{
@@ -80,6 +184,7 @@ protected:
 			(OldValue != Value).GetBooleanValue())
 		{
 			GlobalVariableState.Add(Name, Value);
+			GlobalChangedGeneration = StateGeneration;
 			OnGlobalVariableChanged.Broadcast(Name, Value, bFromScript);
 		}
 	}	
@@ -103,6 +208,136 @@ public:
 
 	USoundConcurrency* GetVoicedLineConcurrency() const { return VoiceConcurrency; }
 
+	/**
+	 * Get a dialogue for a script, reusing one which was previously released if possible. This is cheaper than
+	 * USUDSLibrary::CreateDialogue when you create and discard lots of dialogues, e.g. for crowds.
+	 * The dialogue is in the same state as a newly created one. It is owned by this subsystem, and when you're done with
+	 * it you should give it back with ReleaseDialogue instead of just dropping it.
+	 * @param Script The script to run
+	 * @param Participants Participants for the dialogue, see USUDSDialogue::SetParticipants
+	 * @param bStartImmediately Whether to start the dialogue straight away
+	 * @param StartLabel If starting immediately, the label to start from
+	 * @return The dialogue, or null if the script was invalid
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue Pool", meta=(AutoCreateRefTerm="Participants"))
+	USUDSDialogue* AcquireDialogue(USUDSScript* Script,
+	                               const TArray<UObject*>& Participants,
+	                               bool bStartImmediately = true,
+	                               FName StartLabel = NAME_None);
+
+	/**
+	 * Give a dialogue acquired with AcquireDialogue back to the pool, so it can be reused. The dialogue is ended
+	 * quietly (no finished events), and its participants and event bindings are removed. Don't use it afterwards.
+	 * If the pool for its script is full, the dialogue is left to be garbage collected.
+	 * @param Dialogue The dialogue to release
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue Pool")
+	void ReleaseDialogue(USUDSDialogue* Dialogue);
+
+	/// Set the maximum number of released dialogues kept for reuse per script. Defaults to the value in project settings
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue Pool")
+	void SetMaxPooledDialoguesPerScript(int32 MaxDialogues);
+
+	/// Get the maximum number of released dialogues kept for reuse per script
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category="SUDS|Dialogue Pool")
+	int32 GetMaxPooledDialoguesPerScript() const { return MaxPooledDialoguesPerScript; }
+
+	/// Get statistics about the dialogue pool
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category="SUDS|Dialogue Pool")
+	FSUDSDialoguePoolStats GetDialoguePoolStats() const { return DialoguePoolStats; }
+
+	/// Discard all pooled dialogues, e.g. when changing level. Statistics other than the pooled count are kept
+	UFUNCTION(BlueprintCallable, Category="SUDS|Dialogue Pool")
+	void EmptyDialoguePool();
+
+	/**
+	 * Register a dialogue so that changes to its state are tracked, see GetChangedDialogueStates. Dialogues created in
+	 * a game world, or acquired from the pool, are registered automatically. Registering counts as a change.
+	 * @param Dialogue The dialogue to register
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Saving")
+	void RegisterDialogue(USUDSDialogue* Dialogue);
+
+	/// Stop tracking changes to a dialogue's state. Released dialogues are unregistered automatically
+	UFUNCTION(BlueprintCallable, Category="SUDS|Saving")
+	void UnregisterDialogue(USUDSDialogue* Dialogue);
+
+	/**
+	 * Get the saved state of every registered dialogue which has changed since a previous call, so that the cost of
+	 * saving depends on how much has happened rather than how many dialogues exist.
+	 * Each call ends the current save generation, and changes from then on are recorded against the next one.
+	 * @param SinceGeneration The generation returned by a previous call, whose states you already have. Use 0 to get
+	 *   every registered dialogue.
+	 * @param OutStates The dialogues which have changed and their states, in no particular order
+	 * @param bOnlyChangedVariables Whether to save only the variables which differ from the script header defaults,
+	 *   see USUDSDialogue::GetSavedState
+	 * @return The generation these states were saved at, pass this to the next call
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Saving")
+	int64 GetChangedDialogueStates(int64 SinceGeneration,
+	                               TArray<FSUDSDialogueSaveEntry>& OutStates,
+	                               bool bOnlyChangedVariables = false);
+
+	/// Get the save generation changes are currently being recorded against, see GetChangedDialogueStates
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category="SUDS|Saving")
+	int64 GetStateGeneration() const { return StateGeneration; }
+
+	/// Returns whether the global state has changed since the given generation, see GetChangedDialogueStates
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category="SUDS|Saving")
+	bool HasGlobalStateChangedSince(int64 Generation) const { return GlobalChangedGeneration > Generation; }
+
+	/**
+	 * Take an immutable copy of the state of some dialogues, and optionally the global state. This is the first half
+	 * of an asynchronous save, and the only part which needs to happen on the game thread; pass the result to
+	 * SerializeStateSnapshotAsync to turn it into bytes on a worker thread.
+	 * @param Dialogues The dialogues to save, restore them in the same order
+	 * @param bIncludeGlobalState Whether to include the global state
+	 * @param bOnlyChangedVariables Whether to save only the variables which differ from the script header defaults,
+	 *   see USUDSDialogue::GetSavedState
+	 */
+	FSUDSStateSnapshotRef TakeStateSnapshot(const TArray<USUDSDialogue*>& Dialogues,
+	                                        bool bIncludeGlobalState = true,
+	                                        bool bOnlyChangedVariables = false) const;
+	/// Take an immutable copy of states returned by GetChangedDialogueStates, see the other overload
+	FSUDSStateSnapshotRef TakeStateSnapshot(const TArray<FSUDSDialogueSaveEntry>& States,
+	                                        bool bIncludeGlobalState = true) const;
+
+	/**
+	 * Serialise a snapshot taken with TakeStateSnapshot on a worker thread, so that saving doesn't stall the game.
+	 * @param Snapshot The snapshot to serialise; it's kept alive until serialisation is done
+	 * @return A future which is set to the serialised bytes. Restore them with RestoreSerializedState
+	 */
+	static TFuture<TArray<uint8>> SerializeStateSnapshotAsync(const FSUDSStateSnapshotRef& Snapshot);
+
+	/**
+	 * Save the state of some dialogues, and optionally the global state, to bytes without stalling the game.
+	 * The state is copied immediately, so later changes aren't included, then serialised on a worker thread.
+	 * @param Dialogues The dialogues to save, restore them in the same order
+	 * @param bIncludeGlobalState Whether to include the global state
+	 * @param OnComplete Called on the game thread with the serialised bytes
+	 * @param bOnlyChangedVariables Whether to save only the variables which differ from the script header defaults
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Saving")
+	void SaveStateAsync(const TArray<USUDSDialogue*>& Dialogues,
+	                    bool bIncludeGlobalState,
+	                    const FOnSUDSStateSerialized& OnComplete,
+	                    bool bOnlyChangedVariables = false);
+
+	/**
+	 * Restore state serialised by SaveStateAsync or SerializeStateSnapshotAsync.
+	 * @param Data The serialised state
+	 * @param Dialogues The dialogues to restore, in the same order they were saved
+	 * @param bRestoreGlobalState Whether to restore the global state, if it was saved
+	 * @return Whether the state could be restored. If not, nothing is changed
+	 */
+	UFUNCTION(BlueprintCallable, Category="SUDS|Saving")
+	bool RestoreSerializedState(const TArray<uint8>& Data,
+	                            const TArray<USUDSDialogue*>& Dialogues,
+	                            bool bRestoreGlobalState = true);
+
+	/// Internal use only, called by a registered dialogue when its state first changes after being saved
+	void InternalNotifyDialogueStateChanged(USUDSDialogue* Dialogue);
+
 
 	/**
 	 * Reset the global state of the system.
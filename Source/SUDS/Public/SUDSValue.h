@@ -3,6 +3,7 @@
 #pragma once
 
 #include "SUDSCommon.h"
+#include "Templates/RefCounting.h"
 #include "SUDSValue.generated.h"
 
 
@@ -20,68 +21,193 @@ enum class ESUDSValueType : uint8
 
 	Empty = 99
 };
+/// Immutable, ref-counted holder for text values so that FSUDSValue can keep text out of line and stay small.
+/// Copies of a text value share the same holder.
+struct SUDS_API FSUDSValueText : public FRefCountBase
+{
+	const FText Text;
+
+	explicit FSUDSValueText(const FText& InText) : Text(InText) {}
+	explicit FSUDSValueText(FText&& InText) : Text(MoveTemp(InText)) {}
+};
+
+#if WITH_CASE_PRESERVING_NAME
+/// Editor builds keep the display index of names too, so they show with the casing they were written with
+typedef FName FSUDSValueName;
+#else
+typedef FMinimalName FSUDSValueName;
+#endif
+
 /// Struct which can hold any of the value types that SUDS needs to use, in a Blueprint friendly manner
 /// For getting / setting these values from blueprints, see blueprint library functions SetSUDSValue<Type>() / GetSUDSValue<Type>()
 /// For convenience these are wrapped in USUDSDialogue but in e.g. event callbacks they're not
+/// Internally this is a 16-byte tagged variant: numeric types are stored inline, names & variable names are stored
+/// as a minimal name, and text is stored in a shared FSUDSValueText so copies don't duplicate the FText.
+/// Editor builds store full names so that they keep their casing, which makes this 24 bytes there.
 USTRUCT(BlueprintType)
 struct SUDS_API FSUDSValue
 {
 	GENERATED_BODY()
 protected:
+	/// Whole payload, used to zero / copy regardless of type
+	struct FRawPayload
+	{
+		uint64 Words[(sizeof(FSUDSValueName) + sizeof(uint64) - 1) / sizeof(uint64)];
+	};
+
 	ESUDSValueType Type;
 	union
 	{
+		FRawPayload RawPayload;
+		/// Int, Boolean, Gender
 		int32 IntValue;
 		float FloatValue;
+		/// Text
+		FSUDSValueText* TextValue;
+		/// Name, Variable
+		FSUDSValueName Name;
 	};
-	TOptional<FText> TextValue;
-	// Used for variables and name values
-	TOptional<FName> Name;
+
+	/// Whether the payload holds text / name storage rather than a number
+	FORCEINLINE bool HasNonNumericPayload() const
+	{
+		return Type == ESUDSValueType::Text || Type == ESUDSValueType::Name || Type == ESUDSValueType::Variable;
+	}
+
+	/// Int payload, or 0 if this type doesn't store a number (so unset variables etc degrade to defaults)
+	FORCEINLINE int32 GetRawIntValue() const
+	{
+		return HasNonNumericPayload() ? 0 : IntValue;
+	}
+
+	/// Float payload, or 0 if this type doesn't store a number
+	FORCEINLINE float GetRawFloatValue() const
+	{
+		return HasNonNumericPayload() ? 0.0f : FloatValue;
+	}
+
+	FORCEINLINE const FText& GetRawTextValue() const
+	{
+		return (Type == ESUDSValueType::Text && TextValue) ? TextValue->Text : FText::GetEmpty();
+	}
+
+	FORCEINLINE FName GetRawNameValue() const
+	{
+		return (Type == ESUDSValueType::Name || Type == ESUDSValueType::Variable) ? FName(Name) : FName();
+	}
+
+	FORCEINLINE void AddTextRef() const
+	{
+		if (Type == ESUDSValueType::Text && TextValue)
+			TextValue->AddRef();
+	}
+
+	FORCEINLINE void ReleaseText()
+	{
+		if (Type == ESUDSValueType::Text && TextValue)
+			TextValue->Release();
+	}
+	
 public:
 
-	FSUDSValue() : Type(ESUDSValueType::Empty), IntValue(0), TextValue(FText::GetEmpty()) {}
+	FSUDSValue() : Type(ESUDSValueType::Empty), RawPayload() {}
 
 	FSUDSValue(const int32 Value)
-		: Type(ESUDSValueType::Int) { IntValue = Value; }
+		: Type(ESUDSValueType::Int), RawPayload() { IntValue = Value; }
 
 	FSUDSValue(const float Value)
-		: Type(ESUDSValueType::Float) { FloatValue = Value; }
+		: Type(ESUDSValueType::Float), RawPayload() { FloatValue = Value; }
 
 	FSUDSValue(const FText& Value)
-		: Type(ESUDSValueType::Text),
-		  IntValue(0),
-		  TextValue(Value)
+		: Type(ESUDSValueType::Text), RawPayload()
 	{
+		TextValue = new FSUDSValueText(Value);
+		TextValue->AddRef();
 	}
 
 	FSUDSValue(FText&& Value)
-		: Type(ESUDSValueType::Text), IntValue(0), TextValue(MoveTemp(Value))
+		: Type(ESUDSValueType::Text), RawPayload()
 	{
+		TextValue = new FSUDSValueText(MoveTemp(Value));
+		TextValue->AddRef();
 	}
 
 	FSUDSValue(ETextGender Value)
-		: Type(ESUDSValueType::Gender), IntValue(0)
+		: Type(ESUDSValueType::Gender), RawPayload()
 	{
 		IntValue = static_cast<int32>(Value);
 	}
 
 	FSUDSValue(bool Value)
-		: Type(ESUDSValueType::Boolean), IntValue(0)
+		: Type(ESUDSValueType::Boolean), RawPayload()
 	{
 		IntValue = Value ? 1 : 0;
 	}
 
 	FSUDSValue(const FName& ReferencedName, bool bIsVariable)
 	: Type(bIsVariable ? ESUDSValueType::Variable : ESUDSValueType::Name),
-	  IntValue(0),
-	  Name(ReferencedName)
+	  RawPayload()
 	{
+		Name = FSUDSValueName(ReferencedName);
 	}
 
 	// Construct a default value of a given type
 	explicit FSUDSValue(ESUDSValueType ValType)
-		: Type(ValType), IntValue(0)
+		: Type(ValType), RawPayload()
+	{
+	}
+
+	FSUDSValue(const FSUDSValue& Other)
+		: Type(Other.Type), RawPayload(Other.RawPayload)
+	{
+		AddTextRef();
+	}
+
+	FSUDSValue(FSUDSValue&& Other)
+		: Type(Other.Type), RawPayload(Other.RawPayload)
+	{
+		Other.Type = ESUDSValueType::Empty;
+		Other.RawPayload = FRawPayload();
+	}
+
+	~FSUDSValue()
 	{
+		ReleaseText();
+	}
+
+	FSUDSValue& operator=(const FSUDSValue& Other)
+	{
+		// Add ref before release in case we're sharing the same text
+		Other.AddTextRef();
+		ReleaseText();
+		Type = Other.Type;
+		RawPayload = Other.RawPayload;
+		return *this;
+	}
+
+	FSUDSValue& operator=(FSUDSValue&& Other)
+	{
+		if (this != &Other)
+		{
+			ReleaseText();
+			Type = Other.Type;
+			RawPayload = Other.RawPayload;
+			Other.Type = ESUDSValueType::Empty;
+			Other.RawPayload = FRawPayload();
+		}
+		return *this;
+	}
+
+	/// Get the int payload without any type checks. Only valid if the type is known to be Int, Boolean, Gender or Empty
+	FORCEINLINE int32 GetIntValueUnchecked() const
+	{
+		return IntValue;
+	}
+
+	/// Get the float payload without any type checks. Only valid if the type is known to be Float or Empty
+	FORCEINLINE float GetFloatValueUnchecked() const
+	{
+		return FloatValue;
 	}
 
 	/// Whether this value is empty, i.e. hasn't been set to anything
@@ -101,7 +227,7 @@ public:
 		if (!IsEmpty() && Type != ESUDSValueType::Int && Type != ESUDSValueType::Variable)
 			UE_LOG(LogSUDS, Warning, TEXT("Getting value as int but was type %s"), *StaticEnum<ESUDSValueType>()->GetValueAsString(Type))
 		
-		return IntValue;
+		return GetRawIntValue();
 	}
 
 	FORCEINLINE float GetFloatValue() const
@@ -115,7 +241,7 @@ public:
 			// Allow int widening to float
 			return GetIntValue();
 		}
-		return FloatValue;
+		return GetRawFloatValue();
 	}
 
 	FORCEINLINE const FText& GetTextValue() const
@@ -124,10 +250,7 @@ public:
 		if (!IsEmpty() && Type != ESUDSValueType::Text && Type != ESUDSValueType::Variable)
 			UE_LOG(LogSUDS, Warning, TEXT("Getting value as text but was type %s"), *StaticEnum<ESUDSValueType>()->GetValueAsString(Type))
 
-		if (TextValue.IsSet())
-			return TextValue.GetValue();
-
-		return FText::GetEmpty();
+		return GetRawTextValue();
 	}
 
 	FORCEINLINE ETextGender GetGenderValue() const
@@ -136,7 +259,7 @@ public:
 		if (!IsEmpty() && Type != ESUDSValueType::Gender && Type != ESUDSValueType::Variable)
 			UE_LOG(LogSUDS, Warning, TEXT("Getting value as float but was type %s"), *StaticEnum<ESUDSValueType>()->GetValueAsString(Type))
 		
-		return static_cast<ETextGender>(IntValue);
+		return static_cast<ETextGender>(GetRawIntValue());
 	}
 
 	FORCEINLINE bool GetBooleanValue() const
@@ -145,7 +268,7 @@ public:
 		if (!IsEmpty() && Type != ESUDSValueType::Boolean && Type != ESUDSValueType::Variable)
 			UE_LOG(LogSUDS, Warning, TEXT("Getting value as boolean but was type %s"), *StaticEnum<ESUDSValueType>()->GetValueAsString(Type))
 
-		return IntValue != 0;
+		return GetRawIntValue() != 0;
 	}
 
 	FORCEINLINE FName GetNameValue() const
@@ -154,10 +277,7 @@ public:
 		if (!IsEmpty() && Type != ESUDSValueType::Name && Type != ESUDSValueType::Variable)
 			UE_LOG(LogSUDS, Warning, TEXT("Getting value as Name but was type %s"), *StaticEnum<ESUDSValueType>()->GetValueAsString(Type))
 
-		if (Name.IsSet())
-			return Name.GetValue();
-
-		return NAME_None;
+		return GetRawNameValue();
 	}
 
 	FORCEINLINE FName GetVariableNameValue() const
@@ -165,10 +285,7 @@ public:
 		if (!IsEmpty() && Type != ESUDSValueType::Variable)
 			UE_LOG(LogSUDS, Warning, TEXT("Getting value as variable name but was type %s"), *StaticEnum<ESUDSValueType>()->GetValueAsString(Type))
 
-		if (Name.IsSet())
-			return Name.GetValue();
-
-		return NAME_None;
+		return GetRawNameValue();
 	}
 
 	FORCEINLINE bool IsVariable() const
@@ -187,7 +304,7 @@ public:
 		{
 		default:
 		case ESUDSValueType::Text:
-			return FFormatArgumentValue(TextValue.GetValue());
+			return FFormatArgumentValue(GetTextValue());
 		case ESUDSValueType::Int:
 			return FFormatArgumentValue(GetIntValue());
 		case ESUDSValueType::Boolean:
@@ -327,7 +444,7 @@ public:
 			switch (UseType)
 			{
 			case ESUDSValueType::Text:
-				return FSUDSValue(GetTextValue().EqualTo(Rhs.GetTextValue()));
+				return FSUDSValue(TextEquals(GetTextValue(), Rhs.GetTextValue()));
 			case ESUDSValueType::Boolean:
 				return FSUDSValue(GetBooleanValue() == Rhs.GetBooleanValue());
 			case ESUDSValueType::Gender:
@@ -400,8 +517,23 @@ public:
 	
 	FString ToString() const;
 
+	/**
+	 * Compare 2 text values for equality, using the comparison mode from USUDSSettings.
+	 * Texts referring to the same string table entry are equal without comparing strings.
+	 * @param A First text
+	 * @param B Second text
+	 * @return Whether the texts are considered equal
+	 */
+	static bool TextEquals(const FText& A, const FText& B);
+
 	bool ExportTextItem(FString& ValueStr, FSUDSValue const& DefaultValue, UObject* Parent, int32 PortFlags, UObject* ExportRootScope) const;
 };
+#if WITH_CASE_PRESERVING_NAME
+static_assert(sizeof(FSUDSValue) <= 24, "FSUDSValue should fit in 24 bytes in editor builds, it's stored in bulk for variables & args");
+#else
+static_assert(sizeof(FSUDSValue) <= 16, "FSUDSValue should fit in 16 bytes, it's stored in bulk for variables & args");
+#endif
+
 template<>
 struct TStructOpsTypeTraits<FSUDSValue> : public TStructOpsTypeTraitsBase2<FSUDSValue>
 {
@@ -6,6 +6,7 @@
 #include "ISettingsSection.h"
 #include "SUDSEditorSettings.h"
 #include "SUDSScriptActions.h"
+#include "SUDSSettings.h"
 #include "Interfaces/IPluginManager.h"
 #include "Styling/SlateStyle.h"
 #include "Styling/SlateStyleRegistry.h"
@@ -40,6 +41,11 @@ void FSUDSEditorModule::StartupModule()
 			LOCTEXT("SUDSEditorSettingsDescription", "Configure the editor parts of SUDS."),
 			GetMutableDefault<USUDSEditorSettings>()
 		);
+		SettingsModule->RegisterSettings("Project", "Plugins", "SUDS",
+			LOCTEXT("SUDSSettingsName", "SUDS"),
+			LOCTEXT("SUDSSettingsDescription", "Configure the runtime parts of SUDS."),
+			GetMutableDefault<USUDSSettings>()
+		);
 	}
 
 	UE_LOG(LogSUDSEditor, Log, TEXT("SUDS Editor Module Started"))
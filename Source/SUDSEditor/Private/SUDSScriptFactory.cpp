@@ -55,8 +55,17 @@ UObject* USUDSScriptFactory::FactoryCreateText(UClass* InClass,
 	if(Importer.ImportFromBuffer(Buffer, BufferEnd - Buffer, NameForErrors, &Logger, false))
 	{
 		
+		// Creating the new script reuses any existing asset of the same name (e.g. when re-importing) and resets all its
+		// properties, so copy out the choice ordinals first; compact saved state relies on them not changing
+		TArray<FString> PrevChoiceOrdinals;
+		if (const USUDSScript* Existing = FindObject<USUDSScript>(InParent, *InName.ToString()))
+		{
+			PrevChoiceOrdinals = Existing->GetChoiceOrdinals();
+		}
+
 		// Populate with data
 		Result = NewObject<USUDSScript>(InParent, InName, Flags);
+		Result->SetChoiceOrdinals(PrevChoiceOrdinals);
 		UStringTable* StringTable = CreateStringTable(InParent, InName, Result, Flags, &Logger);
 		Importer.PopulateAsset(Result, StringTable);
 		
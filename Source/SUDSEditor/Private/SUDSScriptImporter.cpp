@@ -4,6 +4,7 @@
 
 #include "SUDSEditorSettings.h"
 #include "SUDSExpression.h"
+#include "SUDSLibrary.h"
 #include "SUDSMessageLogger.h"
 #include "SUDSScript.h"
 #include "SUDSScriptNode.h"
@@ -101,6 +102,7 @@ bool FSUDSScriptImporter::ImportFromBuffer(const TCHAR *Start, int32 Length, con
 	ConnectRemainingNodes(BodyTree, NameForErrors, Logger, bSilent);
 	GenerateTextIDs(HeaderTree);
 	GenerateTextIDs(BodyTree);
+	InferExpressionTypes(NameForErrors, Logger, bSilent);
 
 	bImportedOK = PostImportSanityCheck(NameForErrors, Logger, bSilent) && bImportedOK;
 
@@ -2116,6 +2118,110 @@ void FSUDSScriptImporter::GenerateTextIDs(ParsedTree& Tree)
 	
 }
 
+void FSUDSScriptImporter::InferExpressionTypes(const FString& NameForErrors, FSUDSMessageLogger* Logger, bool bSilent)
+{
+	// The first [set] of a local variable in the header declares its type
+	TMap<FName, ESUDSValueType> KnownTypes;
+	TArray<FString> Problems;
+	for (auto& Node : HeaderTree.Nodes)
+	{
+		if (Node.NodeType == ESUDSParsedNodeType::SetVariable)
+		{
+			FName VarName(Node.Identifier);
+			FName GlobalName;
+			const ESUDSValueType Type = Node.Expression.InferTypes(KnownTypes, Problems);
+			if (!USUDSLibrary::IsDialogueVariableGlobal(VarName, GlobalName) &&
+				Type != ESUDSValueType::Empty &&
+				!KnownTypes.Contains(VarName))
+			{
+				KnownTypes.Add(VarName, Type);
+			}
+		}
+	}
+
+	// Any other [set] to a different or unknown type means the type can change, so it's not known statically.
+	// Removing one can make other set types unknown, so repeat until nothing changes
+	TSet<FName> ReportedVariables;
+	bool bChanged = true;
+	while (bChanged)
+	{
+		bChanged = false;
+		for (ParsedTree* Tree : { &HeaderTree, &BodyTree })
+		{
+			for (auto& Node : Tree->Nodes)
+			{
+				if (Node.NodeType != ESUDSParsedNodeType::SetVariable)
+					continue;
+
+				const FName VarName(Node.Identifier);
+				const ESUDSValueType* pDeclaredType = KnownTypes.Find(VarName);
+				if (!pDeclaredType)
+					continue;
+
+				TArray<FString> IgnoredProblems;
+				const ESUDSValueType Type = Node.Expression.InferTypes(KnownTypes, IgnoredProblems);
+				if (Type != *pDeclaredType)
+				{
+					const bool bNumeric = (Type == ESUDSValueType::Int || Type == ESUDSValueType::Float) &&
+						(*pDeclaredType == ESUDSValueType::Int || *pDeclaredType == ESUDSValueType::Float);
+					if (!bSilent && !bNumeric && Type != ESUDSValueType::Empty && !ReportedVariables.Contains(VarName))
+					{
+						ReportedVariables.Add(VarName);
+						Logger->Logf(ELogVerbosity::Warning,
+						             TEXT("%s line %d: Variable '%s' is set to %s but was declared as %s in the header"),
+						             *NameForErrors,
+						             Node.SourceLineNo,
+						             *Node.Identifier,
+						             *StaticEnum<ESUDSValueType>()->GetNameStringByValue((int64)Type),
+						             *StaticEnum<ESUDSValueType>()->GetNameStringByValue((int64)*pDeclaredType));
+					}
+					KnownTypes.Remove(VarName);
+					bChanged = true;
+				}
+			}
+		}
+	}
+
+	// Now apply final types to every expression, reporting mismatches
+	for (ParsedTree* Tree : { &HeaderTree, &BodyTree })
+	{
+		for (auto& Node : Tree->Nodes)
+		{
+			Problems.Reset();
+			if (Node.NodeType == ESUDSParsedNodeType::SetVariable)
+			{
+				Node.Expression.InferTypes(KnownTypes, Problems);
+			}
+			for (auto& Arg : Node.EventArgs)
+			{
+				Arg.InferTypes(KnownTypes, Problems);
+			}
+			LogTypeProblems(Problems, Node.SourceLineNo, NameForErrors, Logger, bSilent);
+			for (auto& Edge : Node.Edges)
+			{
+				Problems.Reset();
+				Edge.ConditionExpression.InferTypes(KnownTypes, Problems);
+				LogTypeProblems(Problems, Edge.SourceLineNo, NameForErrors, Logger, bSilent);
+			}
+		}
+	}
+}
+
+void FSUDSScriptImporter::LogTypeProblems(const TArray<FString>& Problems,
+                                          int LineNo,
+                                          const FString& NameForErrors,
+                                          FSUDSMessageLogger* Logger,
+                                          bool bSilent)
+{
+	if (!bSilent)
+	{
+		for (const auto& Problem : Problems)
+		{
+			Logger->Logf(ELogVerbosity::Warning, TEXT("%s line %d: %s"), *NameForErrors, LineNo, *Problem);
+		}
+	}
+}
+
 bool FSUDSScriptImporter::PostImportSanityCheck(const FString& NameForErrors, FSUDSMessageLogger* Logger, bool bSilent)
 {
 	bool bOK = true;
@@ -57,7 +57,8 @@ EReimportResult::Type USUDSScriptReimportFactory::Reimport(UObject* Obj)
 	// When a new script is created, it actually lives at the same address as the incoming one. UE must re-use objects
 	// when you put them back at the same outer & asset name?
 	// This means if we want to preserve anything from the previously imported object, such as generated VO asset links,
-	// we need to copy those out now.
+	// we need to copy those out now. Choice ordinals are needed before the new script is populated, so
+	// USUDSScriptFactory::FactoryCreateText copies those itself.
 	TMap<FString, UDialogueVoice*> PrevSpeakerVoices = Script->GetSpeakerVoices();
 	// Store the TextID -> DialogueWave, but also store the line text as well so we can detect whether it matches & warn if not
 	TMap<FString, TPair<FString, UDialogueWave*> > PrevWaves;
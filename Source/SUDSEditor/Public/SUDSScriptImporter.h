@@ -486,6 +486,10 @@ protected:
 	                                 bool bSilent);
 	void ConnectRemainingNodes(ParsedTree& Tree, const FString& NameForErrors, FSUDSMessageLogger* Logger, bool bSilent);
 	void GenerateTextIDs(ParsedTree& BodyTree);
+	/// Infer variable types from the header and apply them to all expressions, so that fully typed expressions use
+	/// specialised operators at runtime. Type mismatches are reported as warnings
+	void InferExpressionTypes(const FString& NameForErrors, FSUDSMessageLogger* Logger, bool bSilent);
+	void LogTypeProblems(const TArray<FString>& Problems, int LineNo, const FString& NameForErrors, FSUDSMessageLogger* Logger, bool bSilent);
 	int FindFallthroughNodeIndex(ParsedTree& Tree, int StartNodeIndex, const FString& FromChoicePath, const FString& FromConditionalPath);
 	bool RetrieveAndRemoveTextID(FStringView& InOutLine, FString& OutTextID);
 	bool RetrieveAndRemoveGosubID(FStringView& InOutLine, FString& OutTextID);
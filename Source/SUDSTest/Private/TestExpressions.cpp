@@ -1,5 +1,9 @@
 ﻿#include "SUDSExpression.h"
+#include "SUDSSettings.h"
+#include "TestUtils.h"
 #include "Misc/AutomationTest.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
 
 UE_DISABLE_OPTIMIZATION
 
@@ -169,8 +173,92 @@ bool FTestExpressions::RunTest(const FString& Parameters)
 	TestTrue("Eval", Expr.Evaluate(Variables, GlobalVariables).GetBooleanValue());
 	TestTrue("GlobalTest", Expr.ParseFromString("{global.GlobalLocalTestInt} == 3", nullptr));
 	TestTrue("Eval", Expr.Evaluate(Variables, GlobalVariables).GetBooleanValue());
-	
 
+	// Short-circuiting, variables should only be requested if they're read
+	TArray<FName> Requested;
+	auto RecordRequest = [&Requested](const FName& Name) { Requested.Add(Name); };
+	TestTrue("ShortCircuitAnd", Expr.ParseFromString("{SomethingFalse} and {SomethingTrue}", nullptr));
+	TestFalse("Eval", Expr.Evaluate(Variables, GlobalVariables, RecordRequest).GetBooleanValue());
+	if (TestEqual("Requested count", Requested.Num(), 1))
+	{
+		TestEqual("Requested name", Requested[0].ToString(), "SomethingFalse");
+	}
+	Requested.Empty();
+	TestTrue("ShortCircuitOr", Expr.ParseFromString("{SomethingTrue} or {SomethingFalse} or {SomethingTrue}", nullptr));
+	const FSUDSValue OrResult = Expr.Evaluate(Variables, GlobalVariables, RecordRequest);
+	TestEqual("Eval type", OrResult.GetType(), ESUDSValueType::Boolean);
+	TestTrue("Eval", OrResult.GetBooleanValue());
+	if (TestEqual("Requested count", Requested.Num(), 1))
+	{
+		TestEqual("Requested name", Requested[0].ToString(), "SomethingTrue");
+	}
+	Requested.Empty();
+	TestTrue("NoShortCircuit", Expr.ParseFromString("{SomethingTrue} and ({Six} > 3 or {SomethingFalse}) and {Six} < 10", nullptr));
+	TestTrue("Eval", Expr.Evaluate(Variables, GlobalVariables, RecordRequest).GetBooleanValue());
+	if (TestEqual("Requested count", Requested.Num(), 2))
+	{
+		// Repeated reads are only requested once
+		TestEqual("Requested name", Requested[0].ToString(), "SomethingTrue");
+		TestEqual("Requested name", Requested[1].ToString(), "Six");
+	}
+	// Including in expressions with more variables than fit in a single word
+	FString ManyVars;
+	for (int i = 0; i < 70; ++i)
+	{
+		const FString Name = FString::Printf(TEXT("ManyVar%d"), i);
+		Variables.Add(FName(Name), 1);
+		ManyVars += FString::Printf(TEXT("{%s} + "), *Name);
+	}
+	ManyVars += "{ManyVar65} + {ManyVar0}";
+	Requested.Empty();
+	TestTrue("ManyVariables", Expr.ParseFromString(ManyVars, nullptr));
+	TestEqual("Eval", Expr.Evaluate(Variables, GlobalVariables, RecordRequest).GetIntValue(), 72);
+	TestEqual("Requested count", Requested.Num(), 70);
+
+	// Constant folding
+	TestTrue("FoldArithmetic", Expr.ParseFromString("1 + 2 * (3 - 1)", nullptr));
+	if (TestTrue("Folded to literal", Expr.IsLiteral()))
+	{
+		TestEqual("Folded value", Expr.GetIntLiteralValue(), 5);
+	}
+	TestTrue("FoldCondition", Expr.ParseFromString("2 > 1 and not false", nullptr));
+	if (TestTrue("Folded to literal", Expr.IsBooleanLiteral()))
+	{
+		TestTrue("Folded value", Expr.GetBooleanLiteralValue());
+	}
+	TestTrue("FoldShortCircuit", Expr.ParseFromString("false and {SomethingTrue}", nullptr));
+	if (TestTrue("Folded to literal", Expr.IsBooleanLiteral()))
+	{
+		TestFalse("Folded value", Expr.GetBooleanLiteralValue());
+	}
+	TestEqual("Folded variable count", Expr.GetVariableNames().Num(), 0);
+	TestTrue("FoldIdentity", Expr.ParseFromString("({Six} > 3) and true", nullptr));
+	TestEqual("Identity removed", Expr.GetQueue().Num(), 3);
+	TestTrue("Eval", Expr.Evaluate(Variables, GlobalVariables).GetBooleanValue());
+	TestTrue("FoldIdentity", Expr.ParseFromString("{Six} * 2 + 0", nullptr));
+	TestEqual("Identity removed", Expr.GetQueue().Num(), 3);
+	TestEqual("Eval", Expr.Evaluate(Variables, GlobalVariables).GetIntValue(), 12);
+	// Identity can't be removed from a plain variable, it's needed for type conversion if unset
+	TestTrue("NoFoldIdentity", Expr.ParseFromString("{Six} + 0", nullptr));
+	TestEqual("Identity kept", Expr.GetQueue().Num(), 3);
+	// Text comparisons are left to runtime
+	TestTrue("NoFoldText", Expr.ParseFromString("\"Hello\" == \"Hello\"", nullptr));
+	TestFalse("Text not folded", Expr.IsLiteral());
+
+	// Deeply nested expressions need a larger evaluation stack than the inline one
+	FString Nested = "1";
+	for (int i = 2; i <= 20; ++i)
+	{
+		Nested = FString::Printf(TEXT("%d + (%s)"), i, *Nested);
+	}
+	TestTrue("DeepNesting", Expr.ParseFromString(Nested, nullptr));
+	TestEqual("Eval", Expr.Evaluate(Variables, GlobalVariables).GetIntValue(), 210);
+
+	// Copies must be independently executable
+	TestTrue("Copy", Expr.ParseFromString("{Six} * 2", nullptr));
+	const FSUDSExpression ExprCopy = Expr;
+	Expr.Reset();
+	TestEqual("Eval copy", ExprCopy.Evaluate(Variables, GlobalVariables).GetIntValue(), 12);
 	
 	return true;
 };
@@ -200,10 +288,300 @@ bool FTestBadExpressions::RunTest(const FString& Parameters)
 	TestTrue("Correct error", ParseError.Contains("Mismatched parentheses"));
 	TestFalse("Invalid symbol", Expr.ParseFromString("something + 1", &ParseError));
 	TestTrue("Correct error", ParseError.Contains("Bad expression"));
+
+	// Error positions
+	TestFalse("Missing operand", Expr.ParseFromString(" + 1", &ParseError));
+	TestTrue("Error column", ParseError.EndsWith("at column 2"));
+	TestFalse("Missing parenthesis", Expr.ParseFromString("(3 + 1", &ParseError));
+	TestTrue("Error column", ParseError.EndsWith("at column 1"));
+	TestFalse("Missing parenthesis", Expr.ParseFromString("3 + 1)", &ParseError));
+	TestTrue("Error column", ParseError.EndsWith("at column 6"));
 	
 	return true;
 }
 
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestExpressionLexer,
+								 "SUDSTest.TestExpressionLexer",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestExpressionLexer::RunTest(const FString& Parameters)
+{
+	// The lexer must produce exactly the same tokens as the regex it replaced
+	const TArray<FString> Expressions = {
+		"3 + 4 * {Six} + 1",
+		"-6.7 * 2 + (21.3 - 8) * 5",
+		"11 % 5",
+		"7.25 % 3.0",
+		"!{SomethingFalse} && {SomethingElseFalse} && {SomethingTrue}",
+		"not {SomethingFalse} and {SomethingElseFalse} and {SomethingTrue}",
+		"{SomethingFalse} || {SomethingTrue}",
+		"{SomethingTrue} or {SomethingFalse} or {SomethingTrue}",
+		"{Six} <= 6",
+		"{Six} = 6",
+		"{Six} >= 6",
+		"{Seven} != {Six}",
+		"{Female} == Feminine",
+		"{Male} == masculine",
+		"{Neuter} == Neuter",
+		"{SomeText} == \"Hello\"",
+		"{global.GlobalLocalTestInt} == 3",
+		"{EightFloatPlusMargin} == 8.1000005",
+		"2 > 1 and not false",
+		"True FALSE fAlse tRUE",
+		"\"Hello this has some \\\"Embedded Quotes\\\"\"",
+		"`AName` == `Other Name`",
+		"something + 1",
+		"android or nothing",
+		"neutered nots",
+		"Masculinefeminine",
+		"a<>b <=> !!x ===",
+		"&|&&||",
+		"- -x 1. -1.5.3 --2",
+		"{a.b_c} {} {x y} {{z}}",
+		"\"unterminated",
+		"\"escape at end\\",
+		"\"line\\\nbreak\" \"ok\"",
+		"`unterminated name",
+		"$extraq == 1",
+		"",
+		"   ",
+	};
+
+	for (const FString& Expression : Expressions)
+	{
+		TArray<FString> Expected, Actual;
+		TokeniseExpressionWithRegex(Expression, Expected);
+		TokeniseExpression(Expression, Actual);
+		TestEqual(FString::Printf(TEXT("Token count for '%s'"), *Expression), Actual.Num(), Expected.Num());
+		for (int i = 0; i < FMath::Min(Actual.Num(), Expected.Num()); ++i)
+		{
+			TestEqual(FString::Printf(TEXT("Token %d for '%s'"), i, *Expression), Actual[i], Expected[i]);
+		}
+	}
+
+	return true;
+}
+
 
 
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestValueStorage,
+								 "SUDSTest.TestValueStorage",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestValueStorage::RunTest(const FString& Parameters)
+{
+	// Bigger in editor builds, where names keep their casing
+	TestTrue("Value size", sizeof(FSUDSValue) <= (WITH_CASE_PRESERVING_NAME ? 24 : 16));
+
+	// Text is shared between copies, and survives the original going away
+	FSUDSValue Copy;
+	{
+		FSUDSValue Original(FText::FromString("Hello"));
+		Copy = Original;
+		FSUDSValue Moved(MoveTemp(Original));
+		TestTrue("Moved from is empty", Original.IsEmpty());
+		TestEqual("Moved text", Moved.GetTextValue().ToString(), "Hello");
+	}
+	TestEqual("Copied text", Copy.GetTextValue().ToString(), "Hello");
+	Copy = Copy;
+	TestEqual("Self assigned text", Copy.GetTextValue().ToString(), "Hello");
+	Copy = FSUDSValue(3);
+	TestEqual("Reassigned", Copy.GetIntValue(), 3);
+
+	// Shared storage must not leak into numeric reads, unset variables compare as defaults
+	TestFalse("Variable as bool", FSUDSValue(FName("Var"), true).GetBooleanValue());
+	TestEqual("Variable as int", FSUDSValue(FName("Var"), true).GetIntValue(), 0);
+	TestTrue("Variable == 0", (FSUDSValue(FName("Var"), true) == FSUDSValue(0)).GetBooleanValue());
+	TestTrue("Default text empty", FSUDSValue(ESUDSValueType::Text).GetTextValue().IsEmpty());
+	TestEqual("Default name", FSUDSValue(ESUDSValueType::Name).GetNameValue(), FName(NAME_None));
+#if WITH_CASE_PRESERVING_NAME
+	// Names are case-insensitive, but should still show as they were written even if another casing came first
+	const FName OtherCasing("suds_value_casing");
+	TestEqual("Name casing", FSUDSValue(FName("SUDS_Value_Casing"), false).GetNameValue().ToString(), FString("SUDS_Value_Casing"));
+#endif
+
+	// Archive round trip for every type
+	const TArray<FSUDSValue> Values = {
+		FSUDSValue(),
+		FSUDSValue(-12),
+		FSUDSValue(3.5f),
+		FSUDSValue(true),
+		FSUDSValue(ETextGender::Feminine),
+		FSUDSValue(FText::FromString("Some text")),
+		FSUDSValue(FName("SomeName"), false),
+		FSUDSValue(FName("SomeVar"), true),
+	};
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+	for (FSUDSValue V : Values)
+	{
+		Writer << V;
+	}
+	FMemoryReader Reader(Bytes);
+	for (const FSUDSValue& Expected : Values)
+	{
+		FSUDSValue Loaded(FText::FromString("Overwritten"));
+		Reader << Loaded;
+		TestEqual("Loaded type", (int32)Loaded.GetType(), (int32)Expected.GetType());
+		TestEqual("Loaded value", Loaded.ToString(), Expected.ToString());
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestTextEquality,
+								 "SUDSTest.TestTextEquality",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestTextEquality::RunTest(const FString& Parameters)
+{
+	ScopedStringTableHolder TableHolder;
+	TableHolder.StringTable->GetMutableStringTable()->SetSourceString("Faction1", "The Guild");
+	TableHolder.StringTable->GetMutableStringTable()->SetSourceString("Faction2", "The Crown");
+	TableHolder.StringTable->GetMutableStringTable()->SetSourceString("Faction1Again", "The Guild");
+	const FName TableId = TableHolder.StringTable->GetStringTableId();
+
+	const FSUDSValue Guild(FText::FromStringTable(TableId, "Faction1"));
+	const FSUDSValue GuildSameKey(FText::FromStringTable(TableId, "Faction1"));
+	const FSUDSValue GuildOtherKey(FText::FromStringTable(TableId, "Faction1Again"));
+	const FSUDSValue Crown(FText::FromStringTable(TableId, "Faction2"));
+	const FSUDSValue GuildLiteral(FText::FromString("The Guild"));
+	const FSUDSValue GuildLowerLiteral(FText::FromString("the guild"));
+
+	USUDSSettings* Settings = GetMutableDefault<USUDSSettings>();
+	const ESUDSTextComparison OldMode = Settings->TextComparison;
+
+	for (ESUDSTextComparison Mode : { ESUDSTextComparison::Ordinal, ESUDSTextComparison::OrdinalIgnoreCase, ESUDSTextComparison::CultureAware })
+	{
+		Settings->TextComparison = Mode;
+		const FString ModeStr = StaticEnum<ESUDSTextComparison>()->GetNameStringByValue((int64)Mode);
+		TestTrue(ModeStr + " same key", (Guild == GuildSameKey).GetBooleanValue());
+		TestTrue(ModeStr + " same string other key", (Guild == GuildOtherKey).GetBooleanValue());
+		TestFalse(ModeStr + " other key", (Guild == Crown).GetBooleanValue());
+		TestTrue(ModeStr + " table vs literal", (Guild == GuildLiteral).GetBooleanValue());
+		TestTrue(ModeStr + " not equal", (Guild != Crown).GetBooleanValue());
+	}
+
+	Settings->TextComparison = ESUDSTextComparison::Ordinal;
+	TestFalse("Ordinal is case sensitive", (GuildLiteral == GuildLowerLiteral).GetBooleanValue());
+	Settings->TextComparison = ESUDSTextComparison::OrdinalIgnoreCase;
+	TestTrue("Ordinal ignoring case", (GuildLiteral == GuildLowerLiteral).GetBooleanValue());
+
+	Settings->TextComparison = OldMode;
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestTypedExpressions,
+								 "SUDSTest.TestTypedExpressions",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestTypedExpressions::RunTest(const FString& Parameters)
+{
+	TMap<FName, ESUDSValueType> KnownTypes;
+	KnownTypes.Add("Count", ESUDSValueType::Int);
+	KnownTypes.Add("Ratio", ESUDSValueType::Float);
+	KnownTypes.Add("Flag", ESUDSValueType::Boolean);
+	KnownTypes.Add("Title", ESUDSValueType::Text);
+
+	const TArray<FString> Sources = {
+		"{Count} * 3 + 1",
+		"{Count} / 2 - {Count} % 3",
+		"{Count} * {Ratio}",
+		"{Ratio} % 2",
+		"{Count} + 1 >= {Ratio} * 2",
+		"{Count} < 10 and not {Flag}",
+		"{Flag} == true or {Count} != 4",
+		"{Ratio} <= 2.5 || {Ratio} > 7",
+		"{Ratio} == 2.5",
+	};
+
+	TMap<FName, FSUDSValue> Variables;
+	TMap<FName, FSUDSValue> GlobalVariables;
+	TArray<TMap<FName, FSUDSValue>> States;
+	// Unset
+	States.Add(Variables);
+	Variables.Add("Count", 4);
+	Variables.Add("Ratio", 2.5f);
+	Variables.Add("Flag", false);
+	States.Add(Variables);
+	Variables["Count"] = 11;
+	Variables["Ratio"] = 7.5f;
+	Variables["Flag"] = true;
+	States.Add(Variables);
+	// Types changed at runtime, must fall back to general operators
+	Variables["Count"] = 3.5f;
+	Variables["Ratio"] = 2;
+	States.Add(Variables);
+
+	for (const FString& Source : Sources)
+	{
+		FSUDSExpression Untyped;
+		FSUDSExpression Typed;
+		TArray<FString> Problems;
+		TestTrue("Parse", Untyped.ParseFromString(Source, nullptr) && Typed.ParseFromString(Source, nullptr));
+		Typed.InferTypes(KnownTypes, Problems);
+		TestEqual(Source + " problems", Problems.Num(), 0);
+		TestTrue(Source + " is typed", Typed.IsStaticallyTyped());
+		TestFalse(Source + " not typed without types", Untyped.IsStaticallyTyped());
+
+		for (int i = 0; i < States.Num(); ++i)
+		{
+			const FSUDSValue Expected = Untyped.Evaluate(States[i], GlobalVariables);
+			const FSUDSValue Actual = Typed.Evaluate(States[i], GlobalVariables);
+			const FString Context = FString::Printf(TEXT("%s state %d"), *Source, i);
+			TestEqual(Context + " type", (int32)Actual.GetType(), (int32)Expected.GetType());
+			TestEqual(Context + " value", Actual.ToString(), Expected.ToString());
+		}
+	}
+
+	// Unknown variables mean the expression can't be typed
+	{
+		FSUDSExpression Expr;
+		TArray<FString> Problems;
+		TestTrue("Parse", Expr.ParseFromString("{Count} + {Unknown}", nullptr));
+		TestEqual("Unknown result type", Expr.InferTypes(KnownTypes, Problems), ESUDSValueType::Empty);
+		TestFalse("Not typed with unknowns", Expr.IsStaticallyTyped());
+	}
+
+	// Mismatches
+	const TArray<FString> BadSources = {
+		"{Count} + {Title}",
+		"{Flag} < 3",
+		"{Count} and {Flag}",
+		"not {Ratio}",
+		"{Title} == 3",
+	};
+	for (const FString& Source : BadSources)
+	{
+		FSUDSExpression Expr;
+		TArray<FString> Problems;
+		TestTrue("Parse", Expr.ParseFromString(Source, nullptr));
+		Expr.InferTypes(KnownTypes, Problems);
+		TestEqual(Source + " problems", Problems.Num(), 1);
+	}
+
+	// Result types
+	{
+		FSUDSExpression Expr;
+		TArray<FString> Problems;
+		TestTrue("Parse", Expr.ParseFromString("{Count} * 2", nullptr));
+		TestEqual("Int result", Expr.InferTypes(KnownTypes, Problems), ESUDSValueType::Int);
+		TestTrue("Parse", Expr.ParseFromString("{Count} * {Ratio}", nullptr));
+		TestEqual("Float result", Expr.InferTypes(KnownTypes, Problems), ESUDSValueType::Float);
+		TestTrue("Parse", Expr.ParseFromString("{Count} > 2", nullptr));
+		TestEqual("Boolean result", Expr.InferTypes(KnownTypes, Problems), ESUDSValueType::Boolean);
+	}
+
+	return true;
+}
+
 UE_ENABLE_OPTIMIZATION
\ No newline at end of file
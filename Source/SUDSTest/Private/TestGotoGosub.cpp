@@ -3,6 +3,8 @@
 #include "SUDSMessageLogger.h"
 #include "SUDSScript.h"
 #include "SUDSScriptImporter.h"
+#include "SUDSScriptNodeGosub.h"
+#include "SUDSScriptNodeText.h"
 #include "TestUtils.h"
 #include "Misc/AutomationTest.h"
 
@@ -414,4 +416,179 @@ bool FTestGosubBetweenSpeakerAndChoice2::RunTest(const FString& Parameters)
 }
 
 
+const FString ChoicePlanInput = R"RAWSUD(
+Player: Hello there
+[set Greeted true]
+* Option A
+    NPC: You chose A
+    [gosub Sub]
+    * Again
+        NPC: Bye
+* Option B
+    NPC: You chose B
+[goto end]
+
+:Sub
+NPC: In the sub
+[set InSub true]
+[return]
+)RAWSUD";
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestChoicePlans,
+								 "SUDSTest.TestChoicePlans",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+
+
+bool FTestChoicePlans::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(ChoicePlanInput), ChoicePlanInput.Len(), "ChoicePlanInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	auto FindTextNode = [Script](const FString& Text) -> const USUDSScriptNode*
+	{
+		for (auto Node : Script->GetNodes())
+		{
+			auto TextNode = Cast<USUDSScriptNodeText>(Node);
+			if (TextNode && TextNode->GetText().ToString() == Text)
+			{
+				return TextNode;
+			}
+		}
+		return nullptr;
+	};
+
+	// Text, set, choice is fully static
+	const FSUDSChoicePlan* Plan = Script->FindChoicePlan(FindTextNode("Hello there"));
+	if (TestNotNull("Plan for first line", Plan))
+	{
+		TestTrue("First line leads to choice", Plan->Result == ESUDSChoicePlanResult::Choice);
+		TestEqual("First line intermediates", Plan->IntermediateNodes.Num(), 1);
+		TestNotNull("First line root choice", Plan->RootChoiceNode);
+	}
+	// A gosub before the choice has to be walked
+	Plan = Script->FindChoicePlan(FindTextNode("You chose A"));
+	if (TestNotNull("Plan for gosub line", Plan))
+	{
+		TestTrue("Gosub line is dynamic", Plan->Result == ESUDSChoicePlanResult::Dynamic);
+	}
+	// Inside the gosub, the choices depend on where we return to
+	Plan = Script->FindChoicePlan(FindTextNode("In the sub"));
+	if (TestNotNull("Plan for sub line", Plan))
+	{
+		TestTrue("Sub line returns", Plan->Result == ESUDSChoicePlanResult::Return);
+		TestEqual("Sub line intermediates", Plan->IntermediateNodes.Num(), 2);
+	}
+	Plan = Script->FindChoicePlan(FindTextNode("You chose B"));
+	if (TestNotNull("Plan for last line", Plan))
+	{
+		TestTrue("Last line has no choice", Plan->Result == ESUDSChoicePlanResult::NoChoice);
+		TestEqual("Last line intermediates", Plan->IntermediateNodes.Num(), 0);
+	}
+
+	// Script shouldn't be the owner of the dialogue but it's the only UObject we've got right now so why not
+	auto Dlg = USUDSLibrary::CreateDialogue(Script, Script);
+	Dlg->Start();
+
+	TestDialogueText(this, "Start node", Dlg, "Player", "Hello there");
+	TestTrue("Set before choice should have run", Dlg->GetVariableBoolean("Greeted"));
+	if (TestEqual("Choice Count", Dlg->GetNumberOfChoices(), 2))
+	{
+		TestEqual("Choice 1", Dlg->GetChoiceText(0).ToString(), "Option A");
+		TestEqual("Choice 2", Dlg->GetChoiceText(1).ToString(), "Option B");
+	}
+	// Choices refer to the script's own edges, with copies made only on request
+	Plan = Script->FindChoicePlan(FindTextNode("Hello there"));
+	if (TestNotNull("Plan for first line", Plan))
+	{
+		const auto& Edges = Plan->RootChoiceNode->GetEdges();
+		const auto& Refs = Dlg->GetChoiceRefs();
+		if (TestEqual("Choice ref count", Refs.Num(), 2) && TestEqual("Choice edge count", Edges.Num(), 2))
+		{
+			TestTrue("Choice ref 1 points at script", Refs[0] == &Edges[0]);
+			TestTrue("Choice ref 2 points at script", Refs[1] == &Edges[1]);
+		}
+		const TArray<FSUDSScriptEdge> Copies = Dlg->GetChoices();
+		if (TestEqual("Choice copy count", Copies.Num(), 2))
+		{
+			TestEqual("Choice copy 2", Copies[1].GetText().ToString(), "Option B");
+		}
+	}
+	TestTrue("Choose", Dlg->Choose(0));
+	TestDialogueText(this, "Choice A", Dlg, "NPC", "You chose A");
+	TestTrue("Plain continue", Dlg->IsSimpleContinue());
+	TestFalse("Sub not run yet", Dlg->GetVariableBoolean("InSub"));
+	TestTrue("Continue", Dlg->Continue());
+	TestDialogueText(this, "Sub line", Dlg, "NPC", "In the sub");
+	TestTrue("Set before return should have run", Dlg->GetVariableBoolean("InSub"));
+	if (TestEqual("Choice Count after return", Dlg->GetNumberOfChoices(), 1))
+	{
+		TestEqual("Choice after return", Dlg->GetChoiceText(0).ToString(), "Again");
+	}
+	TestTrue("Choose", Dlg->Choose(0));
+	TestDialogueText(this, "Last line", Dlg, "NPC", "Bye");
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestRuntimeGraph,
+								 "SUDSTest.TestRuntimeGraph",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+
+
+bool FTestRuntimeGraph::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(NestedGosubInput), NestedGosubInput.Len(), "NestedGosubInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// The flattened graph should agree with the node objects it was built from
+	int NumGosubs = 0;
+	for (auto Node : Script->GetNodes())
+	{
+		const FSUDSRuntimeNode* RNode = Script->GetRuntimeNode(Node);
+		if (!TestNotNull("Node should be in runtime graph", RNode))
+		{
+			continue;
+		}
+		TestTrue("Runtime node type", RNode->Type == Node->GetNodeType());
+		TestEqual("Runtime edge count", RNode->NumEdges, Node->GetEdgeCount());
+		for (int i = 0; i < Node->GetEdgeCount(); ++i)
+		{
+			TestTrue("Runtime edge target", Script->GetEdgeTarget(Node, i) == Node->GetEdge(i)->GetTargetNode().Get());
+		}
+		if (auto GosubNode = Cast<USUDSScriptNodeGosub>(Node))
+		{
+			++NumGosubs;
+			TestNotNull("Gosub target", Script->GetGosubTarget(GosubNode));
+			TestTrue("Gosub target matches label", Script->GetGosubTarget(GosubNode) == Script->GetNodeByLabel(GosubNode->GetLabelName()));
+		}
+	}
+	TestTrue("Should have found gosubs", NumGosubs > 0);
+	for (auto Node : Script->GetHeaderNodes())
+	{
+		TestNotNull("Header node should be in runtime graph", Script->GetRuntimeNode(Node));
+	}
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+
 UE_ENABLE_OPTIMIZATION
\ No newline at end of file
@@ -144,4 +144,140 @@ bool FTestParametersPriority::RunTest(const FString& Parameters)
 	return true;	
 }
 
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestNativeParticipant,
+								 "SUDSTest.TestNativeParticipant",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestNativeParticipant::RunTest(const FString& Parameters)
+{
+	FInternationalization::FCultureStateSnapshot CultureStateSnapshot;
+	FInternationalization::Get().BackupCultureState(CultureStateSnapshot);
+	FInternationalization::Get().SetCurrentCulture(TEXT("en-US"));
+	ON_SCOPE_EXIT
+	{
+		FInternationalization::Get().RestoreCultureState(CultureStateSnapshot);
+	};
+
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(ParamsInput), ParamsInput.Len(), "ParamsInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	auto Dlg = USUDSLibrary::CreateDialogue(Script, Script);
+	// Native participant added first, but higher priority so called after the Blueprint one
+	auto NativeParticipant = NewObject<UTestNativeParticipant>();
+	NativeParticipant->Priority = 50;
+	auto Participant = NewObject<UTestParticipant>();
+	Participant->TestNumber = 0; // priority 0
+	Dlg->AddParticipant(NativeParticipant);
+	Dlg->AddParticipant(Participant);
+	if (TestEqual("Participants", Dlg->GetParticipants().Num(), 2))
+	{
+		TestTrue("Sorted by priority", Dlg->GetParticipants()[1] == NativeParticipant);
+	}
+	Dlg->Start();
+
+	TestEqual("Native starting", NativeParticipant->NumStarting, 1);
+	TestEqual("Native speaker lines", NativeParticipant->NumSpeakerLines, 1);
+	TestTrue("Native saw variable changes", NativeParticipant->ChangedVariables.Contains("FriendName"));
+	// Native participant overrides the Blueprint one
+	TestDialogueText(this, "Line 1", Dlg, "Player", "Hello, I'm Native Hero");
+	// Text parameters are requested when the text is resolved
+	TestTrue("Native requested variable", NativeParticipant->RequestedVariables.Contains("SpeakerName.Player"));
+	Dlg->Continue();
+	TestEqual("Native proceeding", NativeParticipant->NumProceeding, 1);
+	TestEqual("Native speaker lines", NativeParticipant->NumSpeakerLines, 2);
+	TestDialogueText(this, "Line 2", Dlg, "NPC", "Greetings, Native Hero, my name is An NPC");
+
+	// Priority is only read when added
+	NativeParticipant->Priority = -50;
+	Dlg->Restart(true);
+	TestDialogueText(this, "Line 1 again", Dlg, "Player", "Hello, I'm Native Hero");
+	Dlg->SetParticipants({ NativeParticipant, Participant });
+	Dlg->Restart(true);
+	TestDialogueText(this, "Line 1 re-added", Dlg, "Player", "Hello, I'm Protagonist");
+
+	Dlg->End(false);
+	TestEqual("Native finished", NativeParticipant->NumFinished, 1);
+
+	Script->MarkAsGarbage();
+	return true;	
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestParticipantSubscription,
+								 "SUDSTest.TestParticipantSubscription",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestParticipantSubscription::RunTest(const FString& Parameters)
+{
+	FInternationalization::FCultureStateSnapshot CultureStateSnapshot;
+	FInternationalization::Get().BackupCultureState(CultureStateSnapshot);
+	FInternationalization::Get().SetCurrentCulture(TEXT("en-US"));
+	ON_SCOPE_EXIT
+	{
+		FInternationalization::Get().RestoreCultureState(CultureStateSnapshot);
+	};
+
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(ParamsInput), ParamsInput.Len(), "ParamsInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	auto Dlg = USUDSLibrary::CreateDialogue(Script, Script);
+	// Only interested in speaker names and the number of cats
+	auto NativeParticipant = NewObject<UTestNativeParticipant>();
+	NativeParticipant->Subscription.Callbacks = static_cast<int32>(ESUDSParticipantCallbacks::Starting |
+		ESUDSParticipantCallbacks::VariableChanged |
+		ESUDSParticipantCallbacks::VariableRequested);
+	NativeParticipant->Subscription.VariablePrefixes.Add("SpeakerName.");
+	NativeParticipant->Subscription.VariableNames.Add("NumCats");
+	// Sets all the variables
+	auto Participant = NewObject<UTestParticipant>();
+	Participant->TestNumber = 0;
+	Dlg->AddParticipant(NativeParticipant);
+	Dlg->AddParticipant(Participant);
+	Dlg->Start();
+
+	TestEqual("Native starting", NativeParticipant->NumStarting, 1);
+	TestEqual("Not subscribed to speaker lines", NativeParticipant->NumSpeakerLines, 0);
+	TestTrue("Speaker name changed", NativeParticipant->ChangedVariables.Contains("SpeakerName.NPC"));
+	TestTrue("NumCats changed", NativeParticipant->ChangedVariables.Contains("NumCats"));
+	TestFalse("Not subscribed to FriendName", NativeParticipant->ChangedVariables.Contains("FriendName"));
+	TestFalse("Not subscribed to FloatVal", NativeParticipant->ChangedVariables.Contains("FloatVal"));
+	// Blueprint participant still gets everything
+	TestTrue("Blueprint participant gets everything", Participant->SetVarRecords.ContainsByPredicate([](const UTestParticipant::FSetVarRecord& R)
+	{
+		return R.Name == "FriendName";
+	}));
+
+	TestDialogueText(this, "Line 1", Dlg, "Player", "Hello, I'm Protagonist");
+	Dlg->Continue();
+	TestEqual("Not subscribed to proceeding", NativeParticipant->NumProceeding, 0);
+	Dlg->Continue();
+	TestDialogueText(this, "Line 3", Dlg, "Player", "My friend's name is Susan, she has 3 cats");
+	TestTrue("Requested speaker name", NativeParticipant->RequestedVariables.Contains("SpeakerName.Player"));
+	TestTrue("Requested NumCats", NativeParticipant->RequestedVariables.Contains("NumCats"));
+	TestFalse("Not subscribed to FriendName", NativeParticipant->RequestedVariables.Contains("FriendName"));
+	TestFalse("Not subscribed to Gender", NativeParticipant->RequestedVariables.Contains("Gender"));
+
+	// Variables not in the script are routed too
+	NativeParticipant->ChangedVariables.Reset();
+	Dlg->SetVariableInt("SpeakerName.Extra", 1);
+	Dlg->SetVariableInt("Unrelated", 1);
+	TestTrue("Extra variable routed", NativeParticipant->ChangedVariables == TArray<FName> { "SpeakerName.Extra" });
+
+	Script->MarkAsGarbage();
+	return true;	
+}
+
 UE_ENABLE_OPTIMIZATION
\ No newline at end of file
@@ -1186,4 +1186,66 @@ bool FTestErrorsReportedForBadChoiceIndents::RunTest(const FString& Parameters)
 
 
 
+const FString TypeInferenceInput = R"RAWSUD(
+===
+[set Count 1]
+[set Name "Bob"]
+[set Title "Sir"]
+===
+NPC: Hello
+[if {Count} > 2]
+    NPC: Lots
+[endif]
+[if {Name} < 3]
+    NPC: Odd
+[endif]
+[set Title 4]
+NPC: Bye
+)RAWSUD";
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestTypeInference,
+								 "SUDSTest.TestTypeInference",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+
+bool FTestTypeInference::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(TypeInferenceInput), TypeInferenceInput.Len(), "TypeInferenceInput", &Logger, false));
+
+	// One for comparing text with a number, one for setting a text variable to a number
+	TestEqual("Type warnings", Logger.NumWarnings(), 2);
+
+	FSUDSMessageLogger SilentLogger(false);
+	FSUDSScriptImporter SilentImporter;
+	TestTrue("Silent import should succeed", SilentImporter.ImportFromBuffer(GetData(TypeInferenceInput), TypeInferenceInput.Len(), "TypeInferenceInput", &SilentLogger, true));
+	TestEqual("Silent import has no type warnings", SilentLogger.NumWarnings(), 0);
+
+	int NumSelects = 0;
+	for (int i = 0; Importer.GetNode(i); ++i)
+	{
+		const auto Node = Importer.GetNode(i);
+		if (Node->NodeType == ESUDSParsedNodeType::Select && Node->Edges.Num() > 0)
+		{
+			const auto& Condition = Node->Edges[0].ConditionExpression;
+			if (Condition.GetSourceString() == "{Count} > 2")
+			{
+				++NumSelects;
+				TestTrue("Count condition is typed", Condition.IsStaticallyTyped());
+			}
+			else if (Condition.GetSourceString() == "{Name} < 3")
+			{
+				++NumSelects;
+				TestFalse("Mismatched condition is not typed", Condition.IsStaticallyTyped());
+			}
+		}
+	}
+	TestEqual("Found conditions", NumSelects, 2);
+
+	return true;
+}
+
 UE_ENABLE_OPTIMIZATION
\ No newline at end of file
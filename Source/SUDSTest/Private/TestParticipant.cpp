@@ -66,3 +66,13 @@ void UTestParticipant::OnDialogueVariableChanged_Implementation(USUDSDialogue* D
 	SetVarRecords.Add(FSetVarRecord { VariableName, Value, bFromScript });
 }
 
+void UTestNativeParticipant::OnDialogueStarting(USUDSDialogue* Dialogue, FName AtLabel)
+{
+	++NumStarting;
+	Dialogue->SetVariable("SpeakerName.Player", FText::FromString("Native Hero"));
+}
+
+void UTestNativeParticipant::OnDialogueVariableRequested(USUDSDialogue* Dialogue, FName VariableName)
+{
+	RequestedVariables.AddUnique(VariableName);
+}
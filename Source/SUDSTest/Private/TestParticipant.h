@@ -43,3 +43,36 @@ public:
 		const FSUDSValue& Value,
 		bool bFromScript) override;
 };
+
+/**
+ * Participant implementing only the native interface
+ */
+UCLASS()
+class SUDSTEST_API UTestNativeParticipant : public UObject, public ISUDSNativeParticipant
+{
+	GENERATED_BODY()
+
+public:
+	int Priority = 0;
+	FSUDSParticipantSubscription Subscription;
+	int NumStarting = 0;
+	int NumSpeakerLines = 0;
+	int NumProceeding = 0;
+	int NumFinished = 0;
+	TArray<FName> ChangedVariables;
+	TArray<FName> RequestedVariables;
+
+	virtual void OnDialogueStarting(USUDSDialogue* Dialogue, FName AtLabel) override;
+	virtual void OnDialogueFinished(USUDSDialogue* Dialogue) override { ++NumFinished; }
+	virtual void OnDialogueSpeakerLine(USUDSDialogue* Dialogue) override { ++NumSpeakerLines; }
+	virtual void OnDialogueChoiceMade(USUDSDialogue* Dialogue, int ChoiceIndex) override {}
+	virtual void OnDialogueProceeding(USUDSDialogue* Dialogue) override { ++NumProceeding; }
+	virtual void OnDialogueEvent(USUDSDialogue* Dialogue, FName EventName, const TArray<FSUDSValue>& Arguments) override {}
+	virtual void OnDialogueVariableChanged(USUDSDialogue* Dialogue, FName VariableName, const FSUDSValue& Value, bool bFromScript) override
+	{
+		ChangedVariables.Add(VariableName);
+	}
+	virtual void OnDialogueVariableRequested(USUDSDialogue* Dialogue, FName VariableName) override;
+	virtual int GetDialogueParticipantPriority() const override { return Priority; }
+	virtual FSUDSParticipantSubscription GetDialogueParticipantSubscription() const override { return Subscription; }
+};
@@ -0,0 +1,471 @@
+﻿#include "SUDSDialogue.h"
+#include "SUDSExpression.h"
+#include "SUDSLibrary.h"
+#include "SUDSMessageLogger.h"
+#include "SUDSScript.h"
+#include "SUDSScriptImporter.h"
+#include "SUDSSettings.h"
+#include "TestUtils.h"
+#include "Misc/AutomationTest.h"
+#include "Serialization/CustomVersion.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+UE_DISABLE_OPTIMIZATION
+
+// Benchmarks, only run when the performance filter is selected. Results are logged as info, they don't fail
+
+namespace
+{
+	const TArray<FString> BenchmarkExpressions = {
+		"3 + 4 * {Six} + 1",
+		"-6.7 * 2 + (21.3 - 8) * 5",
+		"not {SomethingFalse} and {SomethingElseFalse} and {SomethingTrue}",
+		"{SomethingTrue} or {SomethingFalse} || {SomethingTrue}",
+		"{Female} == Feminine and {Male} != masculine",
+		"{SomeText} == \"Hello this has some \\\"Embedded Quotes\\\"\"",
+		"{global.GlobalLocalTestInt} >= 3 && `AName` <> {SomeName}",
+		"({Seven} % 2 = 1) or ({EightFloat} <= 8.15)",
+	};
+
+	double PerSecond(int32 Count, double Seconds)
+	{
+		return Seconds > 0 ? Count / Seconds : 0;
+	}
+
+	/// Mirror of the original FSUDSValue layout, to compare against
+	struct FLegacySUDSValueLayout
+	{
+		ESUDSValueType Type;
+		union
+		{
+			int32 IntValue;
+			float FloatValue;
+		};
+		TOptional<FText> TextValue;
+		TOptional<FName> Name;
+	};
+
+	FSUDSValue MakeBenchmarkValue(int32 i)
+	{
+		switch (i % 5)
+		{
+		default:
+		case 0:
+			return FSUDSValue(i);
+		case 1:
+			return FSUDSValue((float)i * 0.5f);
+		case 2:
+			return FSUDSValue(i % 2 == 0);
+		case 3:
+			return FSUDSValue(FName("SomeName"), false);
+		case 4:
+			return FSUDSValue(FText::FromString("Some text"));
+		}
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestPerfExpressionLexer,
+                                 "SUDSTest.Performance.ExpressionLexer",
+                                 EAutomationTestFlags::EditorContext |
+                                 EAutomationTestFlags::ClientContext |
+                                 EAutomationTestFlags::PerfFilter)
+
+
+bool FTestPerfExpressionLexer::RunTest(const FString& Parameters)
+{
+	constexpr int32 Iterations = 2000;
+
+	int32 RegexTokens = 0;
+	double StartTime = FPlatformTime::Seconds();
+	for (int32 i = 0; i < Iterations; ++i)
+	{
+		for (const FString& Expression : BenchmarkExpressions)
+		{
+			TArray<FString> Tokens;
+			TokeniseExpressionWithRegex(Expression, Tokens);
+			RegexTokens += Tokens.Num();
+		}
+	}
+	const double RegexTime = FPlatformTime::Seconds() - StartTime;
+
+	int32 LexerTokens = 0;
+	StartTime = FPlatformTime::Seconds();
+	for (int32 i = 0; i < Iterations; ++i)
+	{
+		for (const FString& Expression : BenchmarkExpressions)
+		{
+			int32 Pos = 0;
+			FSUDSExpressionToken Token;
+			while (FSUDSExpression::NextToken(Expression, Pos, Token))
+			{
+				++LexerTokens;
+			}
+		}
+	}
+	const double LexerTime = FPlatformTime::Seconds() - StartTime;
+
+	TestEqual("Same number of tokens", LexerTokens, RegexTokens);
+
+	int32 Parsed = 0;
+	StartTime = FPlatformTime::Seconds();
+	for (int32 i = 0; i < Iterations; ++i)
+	{
+		for (const FString& Expression : BenchmarkExpressions)
+		{
+			FSUDSExpression Expr;
+			Parsed += Expr.ParseFromString(Expression, nullptr) ? 1 : 0;
+		}
+	}
+	const double ParseTime = FPlatformTime::Seconds() - StartTime;
+	TestEqual("All parsed", Parsed, Iterations * BenchmarkExpressions.Num());
+
+	AddInfo(FString::Printf(TEXT("Regex tokeniser: %d tokens in %.3fs, %.0f tokens/sec"),
+	                        RegexTokens, RegexTime, PerSecond(RegexTokens, RegexTime)));
+	AddInfo(FString::Printf(TEXT("Lexer: %d tokens in %.3fs, %.0f tokens/sec"),
+	                        LexerTokens, LexerTime, PerSecond(LexerTokens, LexerTime)));
+	AddInfo(FString::Printf(TEXT("ParseFromString: %d expressions in %.3fs, %.0f expressions/sec"),
+	                        Parsed, ParseTime, PerSecond(Parsed, ParseTime)));
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestPerfValueMemory,
+                                 "SUDSTest.Performance.ValueMemory",
+                                 EAutomationTestFlags::EditorContext |
+                                 EAutomationTestFlags::ClientContext |
+                                 EAutomationTestFlags::PerfFilter)
+
+
+bool FTestPerfValueMemory::RunTest(const FString& Parameters)
+{
+	// A dialogue state with 10k variables, 1 in 5 of them text
+	constexpr int32 NumVariables = 10000;
+	constexpr int32 CopyIterations = 100;
+
+	TArray<FSUDSValue> Values;
+	TMap<FName, FSUDSValue> VariableMap;
+	Values.Reserve(NumVariables);
+	VariableMap.Reserve(NumVariables);
+	int32 NumText = 0;
+	for (int32 i = 0; i < NumVariables; ++i)
+	{
+		FSUDSValue Val = MakeBenchmarkValue(i);
+		NumText += Val.GetType() == ESUDSValueType::Text ? 1 : 0;
+		VariableMap.Add(FName("Var", i), Val);
+		Values.Add(MoveTemp(Val));
+	}
+
+	// Each text value has its own out-of-line holder here, copies of it would share that
+	const SIZE_T ArrayBytes = Values.GetAllocatedSize() + NumText * sizeof(FSUDSValueText);
+	const SIZE_T MapBytes = VariableMap.GetAllocatedSize() + NumText * sizeof(FSUDSValueText);
+	const SIZE_T LegacyArrayBytes = NumVariables * sizeof(FLegacySUDSValueLayout);
+
+	double StartTime = FPlatformTime::Seconds();
+	int32 Copied = 0;
+	for (int32 i = 0; i < CopyIterations; ++i)
+	{
+		TArray<FSUDSValue> Copy = Values;
+		Copied += Copy.Num();
+	}
+	const double CopyTime = FPlatformTime::Seconds() - StartTime;
+	TestEqual("All copied", Copied, NumVariables * CopyIterations);
+
+	AddInfo(FString::Printf(TEXT("FSUDSValue size: %d bytes (original layout %d bytes)"),
+	                        (int32)sizeof(FSUDSValue), (int32)sizeof(FLegacySUDSValueLayout)));
+	AddInfo(FString::Printf(TEXT("%d values in array: %llu bytes (original layout %llu bytes)"),
+	                        NumVariables, (uint64)ArrayBytes, (uint64)LegacyArrayBytes));
+	AddInfo(FString::Printf(TEXT("%d values in name map: %llu bytes"), NumVariables, (uint64)MapBytes));
+	AddInfo(FString::Printf(TEXT("Copying %d values: %.0f values/sec"),
+	                        NumVariables, PerSecond(Copied, CopyTime)));
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestPerfTextEquality,
+                                 "SUDSTest.Performance.TextEquality",
+                                 EAutomationTestFlags::EditorContext |
+                                 EAutomationTestFlags::ClientContext |
+                                 EAutomationTestFlags::PerfFilter)
+
+
+bool FTestPerfTextEquality::RunTest(const FString& Parameters)
+{
+	constexpr int32 Iterations = 20000;
+
+	// Faction checks against string table entries, the typical text-heavy condition
+	ScopedStringTableHolder TableHolder;
+	TableHolder.StringTable->GetMutableStringTable()->SetSourceString("Guild", "The Guild");
+	TableHolder.StringTable->GetMutableStringTable()->SetSourceString("Crown", "The Crown");
+	TableHolder.StringTable->GetMutableStringTable()->SetSourceString("Rebels", "The Rebels");
+	const FName TableId = TableHolder.StringTable->GetStringTableId();
+
+	TMap<FName, FSUDSValue> Variables;
+	Variables.Add("Faction", FText::FromStringTable(TableId, "Rebels"));
+	Variables.Add("Guild", FText::FromStringTable(TableId, "Guild"));
+	Variables.Add("Crown", FText::FromStringTable(TableId, "Crown"));
+	Variables.Add("Rebels", FText::FromStringTable(TableId, "Rebels"));
+	Variables.Add("RebelsLiteral", FText::FromString("The Rebels"));
+	const TMap<FName, FSUDSValue> GlobalVariables;
+
+	FSUDSExpression Expr;
+	TestTrue("Parse", Expr.ParseFromString(
+		"({Faction} == {Guild} or {Faction} == {Crown} or {Faction} == {Rebels}) and {Faction} == {RebelsLiteral}", nullptr));
+
+	USUDSSettings* Settings = GetMutableDefault<USUDSSettings>();
+	const ESUDSTextComparison OldMode = Settings->TextComparison;
+
+	for (ESUDSTextComparison Mode : { ESUDSTextComparison::CultureAware, ESUDSTextComparison::Ordinal, ESUDSTextComparison::OrdinalIgnoreCase })
+	{
+		Settings->TextComparison = Mode;
+		int32 NumTrue = 0;
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 i = 0; i < Iterations; ++i)
+		{
+			NumTrue += Expr.EvaluateBoolean(Variables, GlobalVariables, "") ? 1 : 0;
+		}
+		const double Time = FPlatformTime::Seconds() - StartTime;
+		const FString ModeStr = StaticEnum<ESUDSTextComparison>()->GetNameStringByValue((int64)Mode);
+		TestEqual(ModeStr + " result", NumTrue, Iterations);
+
+		AddInfo(FString::Printf(TEXT("%s: %d conditions in %.3fs, %.0f conditions/sec"),
+		                        *ModeStr, Iterations, Time, PerSecond(Iterations, Time)));
+	}
+
+	Settings->TextComparison = OldMode;
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestPerfTypedExpressions,
+                                 "SUDSTest.Performance.TypedExpressions",
+                                 EAutomationTestFlags::EditorContext |
+                                 EAutomationTestFlags::ClientContext |
+                                 EAutomationTestFlags::PerfFilter)
+
+
+bool FTestPerfTypedExpressions::RunTest(const FString& Parameters)
+{
+	constexpr int32 Iterations = 20000;
+
+	TMap<FName, ESUDSValueType> KnownTypes;
+	KnownTypes.Add("Gold", ESUDSValueType::Int);
+	KnownTypes.Add("Reputation", ESUDSValueType::Float);
+	KnownTypes.Add("MetKing", ESUDSValueType::Boolean);
+
+	TMap<FName, FSUDSValue> Variables;
+	Variables.Add("Gold", 120);
+	Variables.Add("Reputation", 0.75f);
+	Variables.Add("MetKing", true);
+	const TMap<FName, FSUDSValue> GlobalVariables;
+
+	const FString Source = "{Gold} * 2 - 10 >= 200 and {Reputation} * 100 > 50 and {MetKing} == true";
+	FSUDSExpression Untyped;
+	FSUDSExpression Typed;
+	TArray<FString> Problems;
+	TestTrue("Parse", Untyped.ParseFromString(Source, nullptr) && Typed.ParseFromString(Source, nullptr));
+	Typed.InferTypes(KnownTypes, Problems);
+	TestTrue("Typed", Typed.IsStaticallyTyped());
+
+	for (const FSUDSExpression* Expr : { &Untyped, &Typed })
+	{
+		int32 NumTrue = 0;
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 i = 0; i < Iterations; ++i)
+		{
+			NumTrue += Expr->EvaluateBoolean(Variables, GlobalVariables, "") ? 1 : 0;
+		}
+		const double Time = FPlatformTime::Seconds() - StartTime;
+		TestEqual("All true", NumTrue, Iterations);
+		AddInfo(FString::Printf(TEXT("%s: %d conditions in %.3fs, %.0f conditions/sec"),
+		                        Expr->IsStaticallyTyped() ? TEXT("Typed") : TEXT("Untyped"),
+		                        Iterations, Time, PerSecond(Iterations, Time)));
+	}
+
+	return true;
+}
+
+const FString BarkBenchmarkInput = R"RAWSUD(
+===
+[set Mood 1]
+===
+[random]
+	Guard: Move along
+[or]
+	Guard: Nothing to see here
+[endrandom]
+[if {Mood} > 0]
+	Guard: Have a nice day
+[else]
+	Guard: Get lost
+[endif]
+)RAWSUD";
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestPerfDialogueRunner,
+                                 "SUDSTest.Performance.DialogueRunner",
+                                 EAutomationTestFlags::EditorContext |
+                                 EAutomationTestFlags::ClientContext |
+                                 EAutomationTestFlags::PerfFilter)
+
+
+bool FTestPerfDialogueRunner::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumBarks = 500;
+
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(BarkBenchmarkInput), BarkBenchmarkInput.Len(), "BarkBenchmarkInput", &Logger, true));
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// Full UObject dialogues
+	{
+		TArray<USUDSDialogue*> Dialogues;
+		int32 Lines = 0;
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 i = 0; i < NumBarks; ++i)
+		{
+			auto Dlg = USUDSLibrary::CreateDialogue(Script, Script);
+			Dlg->Start();
+			do
+			{
+				++Lines;
+			} while (Dlg->Continue());
+			Dialogues.Add(Dlg);
+		}
+		const double Time = FPlatformTime::Seconds() - StartTime;
+		AddInfo(FString::Printf(TEXT("USUDSDialogue: %d barks (%d lines) in %.3fs, %.0f barks/sec"),
+		                        NumBarks, Lines, Time, PerSecond(NumBarks, Time)));
+		for (auto Dlg : Dialogues)
+		{
+			Dlg->MarkAsGarbage();
+		}
+	}
+
+	// Native runners
+	{
+		TArray<FSUDSDialogueRunner> Runners;
+		Runners.Reserve(NumBarks);
+		int32 Lines = 0;
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 i = 0; i < NumBarks; ++i)
+		{
+			FSUDSDialogueRunner& Runner = Runners.AddDefaulted_GetRef();
+			Runner.Initialise(Script);
+			Runner.Start();
+			do
+			{
+				++Lines;
+			} while (Runner.Continue());
+		}
+		const double Time = FPlatformTime::Seconds() - StartTime;
+		AddInfo(FString::Printf(TEXT("FSUDSDialogueRunner: %d barks (%d lines) in %.3fs, %.0f barks/sec"),
+		                        NumBarks, Lines, Time, PerSecond(NumBarks, Time)));
+		AddInfo(FString::Printf(TEXT("Size of USUDSDialogue: %d bytes, FSUDSDialogueRunner: %d bytes"),
+		                        USUDSDialogue::StaticClass()->GetStructureSize(), (int32)sizeof(FSUDSDialogueRunner)));
+	}
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+const FString SaveStateBenchmarkInput = R"RAWSUD(
+Merchant: Welcome, {PlayerName}. You have {Gold} gold.
+	* Buy a sword
+		[set Gold = {Gold} - 50]
+		[set HasSword true]
+	* Buy a shield
+		[set Gold = {Gold} - 30]
+		[set HasShield true]
+	* Ask about rumours
+		Merchant: They say the old mine is haunted.
+		[set HeardRumour true]
+	* Leave
+Merchant: Come back soon.
+)RAWSUD";
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestPerfCompactSaveState,
+                                 "SUDSTest.Performance.CompactSaveState",
+                                 EAutomationTestFlags::EditorContext |
+                                 EAutomationTestFlags::ClientContext |
+                                 EAutomationTestFlags::PerfFilter)
+
+
+bool FTestPerfCompactSaveState::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumStates = 2000;
+
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(SaveStateBenchmarkInput), SaveStateBenchmarkInput.Len(), "SaveStateBenchmarkInput", &Logger, true));
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// A typical NPC state: a few variables and a couple of choices taken
+	FSUDSDialogueRunner Runner;
+	Runner.Initialise(Script);
+	Runner.SetVariable("PlayerName", FSUDSValue(FName("Hero"), false));
+	Runner.SetVariable("Gold", 100);
+	Runner.SetVariable("Reputation", -2);
+	Runner.Start();
+	Runner.Choose(2);
+	while (Runner.Continue()) {}
+	Runner.Start();
+	Runner.Choose(0);
+	const FSUDSDialogueState State = Runner.GetSavedState();
+
+	// Original struct format
+	TArray<TArray<uint8>> FullData;
+	FullData.SetNum(NumStates);
+	int64 FullBytes = 0;
+	double StartTime = FPlatformTime::Seconds();
+	for (int32 i = 0; i < NumStates; ++i)
+	{
+		FMemoryWriter Ar(FullData[i]);
+		FSUDSDialogueState Copy = State;
+		Ar << Copy;
+		FullBytes += FullData[i].Num();
+	}
+	const double FullSaveTime = FPlatformTime::Seconds() - StartTime;
+	StartTime = FPlatformTime::Seconds();
+	for (int32 i = 0; i < NumStates; ++i)
+	{
+		FMemoryReader Ar(FullData[i]);
+		FSUDSDialogueState Loaded;
+		Ar << Loaded;
+	}
+	const double FullLoadTime = FPlatformTime::Seconds() - StartTime;
+
+	// Compact format
+	TArray<TArray<uint8>> CompactData;
+	CompactData.SetNum(NumStates);
+	int64 CompactBytes = 0;
+	StartTime = FPlatformTime::Seconds();
+	for (int32 i = 0; i < NumStates; ++i)
+	{
+		State.SaveCompact(Script, CompactData[i]);
+		CompactBytes += CompactData[i].Num();
+	}
+	const double CompactSaveTime = FPlatformTime::Seconds() - StartTime;
+	int32 NumLoaded = 0;
+	StartTime = FPlatformTime::Seconds();
+	for (int32 i = 0; i < NumStates; ++i)
+	{
+		FSUDSDialogueState Loaded;
+		NumLoaded += Loaded.LoadCompact(Script, CompactData[i]) ? 1 : 0;
+	}
+	const double CompactLoadTime = FPlatformTime::Seconds() - StartTime;
+	TestEqual("All compact states should load", NumLoaded, NumStates);
+
+	AddInfo(FString::Printf(TEXT("Struct format: %d states, %lld bytes, save %.3fs, load %.3fs"),
+	                        NumStates, FullBytes, FullSaveTime, FullLoadTime));
+	AddInfo(FString::Printf(TEXT("Compact format: %d states, %lld bytes, save %.3fs, load %.3fs"),
+	                        NumStates, CompactBytes, CompactSaveTime, CompactLoadTime));
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+UE_ENABLE_OPTIMIZATION
@@ -1,8 +1,11 @@
-﻿#include "SUDSLibrary.h"
+﻿#include "SUDSDialogue.h"
+#include "SUDSLibrary.h"
 #include "SUDSMessageLogger.h"
 #include "SUDSScript.h"
 #include "SUDSScriptImporter.h"
 #include "TestUtils.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
 
 UE_DISABLE_OPTIMIZATION
 
@@ -339,4 +342,124 @@ bool FTestRandomMixed::RunTest(const FString& Parameters)
     
 }
 
+// Run round the BasicRandomInput loop a number of times, returning the random lines picked
+TArray<FString> CollectRandomLines(USUDSDialogue* Dlg, int Count)
+{
+    TArray<FString> Lines;
+    for (int i = 0; i < Count; ++i)
+    {
+        // On "Player: Hello" or "Player: OK", next is the random line
+        Dlg->Continue();
+        Lines.Add(Dlg->GetText().ToString());
+        Dlg->Continue();
+    }
+    return Lines;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestRandomStreams,
+                                 "SUDSTest.TestRandomStreams",
+                                 EAutomationTestFlags::EditorContext |
+                                 EAutomationTestFlags::ClientContext |
+                                 EAutomationTestFlags::ProductFilter)
+bool FTestRandomStreams::RunTest(const FString& Parameters)
+{
+    FSUDSMessageLogger Logger(false);
+    FSUDSScriptImporter Importer;
+    TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(BasicRandomInput), BasicRandomInput.Len(), "BasicRandomInput", &Logger, true));
+
+    auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+    const ScopedStringTableHolder StringTableHolder;
+    Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+    constexpr int NumLoops = 12;
+    
+    // Same seed gives the same results, even when other things use random numbers in between
+    auto Dlg1 = USUDSLibrary::CreateDialogue(Script, Script);
+    Dlg1->SetRandomSeed(1234);
+    Dlg1->Start();
+    const TArray<FString> Lines1 = CollectRandomLines(Dlg1, NumLoops);
+
+    auto Dlg2 = USUDSLibrary::CreateDialogue(Script, Script);
+    Dlg2->SetRandomSeed(1234);
+    Dlg2->Start();
+    TArray<FString> Lines2;
+    for (int i = 0; i < NumLoops; ++i)
+    {
+        FMath::SRand();
+        FMath::RandRange(0, 100);
+        Lines2.Append(CollectRandomLines(Dlg2, 1));
+    }
+    TestTrue("Same seed should give same random lines", Lines2 == Lines1);
+    TestEqual("Seed should be retrievable", Dlg2->GetRandomSeed(), 1234);
+
+    // Interleaved dialogues don't affect each other
+    auto Dlg3 = USUDSLibrary::CreateDialogue(Script, Script);
+    auto Dlg4 = USUDSLibrary::CreateDialogue(Script, Script);
+    Dlg3->SetRandomSeed(1234);
+    Dlg4->SetRandomSeed(98765);
+    Dlg3->Start();
+    Dlg4->Start();
+    TArray<FString> Lines3;
+    for (int i = 0; i < NumLoops; ++i)
+    {
+        Lines3.Append(CollectRandomLines(Dlg3, 1));
+        CollectRandomLines(Dlg4, 1);
+    }
+    TestTrue("Interleaved dialogue should not affect random lines", Lines3 == Lines1);
+
+    // Unseeded dialogues take their seed from SRand, and each gets a different one
+    FMath::SRandInit(42);
+    auto Dlg5 = USUDSLibrary::CreateDialogue(Script, Script);
+    auto Dlg6 = USUDSLibrary::CreateDialogue(Script, Script);
+    TestEqual("Unseeded dialogue should take seed from SRand", Dlg5->GetRandomSeed(), 42);
+    TestTrue("Unseeded dialogues should get different seeds", Dlg6->GetRandomSeed() != Dlg5->GetRandomSeed());
+    // Next seed must not just be the next step of the previous one's stream
+    FRandomStream LaggedStream(42);
+    LaggedStream.GetUnsignedInt();
+    TestTrue("Unseeded seeds should not follow on from each other", Dlg6->GetRandomSeed() != LaggedStream.GetCurrentSeed());
+    Dlg5->Start();
+    Dlg6->Start();
+    const TArray<FString> Lines5 = CollectRandomLines(Dlg5, NumLoops);
+    const TArray<FString> Lines6 = CollectRandomLines(Dlg6, NumLoops);
+    TestFalse("Unseeded dialogues should not play the same sequence",
+              TArray<FString>(Lines5.GetData() + 1, NumLoops - 1) == TArray<FString>(Lines6.GetData(), NumLoops - 1));
+
+    // Stepping never uses the global stream, so dialogues can be stepped off the game thread
+    auto Dlg9 = USUDSLibrary::CreateDialogue(Script, Script);
+    Dlg9->Start();
+    const int32 GlobalSeed = FMath::GetRandSeed();
+    CollectRandomLines(Dlg9, NumLoops);
+    TestEqual("Stepping should not use SRand", FMath::GetRandSeed(), GlobalSeed);
+
+    // Saved state continues the same sequence
+    auto Dlg7 = USUDSLibrary::CreateDialogue(Script, Script);
+    Dlg7->SetRandomSeed(1234);
+    Dlg7->Start();
+    const TArray<FString> FirstHalf = CollectRandomLines(Dlg7, NumLoops / 2);
+    TestTrue("First half should match", FirstHalf == TArray<FString>(Lines1.GetData(), NumLoops / 2));
+    const FSUDSDialogueState State = Dlg7->GetSavedState();
+    TestTrue("State should include random stream", State.HasRandomStream());
+    TestEqual("State should include seed", State.GetRandomSeed(), 1234);
+
+    // Round-trip through a plain archive
+    TArray<uint8> Bytes;
+    FMemoryWriter Writer(Bytes);
+    FSUDSDialogueState WriteState = State;
+    Writer << WriteState;
+    FMemoryReader Reader(Bytes);
+    FSUDSDialogueState ReadState;
+    Reader << ReadState;
+    TestEqual("Archived random stream state", ReadState.GetRandomStreamState(), State.GetRandomStreamState());
+
+    auto Dlg8 = USUDSLibrary::CreateDialogue(Script, Script);
+    Dlg8->RestoreSavedState(ReadState);
+    TestEqual("Restored seed", Dlg8->GetRandomSeed(), 1234);
+    const TArray<FString> SecondHalf = CollectRandomLines(Dlg8, NumLoops / 2);
+    TestTrue("Restored dialogue should continue sequence", SecondHalf == TArray<FString>(Lines1.GetData() + NumLoops / 2, NumLoops / 2));
+    
+    Script->MarkAsGarbage();
+    return true;
+    
+}
+
 UE_ENABLE_OPTIMIZATION
\ No newline at end of file
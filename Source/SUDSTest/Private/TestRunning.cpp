@@ -3,7 +3,9 @@
 #include "SUDSMessageLogger.h"
 #include "SUDSScript.h"
 #include "SUDSScriptImporter.h"
+#include "SUDSScriptNode.h"
 #include "SUDSSubsystem.h"
+#include "TestEventSub.h"
 #include "TestUtils.h"
 #include "Internationalization/Internationalization.h"
 #include "Misc/AutomationTest.h"
@@ -489,4 +491,529 @@ bool FTestLinesBetweenTextAndChoice::RunTest(const FString& Parameters)
 	return true;
 }
 
+const FString VariableSlotsInput = R"RAWSUD(
+===
+[set Health 100]
+[set global.Difficulty 2]
+===
+Player: I have {Health} health and {Gold} gold
+[set Gold {Gold} + 10]
+[if {Health} > 50]
+	NPC: You look well
+[endif]
+NPC: Bye
+)RAWSUD";
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestVariableSlots,
+								 "SUDSTest.TestVariableSlots",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+
+
+bool FTestVariableSlots::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(VariableSlotsInput), VariableSlotsInput.Len(), "VariableSlotsInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// Globals aren't in the table, header variables come first
+	TestEqual("Num script slots", Script->GetNumVariableSlots(), 2);
+	TestEqual("Health slot", Script->GetVariableSlot("Health"), 0);
+	TestEqual("Gold slot", Script->GetVariableSlot("Gold"), 1);
+	TestEqual("Global slot", Script->GetVariableSlot("global.Difficulty"), INDEX_NONE);
+
+	auto Dlg = USUDSLibrary::CreateDialogue(Script, Script);
+	// Variables which the script doesn't use still work by name
+	Dlg->SetVariableInt("NotInScript", 5);
+	Dlg->SetVariableInt("Gold", 20);
+	Dlg->Start();
+
+	TestDialogueText(this, "Line 1", Dlg, "Player", "I have 100 health and 20 gold");
+	TestTrue("Continue", Dlg->Continue());
+	TestDialogueText(this, "Line 2", Dlg, "NPC", "You look well");
+	TestEqual("Gold", Dlg->GetVariableInt("Gold"), 30);
+	TestEqual("Not in script", Dlg->GetVariableInt("NotInScript"), 5);
+
+	auto Vars = Dlg->GetVariables();
+	TestEqual("Num variables", Vars.Num(), 3);
+	TestTrue("Health in map", Vars.Contains("Health"));
+	TestTrue("Not in script in map", Vars.Contains("NotInScript"));
+
+	Dlg->UnSetVariable("NotInScript");
+	TestFalse("Unset", Dlg->IsVariableSet("NotInScript"));
+	Dlg->UnSetVariable("Gold");
+	TestFalse("Unset script var", Dlg->IsVariableSet("Gold"));
+	TestEqual("Num variables after unset", Dlg->GetVariables().Num(), 1);
+
+	// Restoring state brings back variables both in and out of the script table
+	FSUDSDialogueState State = Dlg->GetSavedState();
+	Dlg->SetVariableInt("NotInScript", 7);
+	Dlg->SetVariableInt("Health", 1);
+	Dlg->RestoreSavedState(State);
+	TestEqual("Restored health", Dlg->GetVariableInt("Health"), 100);
+	TestFalse("Restored not in script", Dlg->IsVariableSet("NotInScript"));
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+const FString NativeRunnerInput = R"RAWSUD(
+===
+[set Greeting "Hi"]
+===
+NPC: {Greeting}, you there
+[event Barked {Mood}]
+	* Who, me?
+		[set Asked true]
+		NPC: Yes you
+	* Ignore
+		NPC: Hmph
+Player: Moving on
+)RAWSUD";
+
+namespace
+{
+	/// Records callbacks from native runners
+	class FTestRunnerListener : public ISUDSDialogueRunnerListener
+	{
+	public:
+		int NumStarting = 0;
+		int NumSpeakerLines = 0;
+		int NumChoices = 0;
+		int NumProceeding = 0;
+		int NumFinished = 0;
+		TArray<FName> Events;
+		TArray<FName> ChangedVariables;
+		TArray<FName> RequestedVariables;
+		TArray<TArray<FName>> RequestBatches;
+		
+		virtual void OnDialogueStarting(FSUDSDialogueRunner& Runner, FName StartLabel) override { ++NumStarting; }
+		virtual void OnDialogueSpeakerLine(FSUDSDialogueRunner& Runner) override { ++NumSpeakerLines; }
+		virtual void OnDialogueChoice(FSUDSDialogueRunner& Runner, int ChoiceIndex, int LineNo) override { ++NumChoices; }
+		virtual void OnDialogueProceeding(FSUDSDialogueRunner& Runner) override { ++NumProceeding; }
+		virtual void OnDialogueFinished(FSUDSDialogueRunner& Runner) override { ++NumFinished; }
+		virtual void OnDialogueEvent(FSUDSDialogueRunner& Runner, FName EventName, const TArray<FSUDSValue>& Arguments, int LineNo) override
+		{
+			Events.Add(EventName);
+		}
+		virtual void OnDialogueVariableChanged(FSUDSDialogueRunner& Runner, FName VariableName, const FSUDSValue& Value, bool bFromScript, int LineNo) override
+		{
+			ChangedVariables.Add(VariableName);
+		}
+		virtual void OnDialogueVariableRequested(FSUDSDialogueRunner& Runner, FName VariableName, int LineNo) override
+		{
+			RequestedVariables.Add(VariableName);
+			// Supply variables on demand, like a participant would
+			if (VariableName == "Mood")
+			{
+				Runner.SetVariable("Mood", FSUDSValue(FName("Grumpy"), false));
+			}
+		}
+		virtual void OnDialogueVariablesRequested(FSUDSDialogueRunner& Runner, const TArray<FName>& VariableNames, int LineNo) override
+		{
+			RequestBatches.Add(VariableNames);
+			if (VariableNames.Contains("Mood"))
+			{
+				Runner.SetVariable("Mood", FSUDSValue(FName("Grumpy"), false));
+			}
+		}
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestNativeRunner,
+								 "SUDSTest.TestNativeRunner",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestNativeRunner::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(NativeRunnerInput), NativeRunnerInput.Len(), "NativeRunnerInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// Several runners sharing one listener, no UObjects involved
+	FTestRunnerListener Listener;
+	TArray<FSUDSDialogueRunner> Runners;
+	Runners.SetNum(3);
+	for (auto& Runner : Runners)
+	{
+		Runner.Initialise(Script, &Listener);
+	}
+	TestEqual("Header variables set", Listener.ChangedVariables.Num(), 3);
+	for (auto& Runner : Runners)
+	{
+		Runner.Start();
+	}
+	TestEqual("Starting", Listener.NumStarting, 3);
+	TestEqual("Speaker lines", Listener.NumSpeakerLines, 3);
+	TestEqual("Events", Listener.Events.Num(), 3);
+	TestTrue("Mood supplied on request", Runners[0].GetVariable("Mood").GetNameValue() == FName("Grumpy"));
+
+	for (auto& Runner : Runners)
+	{
+		TestEqual("Speaker", Runner.GetSpeakerID(), "NPC");
+		TestEqual("Text", Runner.GetText().ToString(), "Hi, you there");
+		TestEqual("Choices", Runner.GetNumberOfChoices(), 2);
+		TestEqual("Choice text", Runner.GetChoiceText(0).ToString(), "Who, me?");
+	}
+
+	// Runners are independent
+	TestTrue("Choose", Runners[0].Choose(0));
+	TestEqual("Chosen text", Runners[0].GetText().ToString(), "Yes you");
+	TestTrue("Asked set", Runners[0].GetVariable("Asked").GetBooleanValue());
+	TestFalse("Asked not set on others", Runners[1].IsVariableSet("Asked"));
+	TestTrue("Choose", Runners[1].Choose(1));
+	TestEqual("Other chosen text", Runners[1].GetText().ToString(), "Hmph");
+	TestEqual("Choices made", Listener.NumChoices, 2);
+	TestEqual("Proceeding", Listener.NumProceeding, 2);
+
+	TestTrue("Continue", Runners[0].Continue());
+	TestEqual("Fallthrough text", Runners[0].GetText().ToString(), "Moving on");
+	TestFalse("Continue to end", Runners[0].Continue());
+	TestTrue("Ended", Runners[0].IsEnded());
+	TestEqual("Finished", Listener.NumFinished, 1);
+	TestFalse("Others not ended", Runners[2].IsEnded());
+
+	// Save state from a runner restores into a dialogue
+	const FSUDSDialogueState State = Runners[1].GetSavedState();
+	auto Dlg = USUDSLibrary::CreateDialogue(Script, Script);
+	Dlg->RestoreSavedState(State);
+	TestDialogueText(this, "Restored", Dlg, "NPC", "Hmph");
+	TestTrue("Restored variable", Dlg->GetVariableName("Mood") == FName("Grumpy"));
+	
+	Script->MarkAsGarbage();
+	return true;
+}
+
+const FString HeaderDefaultsInput = R"RAWSUD(
+===
+[set Name "Bob"]
+[set Count 2 + 3]
+[set Ratio 0.5]
+[set Doubled {Count} * 2]
+[set Late true]
+===
+NPC: Hello {Name}
+)RAWSUD";
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestHeaderDefaults,
+								 "SUDSTest.TestHeaderDefaults",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestHeaderDefaults::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(HeaderDefaultsInput), HeaderDefaultsInput.Len(), "HeaderDefaultsInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// Everything up to the first set which reads a variable is evaluated up front
+	TestEqual("Header defaults", Script->GetHeaderDefaults().Num(), 3);
+	if (TestNotNull("Resume node", Script->GetHeaderResumeNode()))
+	{
+		TestEqual("Resume node is the dependent set", Script->GetHeaderResumeNode()->GetSourceLineNo(), 6);
+	}
+
+	FTestRunnerListener Listener;
+	FSUDSDialogueRunner Runner;
+	Runner.Initialise(Script, &Listener);
+
+	// Change notifications should be exactly as if the header had been run
+	TestTrue("Variable changes", Listener.ChangedVariables == TArray<FName> { "Name", "Count", "Ratio", "Doubled", "Late" });
+	TestEqual("Name", Runner.GetVariable("Name").GetTextValue().ToString(), "Bob");
+	TestEqual("Count", Runner.GetVariable("Count").GetIntValue(), 5);
+	TestEqual("Ratio", Runner.GetVariable("Ratio").GetFloatValue(), 0.5f);
+	TestEqual("Doubled", Runner.GetVariable("Doubled").GetIntValue(), 10);
+	TestTrue("Late", Runner.GetVariable("Late").GetBooleanValue());
+
+	// Defaults are restored on reset
+	Runner.SetVariable("Count", 7);
+	Runner.SetVariable("Name", FText::FromString("Jim"));
+	Runner.ResetState();
+	TestEqual("Count", Runner.GetVariable("Count").GetIntValue(), 5);
+	TestEqual("Name", Runner.GetVariable("Name").GetTextValue().ToString(), "Bob");
+	TestEqual("Doubled", Runner.GetVariable("Doubled").GetIntValue(), 10);
+
+	// Re-running the header without a reset only notifies about what it changed
+	Runner.SetVariable("Count", 7);
+	Listener.ChangedVariables.Reset();
+	Runner.Restart(false);
+	TestTrue("Variable changes", Listener.ChangedVariables == TArray<FName> { "Count" });
+	TestEqual("Count", Runner.GetVariable("Count").GetIntValue(), 5);
+	
+	Script->MarkAsGarbage();
+	return true;
+}
+
+const FString BatchedRequestsInput = R"RAWSUD(
+[set Double {Count} * 2]
+NPC: Hello {Name}
+    * Ask about {Topic}
+        [if {Mood} == `Grumpy`]
+            NPC: Go away
+        [else]
+            NPC: Well, {Topic} is {Opinion}
+        [endif]
+[if {Brave}]
+    * Insult
+        NPC: How dare you
+[endif]
+NPC: Bye
+)RAWSUD";
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestBatchedVariableRequests,
+								 "SUDSTest.TestBatchedVariableRequests",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestBatchedVariableRequests::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(BatchedRequestsInput), BatchedRequestsInput.Len(), "BatchedRequestsInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// Unbatched first for comparison
+	{
+		FTestRunnerListener Listener;
+		FSUDSDialogueRunner Runner;
+		Runner.Initialise(Script, &Listener);
+		Runner.Start();
+		Runner.GetText();
+		Runner.GetChoiceText(0);
+		TestEqual("No batches", Listener.RequestBatches.Num(), 0);
+		TestTrue("Individual requests", Listener.RequestedVariables.Num() >= 4);
+	}
+
+	FTestRunnerListener Listener;
+	FSUDSDialogueRunner Runner;
+	Runner.SetBatchVariableRequests(true);
+	Runner.Initialise(Script, &Listener);
+	Runner.Start();
+
+	// Everything up to the first line and its choices, in one go
+	if (TestEqual("First step batch", Listener.RequestBatches.Num(), 1))
+	{
+		const TSet<FName> Batch(Listener.RequestBatches[0]);
+		TestTrue("First step variables", Batch.Num() == 4 && Batch.Includes(TSet<FName> { "Count", "Name", "Topic", "Brave" }));
+	}
+	Runner.GetText();
+	Runner.GetChoiceText(0);
+	Runner.GetText();
+	TestEqual("No individual requests", Listener.RequestedVariables.Num(), 0);
+
+	// All paths from the choice are included, and values supplied in the batch are used
+	TestTrue("Choose", Runner.Choose(0));
+	if (TestEqual("Second step batch", Listener.RequestBatches.Num(), 2))
+	{
+		const TSet<FName> Batch(Listener.RequestBatches[1]);
+		TestTrue("Second step variables", Batch.Num() == 3 && Batch.Includes(TSet<FName> { "Mood", "Topic", "Opinion" }));
+	}
+	TestEqual("Text", Runner.GetText().ToString(), "Go away");
+	TestEqual("No individual requests", Listener.RequestedVariables.Num(), 0);
+
+	// Turning batching off goes back to individual requests
+	Runner.SetBatchVariableRequests(false);
+	Runner.Restart(true);
+	Runner.GetText();
+	TestEqual("No more batches", Listener.RequestBatches.Num(), 2);
+	TestTrue("Individual requests", Listener.RequestedVariables.Contains("Name"));
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+const FString VariableProviderInput = R"RAWSUD(
+NPC: You have {Apples} apples
+[if {Apples} > 2]
+    NPC: That's a lot
+[else]
+    NPC: Not many
+[endif]
+)RAWSUD";
+
+namespace
+{
+	/// Supplies variables from a map, counting how often it's asked
+	class FTestVariableProvider : public ISUDSVariableProvider
+	{
+	public:
+		TMap<FName, FSUDSValue> Values;
+		mutable int NumCalls = 0;
+
+		virtual bool ProvideVariable(const FSUDSDialogueRunner& Runner, const FName& Name, FSUDSValue& OutValue) const override
+		{
+			++NumCalls;
+			if (const FSUDSValue* Value = Values.Find(Name))
+			{
+				OutValue = *Value;
+				return true;
+			}
+			return false;
+		}
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestVariableProviders,
+								 "SUDSTest.TestVariableProviders",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestVariableProviders::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(VariableProviderInput), VariableProviderInput.Len(), "VariableProviderInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	FTestVariableProvider Provider;
+	Provider.Values.Add(FName("Apples"), FSUDSValue(5));
+	FTestRunnerListener Listener;
+	FSUDSDialogueRunner Runner;
+	Runner.Initialise(Script, &Listener);
+	Runner.AddVariableProvider(&Provider);
+	Runner.Start();
+
+	// Values are read from the provider, not copied into the dialogue
+	TestEqual("Text", Runner.GetText().ToString(), "You have 5 apples");
+	TestFalse("Not set in dialogue", Runner.IsVariableSet("Apples"));
+	TestFalse("No change notification", Listener.ChangedVariables.Contains("Apples"));
+	// Still requested, so listeners can update external state first
+	TestTrue("Requested", Listener.RequestedVariables.Contains("Apples"));
+
+	// Not cached by default, so always up to date
+	Provider.Values.Add(FName("Apples"), FSUDSValue(1));
+	TestEqual("Text", Runner.GetText().ToString(), "You have 1 apples");
+
+	// Variables set in the dialogue take precedence
+	Runner.SetVariable("Apples", 7);
+	TestEqual("Text", Runner.GetText().ToString(), "You have 7 apples");
+	Runner.UnSetVariable("Apples");
+
+	// Conditions use providers too
+	Provider.Values.Add(FName("Apples"), FSUDSValue(3));
+	TestTrue("Continue", Runner.Continue());
+	TestEqual("Conditional text", Runner.GetText().ToString(), "That's a lot");
+
+	// With caching, each variable is only provided once per step
+	Runner.SetCacheProvidedVariables(true);
+	Runner.Restart();
+	const int CallsBefore = Provider.NumCalls;
+	TestEqual("Text", Runner.GetText().ToString(), "You have 3 apples");
+	Provider.Values.Add(FName("Apples"), FSUDSValue(0));
+	TestEqual("Cached text", Runner.GetText().ToString(), "You have 3 apples");
+	TestEqual("Provider asked once", Provider.NumCalls - CallsBefore, 1);
+	Runner.InvalidateProvidedVariables();
+	TestEqual("Invalidated text", Runner.GetText().ToString(), "You have 0 apples");
+	// Next step asks again
+	TestTrue("Continue", Runner.Continue());
+	TestEqual("Conditional text", Runner.GetText().ToString(), "Not many");
+
+	Runner.RemoveVariableProvider(&Provider);
+	TestEqual("No provider", Runner.GetText().ToString(), "Not many");
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestDialoguePool,
+								 "SUDSTest.TestDialoguePool",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+bool FTestDialoguePool::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(NativeRunnerInput), NativeRunnerInput.Len(), "NativeRunnerInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// Subsystem isn't running in tests, make our own
+	auto GameInstance = NewObject<UGameInstance>(GetTransientPackage());
+	auto Sub = NewObject<USUDSSubsystem>(GameInstance);
+	Sub->SetMaxPooledDialoguesPerScript(2);
+
+	auto Dlg = Sub->AcquireDialogue(Script, {});
+	TestNotNull("Acquired", Dlg);
+	TestEqual("Created", Sub->GetDialoguePoolStats().NumCreated, 1);
+	TestDialogueText(this, "Start", Dlg, "NPC", "Hi, you there");
+
+	// Change some state and bind events, all of which should be gone when reused
+	auto EventSub = NewObject<UTestEventSub>();
+	EventSub->Init(Dlg);
+	Dlg->SetVariableInt("FromCode", 3);
+	TestTrue("Choose", Dlg->Choose(0));
+	TestTrue("Asked set", Dlg->GetVariableBoolean("Asked"));
+	TestTrue("Has event bindings", Dlg->OnEvent.IsBound());
+
+	Sub->ReleaseDialogue(Dlg);
+	TestEqual("Released", Sub->GetDialoguePoolStats().NumReleased, 1);
+	TestEqual("Pooled", Sub->GetDialoguePoolStats().NumPooled, 1);
+	TestFalse("Event bindings cleared", Dlg->OnEvent.IsBound() || Dlg->OnVariableChanged.IsBound());
+	TestTrue("Ended", Dlg->IsEnded());
+	// Releasing twice is ignored
+	Sub->ReleaseDialogue(Dlg);
+	TestEqual("Pooled", Sub->GetDialoguePoolStats().NumPooled, 1);
+
+	auto Dlg2 = Sub->AcquireDialogue(Script, {});
+	TestTrue("Reused same dialogue", Dlg2 == Dlg);
+	TestEqual("Reused", Sub->GetDialoguePoolStats().NumReused, 1);
+	TestEqual("Not created", Sub->GetDialoguePoolStats().NumCreated, 1);
+	TestEqual("Pooled", Sub->GetDialoguePoolStats().NumPooled, 0);
+	TestDialogueText(this, "Start", Dlg2, "NPC", "Hi, you there");
+	TestFalse("Variables reset", Dlg2->IsVariableSet("Asked") || Dlg2->IsVariableSet("FromCode"));
+	TestEqual("Header run", Dlg2->GetVariableText("Greeting").ToString(), "Hi");
+	TestFalse("Choices taken reset", Dlg2->HasChoiceIndexBeenTakenPreviously(0));
+	TestEqual("No participants", Dlg2->GetParticipants().Num(), 0);
+
+	// Pool is capped per script
+	auto Dlg3 = Sub->AcquireDialogue(Script, {});
+	auto Dlg4 = Sub->AcquireDialogue(Script, {});
+	TestEqual("Created", Sub->GetDialoguePoolStats().NumCreated, 3);
+	Sub->ReleaseDialogue(Dlg2);
+	Sub->ReleaseDialogue(Dlg3);
+	Sub->ReleaseDialogue(Dlg4);
+	TestEqual("Pooled up to cap", Sub->GetDialoguePoolStats().NumPooled, 2);
+	TestEqual("Discarded over cap", Sub->GetDialoguePoolStats().NumDiscarded, 1);
+
+	// Dialogues not from the pool are not pooled
+	auto Other = USUDSLibrary::CreateDialogue(Script, Script);
+	Sub->ReleaseDialogue(Other);
+	TestEqual("Not pooled", Sub->GetDialoguePoolStats().NumReleased, 4);
+	
+	Sub->EmptyDialoguePool();
+	TestEqual("Emptied", Sub->GetDialoguePoolStats().NumPooled, 0);
+	
+	Script->MarkAsGarbage();
+	return true;
+}
+
 UE_ENABLE_OPTIMIZATION
\ No newline at end of file
@@ -3,8 +3,11 @@
 #include "SUDSMessageLogger.h"
 #include "SUDSScript.h"
 #include "SUDSScriptImporter.h"
+#include "SUDSSubsystem.h"
 #include "TestUtils.h"
 #include "Misc/AutomationTest.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
 
 UE_DISABLE_OPTIMIZATION
 
@@ -143,4 +146,539 @@ bool FTestSaveState::RunTest(const FString& Parameters)
 	return true;
 }
 
+const FString SaveGosubStateInput = R"RAWSUD(
+NPC: Before the sub
+[gosub Sub]
+NPC: After the sub
+[goto end]
+
+:Sub
+NPC: Inside the sub
+Player: Still inside
+[return]
+)RAWSUD";
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestSaveGosubState,
+								 "SUDSTest.TestSaveGosubState",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+
+
+bool FTestSaveGosubState::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(SaveGosubStateInput), SaveGosubStateInput.Len(), "SaveGosubStateInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	auto Dlg = USUDSLibrary::CreateDialogue(Script, Script);
+	Dlg->Start();
+	TestDialogueText(this, "Text node", Dlg, "NPC", "Before the sub");
+	TestTrue("Continue", Dlg->Continue());
+	TestDialogueText(this, "Text node", Dlg, "NPC", "Inside the sub");
+
+	// Save while inside the gosub, so the return stack has to be restored by ID
+	auto SaveState = Dlg->GetSavedState();
+	if (TestEqual("Return stack size", SaveState.GetReturnStack().Num(), 1))
+	{
+		TestNotNull("Gosub found by ID", Script->GetNodeByGosubID(SaveState.GetReturnStack()[0]));
+	}
+	TestNotNull("Text found by ID", Script->GetNodeByTextID(SaveState.GetTextNodeID()));
+	TestNull("Unknown gosub ID", Script->GetNodeByGosubID("NotAGosub"));
+	TestNull("Unknown text ID", Script->GetNodeByTextID("NotAText"));
+
+	auto Dlg2 = USUDSLibrary::CreateDialogue(Script, Script);
+	Dlg2->RestoreSavedState(SaveState);
+	TestDialogueText(this, "Text node", Dlg2, "NPC", "Inside the sub");
+	TestTrue("Continue", Dlg2->Continue());
+	TestDialogueText(this, "Text node", Dlg2, "Player", "Still inside");
+	TestTrue("Continue", Dlg2->Continue());
+	TestDialogueText(this, "Returned from sub", Dlg2, "NPC", "After the sub");
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestCompactSaveState,
+								 "SUDSTest.TestCompactSaveState",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+
+
+bool FTestCompactSaveState::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(SaveStateInput), SaveStateInput.Len(), "SaveStateInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	TestTrue("Script should have choice ordinals", Script->GetNumChoiceOrdinals() > 0);
+
+	auto Dlg = USUDSLibrary::CreateDialogue(Script, Script);
+	Dlg->SetVariableInt("x", 5);
+	Dlg->SetVariableInt("negative", -3);
+	Dlg->SetVariableBoolean("flag", true);
+	Dlg->SetVariableName("aname", "Something");
+	Dlg->SetVariableGender("gender", ETextGender::Feminine);
+	Dlg->SetVariableText("sometext", FText::FromString("Hello world"));
+	Dlg->SetRandomSeed(1234);
+	Dlg->Start();
+	TestDialogueText(this, "Text Node", Dlg, "NPC", "Hello");
+	TestTrue("Choose", Dlg->Choose(2));
+	TestDialogueText(this, "Text node", Dlg, "Player", "I took the 1.3 choice");
+	Dlg->SetVariableFloat("y", 23.5f);
+
+	const FSUDSDialogueState State = Dlg->GetSavedState();
+	TArray<uint8> Compact;
+	Dlg->GetCompactSavedState(Compact);
+
+	// The same state in the original struct format
+	TArray<uint8> Full;
+	FMemoryWriter FullAr(Full);
+	FSUDSDialogueState FullState = State;
+	FullAr << FullState;
+	TestTrue("Compact state should be smaller", Compact.Num() < Full.Num());
+
+	FSUDSDialogueState Loaded;
+	if (TestTrue("Load compact", Loaded.LoadCompact(Script, Compact)))
+	{
+		TestEqual("Text node ID", Loaded.GetTextNodeID(), State.GetTextNodeID());
+		TestTrue("Choices", TSet<FString>(Loaded.GetChoicesTaken()) == TSet<FString>(State.GetChoicesTaken()));
+		TestTrue("Return stack", Loaded.GetReturnStack() == State.GetReturnStack());
+		TestEqual("Random seed", Loaded.GetRandomSeed(), State.GetRandomSeed());
+		TestEqual("Random stream", Loaded.GetRandomStreamState(), State.GetRandomStreamState());
+		TestEqual("Variable count", Loaded.GetVariables().Num(), State.GetVariables().Num());
+		for (auto& Pair : State.GetVariables())
+		{
+			const FSUDSValue* Value = Loaded.GetVariables().Find(Pair.Key);
+			if (TestNotNull("Variable loaded", Value))
+			{
+				TestEqual("Variable value", Value->ToString(), Pair.Value.ToString());
+			}
+		}
+	}
+
+	auto Dlg2 = USUDSLibrary::CreateDialogue(Script, Script);
+	TestTrue("Restore compact", Dlg2->RestoreCompactSavedState(Compact));
+	TestDialogueText(this, "Text node", Dlg2, "Player", "I took the 1.3 choice");
+	TestEqual("x value", Dlg2->GetVariableInt("x"), 5);
+	TestEqual("negative value", Dlg2->GetVariableInt("negative"), -3);
+	TestEqual("y value", Dlg2->GetVariableFloat("y"), 23.5f);
+	TestTrue("flag value", Dlg2->GetVariableBoolean("flag"));
+	TestTrue("name value", Dlg2->GetVariableName("aname") == FName("Something"));
+	TestTrue("gender value", Dlg2->GetVariableGender("gender") == ETextGender::Feminine);
+	TestEqual("text value", Dlg2->GetVariableText("sometext").ToString(), "Hello world");
+	Dlg2->Restart();
+	TestDialogueText(this, "Text Node", Dlg2, "NPC", "Hello");
+	TestFalse("Choice not taken", Dlg2->HasChoiceIndexBeenTakenPreviously(0));
+	TestTrue("Choice taken", Dlg2->HasChoiceIndexBeenTakenPreviously(2));
+
+	// Bad data is rejected without changing the dialogue
+	AddExpectedError(TEXT("Compact dialogue state is corrupt"), EAutomationExpectedErrorFlags::Contains, 4);
+	AddExpectedError(TEXT("unknown version"), EAutomationExpectedErrorFlags::Contains, 1);
+	TArray<uint8> Truncated(Compact.GetData(), Compact.Num() / 2);
+	TestFalse("Truncated data should fail", Dlg2->RestoreCompactSavedState(Truncated));
+	TestDialogueText(this, "Text Node", Dlg2, "NPC", "Hello");
+	TestFalse("Empty data should fail", Dlg2->RestoreCompactSavedState(TArray<uint8>()));
+
+	// Counts which are negative or don't fit the data are rejected, even when the header and checksum are valid
+	auto MakeCompact = [&Compact](uint32 NumVars, uint32 NumOrdinals)
+	{
+		TArray<uint8> Payload;
+		FMemoryWriter PayloadAr(Payload);
+		uint32 NumStrings = 1, EmptyLen = 0, TextNodeIndex = 0;
+		uint8 bDelta = 0;
+		PayloadAr.SerializeIntPacked(NumStrings);
+		PayloadAr.SerializeIntPacked(EmptyLen);
+		PayloadAr.SerializeIntPacked(TextNodeIndex);
+		PayloadAr.SerializeIntPacked(NumVars);
+		PayloadAr << bDelta;
+		PayloadAr.SerializeIntPacked(NumOrdinals);
+
+		TArray<uint8> Data;
+		FMemoryWriter Ar(Data);
+		uint8 Version = Compact[0];
+		uint32 PayloadSize = Payload.Num();
+		uint32 Crc = FCrc::MemCrc32(Payload.GetData(), Payload.Num());
+		Ar << Version << PayloadSize << Crc;
+		Ar.Serialize(Payload.GetData(), Payload.Num());
+		return Data;
+	};
+	FSUDSDialogueState Corrupt;
+	TestFalse("Negative variable count should fail", Corrupt.LoadCompact(Script, MakeCompact(0x80000000u, 0)));
+	TestFalse("Negative ordinal count should fail", Corrupt.LoadCompact(Script, MakeCompact(0, 0xFFFFFFFFu)));
+	TestFalse("Too many ordinals should fail", Corrupt.LoadCompact(Script, MakeCompact(0, 1000)));
+	TestTrue("Failed load leaves empty state", Corrupt.GetTextNodeID().IsEmpty() && Corrupt.GetVariables().IsEmpty());
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+const FString CompactReimportInputV1 = R"RAWSUD(
+NPC: Hello @0001@
+    * First choice @0002@
+        Player: I took the first choice @0003@
+    * Second choice @0004@
+        Player: I took the second choice @0005@
+    * Third choice @0006@
+        Player: I took the third choice @0007@
+NPC: Bye @0008@
+)RAWSUD";
+
+// Same script with a choice inserted at the start and one removed, as if edited and re-imported
+const FString CompactReimportInputV2 = R"RAWSUD(
+NPC: Hello @0001@
+    * A new choice @0009@
+        Player: I took the new choice @0010@
+    * First choice @0002@
+        Player: I took the first choice @0003@
+    * Third choice @0006@
+        Player: I took the third choice @0007@
+NPC: Bye @0008@
+)RAWSUD";
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestCompactSaveStateReimport,
+								 "SUDSTest.TestCompactSaveStateReimport",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+
+
+bool FTestCompactSaveStateReimport::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(CompactReimportInputV1), CompactReimportInputV1.Len(), "CompactReimportInputV1", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	auto Dlg = USUDSLibrary::CreateDialogue(Script, Script);
+	Dlg->Start();
+	TestDialogueText(this, "Text Node", Dlg, "NPC", "Hello");
+	TestTrue("Choose", Dlg->Choose(2));
+	TestDialogueText(this, "Text node", Dlg, "Player", "I took the third choice");
+	const FSUDSDialogueState State = Dlg->GetSavedState();
+	TArray<uint8> Compact;
+	Dlg->GetCompactSavedState(Compact);
+
+	// Re-importing creates a new script over the old one, the factory carries the ordinals across
+	FSUDSScriptImporter Importer2;
+	TestTrue("Import should succeed", Importer2.ImportFromBuffer(GetData(CompactReimportInputV2), CompactReimportInputV2.Len(), "CompactReimportInputV2", &Logger, true));
+	auto Script2 = NewObject<USUDSScript>(GetTransientPackage(), "Test2");
+	Script2->SetChoiceOrdinals(Script->GetChoiceOrdinals());
+	Importer2.PopulateAsset(Script2, StringTableHolder.StringTable);
+
+	TestEqual("Existing ordinals kept", Script2->GetChoiceOrdinal("@0002@"), Script->GetChoiceOrdinal("@0002@"));
+	TestEqual("Existing ordinals kept", Script2->GetChoiceOrdinal("@0006@"), Script->GetChoiceOrdinal("@0006@"));
+	TestEqual("New choice appended", Script2->GetChoiceOrdinal("@0009@"), Script->GetNumChoiceOrdinals());
+
+	auto Dlg2 = USUDSLibrary::CreateDialogue(Script2, Script2);
+	TestTrue("Restore compact", Dlg2->RestoreCompactSavedState(Compact));
+	TestTrue("Same choices taken", TSet<FString>(Dlg2->GetSavedState().GetChoicesTaken()) == TSet<FString>(State.GetChoicesTaken()));
+	TestDialogueText(this, "Text node", Dlg2, "Player", "I took the third choice");
+	Dlg2->Restart();
+	TestDialogueText(this, "Text Node", Dlg2, "NPC", "Hello");
+	TestFalse("New choice not taken", Dlg2->HasChoiceIndexBeenTakenPreviously(0));
+	TestFalse("First choice not taken", Dlg2->HasChoiceIndexBeenTakenPreviously(1));
+	TestTrue("Third choice taken", Dlg2->HasChoiceIndexBeenTakenPreviously(2));
+
+	Script->MarkAsGarbage();
+	Script2->MarkAsGarbage();
+	return true;
+}
+
+const FString DeltaSaveStateInput = R"RAWSUD(
+===
+[set Gold 100]
+[set Mood `Happy`]
+[set Greeting "Hello there"]
+[set Visited false]
+[set Count 0]
+[set Doubled {Count} * 2]
+[set Count 3]
+===
+NPC: {Greeting}
+NPC: Goodbye
+)RAWSUD";
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestDeltaSaveState,
+								 "SUDSTest.TestDeltaSaveState",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+
+
+bool FTestDeltaSaveState::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(DeltaSaveStateInput), DeltaSaveStateInput.Len(), "DeltaSaveStateInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// Count is set again after a non-literal set, so its value after the header isn't a known default
+	const auto& Defaults = Script->GetHeaderDefaultValues();
+	TestTrue("Gold has default", Defaults.Contains("Gold"));
+	TestTrue("Visited has default", Defaults.Contains("Visited"));
+	TestFalse("Count has no default", Defaults.Contains("Count"));
+	TestFalse("Doubled has no default", Defaults.Contains("Doubled"));
+
+	auto Dlg = USUDSLibrary::CreateDialogue(Script, Script);
+	Dlg->Start();
+	TestDialogueText(this, "Text node", Dlg, "NPC", "Hello there");
+	Dlg->SetVariableInt("Gold", 50);
+	Dlg->UnSetVariable("Mood");
+	Dlg->SetVariableInt("Extra", 7);
+
+	const FSUDSDialogueState Full = Dlg->GetSavedState();
+	const FSUDSDialogueState Delta = Dlg->GetSavedState(true);
+	TestFalse("Full state isn't a delta", Full.AreVariablesDelta());
+	TestTrue("Delta state is a delta", Delta.AreVariablesDelta());
+	TestTrue("Delta should be smaller", Delta.GetVariables().Num() < Full.GetVariables().Num());
+	TestTrue("Changed default saved", Delta.GetVariables().Contains("Gold"));
+	TestFalse("Unchanged default not saved", Delta.GetVariables().Contains("Greeting"));
+	TestFalse("Unchanged default not saved", Delta.GetVariables().Contains("Visited"));
+	TestTrue("Non-default saved", Delta.GetVariables().Contains("Count"));
+	TestTrue("Non-default saved", Delta.GetVariables().Contains("Doubled"));
+	TestTrue("New variable saved", Delta.GetVariables().Contains("Extra"));
+	TestTrue("Unset default recorded", Delta.GetUnsetVariables() == TArray<FName> { "Mood" });
+
+	auto Dlg2 = USUDSLibrary::CreateDialogue(Script, Script);
+	Dlg2->RestoreSavedState(Delta);
+	TestDialogueText(this, "Text node", Dlg2, "NPC", "Hello there");
+	TestEqual("Gold", Dlg2->GetVariableInt("Gold"), 50);
+	TestFalse("Mood unset", Dlg2->IsVariableSet("Mood"));
+	TestEqual("Greeting", Dlg2->GetVariableText("Greeting").ToString(), "Hello there");
+	TestFalse("Visited", Dlg2->GetVariableBoolean("Visited"));
+	TestTrue("Visited set", Dlg2->IsVariableSet("Visited"));
+	TestEqual("Count", Dlg2->GetVariableInt("Count"), 3);
+	TestEqual("Doubled", Dlg2->GetVariableInt("Doubled"), 0);
+	TestEqual("Extra", Dlg2->GetVariableInt("Extra"), 7);
+
+	// Deltas survive the compact format too
+	TArray<uint8> Compact;
+	Dlg->GetCompactSavedState(Compact, true);
+	auto Dlg3 = USUDSLibrary::CreateDialogue(Script, Script);
+	TestTrue("Restore compact", Dlg3->RestoreCompactSavedState(Compact));
+	TestEqual("Gold", Dlg3->GetVariableInt("Gold"), 50);
+	TestFalse("Mood unset", Dlg3->IsVariableSet("Mood"));
+	TestEqual("Greeting", Dlg3->GetVariableText("Greeting").ToString(), "Hello there");
+
+	// And plain archives, which don't carry custom versions
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+	FSUDSDialogueState WriteState = Delta;
+	Writer << WriteState;
+	FMemoryReader Reader(Bytes);
+	FSUDSDialogueState ReadState;
+	Reader << ReadState;
+	TestFalse("Archive read", Reader.IsError());
+	TestTrue("Archived delta is a delta", ReadState.AreVariablesDelta());
+	TestTrue("Archived unset variables", ReadState.GetUnsetVariables() == TArray<FName> { "Mood" });
+
+	// State written before it was versioned has only the original fields, and is still readable
+	TArray<uint8> OldBytes;
+	FMemoryWriter OldWriter(OldBytes);
+	FString OldTextNodeID = Full.GetTextNodeID();
+	TMap<FName, FSUDSValue> OldVariables = Full.GetVariables();
+	TArray<FString> OldChoices = Full.GetChoicesTaken();
+	TArray<FString> OldReturnStack = Full.GetReturnStack();
+	OldWriter << OldTextNodeID << OldVariables << OldChoices << OldReturnStack;
+	FMemoryReader OldReader(OldBytes);
+	FSUDSDialogueState OldState;
+	OldReader << OldState;
+	TestFalse("Old archive read", OldReader.IsError());
+	TestEqual("Old archive read all data", OldReader.Tell(), (int64)OldBytes.Num());
+	TestEqual("Old text node", OldState.GetTextNodeID(), Full.GetTextNodeID());
+	TestEqual("Old variables", OldState.GetVariables().Num(), Full.GetVariables().Num());
+	TestFalse("Old state isn't a delta", OldState.AreVariablesDelta());
+	TestFalse("Old state has no random stream", OldState.HasRandomStream());
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestIncrementalSaveState,
+								 "SUDSTest.TestIncrementalSaveState",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+
+
+bool FTestIncrementalSaveState::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(SaveStateInput), SaveStateInput.Len(), "SaveStateInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// Subsystem isn't running in tests, make our own; dialogues have no world so aren't registered automatically
+	auto GameInstance = NewObject<UGameInstance>(GetTransientPackage());
+	auto Sub = NewObject<USUDSSubsystem>(GameInstance);
+
+	auto Dlg1 = USUDSLibrary::CreateDialogue(Script, Script);
+	auto Dlg2 = USUDSLibrary::CreateDialogue(Script, Script);
+	auto Dlg3 = USUDSLibrary::CreateDialogue(Script, Script);
+	Sub->RegisterDialogue(Dlg1);
+	Sub->RegisterDialogue(Dlg2);
+	Sub->RegisterDialogue(Dlg3);
+
+	auto Contains = [](const TArray<FSUDSDialogueSaveEntry>& States, const USUDSDialogue* Dlg)
+	{
+		return States.ContainsByPredicate([Dlg](const FSUDSDialogueSaveEntry& E) { return E.Dialogue == Dlg; });
+	};
+
+	// Everything is new the first time
+	TArray<FSUDSDialogueSaveEntry> States;
+	const int64 Gen1 = Sub->GetChangedDialogueStates(0, States);
+	TestEqual("All registered dialogues", States.Num(), 3);
+	TestFalse("Saving clears dirty", Dlg1->GetRunner().IsStateDirty());
+
+	// Nothing changed
+	const int64 Gen2 = Sub->GetChangedDialogueStates(Gen1, States);
+	TestTrue("Generation moves on", Gen2 > Gen1);
+	TestEqual("No changes", States.Num(), 0);
+
+	// Lots of changes to one dialogue are still only one entry
+	Dlg1->Start();
+	TestDialogueText(this, "Start", Dlg1, "NPC", "Hello");
+	TestTrue("Choose", Dlg1->Choose(0));
+	Dlg1->SetVariableInt("x", 1);
+	Dlg1->SetVariableInt("x", 2);
+	TestTrue("Dirty", Dlg1->GetRunner().IsStateDirty());
+	const int64 Gen3 = Sub->GetChangedDialogueStates(Gen2, States);
+	TestEqual("One change", States.Num(), 1);
+	TestTrue("Changed dialogue", Contains(States, Dlg1));
+	TestEqual("Saved state", States[0].State.GetTextNodeID(), Dlg1->GetSavedState().GetTextNodeID());
+
+	// Setting a variable to the value it already has isn't a change
+	Dlg1->SetVariableInt("x", 2);
+	Dlg2->SetVariableInt("x", 5);
+	const int64 Gen4 = Sub->GetChangedDialogueStates(Gen3, States);
+	TestEqual("One change", States.Num(), 1);
+	TestTrue("Changed dialogue", Contains(States, Dlg2));
+
+	// Asking from further back covers every change since, once each
+	Dlg1->SetVariableInt("x", 3);
+	Sub->GetChangedDialogueStates(Gen1, States);
+	TestEqual("Changes since Gen1", States.Num(), 2);
+	TestTrue("Changed dialogue", Contains(States, Dlg1));
+	TestTrue("Changed dialogue", Contains(States, Dlg2));
+	TestFalse("Unchanged dialogue", Contains(States, Dlg3));
+
+	// Unregistered dialogues aren't tracked
+	Sub->UnregisterDialogue(Dlg3);
+	Dlg3->SetVariableInt("x", 9);
+	const int64 Gen5 = Sub->GetChangedDialogueStates(Gen4, States);
+	TestFalse("Unregistered dialogue", Contains(States, Dlg3));
+
+	// Restoring into a registered dialogue is a change, but leaves it clean
+	Sub->RegisterDialogue(Dlg3);
+	Sub->GetChangedDialogueStates(Gen5, States);
+	Dlg3->RestoreSavedState(Dlg1->GetSavedState());
+	TestFalse("Restored state is clean", Dlg3->GetRunner().IsStateDirty());
+
+	// Global state
+	const int64 Gen6 = Sub->GetStateGeneration() - 1;
+	TestFalse("Globals unchanged", Sub->HasGlobalStateChangedSince(Gen6));
+	Sub->SetGlobalVariableInt("GlobalCount", 1);
+	TestTrue("Globals changed", Sub->HasGlobalStateChangedSince(Gen6));
+	const int64 Gen7 = Sub->GetChangedDialogueStates(Gen6, States);
+	Sub->SetGlobalVariableInt("GlobalCount", 1);
+	TestFalse("Same global value isn't a change", Sub->HasGlobalStateChangedSince(Gen7));
+	Sub->UnSetGlobalVariable("GlobalCount");
+	TestTrue("Globals changed", Sub->HasGlobalStateChangedSince(Gen7));
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTestAsyncSaveState,
+								 "SUDSTest.TestAsyncSaveState",
+								 EAutomationTestFlags::EditorContext |
+								 EAutomationTestFlags::ClientContext |
+								 EAutomationTestFlags::ProductFilter)
+
+
+
+bool FTestAsyncSaveState::RunTest(const FString& Parameters)
+{
+	FSUDSMessageLogger Logger(false);
+	FSUDSScriptImporter Importer;
+	TestTrue("Import should succeed", Importer.ImportFromBuffer(GetData(SaveStateInput), SaveStateInput.Len(), "SaveStateInput", &Logger, true));
+
+	auto Script = NewObject<USUDSScript>(GetTransientPackage(), "Test");
+	const ScopedStringTableHolder StringTableHolder;
+	Importer.PopulateAsset(Script, StringTableHolder.StringTable);
+
+	// Subsystem isn't running in tests, make our own
+	auto GameInstance = NewObject<UGameInstance>(GetTransientPackage());
+	auto Sub = NewObject<USUDSSubsystem>(GameInstance);
+
+	auto Dlg1 = USUDSLibrary::CreateDialogue(Script, Script);
+	auto Dlg2 = USUDSLibrary::CreateDialogue(Script, Script);
+	Dlg1->SetVariableInt("x", 1);
+	Dlg1->Start();
+	TestDialogueText(this, "Start", Dlg1, "NPC", "Hello");
+	TestTrue("Choose", Dlg1->Choose(1));
+	TestDialogueText(this, "Choice", Dlg1, "Player", "I took the 1.2 choice");
+	Dlg2->SetVariableBoolean("alreadyvisited", true);
+	Dlg2->Start();
+	TestDialogueText(this, "Start", Dlg2, "NPC", "Hello again you!");
+	Sub->SetGlobalVariableText("GlobalName", FText::FromString("Bob"));
+
+	const FSUDSStateSnapshotRef Snapshot = Sub->TakeStateSnapshot({ Dlg1, Dlg2 });
+
+	// Changes after the snapshot aren't included
+	TestTrue("Continue", Dlg1->Continue());
+	Dlg2->SetVariableInt("y", 5);
+	Sub->SetGlobalVariableInt("GlobalCount", 3);
+
+	TFuture<TArray<uint8>> Future = USUDSSubsystem::SerializeStateSnapshotAsync(Snapshot);
+	const TArray<uint8> Data = Future.Get();
+	TestTrue("Serialized", Data.Num() > 0);
+
+	auto Restored1 = USUDSLibrary::CreateDialogue(Script, Script);
+	auto Restored2 = USUDSLibrary::CreateDialogue(Script, Script);
+	Sub->ResetGlobalState();
+	TestTrue("Restore", Sub->RestoreSerializedState(Data, { Restored1, Restored2 }));
+	TestDialogueText(this, "Restored", Restored1, "Player", "I took the 1.2 choice");
+	TestEqual("Restored var", Restored1->GetVariableInt("x"), 1);
+	TestDialogueText(this, "Restored", Restored2, "NPC", "Hello again you!");
+	TestFalse("Change after snapshot", Restored2->GetVariableInt("y") == 5);
+	TestEqual("Restored global", Sub->GetGlobalVariableText("GlobalName").ToString(), "Bob");
+	TestFalse("Change after snapshot", Sub->IsGlobalVariableSet("GlobalCount"));
+
+	// Wrong number of dialogues, or bad data, changes nothing
+	AddExpectedError("holds 2 dialogues but 1 were given");
+	TestFalse("Mismatched dialogues", Sub->RestoreSerializedState(Data, { Restored1 }));
+	AddExpectedError("State snapshot is corrupt");
+	TArray<uint8> Truncated(Data.GetData(), Data.Num() / 2);
+	TestFalse("Truncated", Sub->RestoreSerializedState(Truncated, { Restored1, Restored2 }));
+	TestDialogueText(this, "Unchanged", Restored1, "Player", "I took the 1.2 choice");
+
+	Script->MarkAsGarbage();
+	return true;
+}
+
 UE_ENABLE_OPTIMIZATION
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include "SUDSDialogue.h"
 #include "SUDSScriptNode.h"
 #include "SUDSScriptNodeText.h"
+#include "SUDSExpression.h"
+#include "Internationalization/Regex.h"
 #include "Internationalization/StringTable.h"
 #include "Internationalization/StringTableRegistry.h"
 #include "Misc/AutomationTest.h"
@@ -14,6 +16,27 @@ FORCEINLINE void TestDialogueText(FAutomationTestBase* T, const FString& NameFor
 	
 }
 
+/// The regular expression tokeniser FSUDSExpression used to use, kept as a reference for the hand-written lexer
+FORCEINLINE void TokeniseExpressionWithRegex(const FString& Expression, TArray<FString>& OutTokens)
+{
+	const FRegexPattern Pattern(TEXT("(\\{[\\w\\.]+\\}|-?\\d+(?:\\.\\d*)?|[-+*\\/%\\(\\)]|and|&&|\\|\\||or|not|\\<\\>|!=|!|\\<=?|\\>=?|==?|[mM]asculine|[fF]eminine|[nN]euter|[tT]rue|[fF]alse|\"(?:[^\"\\\\]|\\\\.)*\"|`([^`]*)`)"));
+	FRegexMatcher Regex(Pattern, Expression);
+	while (Regex.FindNext())
+	{
+		OutTokens.Add(Regex.GetCaptureGroup(1));
+	}
+}
+
+FORCEINLINE void TokeniseExpression(const FString& Expression, TArray<FString>& OutTokens)
+{
+	int32 Pos = 0;
+	FSUDSExpressionToken Token;
+	while (FSUDSExpression::NextToken(Expression, Pos, Token))
+	{
+		OutTokens.Add(Expression.Mid(Token.Start, Token.Len));
+	}
+}
+
 FORCEINLINE bool TestParsedText(FAutomationTestBase* T, const FString& NameForTest, const FSUDSParsedNode* Node, const FString& Speaker, const FString& Text)
 {
 	if (T->TestNotNull(NameForTest, Node))